@@ -0,0 +1,116 @@
+#ifndef INCLUDED_PFS_ATOMIC_WRITE_HPP
+#define INCLUDED_PFS_ATOMIC_WRITE_HPP
+
+#include <mutex>
+#include <pfs/filesystem.hpp>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace pfs {
+
+/**
+ * @brief Replaces whole files atomically through @c filesystem::write_all,
+ * with fixed options, and counts the syncs it took.
+ *
+ * @details How atomic and durable the files are depends on the filesystem:
+ * @c std_filesystem publishes each through a temporary file and syncs it as
+ * the options ask (see @c std_atomic_writer), @c fake_filesystem replaces
+ * each in a single step, @c persistent_fake_filesystem logs each as a single
+ * record, and @c remote_filesystem forwards them to its server in a single
+ * request. Other filesystems only truncate and rewrite each file through a
+ * stream.
+ *
+ * An @c atomic_writer may be shared by several threads, if its filesystem
+ * may be.
+ */
+class atomic_writer {
+private:
+  filesystem &fs_;               ///< Filesystem written to.
+  atomic_write_options options_; ///< Options given on construction.
+  std::mutex mutex_;             ///< Guards @c stats_.
+  atomic_write_stats stats_{};   ///< Counters of every write so far.
+
+public:
+  explicit atomic_writer(filesystem &fs, atomic_write_options options = {})
+      : fs_(fs), options_(options) {}
+
+  atomic_writer(const atomic_writer &) = delete;
+  atomic_writer &operator=(const atomic_writer &) = delete;
+
+  /**
+   * @brief Creates or replaces files, each atomically, and returns once
+   * they are published and synced as the options ask.
+   *
+   * @details See @c filesystem::write_all.
+   *
+   * @param files Paths and contents.
+   * @param ec Set to the first failure, e.g. if a parent directory does not
+   * exist or a path names a directory.
+   */
+  void write_all(const std::vector<std::pair<path, std::string_view>> &files,
+                 error_code &ec) {
+    auto stats = fs_.write_all(files, options_, ec);
+    std::lock_guard<std::mutex> lock(mutex_);
+    stats_ += stats;
+  }
+
+  void write_all(const std::vector<std::pair<path, std::string_view>> &files) {
+    error_code ec;
+    write_all(files, ec);
+    if (ec) {
+      throw filesystem_error("write_all", ec);
+    }
+  }
+
+  /**
+   * @brief Creates or replaces a file atomically. See @c write_all.
+   */
+  void write(const path &p, std::string_view content, error_code &ec) {
+    write_all({{p, content}}, ec);
+  }
+
+  void write(const path &p, std::string_view content) {
+    error_code ec;
+    write(p, content, ec);
+    if (ec) {
+      throw filesystem_error("write", p, ec);
+    }
+  }
+
+  /**
+   * @brief Gets the counters of every write so far.
+   */
+  atomic_write_stats stats() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stats_;
+  }
+};
+
+/**
+ * @brief Creates or replaces a file atomically in any filesystem.
+ *
+ * @details See @c filesystem::write_all for what each filesystem guarantees.
+ *
+ * @return The counters of the write, e.g. how many syncs it took.
+ */
+inline atomic_write_stats
+write_file_atomic(filesystem &fs, const path &p, std::string_view content,
+                  error_code &ec, atomic_write_options options = {}) {
+  return fs.write_all({{p, content}}, options, ec);
+}
+
+inline atomic_write_stats
+write_file_atomic(filesystem &fs, const path &p, std::string_view content,
+                  atomic_write_options options = {}) {
+  error_code ec;
+  auto ret = write_file_atomic(fs, p, content, ec, options);
+  if (ec) {
+    throw filesystem_error("write_file_atomic", p, ec);
+  }
+  return ret;
+}
+
+} // namespace pfs
+
+#endif
@@ -0,0 +1,343 @@
+#ifndef INCLUDED_PFS_DIFF_HPP
+#define INCLUDED_PFS_DIFF_HPP
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+#include <pfs/fake_filesystem.hpp>
+#include <pfs/filesystem.hpp>
+#include <pfs/thread_pool.hpp>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace pfs {
+
+/**
+ * @brief Options of @c diff.
+ */
+struct diff_options {
+  /// Number of threads walking the trees. 0 means one per CPU if both
+  /// filesystems are known to allow concurrent reads, and one otherwise.
+  /// Other values require both filesystems to allow concurrent reads.
+  unsigned threads = 0;
+
+  /// Compare the contents of regular files of equal size. If false, files of
+  /// equal size are considered equal.
+  bool compare_content = true;
+};
+
+/**
+ * @brief Entries that differ between two trees, relative to their roots and
+ * sorted.
+ *
+ * @details A directory that exists on one side only is listed by itself, not
+ * with its descendants. An entry whose type differs between the sides is
+ * listed as changed, also without its descendants.
+ */
+struct diff_result {
+  std::vector<path> added;   ///< Entries only in the second tree.
+  std::vector<path> removed; ///< Entries only in the first tree.
+  std::vector<path> changed; ///< Entries in both trees that differ.
+
+  bool empty() const {
+    return added.empty() && removed.empty() && changed.empty();
+  }
+};
+
+namespace detail {
+
+/**
+ * @brief Walks two trees together, one directory pair per task.
+ */
+class tree_differ {
+private:
+  struct entry {
+    std::string name;
+    file_type type;
+  };
+
+  /**
+   * @brief Results and pending directories of one task, merged under the
+   * lock when the task ends.
+   */
+  struct task_output {
+    diff_result result;
+    std::vector<path> dirs;
+  };
+
+  filesystem &a_fs_;
+  filesystem &b_fs_;
+  const path &a_;
+  const path &b_;
+  const diff_options &options_;
+
+  /// Set when both sides are fakes, whose subtree hashes prune the walk.
+  const fake_filesystem *a_fake_;
+  const fake_filesystem *b_fake_;
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::vector<path> queue_; ///< Directories to compare, relative to roots.
+  unsigned busy_{0};        ///< Tasks in progress.
+  error_code ec_;           ///< First error, which stops the walk.
+  diff_result result_;
+
+  static void append(std::vector<path> &to, std::vector<path> &from) {
+    to.insert(to.end(), std::make_move_iterator(from.begin()),
+              std::make_move_iterator(from.end()));
+  }
+
+  /**
+   * @brief Joins a root and a path relative to it, without adding a
+   * trailing separator to the root itself.
+   */
+  static path join(const path &root, const path &rel) {
+    return rel.empty() ? root : root / rel;
+  }
+
+  /**
+   * @brief Lists a directory, sorted by name.
+   */
+  static std::vector<entry> list(filesystem &fs, const path &p,
+                                 error_code &ec) {
+    std::vector<entry> ret;
+    auto it = fs.directory_iterator(p, ec);
+    while (!ec && !it->at_end()) {
+      auto type = it->status(ec).type();
+      if (type == file_type::not_found) {
+        // A dangling symlink, or an entry removed during the walk.
+        ec.clear();
+      } else if (ec) {
+        break;
+      }
+      ret.push_back({it->path().filename().string(), type});
+      it->increment(ec);
+    }
+    std::sort(ret.begin(), ret.end(), [](const entry &x, const entry &y) {
+      return x.name < y.name;
+    });
+    return ret;
+  }
+
+  /**
+   * @brief Whether two subtrees are known to be equal without walking them.
+   */
+  bool same_hash(const path &rel) const {
+    if (!a_fake_ || !b_fake_) {
+      return false;
+    }
+    error_code ec1, ec2;
+    auto ha = a_fake_->tree_hash(join(a_, rel), ec1);
+    auto hb = b_fake_->tree_hash(join(b_, rel), ec2);
+    return !ec1 && !ec2 && ha == hb;
+  }
+
+  /**
+   * @brief Compares two regular files, by size first.
+   */
+  bool files_differ(const path &rel, error_code &ec) {
+    if (a_fake_ && b_fake_) {
+      // Equal contents have equal hashes; unequal hashes mean unequal
+      // contents.
+      return !same_hash(rel);
+    }
+    auto pa = join(a_, rel);
+    auto pb = join(b_, rel);
+    auto sa = a_fs_.file_size(pa, ec);
+    if (ec) {
+      return false;
+    }
+    auto sb = b_fs_.file_size(pb, ec);
+    if (ec || sa != sb) {
+      return !ec;
+    }
+    if (!options_.compare_content || sa == 0) {
+      return false;
+    }
+    auto fa = a_fs_.open_file(pa, std::ios_base::in | std::ios_base::binary);
+    auto fb = b_fs_.open_file(pb, std::ios_base::in | std::ios_base::binary);
+    if (!*fa || !*fb) {
+      ec = std::make_error_code(std::errc::io_error);
+      return false;
+    }
+    constexpr std::size_t chunk = 64 << 10;
+    std::string ba(chunk, '\0'), bb(chunk, '\0');
+    for (;;) {
+      fa->read(ba.data(), chunk);
+      fb->read(bb.data(), chunk);
+      auto na = fa->gcount();
+      if (na != fb->gcount() ||
+          std::memcmp(ba.data(), bb.data(), static_cast<std::size_t>(na))) {
+        return true;
+      }
+      if (na < static_cast<std::streamsize>(chunk)) {
+        return false;
+      }
+    }
+  }
+
+  /**
+   * @brief Merge-joins the listings of one directory pair.
+   */
+  void compare_directory(const path &rel, task_output &out, error_code &ec) {
+    auto la = list(a_fs_, join(a_, rel), ec);
+    if (ec) {
+      return;
+    }
+    auto lb = list(b_fs_, join(b_, rel), ec);
+    if (ec) {
+      return;
+    }
+    auto ia = la.begin(), ib = lb.begin();
+    while (ia != la.end() || ib != lb.end()) {
+      if (ib == lb.end() || (ia != la.end() && ia->name < ib->name)) {
+        out.result.removed.push_back(rel / ia->name);
+        ++ia;
+      } else if (ia == la.end() || ib->name < ia->name) {
+        out.result.added.push_back(rel / ib->name);
+        ++ib;
+      } else {
+        auto child = rel / ia->name;
+        if (ia->type != ib->type) {
+          out.result.changed.push_back(std::move(child));
+        } else if (ia->type == file_type::directory) {
+          if (!same_hash(child)) {
+            out.dirs.push_back(std::move(child));
+          }
+        } else if (ia->type == file_type::regular) {
+          if (files_differ(child, ec)) {
+            out.result.changed.push_back(std::move(child));
+          } else if (ec) {
+            return;
+          }
+        }
+        ++ia;
+        ++ib;
+      }
+    }
+  }
+
+  void worker() {
+    std::unique_lock lock(mutex_);
+    for (;;) {
+      cv_.wait(lock, [&] { return !queue_.empty() || busy_ == 0 || ec_; });
+      if (ec_ || queue_.empty()) {
+        return;
+      }
+      auto rel = std::move(queue_.back());
+      queue_.pop_back();
+      ++busy_;
+      lock.unlock();
+
+      task_output out;
+      error_code ec;
+      try {
+        compare_directory(rel, out, ec);
+      } catch (...) {
+        // Stop the other workers, which would otherwise wait for this task.
+        lock.lock();
+        --busy_;
+        if (!ec_) {
+          ec_ = std::make_error_code(std::errc::operation_canceled);
+        }
+        cv_.notify_all();
+        throw;
+      }
+
+      lock.lock();
+      --busy_;
+      if (ec && !ec_) {
+        ec_ = ec;
+      }
+      append(result_.added, out.result.added);
+      append(result_.removed, out.result.removed);
+      append(result_.changed, out.result.changed);
+      append(queue_, out.dirs);
+      cv_.notify_all();
+    }
+  }
+
+public:
+  tree_differ(filesystem &a_fs, const path &a, filesystem &b_fs,
+              const path &b, const diff_options &options)
+      : a_fs_(a_fs), b_fs_(b_fs), a_(a), b_(b), options_(options),
+        a_fake_(dynamic_cast<const fake_filesystem *>(&a_fs)),
+        b_fake_(dynamic_cast<const fake_filesystem *>(&b_fs)) {}
+
+  diff_result run(error_code &ec) {
+    auto ta = a_fs_.status(a_, ec).type();
+    auto tb = ec ? ta : b_fs_.status(b_, ec).type();
+    if (!ec && (ta == file_type::not_found || tb == file_type::not_found)) {
+      ec = std::make_error_code(std::errc::no_such_file_or_directory);
+    }
+    if (ec) {
+      return {};
+    }
+    if (ta != tb) {
+      result_.changed.emplace_back();
+    } else if (ta == file_type::regular) {
+      if (files_differ(path(), ec)) {
+        result_.changed.emplace_back();
+      }
+    } else if (ta == file_type::directory && !same_hash(path())) {
+      queue_.emplace_back();
+      auto threads = pool_size(options_.threads,
+                               a_fs_.allows_concurrent_reads() &&
+                                   b_fs_.allows_concurrent_reads());
+      run_pool(threads, [this] { worker(); });
+      ec = ec_;
+    }
+    if (ec) {
+      return {};
+    }
+    std::sort(result_.added.begin(), result_.added.end());
+    std::sort(result_.removed.begin(), result_.removed.end());
+    std::sort(result_.changed.begin(), result_.changed.end());
+    return std::move(result_);
+  }
+};
+
+} // namespace detail
+
+/**
+ * @brief Compares the tree at @c a in @c a_fs with the tree at @c b in
+ * @c b_fs.
+ *
+ * @details Both trees are walked together, one directory pair at a time, by
+ * a pool of threads. The listings of each pair are sorted and merge-joined.
+ * Regular files present on both sides are compared by size, then by
+ * content. When both filesystems are @c fake_filesystem instances, subtrees
+ * and files are compared by their hashes instead, so equal subtrees are
+ * skipped and no content is read.
+ *
+ * The roots may also be two regular files, which are reported as changed
+ * with an empty path if they differ.
+ *
+ * @param a_fs Filesystem of the first tree.
+ * @param a Root of the first tree.
+ * @param b_fs Filesystem of the second tree.
+ * @param b Root of the second tree.
+ * @param options How to walk and compare.
+ * @param ec Set if a root does not exist, or an entry cannot be read.
+ */
+inline diff_result diff(filesystem &a_fs, const path &a, filesystem &b_fs,
+                        const path &b, const diff_options &options,
+                        error_code &ec) {
+  return detail::tree_differ(a_fs, a, b_fs, b, options).run(ec);
+}
+
+inline diff_result diff(filesystem &a_fs, const path &a, filesystem &b_fs,
+                        const path &b, const diff_options &options = {}) {
+  error_code ec;
+  auto ret = diff(a_fs, a, b_fs, b, options, ec);
+  if (ec) {
+    throw filesystem_error("diff", a, b, ec);
+  }
+  return ret;
+}
+
+} // namespace pfs
+
+#endif
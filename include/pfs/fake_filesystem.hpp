@@ -2,10 +2,28 @@
 #define INCLUDED_PFS_FAKE_FILESYSTEM_HPP
 
 #include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <limits>
 #include <map>
 #include <memory>
+#include <pfs/file_handle.hpp>
+#include <pfs/file_view.hpp>
 #include <pfs/filesystem.hpp>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <unordered_map>
+#include <unordered_set>
 #include <utility>
+#include <vector>
+
+#if defined(__AVX2__) || defined(__SSE4_2__)
+#include <immintrin.h>
+#endif
 
 namespace pfs {
 
@@ -30,15 +48,454 @@ private:
   /**
    * @brief Underlying node in the filesystem tree.
    *
-   * @details The same node structure is used for all file types (regular file,
-   * directory, symlink, etc).
+   * @details Holds the fields common to all file types. Nodes that need more
+   * storage derive from it: directories are @c directory_node and regular
+   * files are @c file_node. Other leaves, such as symlinks, are plain nodes.
+   * The meta-root and Windows drive nodes have type @c file_type::none and
+   * are directory nodes. A node is always created by @c std::make_shared for
+   * its most-derived type, so it needs no virtual destructor.
    */
   struct node {
-    path name;       ///< File or directory name. Not a full path.
-    file_type type;  ///< Type of node: regular file, directory, etc.
-    node_list dents; ///< List of child nodes, if this is a directory.
+    path::string_type name; ///< File or directory name. Not a full path.
+    node *parent{nullptr};  ///< Directory containing this node. Not owned.
+                            ///< Null for the meta-root.
+    file_type type{file_type::none}; ///< Type of node: regular file, etc.
+    /// Hash of the subtree rooted here, without this node's name. See
+    /// @c tree_hash.
+    std::uint64_t hash{0};
+  };
+
+  /**
+   * @brief A node that has children.
+   */
+  struct directory_node final : node {
+    node_list dents; ///< List of child nodes, sorted by name.
+    /// Search keys parallel to @c dents. See @c name_key.
+    std::vector<std::int64_t> keys;
+    /// Length of a prefix shared by the names of all children. Not always the
+    /// longest such prefix: it shrinks as children are added, but does not
+    /// grow back when they are removed.
+    std::size_t key_offset{0};
+    /// Sum of the entry hashes of the children. See @c entry_hash.
+    std::uint64_t entry_sum{0};
+
+    directory_node() = default;
+    directory_node(const directory_node &) = delete;
+    directory_node &operator=(const directory_node &) = delete;
+
+    /**
+     * @brief Detaches the children that outlive the directory, such as files
+     * held by open streams.
+     */
+    ~directory_node() {
+      for (const auto &dent : dents) {
+        if (dent->parent == this) {
+          dent->parent = nullptr;
+        }
+      }
+    }
+  };
+
+  /**
+   * @brief Storage allocated to a file that is not exactly its contents,
+   * after holes were punched in it or space was preallocated.
+   */
+  struct file_space {
+    /// Allocated byte ranges, mapping each start to its end. Disjoint and
+    /// not adjacent, and may reach past the end of the file.
+    std::map<std::uint64_t, std::uint64_t> extents;
+  };
+
+  /**
+   * @brief A regular file node.
+   */
+  struct file_node final : node {
+    /// File contents, or null if the file is empty. Kept out of line so that
+    /// empty files stay small.
+    std::unique_ptr<std::string> content;
+    /// Allocated storage, or null if exactly the contents are allocated.
+    /// Holes still hold zeros in @c content: only the allocation is tracked.
+    std::unique_ptr<file_space> space;
+    /// Sum of the hashes of the blocks of the contents. See @c block_hash.
+    std::uint64_t block_sum{0};
+
+    /**
+     * @brief Gets the file contents.
+     */
+    const std::string &data() const noexcept {
+      static const std::string empty;
+      return content ? *content : empty;
+    }
+
+    /**
+     * @brief Sums the hashes of the blocks that overlap bytes [begin, end)
+     * of the contents.
+     */
+    std::uint64_t block_hashes(std::uint64_t begin,
+                               std::uint64_t end) const noexcept {
+      std::string_view view = data();
+      end = std::min<std::uint64_t>(end, view.size());
+      std::uint64_t sum = 0;
+      for (auto pos = begin - begin % hash_block; pos < end;
+           pos += hash_block) {
+        sum += block_hash(pos, view.substr(pos, hash_block));
+      }
+      return sum;
+    }
+
+    /**
+     * @brief Recomputes @c block_sum from the whole contents.
+     */
+    void rehash() noexcept { block_sum = block_hashes(0, data().size()); }
+
+    /**
+     * @brief Replaces the file contents, and updates the hashes of the file
+     * and its ancestors. The new contents are allocated exactly.
+     *
+     * @details Only the blocks that differ from the old contents are hashed
+     * again, so republishing a large file after a small change is cheap.
+     */
+    void assign(std::string s) {
+      std::string_view old = data();
+      for (std::size_t pos = 0; pos < std::max(old.size(), s.size());
+           pos += hash_block) {
+        auto a = pos < old.size() ? old.substr(pos, hash_block)
+                                  : std::string_view();
+        auto b = pos < s.size() ? std::string_view(s).substr(pos, hash_block)
+                                : std::string_view();
+        if (a != b) {
+          block_sum += block_hash(pos, b) - block_hash(pos, a);
+        }
+      }
+      if (s.empty()) {
+        content.reset();
+      } else if (content) {
+        *content = std::move(s);
+      } else {
+        content = std::make_unique<std::string>(std::move(s));
+      }
+      space.reset();
+      set_hash(*this, file_hash(*this));
+    }
+
+    /**
+     * @brief Starts tracking the allocation explicitly, if it is not
+     * already.
+     */
+    void track_space() {
+      if (!space) {
+        space = std::make_unique<file_space>();
+        if (auto size = data().size()) {
+          space->extents.emplace(0, size);
+        }
+      }
+    }
+
+    /**
+     * @brief Marks the bytes in [begin, end) as allocated.
+     */
+    void allocate(std::uint64_t begin, std::uint64_t end) {
+      if (begin >= end || (!space && end <= data().size())) {
+        return;
+      }
+      track_space();
+      auto &extents = space->extents;
+      auto it = extents.upper_bound(begin);
+      if (it != extents.begin() && std::prev(it)->second >= begin) {
+        --it;
+        begin = it->first;
+      }
+      while (it != extents.end() && it->first <= end) {
+        end = std::max(end, it->second);
+        it = extents.erase(it);
+      }
+      extents.emplace(begin, end);
+      untrack_space();
+    }
+
+    /**
+     * @brief Marks the bytes in [begin, end) as not allocated.
+     */
+    void deallocate(std::uint64_t begin, std::uint64_t end) {
+      if (begin >= end || (!space && begin >= data().size())) {
+        return;
+      }
+      track_space();
+      auto &extents = space->extents;
+      auto it = extents.upper_bound(begin);
+      if (it != extents.begin() && std::prev(it)->second > begin) {
+        --it;
+      }
+      while (it != extents.end() && it->first < end) {
+        auto [first, last] = *it;
+        it = extents.erase(it);
+        if (first < begin) {
+          extents.emplace(first, begin);
+        }
+        if (last > end) {
+          extents.emplace(end, last);
+        }
+      }
+      untrack_space();
+    }
+
+    /**
+     * @brief Stops tracking the allocation if it is exactly the contents.
+     */
+    void untrack_space() noexcept {
+      auto size = data().size();
+      const auto &extents = space->extents;
+      if (size == 0 ? extents.empty()
+                    : extents.size() == 1 && extents.begin()->first == 0 &&
+                          extents.begin()->second == size) {
+        space.reset();
+      }
+    }
+  };
+
+  /**
+   * @brief Bump allocator for the nodes placed by @c compact.
+   *
+   * @details Hands out memory in allocation order from large chunks, and
+   * frees nothing until the last @c arena_allocator referring to it is
+   * destroyed. Every node allocated from the arena keeps such an allocator in
+   * its shared_ptr control block, so the arena lives as long as any of its
+   * nodes.
+   */
+  class node_arena {
+  private:
+    std::vector<std::unique_ptr<char[]>> chunks_; ///< Storage, in order.
+    void *next_{nullptr};        ///< Next free byte of the last chunk.
+    std::size_t space_{0};       ///< Free bytes left in the last chunk.
+    std::size_t chunk_size_;     ///< Size of the next chunk to allocate.
+    std::atomic<std::size_t> refs_{0}; ///< Number of allocators.
+
+  public:
+    /**
+     * @param capacity Size of the first chunk. Should fit everything that
+     * will be allocated, so that the arena is a single contiguous block.
+     */
+    explicit node_arena(std::size_t capacity) : chunk_size_(capacity) {}
+
+    void *allocate(std::size_t bytes, std::size_t alignment) {
+      if (!std::align(alignment, bytes, next_, space_)) {
+        // Out of space. Continue in a new chunk.
+        space_ = std::max(chunk_size_, bytes + alignment);
+        chunks_.push_back(std::make_unique<char[]>(space_));
+        next_ = chunks_.back().get();
+        chunk_size_ = std::max<std::size_t>(chunk_size_ / 4, 4096);
+        std::align(alignment, bytes, next_, space_);
+      }
+      auto ret = next_;
+      next_ = static_cast<char *>(next_) + bytes;
+      space_ -= bytes;
+      return ret;
+    }
+
+    void acquire() noexcept { refs_.fetch_add(1, std::memory_order_relaxed); }
+
+    void release() noexcept {
+      if (refs_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        delete this;
+      }
+    }
+  };
+
+  /**
+   * @brief Allocator that draws from a @c node_arena and shares ownership of
+   * it.
+   */
+  template <typename T> class arena_allocator {
+  private:
+    template <typename U> friend class arena_allocator;
+    node_arena *arena_;
+
+  public:
+    using value_type = T;
+
+    explicit arena_allocator(node_arena *arena) noexcept : arena_(arena) {
+      arena_->acquire();
+    }
+
+    arena_allocator(const arena_allocator &other) noexcept
+        : arena_allocator(other.arena_) {}
+
+    template <typename U>
+    arena_allocator(const arena_allocator<U> &other) noexcept
+        : arena_allocator(other.arena_) {}
+
+    arena_allocator &operator=(const arena_allocator &other) noexcept {
+      other.arena_->acquire();
+      arena_->release();
+      arena_ = other.arena_;
+      return *this;
+    }
+
+    ~arena_allocator() { arena_->release(); }
+
+    T *allocate(std::size_t n) {
+      return static_cast<T *>(arena_->allocate(n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T *, std::size_t) noexcept {
+      // Freed with the arena.
+    }
+
+    template <typename U>
+    bool operator==(const arena_allocator<U> &other) const noexcept {
+      return arena_ == other.arena_;
+    }
+
+    template <typename U>
+    bool operator!=(const arena_allocator<U> &other) const noexcept {
+      return arena_ != other.arena_;
+    }
   };
 
+  /**
+   * @brief Checks if a node is a @c directory_node.
+   */
+  static bool has_children(const node &n) noexcept {
+    return n.type == file_type::directory || n.type == file_type::none;
+  }
+
+  /**
+   * @brief Gets the directory node for a node.
+   *
+   * @pre @c has_children(n) is true.
+   */
+  static directory_node &as_directory(node &n) noexcept {
+    return static_cast<directory_node &>(n);
+  }
+
+  /**
+   * @brief Gets the file node for a node.
+   *
+   * @pre The node is a regular file.
+   */
+  static file_node &as_file(node &n) noexcept {
+    return static_cast<file_node &>(n);
+  }
+
+  /**
+   * @brief Gets the children of a node, or an empty list if it is a leaf.
+   */
+  static const node_list &children(const node &n) noexcept {
+    static const node_list no_children;
+    return has_children(n) ? static_cast<const directory_node &>(n).dents
+                           : no_children;
+  }
+
+  /**
+   * @brief Checks if a node is a root directory.
+   */
+  static bool is_root_directory(const node &n) noexcept {
+    return n.name.size() == 1 && n.name[0] == path::preferred_separator;
+  }
+
+  /**
+   * @brief Mixes the bits of a hash. The 64-bit finalizer of MurmurHash3.
+   */
+  static std::uint64_t mix(std::uint64_t h) noexcept {
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+  }
+
+  static std::uint64_t name_hash(const path::string_type &name) noexcept {
+    return std::hash<std::basic_string_view<path::value_type>>()(name);
+  }
+
+  /**
+   * @brief Hash of a child as seen by its directory: its name and its hash.
+   *
+   * @details A directory combines the entry hashes of its children by adding
+   * them, which does not depend on their order, and lets one entry be
+   * replaced without visiting the others.
+   */
+  static std::uint64_t entry_hash(std::uint64_t name_hash,
+                                  std::uint64_t hash) noexcept {
+    return mix(name_hash + 0x9e3779b97f4a7c15ULL * mix(hash));
+  }
+
+  static std::uint64_t directory_hash(const directory_node &dir) noexcept {
+    return mix(dir.entry_sum ^ static_cast<std::uint64_t>(dir.type));
+  }
+
+  /**
+   * @brief Size of the blocks that file contents are hashed in.
+   */
+  static constexpr std::size_t hash_block = 4096;
+
+  /**
+   * @brief Hash of the block of a file's contents that starts at @c pos, or
+   * 0 if the block is empty.
+   *
+   * @details A file combines the hashes of its blocks by adding them, so
+   * that a write only hashes the blocks it changes again.
+   */
+  static std::uint64_t block_hash(std::uint64_t pos,
+                                  std::string_view block) noexcept {
+    return block.empty() ? 0
+                         : mix(std::hash<std::string_view>()(block) +
+                               0x9e3779b97f4a7c15ULL * (pos / hash_block + 1));
+  }
+
+  static std::uint64_t file_hash(const file_node &file) noexcept {
+    return mix((file.block_sum + mix(file.data().size())) ^
+               static_cast<std::uint64_t>(file_type::regular));
+  }
+
+  /**
+   * @brief Changes the hash of a node, and updates the hashes of its
+   * ancestors to match.
+   *
+   * @details Takes time proportional to the depth of the node.
+   */
+  static void set_hash(node &n, std::uint64_t hash) noexcept {
+    auto *cur = &n;
+    while (cur->hash != hash) {
+      auto old = cur->hash;
+      cur->hash = hash;
+      if (!cur->parent) {
+        break;
+      }
+      auto &dir = as_directory(*cur->parent);
+      auto name = name_hash(cur->name);
+      dir.entry_sum += entry_hash(name, hash) - entry_hash(name, old);
+      hash = directory_hash(dir);
+      cur = &dir;
+    }
+  }
+
+  /**
+   * @brief Makes an empty directory node, or a node of another type that has
+   * children.
+   */
+  static std::shared_ptr<directory_node>
+  make_directory(path::string_type name,
+                 file_type type = file_type::directory) {
+    auto dir = std::make_shared<directory_node>();
+    dir->name = std::move(name);
+    dir->type = type;
+    dir->hash = directory_hash(*dir);
+    return dir;
+  }
+
+  /**
+   * @brief Makes an empty regular file node.
+   */
+  static std::shared_ptr<file_node> make_file(path::string_type name) {
+    auto file = std::make_shared<file_node>();
+    file->name = std::move(name);
+    file->type = file_type::regular;
+    file->hash = file_hash(*file);
+    return file;
+  }
+
   /**
    * @brief A node that contains all roots.
    *
@@ -48,7 +505,7 @@ private:
    * each drive letter (C:, D:, etc.), and each of those nodes have a single
    * child for their own root directory.
    */
-  std::shared_ptr<node> meta_root_;
+  std::shared_ptr<directory_node> meta_root_;
 
   /**
    * @brief List of nodes through the tree leading to the CWD.
@@ -63,70 +520,464 @@ private:
   path cwd_;
 
   /**
-   * @brief Adds a node to the sorted node list.
+   * @brief A change to the tree, recorded so that it can be undone.
+   */
+  struct undo_record {
+    enum class change {
+      insert,  ///< @c n was inserted into @c dir.
+      remove,  ///< @c n was removed from @c dir.
+      rename,  ///< @c n was moved from @c dir, where it was called @c name.
+      content, ///< The contents of @c n were @c content.
+    };
+    change what;
+    std::shared_ptr<node> n;
+    directory_node *dir{nullptr};
+    path::string_type name;
+    std::unique_ptr<std::string> content;
+  };
+
+  /**
+   * @brief Nodes in the tree grouped by name and by extension. See
+   * @c enable_name_index.
+   */
+  struct name_index {
+    using node_set = std::unordered_set<const node *>;
+    std::unordered_map<path::string_type, node_set> by_name;
+    std::unordered_map<path::string_type, node_set> by_extension;
+  };
+
+  /**
+   * @brief The name index, or null if it is disabled.
+   */
+  std::unique_ptr<name_index> index_;
+
+  /**
+   * @brief Changes made since the outermost open transaction began.
+   */
+  std::vector<undo_record> undo_log_;
+
+  /**
+   * @brief Size of @c undo_log_ when each open transaction began, innermost
+   * last.
+   */
+  std::vector<std::size_t> savepoints_;
+
+  /**
+   * @brief Number of name characters encoded in a search key.
+   */
+  static constexpr std::size_t key_length =
+      sizeof(std::int64_t) / sizeof(path::value_type);
+
+  /**
+   * @brief Makes the search key for a name.
+   *
+   * @details The key packs @c key_length characters of the name, starting at
+   * @c offset, most significant first and zero-padded. Unsigned keys built
+   * this way compare like the names they came from; flipping the top bit lets
+   * them compare the same way as signed integers, which is what SIMD compare
+   * instructions support. Equal keys mean the names must be compared in full.
+   *
+   * @param name Name of a node.
+   * @param offset Number of leading characters to skip.
+   */
+  static std::int64_t name_key(const path::string_type &name,
+                               std::size_t offset) noexcept {
+    using unit = std::make_unsigned_t<path::value_type>;
+    constexpr std::size_t bits = 8 * sizeof(unit);
+    std::uint64_t key = 0;
+    for (std::size_t i = offset; i < offset + key_length; ++i) {
+      key = key << bits | (i < name.size() ? static_cast<unit>(name[i]) : 0);
+    }
+    return static_cast<std::int64_t>(key ^ (std::uint64_t{1} << 63));
+  }
+
+  /**
+   * @brief Counts the keys less than @c key in a sorted array of keys.
+   */
+  static std::size_t count_less(const std::int64_t *keys, std::size_t n,
+                                std::int64_t key) noexcept {
+    std::size_t i = 0;
+#if defined(__AVX2__)
+    auto k = _mm256_set1_epi64x(key);
+    for (; i + 4 <= n; i += 4) {
+      auto v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(keys + i));
+      auto less = _mm256_cmpgt_epi64(k, v);
+      auto mask = _mm256_movemask_pd(_mm256_castsi256_pd(less));
+      if (mask != 0xf) {
+        // Keys are sorted, so the lesser keys are the low lanes.
+        return i + (mask == 0 ? 0 : mask == 1 ? 1 : mask == 3 ? 2 : 3);
+      }
+    }
+#elif defined(__SSE4_2__)
+    auto k = _mm_set1_epi64x(key);
+    for (; i + 2 <= n; i += 2) {
+      auto v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(keys + i));
+      auto less = _mm_cmpgt_epi64(k, v);
+      auto mask = _mm_movemask_pd(_mm_castsi128_pd(less));
+      if (mask != 0x3) {
+        // Keys are sorted, so the lesser keys are the low lanes.
+        return i + (mask == 0 ? 0 : 1);
+      }
+    }
+#endif
+    while (i < n && keys[i] < key) {
+      ++i;
+    }
+    return i;
+  }
+
+  /**
+   * @brief Finds the first key not less than @c key in a sorted array.
+   *
+   * @details Binary searches down to a window of a few cache lines, then
+   * scans the window with SIMD compares where available.
+   */
+  static std::size_t lower_bound_key(const std::int64_t *keys, std::size_t n,
+                                     std::int64_t key) noexcept {
+    constexpr std::size_t window = 16;
+    std::size_t first = 0;
+    while (n > window) {
+      auto half = n / 2;
+      if (keys[first + half] < key) {
+        first += half + 1;
+        n -= half + 1;
+      } else {
+        n = half;
+      }
+    }
+    return first + count_less(keys + first, n, key);
+  }
+
+  /**
+   * @brief Adds a node to a directory's sorted node list.
    *
    * @pre The node list is sorted alphabetically by node name.
    * @post The node list is sorted alphabetically by node name.
    *
-   * @param l Node list to be modified.
+   * @param dir Directory whose node list is modified. Becomes the parent of
+   * the inserted node.
    * @param n Node to insert.
    * @return true if the node was inserted; false if an equivalent node was
    * found and the input node was not inserted.
    */
-  static bool insert_node(node_list &l, std::shared_ptr<node> n) {
-    auto it = std::lower_bound(l.begin(), l.end(), n, [](auto n1, auto n2) {
-      return n1->name < n2->name;
-    });
-    if (it == l.end() || (*it)->name != n->name) {
-      // Not found in node list.
-      l.insert(it, n);
-      return true;
-    } else {
+  static bool insert_node(directory_node &dir, std::shared_ptr<node> n) {
+    auto &l = dir.dents;
+    auto it = find_position(dir, n->name);
+    if (it != l.end() && (*it)->name == n->name) {
       return false;
     }
+    auto index = it - l.begin();
+    if (l.empty()) {
+      dir.key_offset = n->name.size();
+    } else {
+      // Shorten the shared prefix if the new name does not have all of it.
+      const auto &other = l.front()->name;
+      auto limit = std::min(n->name.size(), dir.key_offset);
+      std::size_t shared = 0;
+      while (shared < limit && n->name[shared] == other[shared]) {
+        ++shared;
+      }
+      if (shared < dir.key_offset) {
+        dir.key_offset = shared;
+        for (std::size_t i = 0; i < l.size(); ++i) {
+          dir.keys[i] = name_key(l[i]->name, shared);
+        }
+      }
+    }
+    n->parent = &dir;
+    dir.entry_sum += entry_hash(name_hash(n->name), n->hash);
+    dir.keys.insert(dir.keys.begin() + index,
+                    name_key(n->name, dir.key_offset));
+    l.insert(l.begin() + index, std::move(n));
+    set_hash(dir, directory_hash(dir));
+    return true;
   }
 
   /**
-   * @brief Removes a node from a sorted node list.
+   * @brief Removes a node from a directory's sorted node list.
    *
    * @pre The node list is sorted alphabetically by node name.
    *
-   * @param l The node list to be modified.
-   * @param n Removes all nodes with the same name.
+   * @param dir Directory whose node list is modified.
+   * @param n Removes all nodes with the same name. Loses its parent.
    * @return true if any nodes were removed; false if none found.
    */
-  static bool remove_node(node_list &l, std::shared_ptr<node> n) {
-    auto [first, last] =
-        std::equal_range(l.begin(), l.end(), n,
-                         [](auto n1, auto n2) { return n1->name < n2->name; });
-    if (first == last) {
+  static bool remove_node(directory_node &dir,
+                          const std::shared_ptr<node> &n) {
+    auto &l = dir.dents;
+    auto it = find_position(dir, n->name);
+    if (it == l.end() || (*it)->name != n->name) {
       return false;
     }
-    l.erase(first, last);
+    (*it)->parent = nullptr;
+    dir.entry_sum -= entry_hash(name_hash((*it)->name), (*it)->hash);
+    dir.keys.erase(dir.keys.begin() + (it - l.begin()));
+    l.erase(it);
+    set_hash(dir, directory_hash(dir));
     return true;
   }
 
   /**
-   * @brief Finds a node in a sorted node list.
+   * @brief Directories with at most this many children are searched by name
+   * alone, which is as fast as computing and searching the keys.
+   */
+  static constexpr std::size_t small_directory = 16;
+
+  /**
+   * @brief Gets the extension of a name, as @c path::extension would.
+   */
+  static path::string_type extension_of(const path::string_type &name) {
+    auto dot = name.rfind('.');
+    if (dot == path::string_type::npos || dot == 0 ||
+        (name.size() == 2 && name[0] == '.' && name[1] == '.')) {
+      return {};
+    }
+    return name.substr(dot);
+  }
+
+  /**
+   * @brief Adds a node to the name index, or removes it.
+   */
+  void index_node(const node &n, bool add) {
+    if (n.type == file_type::none || is_root_directory(n)) {
+      return;
+    }
+    auto update = [&](auto &map, const path::string_type &key) {
+      if (add) {
+        map[key].insert(&n);
+      } else if (auto it = map.find(key); it != map.end()) {
+        it->second.erase(&n);
+        if (it->second.empty()) {
+          map.erase(it);
+        }
+      }
+    };
+    update(index_->by_name, n.name);
+    if (auto ext = extension_of(n.name); !ext.empty()) {
+      update(index_->by_extension, ext);
+    }
+  }
+
+  /**
+   * @brief Adds a subtree that joined the tree to the name index, or removes
+   * one that left it.
+   */
+  void index_subtree(node &n, bool add) {
+    if (index_) {
+      visit_nodes(n, [&](node &m) { index_node(m, add); });
+    }
+  }
+
+  /**
+   * @brief Inserts a node into a directory, recording the change if a
+   * transaction is open.
+   */
+  void link(directory_node &dir, const std::shared_ptr<node> &n) {
+    if (savepoints_.empty()) {
+      if (!insert_node(dir, n)) {
+        return;
+      }
+    } else {
+      undo_log_.push_back({undo_record::change::insert, n, &dir, {}, {}});
+      if (!insert_node(dir, n)) {
+        undo_log_.pop_back();
+        return;
+      }
+    }
+    index_subtree(*n, true);
+  }
+
+  /**
+   * @brief Removes a node from a directory, recording the change if a
+   * transaction is open.
+   */
+  void unlink(directory_node &dir, const std::shared_ptr<node> &n) {
+    if (savepoints_.empty()) {
+      if (!remove_node(dir, n)) {
+        return;
+      }
+    } else {
+      undo_log_.push_back({undo_record::change::remove, n, &dir, {}, {}});
+      if (!remove_node(dir, n)) {
+        undo_log_.pop_back();
+        return;
+      }
+    }
+    index_subtree(*n, false);
+  }
+
+  /**
+   * @brief Moves and renames a node, recording the change if a transaction
+   * is open.
+   */
+  void move_node(directory_node &from, directory_node &to,
+                 const std::shared_ptr<node> &n, path::string_type name) {
+    remove_node(from, n);
+    if (index_) {
+      index_node(*n, false);
+    }
+    if (!savepoints_.empty()) {
+      undo_log_.push_back(
+          {undo_record::change::rename, n, &from, std::move(n->name), {}});
+    }
+    n->name = std::move(name);
+    insert_node(to, n);
+    if (index_) {
+      index_node(*n, true);
+    }
+  }
+
+  /**
+   * @brief Records the contents of a file that is about to change, if a
+   * transaction is open.
+   */
+  void save_content(const std::shared_ptr<file_node> &file) {
+    if (!savepoints_.empty()) {
+      auto saved = file->content
+                       ? std::make_unique<std::string>(*file->content)
+                       : nullptr;
+      undo_log_.push_back(
+          {undo_record::change::content, file, nullptr, {}, std::move(saved)});
+    }
+  }
+
+  /**
+   * @brief Undoes a recorded change. Changes must be undone in the reverse of
+   * the order they were made.
+   */
+  void undo(undo_record &r) {
+    switch (r.what) {
+    case undo_record::change::insert:
+      remove_node(*r.dir, r.n);
+      index_subtree(*r.n, false);
+      break;
+    case undo_record::change::remove:
+      insert_node(*r.dir, r.n);
+      index_subtree(*r.n, true);
+      break;
+    case undo_record::change::rename:
+      remove_node(static_cast<directory_node &>(*r.n->parent), r.n);
+      if (index_) {
+        index_node(*r.n, false);
+      }
+      r.n->name = std::move(r.name);
+      insert_node(*r.dir, r.n);
+      if (index_) {
+        index_node(*r.n, true);
+      }
+      break;
+    case undo_record::change::content:
+      as_file(*r.n).content = std::move(r.content);
+      as_file(*r.n).space.reset();
+      as_file(*r.n).rehash();
+      set_hash(*r.n, file_hash(as_file(*r.n)));
+      break;
+    }
+  }
+
+  /**
+   * @brief Finds where a name belongs in a directory's sorted node list.
+   *
+   * @details In larger directories, searches the contiguous array of keys
+   * first, and compares full names only among children whose keys are equal
+   * to the name's key, which avoids dereferencing most of the child nodes.
    *
    * @pre The node list is sorted alphabetically by node name.
    *
-   * @param l Node list to be searched.
+   * @param dir Directory to be searched.
    * @param name Name of the node to search for.
-   * @return The found node, or nullptr if not found.
-   */
-  static std::shared_ptr<node> find_node(const node_list &l, const path &name) {
-    auto val = std::make_shared<node>();
-    val->name = name;
-    auto [first, last] =
-        std::equal_range(l.begin(), l.end(), val,
-                         [](auto n1, auto n2) { return n1->name < n2->name; });
-    if (first == last) {
+   * @return Iterator to the first node whose name is not less than @c name.
+   */
+  static node_list::const_iterator
+  find_position(const directory_node &dir,
+                const path::string_type &name) noexcept {
+    const auto &l = dir.dents;
+    auto by_name = [](const std::shared_ptr<node> &n,
+                      const path::string_type &name) { return n->name < name; };
+    if (l.size() <= small_directory) {
+      return std::lower_bound(l.begin(), l.end(), name, by_name);
+    }
+    // Names without the shared prefix sort before or after every child.
+    auto offset = dir.key_offset;
+    if (auto c = name.compare(0, offset, l.front()->name, 0, offset)) {
+      return c < 0 ? l.begin() : l.end();
+    }
+    auto key = name_key(name, offset);
+    const auto *keys = dir.keys.data();
+    auto size = dir.keys.size();
+    auto first = lower_bound_key(keys, size, key);
+    if (first == size || keys[first] != key ||
+        name.size() <= offset + key_length) {
+      // Either no child has the same key, or the key holds the whole name and
+      // any child with the same key is equal or longer.
+      return l.begin() + first;
+    }
+    auto last = key == std::numeric_limits<std::int64_t>::max()
+                    ? size
+                    : first + lower_bound_key(keys + first, size - first,
+                                              key + 1);
+    return std::lower_bound(l.begin() + first, l.begin() + last, name,
+                            by_name);
+  }
+
+  /**
+   * @brief Finds a child of a node.
+   *
+   * @param n Node to be searched.
+   * @param name Name of the child to search for.
+   * @return The found node, or nullptr if not found or @c n is a leaf.
+   */
+  static std::shared_ptr<node> find_node(const node &n,
+                                         const path::string_type &name) {
+    if (!has_children(n)) {
+      return nullptr;
+    }
+    const auto &dir = static_cast<const directory_node &>(n);
+    auto it = find_position(dir, name);
+    if (it == dir.dents.end() || (*it)->name != name) {
       // Not found.
       return nullptr;
     } else {
-      return *first;
+      return *it;
+    }
+  }
+
+  /**
+   * @brief Estimated size of the block allocated by @c std::make_shared for a
+   * node: the node itself plus a control block of a vtable pointer and two
+   * reference counts.
+   */
+  static std::size_t node_allocation_bytes(const node &n) noexcept {
+    constexpr std::size_t control_block = sizeof(void *) + 2 * sizeof(int);
+    if (has_children(n)) {
+      return sizeof(directory_node) + control_block;
+    } else if (n.type == file_type::regular) {
+      return sizeof(file_node) + control_block;
+    }
+    return sizeof(node) + control_block;
+  }
+
+  /**
+   * @brief Gets the heap bytes owned by a string, or 0 if it fits in its
+   * small-string buffer.
+   */
+  template <typename String>
+  static std::size_t heap_bytes(const String &str) noexcept {
+    static const std::size_t inline_capacity = String().capacity();
+    if (str.capacity() <= inline_capacity) {
+      return 0;
     }
+    return (str.capacity() + 1) * sizeof(typename String::value_type);
+  }
+
+  /**
+   * @brief Estimates the allocator's bookkeeping and rounding for a block.
+   */
+  static std::size_t allocator_overhead(std::size_t bytes) noexcept {
+    constexpr std::size_t header = sizeof(void *);
+    constexpr std::size_t granule = 2 * sizeof(void *);
+    auto block = (bytes + header + granule - 1) / granule * granule;
+    return block - bytes;
   }
 
   /**
@@ -139,9 +990,128 @@ private:
   template <typename Callback>
   static void visit_nodes(node &n, Callback visitor) {
     visitor(n);
-    for (auto dent : n.dents) {
-      visit_nodes(*dent, visitor);
+    if (has_children(n)) {
+      for (const auto &dent : as_directory(n).dents) {
+        visit_nodes(*dent, visitor);
+      }
+    }
+  }
+
+  /**
+   * @brief Copies a subtree, allocating the copies in depth-first order.
+   *
+   * @details Regular files that are referenced outside the tree, by an open
+   * file stream, are not copied: the stream must keep writing to the file in
+   * the tree. Contents of copied files are moved rather than copied.
+   *
+   * @param n Root of the subtree to copy.
+   * @param alloc Allocator for the copies.
+   * @return The copy of @c n. Its parent is not set.
+   */
+  template <typename Allocator>
+  static std::shared_ptr<node> relocate(const std::shared_ptr<node> &n,
+                                        const Allocator &alloc) {
+    if (has_children(*n)) {
+      const auto &old = as_directory(*n);
+      auto dir = std::allocate_shared<directory_node>(alloc);
+      dir->name = old.name;
+      dir->type = old.type;
+      dir->hash = old.hash;
+      dir->keys.assign(old.keys.begin(), old.keys.end());
+      dir->key_offset = old.key_offset;
+      dir->entry_sum = old.entry_sum;
+      dir->dents.reserve(old.dents.size());
+      for (const auto &dent : old.dents) {
+        dir->dents.push_back(relocate(dent, alloc));
+        dir->dents.back()->parent = dir.get();
+      }
+      return dir;
+    } else if (n.use_count() > 1) {
+      // Open in a file stream. Keep it.
+      return n;
+    } else if (n->type == file_type::regular) {
+      auto file = std::allocate_shared<file_node>(alloc);
+      file->name = n->name;
+      file->type = n->type;
+      file->hash = n->hash;
+      file->content = std::move(as_file(*n).content);
+      file->space = std::move(as_file(*n).space);
+      file->block_sum = as_file(*n).block_sum;
+      return file;
+    }
+    auto leaf = std::allocate_shared<node>(alloc);
+    leaf->name = n->name;
+    leaf->type = n->type;
+    leaf->hash = n->hash;
+    return leaf;
+  }
+
+  /**
+   * @brief Appends to @c out the paths of the children that differ between
+   * two directories of the same type, descending into differing directories.
+   */
+  static void collect_differences(const node &a, const node &b,
+                                  const path &prefix, std::vector<path> &out) {
+    if (a.hash == b.hash) {
+      return;
+    }
+    const auto &a_list = children(a);
+    const auto &b_list = children(b);
+    auto ai = a_list.begin();
+    auto bi = b_list.begin();
+    while (ai != a_list.end() || bi != b_list.end()) {
+      int c = ai == a_list.end()   ? 1
+              : bi == b_list.end() ? -1
+                                   : (*ai)->name.compare((*bi)->name);
+      if (c < 0) {
+        out.push_back(prefix / (*ai++)->name);
+      } else if (c > 0) {
+        out.push_back(prefix / (*bi++)->name);
+      } else {
+        const auto &an = **ai++;
+        const auto &bn = **bi++;
+        if (an.type != bn.type ||
+            (an.hash != bn.hash && !has_children(an))) {
+          out.push_back(prefix / an.name);
+        } else if (an.hash != bn.hash) {
+          collect_differences(an, bn, prefix / an.name, out);
+        }
+      }
+    }
+  }
+
+  /**
+   * @brief Gets the absolute paths of the nodes under a key of the name
+   * index.
+   */
+  std::vector<path>
+  indexed_paths(std::unordered_map<path::string_type, name_index::node_set>
+                    name_index::*map,
+                const path::string_type &key) const {
+    if (!index_) {
+      throw std::logic_error("the name index is disabled");
+    }
+    std::vector<path> ret;
+    auto it = ((*index_).*map).find(key);
+    if (it == ((*index_).*map).end()) {
+      return ret;
     }
+    ret.reserve(it->second.size());
+    std::vector<const node *> chain;
+    for (const node *n : it->second) {
+      chain.clear();
+      // Stop below the meta-root, which has no name.
+      for (; n->parent; n = n->parent) {
+        chain.push_back(n);
+      }
+      path p;
+      for (auto c = chain.rbegin(); c != chain.rend(); ++c) {
+        p /= (*c)->name;
+      }
+      ret.push_back(std::move(p));
+    }
+    std::sort(ret.begin(), ret.end());
+    return ret;
   }
 
   /**
@@ -166,14 +1136,14 @@ private:
       // Traverse the current node for the next part of the path.
       return traverse(node_path, ++pit, pend);
     } else if (*pit == "..") {
-      if (node_path.back()->name.root_directory().empty()) {
+      if (!is_root_directory(*node_path.back())) {
         // Last element of the path is NOT the root directory. Safe to pop.
         // Otherwise, remain in the root directory.
         node_path.pop_back();
       }
       return traverse(node_path, ++pit, pend);
     }
-    auto next = find_node(node_path.back()->dents, *pit);
+    auto next = find_node(*node_path.back(), pit->native());
     if (!next) {
       // Next part of the path not found. Traversal ends here.
       return pit;
@@ -204,24 +1174,314 @@ private:
     } else {
       node_path = cwd_nodes_;
     }
-    auto pit = traverse(node_path, p.begin(), p.end());
-    return {std::move(node_path), pit};
-  }
+    auto pit = traverse(node_path, p.begin(), p.end());
+    return {std::move(node_path), pit};
+  }
+
+  /**
+   * @brief Finds the node at the given path.
+   *
+   * @details Resolves the path like @c traverse, but follows parent links for
+   * ".." instead of recording the node path, so it does not allocate. Prefer
+   * this for queries that only need the final node.
+   *
+   * @param p Path to look up.
+   * @return The node at @c p, or nullptr if the path does not exist.
+   */
+  const node *lookup(const path &p) const noexcept {
+    const node *n =
+        p.is_absolute() ? meta_root_.get() : cwd_nodes_.back().get();
+    for (const auto &part : p) {
+      const auto &name = part.native();
+      if (name == dot()) {
+        continue;
+      } else if (name == dot_dot()) {
+        if (!is_root_directory(*n) && n->parent) {
+          // Not the root directory, nor a directory that was removed. Safe to
+          // go up. Otherwise, remain where we are.
+          n = n->parent;
+        }
+        continue;
+      }
+      if (!has_children(*n)) {
+        return nullptr;
+      }
+      const auto &dir = static_cast<const directory_node &>(*n);
+      auto it = find_position(dir, name);
+      if (it == dir.dents.end() || (*it)->name != name) {
+        return nullptr;
+      }
+      n = it->get();
+    }
+    return n;
+  }
+
+  /**
+   * @brief The special directory name ".".
+   */
+  static const path::string_type &dot() noexcept {
+    static const path::string_type s = path(".").native();
+    return s;
+  }
+
+  /**
+   * @brief The special directory name "..".
+   */
+  static const path::string_type &dot_dot() noexcept {
+    static const path::string_type s = path("..").native();
+    return s;
+  }
+
+  /**
+   * @brief Stream buffer over the contents of a regular file node.
+   *
+   * @details The contents are copied into the buffer when the file is opened.
+   * Writes are published back to the node whenever the stream is flushed, and
+   * when the buffer is destroyed. Like separate file descriptors, two open
+   * streams on the same file do not see each other's unflushed writes.
+   */
+  class fake_filebuf final : public std::stringbuf {
+  private:
+    std::shared_ptr<file_node> node_; ///< File node receiving the writes.
+    bool writable_;                   ///< False if opened for reading only.
+
+  public:
+    fake_filebuf(std::shared_ptr<file_node> n, std::ios_base::openmode mode)
+        : std::stringbuf(n->data(), (mode & std::ios_base::app)
+                                         ? mode | std::ios_base::out
+                                         : mode),
+          node_(std::move(n)),
+          writable_(mode & (std::ios_base::out | std::ios_base::app)) {}
+
+    ~fake_filebuf() override { sync(); }
+
+  protected:
+    int sync() override {
+      if (writable_) {
+        node_->assign(str());
+      }
+      return 0;
+    }
+  };
+
+  /**
+   * @brief File stream returned by @c open_file.
+   */
+  class fake_file_stream final : public std::iostream {
+  private:
+    fake_filebuf buf_;
+
+  public:
+    fake_file_stream(std::shared_ptr<file_node> n,
+                     std::ios_base::openmode mode)
+        : std::iostream(nullptr), buf_(std::move(n), mode) {
+      rdbuf(&buf_);
+    }
+  };
+
+  /**
+   * @brief File handle returned by @c open_handle.
+   *
+   * @details Reads copy straight out of the node, taking no locks and
+   * touching no shared state, so any number of threads may read through any
+   * number of handles at once. Writes change the node in place and are seen
+   * by reads at once. They hash the blocks they change again; the hashes of
+   * the file and its ancestors are updated from those by @c sync, and when
+   * the handle is destroyed. Like other modifications,
+   * writes must not run concurrently with any other operation on the file.
+   *
+   * Allocation is tracked byte for byte: writes past the end of the file
+   * leave holes, @c preallocate and @c punch_hole allocate and free ranges,
+   * and @c allocation reports the result. Hints do nothing.
+   */
+  class fake_file_handle final : public file_handle {
+  private:
+    std::shared_ptr<file_node> node_; ///< File node read and written.
+    bool writable_;                   ///< False if opened for reading only.
+    bool dirty_ = false;              ///< True if written since the last sync.
+
+  public:
+    fake_file_handle(std::shared_ptr<file_node> n, bool writable)
+        : node_(std::move(n)), writable_(writable) {}
+    fake_file_handle(const fake_file_handle &) = delete;
+    fake_file_handle &operator=(const fake_file_handle &) = delete;
+
+    ~fake_file_handle() override {
+      error_code ec;
+      sync(ec);
+    }
+
+    using file_handle::allocation;
+    using file_handle::preadv;
+    using file_handle::preallocate;
+    using file_handle::punch_hole;
+    using file_handle::pwritev;
+    using file_handle::size;
+    using file_handle::sync;
+
+    std::size_t preadv(const mutable_buffer *buffers, std::size_t count,
+                       std::uint64_t offset, error_code &ec) override {
+      ec.clear();
+      const auto &data = node_->data();
+      if (offset >= data.size()) {
+        return 0;
+      }
+      auto pos = static_cast<std::size_t>(offset);
+      std::size_t done = 0;
+      for (std::size_t i = 0; i < count && pos < data.size(); ++i) {
+        auto n = std::min(buffers[i].size, data.size() - pos);
+        std::copy_n(data.data() + pos, n, static_cast<char *>(buffers[i].data));
+        pos += n;
+        done += n;
+      }
+      return done;
+    }
+
+    std::size_t pwritev(const const_buffer *buffers, std::size_t count,
+                        std::uint64_t offset, error_code &ec) override {
+      if (!writable_) {
+        ec = std::make_error_code(std::errc::bad_file_descriptor);
+        return 0;
+      }
+      ec.clear();
+      std::uint64_t total = 0;
+      for (std::size_t i = 0; i < count; ++i) {
+        if (buffers[i].size > max_offset - total) {
+          ec = std::make_error_code(std::errc::file_too_large);
+          return 0;
+        }
+        total += buffers[i].size;
+      }
+      if (total == 0) {
+        return 0;
+      }
+      if (!node_->content) {
+        node_->content = std::make_unique<std::string>();
+      }
+      auto &data = *node_->content;
+      if (offset > max_offset - total || offset + total > data.max_size()) {
+        ec = std::make_error_code(std::errc::file_too_large);
+        return 0;
+      }
+      auto pos = static_cast<std::size_t>(offset);
+      if (pos > data.size()) {
+        // The gap becomes a hole.
+        node_->track_space();
+      }
+      // The blocks written, and any between the old end and the offset.
+      auto first = std::min<std::uint64_t>(offset, data.size());
+      auto old_hashes = node_->block_hashes(first, offset + total);
+      if (data.size() < pos + total) {
+        try {
+          data.resize(pos + total, '\0');
+        } catch (const std::bad_alloc &) {
+          ec = std::make_error_code(std::errc::not_enough_memory);
+          return 0;
+        }
+      }
+      for (std::size_t i = 0; i < count; ++i) {
+        std::copy_n(static_cast<const char *>(buffers[i].data),
+                    buffers[i].size, data.data() + pos);
+        pos += buffers[i].size;
+      }
+      node_->block_sum +=
+          node_->block_hashes(first, offset + total) - old_hashes;
+      node_->allocate(offset, offset + total);
+      dirty_ = true;
+      return static_cast<std::size_t>(total);
+    }
+
+    std::uint64_t size(error_code &ec) const override {
+      ec.clear();
+      return node_->data().size();
+    }
+
+    /**
+     * @brief Updates the hashes of the file and its ancestors to match the
+     * writes so far.
+     */
+    void sync(error_code &ec) override {
+      ec.clear();
+      if (dirty_) {
+        set_hash(*node_, file_hash(*node_));
+        dirty_ = false;
+      }
+    }
+
+    void preallocate(std::uint64_t offset, std::uint64_t length,
+                     error_code &ec) override {
+      if (!writable_) {
+        ec = std::make_error_code(std::errc::bad_file_descriptor);
+        return;
+      }
+      if (offset > max_offset || length > max_offset - offset) {
+        ec = std::make_error_code(std::errc::file_too_large);
+        return;
+      }
+      ec.clear();
+      node_->allocate(offset, offset + length);
+    }
+
+    void punch_hole(std::uint64_t offset, std::uint64_t length,
+                    error_code &ec) override {
+      if (!writable_) {
+        ec = std::make_error_code(std::errc::bad_file_descriptor);
+        return;
+      }
+      ec.clear();
+      auto end = range_end(offset, length);
+      auto fill_end = std::min<std::uint64_t>(node_->data().size(), end);
+      if (offset < fill_end) {
+        auto old_hashes = node_->block_hashes(offset, fill_end);
+        auto first = node_->content->begin();
+        std::fill(first + static_cast<std::ptrdiff_t>(offset),
+                  first + static_cast<std::ptrdiff_t>(fill_end), '\0');
+        node_->block_sum += node_->block_hashes(offset, fill_end) - old_hashes;
+        dirty_ = true;
+      }
+      node_->deallocate(offset, end);
+    }
+
+    allocation_info allocation(error_code &ec) const override {
+      ec.clear();
+      allocation_info info;
+      info.size = node_->data().size();
+      if (!node_->space) {
+        info.allocated = info.size;
+        return info;
+      }
+      std::uint64_t pos = 0;
+      for (auto [begin, end] : node_->space->extents) {
+        info.allocated += end - begin;
+        if (begin > pos && pos < info.size) {
+          info.holes.emplace_back(pos, std::min(begin, info.size));
+        }
+        pos = end;
+      }
+      if (pos < info.size) {
+        info.holes.emplace_back(pos, info.size);
+      }
+      return info;
+    }
+  };
 
   class fake_directory_iterator final : public pfs::directory_iterator {
   private:
     pfs::path path_;      ///< Path to the directory being iterated.
     node_list node_path_; ///< Node path to the directory being iterated.
-    node_list::iterator dent_iter_; ///< Iterator to the child nodes.
-    pfs::path dent_path_;           ///< Path of the current directory entry.
-    file_status dent_status_;       ///< Status of the current directory entry.
+    node_list::const_iterator dent_iter_; ///< Iterator to the child nodes.
+    pfs::path dent_path_;     ///< Path of the current directory entry.
+    file_status dent_status_; ///< Status of the current directory entry.
 
     /**
      * @brief Updates the internal directory entry.
      */
     void refresh() {
       if (!at_end()) {
-        dent_path_ = path_ / (*dent_iter_)->name;
+        // Reuse the storage of the previous entry's path. Appending the name
+        // as a string avoids converting it to a temporary path first.
+        dent_path_.remove_filename();
+        dent_path_ += (*dent_iter_)->name;
         dent_status_.type((*dent_iter_)->type);
       }
     }
@@ -242,7 +1502,8 @@ private:
      */
     fake_directory_iterator(pfs::path p, node_list &&node_path)
         : path_(std::move(p)), node_path_(std::move(node_path)) {
-      dent_iter_ = node_path_.back()->dents.begin();
+      dent_iter_ = children(*node_path_.back()).begin();
+      dent_path_ = path_ / "";
       refresh();
     }
 
@@ -260,7 +1521,7 @@ private:
 
     bool at_end() const override {
       return !node_path_.empty() &&
-             dent_iter_ == node_path_.back()->dents.end();
+             dent_iter_ == children(*node_path_.back()).end();
     }
 
     const pfs::path &path() const noexcept override { return dent_path_; }
@@ -282,7 +1543,8 @@ private:
      * @details The first element is an iterator into a list of child nodes for
      * a directory. The second element is the end iterator for that same list.
      */
-    using node_range = std::pair<node_list::iterator, node_list::iterator>;
+    using node_range =
+        std::pair<node_list::const_iterator, node_list::const_iterator>;
 
     pfs::path path_; ///< Path to the directory being iterated. Changes as new
                      ///< directories are entered.
@@ -301,7 +1563,8 @@ private:
      */
     void refresh() {
       if (!at_end()) {
-        dent_path_ = path_ / cur().name;
+        dent_path_ = path_;
+        dent_path_ /= cur().name;
         dent_status_.type(cur().type);
       }
     }
@@ -309,7 +1572,7 @@ private:
     /**
      * @brief Gets reference to the node of the current directory entry.
      */
-    node &cur() { return *(range_.first->get()); }
+    const node &cur() const { return *(range_.first->get()); }
 
   public:
     /**
@@ -328,8 +1591,8 @@ private:
      */
     fake_recursive_directory_iterator(pfs::path p, node_list &&node_path)
         : path_(std::move(p)), node_path_(std::move(node_path)),
-          range_(node_path_.back()->dents.begin(),
-                 node_path_.back()->dents.end()) {
+          range_(children(*node_path_.back()).begin(),
+                 children(*node_path_.back()).end()) {
       refresh();
     }
 
@@ -337,11 +1600,12 @@ private:
       if (at_end()) {
         // Do nothing.
       }
-      if (cur().type == file_type::directory && !cur().dents.empty() &&
+      if (cur().type == file_type::directory && !children(cur()).empty() &&
           recursion_pending_) {
         // Step into directory.
         path_ /= cur().name;
-        node_range subdir_range{cur().dents.begin(), cur().dents.end()};
+        const auto &dents = children(cur());
+        node_range subdir_range{dents.begin(), dents.end()};
         ++range_.first;
         stack_.push_back(range_);
         ++depth_;
@@ -448,17 +1712,13 @@ public:
           "\" is not a valid root name for this platform");
     }
 
-    auto root_node = std::make_shared<node>();
 #ifdef _WIN32
     // This node represents the drive.
-    root_node->name = root_name;
-    root_node->type = file_type::none;
+    auto root_node = make_directory(root_name.native(), file_type::none);
 
     // This node represents the root directory of the drive.
-    auto root_dir_node = std::make_shared<node>();
-    root_dir_node->name = "\\";
-    root_dir_node->type = file_type::directory;
-    root_node->dents.push_back(root_dir_node);
+    auto root_dir_node = make_directory(L"\\");
+    insert_node(*root_node, root_dir_node);
 
     // If cwd not set, set it now.
     if (cwd_.empty()) {
@@ -469,8 +1729,7 @@ public:
     }
 #else
     // This node represents the root directory.
-    root_node->name = "/";
-    root_node->type = file_type::directory;
+    auto root_node = make_directory("/");
 
     // If cwd not set, set it now.
     if (cwd_.empty()) {
@@ -480,12 +1739,12 @@ public:
     }
 #endif
 
-    auto existing_root = find_node(meta_root_->dents, root_node->name);
+    auto existing_root = find_node(*meta_root_, root_node->name);
     if (existing_root) {
       // Requested root already exists.
       return false;
     } else {
-      insert_node(meta_root_->dents, root_node);
+      link(*meta_root_, root_node);
       return true;
     }
   }
@@ -511,7 +1770,7 @@ public:
    * initially empty.
    */
   fake_filesystem() {
-    meta_root_ = std::make_shared<node>();
+    meta_root_ = make_directory({}, file_type::none);
 #ifdef _WIN32
     path root_name = "C:";
 #else
@@ -520,6 +1779,535 @@ public:
     create_root(root_name);
   }
 
+  /**
+   * @brief Memory used by a fake filesystem, as reported by @c memory_stats.
+   *
+   * @details Byte counts cover the heap blocks owned by the tree: the nodes
+   * (including their shared_ptr control blocks), names too long for the
+   * small-string buffer, directory entry lists, and file contents. The
+   * allocator overhead is an estimate, modelled on general-purpose allocators
+   * that keep one pointer-sized header per block and round blocks up to twice
+   * the pointer size. Nodes placed by @c compact share one arena instead, so
+   * for them the allocation count and overhead are overestimated.
+   */
+  struct memory_info {
+    /// Number of nodes in the tree.
+    std::uintmax_t nodes{0};
+    /// Bytes of node allocations.
+    std::uintmax_t node_bytes{0};
+    /// Heap bytes of node names.
+    std::uintmax_t name_bytes{0};
+    /// Bytes of directory entries (child pointers and search keys) in use.
+    std::uintmax_t dents_used_bytes{0};
+    /// Bytes reserved for directory entries, used or not.
+    std::uintmax_t dents_capacity_bytes{0};
+    /// Bytes of file contents.
+    std::uintmax_t content_used_bytes{0};
+    /// Heap bytes reserved for file contents, used or not.
+    std::uintmax_t content_capacity_bytes{0};
+    /// Number of heap blocks.
+    std::uintmax_t allocations{0};
+    /// Estimated bookkeeping and rounding of the allocator.
+    std::uintmax_t allocator_overhead_bytes{0};
+
+    /**
+     * @brief Total bytes held by the tree, including unused capacity and the
+     * estimated allocator overhead.
+     */
+    std::uintmax_t total_bytes() const noexcept {
+      return node_bytes + name_bytes + dents_capacity_bytes +
+             content_capacity_bytes + allocator_overhead_bytes;
+    }
+  };
+
+  /**
+   * @brief Reports the memory held by the tree.
+   *
+   * @details Visits every node, so it takes time proportional to the size of
+   * the tree. Nodes that were removed but are still referenced by open
+   * iterators or file streams are not counted.
+   */
+  memory_info memory_stats() const {
+    memory_info info;
+    auto add_block = [&info](std::uintmax_t bytes) {
+      ++info.allocations;
+      info.allocator_overhead_bytes += allocator_overhead(bytes);
+    };
+    visit_nodes(*meta_root_, [&](node &n) {
+      ++info.nodes;
+      info.node_bytes += node_allocation_bytes(n);
+      add_block(node_allocation_bytes(n));
+      if (auto bytes = heap_bytes(n.name)) {
+        info.name_bytes += bytes;
+        add_block(bytes);
+      }
+      if (has_children(n)) {
+        const auto &dir = as_directory(n);
+        if (dir.dents.capacity()) {
+          auto bytes = dir.dents.capacity() * sizeof(node_list::value_type);
+          info.dents_used_bytes +=
+              dir.dents.size() * sizeof(node_list::value_type);
+          info.dents_capacity_bytes += bytes;
+          add_block(bytes);
+        }
+        if (dir.keys.capacity()) {
+          auto bytes = dir.keys.capacity() * sizeof(std::int64_t);
+          info.dents_used_bytes += dir.keys.size() * sizeof(std::int64_t);
+          info.dents_capacity_bytes += bytes;
+          add_block(bytes);
+        }
+      } else if (n.type == file_type::regular) {
+        if (const auto &content = as_file(n).content) {
+          info.content_used_bytes += content->size();
+          info.content_capacity_bytes += sizeof(std::string);
+          add_block(sizeof(std::string));
+          if (auto bytes = heap_bytes(*content)) {
+            info.content_capacity_bytes += bytes;
+            add_block(bytes);
+          }
+        }
+      }
+    });
+    return info;
+  }
+
+  /**
+   * @brief Releases unused capacity of directory entry lists and file
+   * contents, for example after mass removals.
+   *
+   * @return Number of bytes released, not counting allocator overhead.
+   */
+  std::uintmax_t shrink_to_fit() {
+    std::uintmax_t released = 0;
+    visit_nodes(*meta_root_, [&released](node &n) {
+      if (has_children(n)) {
+        auto &dir = as_directory(n);
+        auto dents_before = dir.dents.capacity();
+        auto keys_before = dir.keys.capacity();
+        dir.dents.shrink_to_fit();
+        dir.keys.shrink_to_fit();
+        released += (dents_before - dir.dents.capacity()) *
+                    sizeof(node_list::value_type);
+        released += (keys_before - dir.keys.capacity()) * sizeof(std::int64_t);
+      } else if (n.type == file_type::regular) {
+        auto &content = as_file(n).content;
+        if (content && content->empty()) {
+          released += sizeof(std::string) + heap_bytes(*content);
+          content.reset();
+        } else if (content) {
+          auto before = heap_bytes(*content);
+          content->shrink_to_fit();
+          released += before - heap_bytes(*content);
+        }
+      }
+    });
+    return released;
+  }
+
+  /**
+   * @brief Moves the tree into contiguous storage in depth-first order.
+   *
+   * @details After a long series of insertions and renames, nodes are
+   * scattered across the heap, and traversing the tree is bound by memory
+   * latency. Compaction copies every node into one arena in the order a
+   * recursive directory iterator visits them, with exactly sized directory
+   * entry lists and fresh copies of long names, so that a traversal streams
+   * through memory. Existing paths and the current directory are unaffected.
+   *
+   * Files open in a stream are left in place. Iterators that are open keep
+   * iterating the tree as it was. The arena is freed once all of its nodes
+   * are removed or replaced by another compaction; until then, the memory of
+   * nodes removed after compaction is not reused.
+   *
+   * @throw std::logic_error if a transaction is open.
+   */
+  void compact() {
+    if (!savepoints_.empty()) {
+      throw std::logic_error("cannot compact during a transaction");
+    }
+    constexpr std::size_t allocator_bytes = sizeof(arena_allocator<node>);
+    std::size_t capacity = 0;
+    visit_nodes(*meta_root_, [&capacity](node &n) {
+      capacity += node_allocation_bytes(n) + allocator_bytes;
+    });
+    arena_allocator<node> alloc(new node_arena(capacity));
+    auto meta_root =
+        std::static_pointer_cast<directory_node>(relocate(meta_root_, alloc));
+
+    // Find the current directory in the new tree.
+    node_list cwd_nodes{meta_root};
+    for (auto it = cwd_nodes_.begin() + 1; it != cwd_nodes_.end(); ++it) {
+      cwd_nodes.push_back(find_node(*cwd_nodes.back(), (*it)->name));
+    }
+    meta_root_ = std::move(meta_root);
+    cwd_nodes_ = std::move(cwd_nodes);
+    if (index_) {
+      // The nodes moved.
+      enable_name_index();
+    }
+  }
+
+  /**
+   * @brief Opens a transaction.
+   *
+   * @details Changes to the tree made while a transaction is open are
+   * recorded in an undo log, so that @c rollback can revert them in time
+   * proportional to the number of changes, regardless of the size of the
+   * tree. Transactions nest: each @c begin must be matched by a @c commit or
+   * a @c rollback, which applies to the changes since that @c begin.
+   *
+   * File contents are recorded when a file is opened for writing, so streams
+   * should be opened and closed within the transaction. The current
+   * directory is not part of the transaction.
+   */
+  void begin() { savepoints_.push_back(undo_log_.size()); }
+
+  /**
+   * @brief Closes the innermost transaction, keeping its changes.
+   *
+   * @details The changes become part of the enclosing transaction, if any, and
+   * can still be undone by rolling that back.
+   *
+   * @throw std::logic_error if no transaction is open.
+   */
+  void commit() {
+    if (savepoints_.empty()) {
+      throw std::logic_error("no transaction to commit");
+    }
+    savepoints_.pop_back();
+    if (savepoints_.empty()) {
+      undo_log_.clear();
+    }
+  }
+
+  /**
+   * @brief Closes the innermost transaction, undoing its changes.
+   *
+   * @throw std::logic_error if no transaction is open.
+   */
+  void rollback() {
+    if (savepoints_.empty()) {
+      throw std::logic_error("no transaction to roll back");
+    }
+    auto savepoint = savepoints_.back();
+    while (undo_log_.size() > savepoint) {
+      undo(undo_log_.back());
+      undo_log_.pop_back();
+    }
+    savepoints_.pop_back();
+  }
+
+  /**
+   * @brief Gets the number of open transactions.
+   */
+  std::size_t transaction_depth() const noexcept { return savepoints_.size(); }
+
+  /**
+   * @brief Gets a hash of the file or directory at a path, covering the
+   * names, types and file contents of everything below it.
+   *
+   * @details Every node keeps the hash of its subtree, updated along the
+   * path to the root whenever the tree changes, so getting it costs a single
+   * lookup. The name of @c p itself is not covered, so that subtrees can be
+   * compared wherever they are. Equal subtrees have equal hashes, in this or
+   * any other fake filesystem of the same program; unequal subtrees have
+   * equal hashes with a probability of about 2^-64. Hashes are not meant to
+   * be stored: they may differ between builds.
+   *
+   * Writes to a file stream are included once they are flushed.
+   */
+  std::uint64_t tree_hash(const path &p, error_code &ec) const noexcept {
+    const node *n = p.empty() ? nullptr : lookup(p);
+    if (!n) {
+      ec = std::make_error_code(std::errc::no_such_file_or_directory);
+      return 0;
+    }
+    ec.clear();
+    return n->hash;
+  }
+
+  std::uint64_t tree_hash(const path &p) const {
+    error_code ec;
+    auto ret = tree_hash(p, ec);
+    if (ec) {
+      throw filesystem_error("tree_hash", p, ec);
+    }
+    return ret;
+  }
+
+  /**
+   * @brief Lists the entries that differ between two subtrees.
+   *
+   * @details Compares the hashes of entries with the same name, and descends
+   * only into directories whose hashes differ, so the time taken depends on
+   * the differences rather than on the size of the subtrees.
+   *
+   * @param a_fs Filesystem of the first subtree.
+   * @param a Path of the first subtree.
+   * @param b_fs Filesystem of the second subtree. May be @c a_fs.
+   * @param b Path of the second subtree.
+   * @return Paths, relative to the subtrees, of the entries that exist in
+   * only one of them or differ in type, or are files that differ in contents.
+   * The descendants of such entries are not listed. Sorted in depth-first
+   * order.
+   * @throw filesystem_error if either path does not exist.
+   */
+  static std::vector<path> differences(const fake_filesystem &a_fs,
+                                       const path &a,
+                                       const fake_filesystem &b_fs,
+                                       const path &b) {
+    const node *a_node = a.empty() ? nullptr : a_fs.lookup(a);
+    const node *b_node = b.empty() ? nullptr : b_fs.lookup(b);
+    if (!a_node || !b_node) {
+      throw filesystem_error(
+          "differences", a_node ? b : a,
+          std::make_error_code(std::errc::no_such_file_or_directory));
+    }
+    std::vector<path> ret;
+    if (a_node->type != b_node->type ||
+        (a_node->hash != b_node->hash && !has_children(*a_node))) {
+      ret.emplace_back();
+    } else {
+      collect_differences(*a_node, *b_node, path(), ret);
+    }
+    return ret;
+  }
+
+  /**
+   * @brief Starts maintaining an index of the tree by entry name and
+   * extension, for @c find_by_name and @c find_by_extension.
+   *
+   * @details Building the index visits every node. Afterwards, creating,
+   * removing and renaming an entry update it in constant time per entry
+   * added to or removed from the tree; removing or restoring a subtree
+   * visits the subtree. Compaction rebuilds it. Enabling an enabled index
+   * rebuilds it.
+   */
+  void enable_name_index() {
+    index_ = std::make_unique<name_index>();
+    visit_nodes(*meta_root_, [&](node &n) { index_node(n, true); });
+  }
+
+  /**
+   * @brief Stops maintaining the name index, and frees it.
+   */
+  void disable_name_index() noexcept { index_.reset(); }
+
+  /**
+   * @brief Checks whether the name index is maintained.
+   */
+  bool name_index_enabled() const noexcept { return index_ != nullptr; }
+
+  /**
+   * @brief Finds every entry with a name.
+   *
+   * @details Takes time proportional to the number of results times their
+   * depth, regardless of the size of the tree.
+   *
+   * @return Absolute paths of the entries, sorted.
+   * @throw std::logic_error if the name index is disabled.
+   */
+  std::vector<path> find_by_name(const path &name) const {
+    return indexed_paths(&name_index::by_name, name.native());
+  }
+
+  /**
+   * @brief Finds every entry whose name has an extension, such as
+   * <tt>".cpp"</tt>, as @c path::extension defines it.
+   *
+   * @details Takes time proportional to the number of results times their
+   * depth, regardless of the size of the tree.
+   *
+   * @return Absolute paths of the entries, sorted.
+   * @throw std::logic_error if the name index is disabled.
+   */
+  std::vector<path> find_by_extension(const path &extension) const {
+    return indexed_paths(&name_index::by_extension, extension.native());
+  }
+
+  /**
+   * @brief Gets a view of the contents of a regular file, without copying
+   * them.
+   *
+   * @details The view points into the file node, which it keeps alive even
+   * if the file is removed. Its bytes stay valid until the file is written
+   * (when a write stream is flushed), its contents are rolled back, or
+   * @c shrink_to_fit is called. Concurrent views and reads are safe.
+   */
+  file_view view_file(const path &p, error_code &ec) override {
+    if (p.empty()) {
+      ec = std::make_error_code(std::errc::no_such_file_or_directory);
+      return {};
+    }
+    auto [node_path, pit] = traverse(p);
+    const auto &n = node_path.back();
+    if (pit != p.end()) {
+      ec = std::make_error_code(std::errc::no_such_file_or_directory);
+      return {};
+    } else if (n->type == file_type::directory) {
+      ec = std::make_error_code(std::errc::is_a_directory);
+      return {};
+    } else if (n->type != file_type::regular) {
+      ec = std::make_error_code(std::errc::not_supported);
+      return {};
+    }
+    ec.clear();
+    auto file = std::static_pointer_cast<const file_node>(n);
+    std::string_view data = file->data();
+    return file_view(data, std::move(file));
+  }
+
+  file_view view_file(const path &p) override {
+    error_code ec;
+    auto ret = view_file(p, ec);
+    if (ec) {
+      throw filesystem_error("view_file", p, ec);
+    }
+    return ret;
+  }
+
+  /**
+   * @brief Creates a regular file, or replaces the contents of one, in a
+   * single step.
+   *
+   * @details Equivalent to opening the file with @c std::ios_base::out and
+   * writing @c content, but moves @c content into the node instead of
+   * copying it through a stream buffer, for bulk loads.
+   *
+   * @param ec Set if the parent directory does not exist, or @c p is a
+   * directory.
+   */
+  void write_file(const path &p, std::string content, error_code &ec) {
+    std::shared_ptr<file_node> file;
+    if (p.empty()) {
+      ec = std::make_error_code(std::errc::no_such_file_or_directory);
+      return;
+    }
+    auto [node_path, pit] = traverse(p);
+    if (pit == p.end()) {
+      if (node_path.back()->type == file_type::directory) {
+        ec = std::make_error_code(std::errc::is_a_directory);
+        return;
+      } else if (node_path.back()->type != file_type::regular) {
+        ec = std::make_error_code(std::errc::not_supported);
+        return;
+      }
+      file = std::static_pointer_cast<file_node>(node_path.back());
+      save_content(file);
+    } else if (++pit == p.end() &&
+               node_path.back()->type == file_type::directory) {
+      file = make_file(p.filename().native());
+      link(as_directory(*node_path.back()), file);
+      save_content(file);
+    } else {
+      ec = std::make_error_code(std::errc::no_such_file_or_directory);
+      return;
+    }
+    ec.clear();
+    file->assign(std::move(content));
+  }
+
+  void write_file(const path &p, std::string content) {
+    error_code ec;
+    write_file(p, std::move(content), ec);
+    if (ec) {
+      throw filesystem_error("write_file", p, ec);
+    }
+  }
+
+  /**
+   * @brief Creates or replaces files, each in a single step with
+   * @c write_file. Nothing is ever synced, whatever the options.
+   */
+  atomic_write_stats
+  write_all(const std::vector<std::pair<path, std::string_view>> &files,
+            const atomic_write_options &options, error_code &ec) override {
+    (void)options;
+    atomic_write_stats stats{};
+    ec.clear();
+    for (auto &[p, content] : files) {
+      write_file(p, std::string(content), ec);
+      if (ec) {
+        break;
+      }
+      ++stats.files;
+    }
+    stats.commits = stats.files ? 1 : 0;
+    return stats;
+  }
+
+  using filesystem::write_all;
+
+  /**
+   * @brief Opens a regular file for positional and vectored reads and
+   * writes.
+   *
+   * @details The file is created and truncated as by @c open_file with the
+   * same mode. See @c fake_file_handle for which calls may run concurrently.
+   *
+   * @param ec Set if the file does not exist and is not created, or is not a
+   * regular file.
+   * @return The handle, or null on failure.
+   */
+  std::unique_ptr<file_handle> open_handle(const path &p,
+                                           std::ios_base::openmode mode,
+                                           error_code &ec) override {
+    using std::ios_base;
+    bool writable = mode & (ios_base::out | ios_base::app);
+    bool create = (mode & ios_base::app) ||
+                  ((mode & ios_base::out) &&
+                   (!(mode & ios_base::in) || (mode & ios_base::trunc)));
+    bool truncate =
+        (mode & ios_base::trunc) ||
+        ((mode & ios_base::out) && !(mode & (ios_base::in | ios_base::app)));
+
+    std::shared_ptr<file_node> file;
+    if (p.empty()) {
+      ec = std::make_error_code(std::errc::no_such_file_or_directory);
+      return nullptr;
+    }
+    auto [node_path, pit] = traverse(p);
+    if (pit == p.end()) {
+      if (node_path.back()->type == file_type::directory) {
+        ec = std::make_error_code(std::errc::is_a_directory);
+        return nullptr;
+      } else if (node_path.back()->type != file_type::regular) {
+        ec = std::make_error_code(std::errc::not_supported);
+        return nullptr;
+      }
+      file = std::static_pointer_cast<file_node>(node_path.back());
+    } else if (++pit == p.end() && create &&
+               node_path.back()->type == file_type::directory) {
+      file = make_file(p.filename().native());
+      link(as_directory(*node_path.back()), file);
+    } else {
+      ec = std::make_error_code(std::errc::no_such_file_or_directory);
+      return nullptr;
+    }
+    ec.clear();
+    if (writable) {
+      save_content(file);
+    }
+    if (truncate && file->content) {
+      file->assign({});
+    }
+    return std::make_unique<fake_file_handle>(std::move(file), writable);
+  }
+
+  std::unique_ptr<file_handle>
+  open_handle(const path &p, std::ios_base::openmode mode) override {
+    error_code ec;
+    auto ret = open_handle(p, mode, ec);
+    if (ec) {
+      throw filesystem_error("open_handle", p, ec);
+    }
+    return ret;
+  }
+
+  bool allows_concurrent_reads() const noexcept override { return true; }
+
+  bool allows_concurrent_writes() const noexcept override { return false; }
+
 public:
   path absolute(const path &p, error_code &ec) override {
     ec.clear();
@@ -534,7 +2322,7 @@ public:
       path_parts.reserve(cwd_nodes_.size());
       std::transform(cwd_nodes_.begin(), cwd_nodes_.end(),
                      std::back_inserter(path_parts),
-                     [](auto n) { return n->name; });
+                     [](const auto &n) { return path(n->name); });
 
       // Eliminate special directories . and .. from the path.
       for (auto pit = p.begin(); pit != p.end(); ++pit) {
@@ -588,10 +2376,8 @@ public:
     if (++pit == p.end()) {
       // The parent path already exists.
       if (node_path.back()->type == file_type::directory) {
-        auto new_dir = std::make_shared<node>();
-        new_dir->type = file_type::directory;
-        new_dir->name = p.filename();
-        insert_node(node_path.back()->dents, new_dir);
+        link(as_directory(*node_path.back()),
+             make_directory(p.filename().native()));
         ec.clear();
         return true;
       }
@@ -636,15 +2422,21 @@ public:
       return false;
     }
 
-    // Make additional directories.
-    auto parent_node = node_path.back();
+    // Make the missing directories from the bottom up, then link the top one
+    // into the tree, so that the hashes of the tree are updated once.
+    std::vector<path::string_type> names;
     for (; pit != p.end(); ++pit) {
-      auto new_dir = std::make_shared<node>();
-      new_dir->name = *pit;
-      new_dir->type = file_type::directory;
-      insert_node(parent_node->dents, new_dir);
-      parent_node = new_dir;
+      names.push_back(pit->native());
     }
+    std::shared_ptr<directory_node> top;
+    for (auto it = names.rbegin(); it != names.rend(); ++it) {
+      auto new_dir = make_directory(std::move(*it));
+      if (top) {
+        insert_node(*new_dir, std::move(top));
+      }
+      top = std::move(new_dir);
+    }
+    link(as_directory(*node_path.back()), top);
     ec.clear();
     return true;
   }
@@ -705,8 +2497,7 @@ public:
       // Special case. Path is empty string.
       return false;
     }
-    auto [node_path, pit] = traverse(p);
-    return pit == p.end();
+    return lookup(p) != nullptr;
   }
 
   bool exists(const path &p) const override {
@@ -718,14 +2509,41 @@ public:
     return ret;
   }
 
+  std::uintmax_t file_size(const path &p,
+                           error_code &ec) const noexcept override {
+    auto n = lookup(p);
+    if (p.empty() || !n) {
+      ec = std::make_error_code(std::errc::no_such_file_or_directory);
+      return static_cast<std::uintmax_t>(-1);
+    }
+    if (n->type == file_type::directory) {
+      ec = std::make_error_code(std::errc::is_a_directory);
+      return static_cast<std::uintmax_t>(-1);
+    } else if (n->type != file_type::regular) {
+      ec = std::make_error_code(std::errc::not_supported);
+      return static_cast<std::uintmax_t>(-1);
+    }
+    ec.clear();
+    return static_cast<const file_node *>(n)->data().size();
+  }
+
+  std::uintmax_t file_size(const path &p) const override {
+    error_code ec;
+    auto ret = file_size(p, ec);
+    if (ec) {
+      throw filesystem_error("file_size", ec);
+    }
+    return ret;
+  }
+
   bool is_directory(const path &p, error_code &ec) const noexcept override {
     ec.clear();
     if (p.empty()) {
       // Special case. Path is empty string.
       return false;
     }
-    auto [node_path, pit] = traverse(p);
-    return (pit == p.end() && node_path.back()->type == file_type::directory);
+    auto n = lookup(p);
+    return n && n->type == file_type::directory;
   }
 
   bool is_directory(const path &p) const override {
@@ -737,6 +2555,53 @@ public:
     return ret;
   }
 
+  /**
+   * @brief Opens a regular file, following the rules of @c std::fstream.
+   *
+   * @details Files are created by modes that write without requiring an
+   * existing file (@c out, @c app, or @c in|out|trunc), and truncated by
+   * @c trunc or by @c out without @c in or @c app. On failure, the returned
+   * stream has its failbit set, like an @c std::fstream that failed to open.
+   */
+  std::unique_ptr<std::iostream>
+  open_file(const path &p, std::ios_base::openmode mode) override {
+    using std::ios_base;
+    bool create = (mode & ios_base::app) ||
+                  ((mode & ios_base::out) &&
+                   (!(mode & ios_base::in) || (mode & ios_base::trunc)));
+    bool truncate =
+        (mode & ios_base::trunc) ||
+        ((mode & ios_base::out) && !(mode & (ios_base::in | ios_base::app)));
+
+    std::shared_ptr<file_node> file;
+    if (!p.empty()) {
+      auto [node_path, pit] = traverse(p);
+      if (pit == p.end()) {
+        // The file exists.
+        if (node_path.back()->type == file_type::regular) {
+          file = std::static_pointer_cast<file_node>(node_path.back());
+        }
+      } else if (++pit == p.end() && create &&
+                 node_path.back()->type == file_type::directory) {
+        // The parent directory exists. Create the file.
+        file = make_file(p.filename().native());
+        link(as_directory(*node_path.back()), file);
+      }
+    }
+    if (!file) {
+      auto ret = std::make_unique<std::stringstream>();
+      ret->setstate(std::ios_base::failbit);
+      return ret;
+    }
+    if (mode & (ios_base::out | ios_base::app)) {
+      save_content(file);
+    }
+    if (truncate && file->content) {
+      file->assign({});
+    }
+    return std::make_unique<fake_file_stream>(std::move(file), mode);
+  }
+
   bool remove(const path &p, error_code &ec) noexcept {
     if (p.empty()) {
       ec.clear();
@@ -750,11 +2615,11 @@ public:
     }
     auto n = node_path.back();
     if (n->type == file_type::directory) {
-      if (!n->name.root_directory().empty()) {
+      if (is_root_directory(*n)) {
         // Cannot remove the root directory.
         ec = std::make_error_code(std::errc::permission_denied);
         return false;
-      } else if (!n->dents.empty()) {
+      } else if (!children(*n).empty()) {
         // Cannot remove non-empty directories.
         ec = std::make_error_code(std::errc::directory_not_empty);
         return false;
@@ -763,15 +2628,17 @@ public:
         auto dir = node_path.back();
         node_path.pop_back();
         auto parent = node_path.back();
-        remove_node(parent->dents, dir);
+        unlink(as_directory(*parent), dir);
         ec.clear();
         return true;
       }
     }
 
-    // TODO: Handle types other than directories.
-    ec = std::make_error_code(std::errc::not_supported);
-    return false;
+    // Remove the file.
+    node_path.pop_back();
+    unlink(as_directory(*node_path.back()), n);
+    ec.clear();
+    return true;
   }
 
   bool remove(const path &p) {
@@ -796,7 +2663,7 @@ public:
     }
     auto n = node_path.back();
     if (n->type == file_type::directory) {
-      if (!n->name.root_directory().empty()) {
+      if (is_root_directory(*n)) {
         // Cannot remove the root directory.
         ec = std::make_error_code(std::errc::permission_denied);
         return false;
@@ -806,7 +2673,7 @@ public:
     // Unlink the node from its parent.
     node_path.pop_back();
     auto parent = node_path.back();
-    remove_node(parent->dents, n);
+    unlink(as_directory(*parent), n);
 
     // Count decendants
     std::uintmax_t count = 0;
@@ -856,15 +2723,26 @@ public:
       ec = std::make_error_code(std::errc::no_such_file_or_directory);
       return;
     }
+    if (new_node_path.back()->type != file_type::directory) {
+      // Parent of destination is not a directory.
+      ec = std::make_error_code(std::errc::not_a_directory);
+      return;
+    }
 
     // Move the node.
     auto n = old_node_path.back();
     old_node_path.pop_back();
     auto old_parent = old_node_path.back();
     auto new_parent = new_node_path.back();
-    remove_node(old_parent->dents, n);
-    n->name = new_p.filename();
-    insert_node(new_parent->dents, n);
+    for (auto *a = new_parent.get(); a; a = a->parent) {
+      if (a == n.get()) {
+        // Cannot move a directory into itself.
+        ec = std::make_error_code(std::errc::invalid_argument);
+        return;
+      }
+    }
+    move_node(as_directory(*old_parent), as_directory(*new_parent), n,
+              new_p.filename().native());
     ec.clear();
   }
 
@@ -878,9 +2756,8 @@ public:
 
   file_status status(const path &p, error_code &ec) const noexcept override {
     file_status s;
-    auto [node_path, pit] = traverse(p);
-    if (pit == p.end()) {
-      s.type(node_path.back()->type);
+    if (auto n = lookup(p)) {
+      s.type(n->type);
     } else {
       s.type(file_type::not_found);
     }
@@ -0,0 +1,435 @@
+#ifndef INCLUDED_PFS_FILE_HANDLE_HPP
+#define INCLUDED_PFS_FILE_HANDLE_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+namespace pfs {
+
+// Included by filesystem.hpp, so it cannot include it.
+using std::error_code;
+using std::filesystem::filesystem_error;
+
+/**
+ * @brief A buffer for a vectored read.
+ */
+struct mutable_buffer {
+  void *data;
+  std::size_t size;
+};
+
+/**
+ * @brief A buffer for a vectored write.
+ */
+struct const_buffer {
+  const void *data;
+  std::size_t size;
+};
+
+/**
+ * @brief How a range of a file is about to be accessed, for
+ * @c file_handle::advise. Values follow @c posix_fadvise.
+ */
+enum class access_advice {
+  normal,     ///< No particular pattern.
+  sequential, ///< In order: read ahead more aggressively.
+  random,     ///< In no order: do not read ahead.
+  willneed,   ///< Soon: start reading it into the cache.
+  dontneed,   ///< Not again soon: drop it from the cache.
+};
+
+/**
+ * @brief Storage allocated to a file, as reported by
+ * @c file_handle::allocation.
+ */
+struct allocation_info {
+  /// Size of the file.
+  std::uint64_t size{0};
+  /// Bytes of storage allocated, including any preallocated past the end.
+  std::uint64_t allocated{0};
+  /// Ranges of the file with no storage, as [begin, end) offsets, in order.
+  /// They read as zeros.
+  std::vector<std::pair<std::uint64_t, std::uint64_t>> holes;
+};
+
+/**
+ * @brief An open regular file, read and written at explicit offsets.
+ *
+ * @details Unlike a stream, a handle has no position, so several threads can
+ * read and write it at once without seeking. Reads fill the buffers until
+ * the end of the file, and return the number of bytes read. Writes write
+ * every byte, extending the file as needed; writing past the end leaves a
+ * gap that reads as zeros.
+ *
+ * Obtained from @c filesystem::open_handle. See the backends for which calls
+ * may run concurrently.
+ */
+class file_handle {
+public:
+  virtual ~file_handle() = default;
+
+  /**
+   * @brief Reads into several buffers, in order, from an offset.
+   *
+   * @return Bytes read, fewer than the buffers hold only at the end of the
+   * file.
+   */
+  virtual std::size_t preadv(const mutable_buffer *buffers, std::size_t count,
+                             std::uint64_t offset, error_code &ec) = 0;
+
+  /**
+   * @brief Writes several buffers, in order, at an offset.
+   *
+   * @return Bytes written: all of them, unless @c ec is set, which is
+   * @c file_too_large if the write would end past @c max_offset.
+   */
+  virtual std::size_t pwritev(const const_buffer *buffers, std::size_t count,
+                              std::uint64_t offset, error_code &ec) = 0;
+
+  virtual std::size_t pread(void *data, std::size_t size,
+                            std::uint64_t offset, error_code &ec) {
+    mutable_buffer buffer{data, size};
+    return preadv(&buffer, 1, offset, ec);
+  }
+
+  virtual std::size_t pwrite(const void *data, std::size_t size,
+                             std::uint64_t offset, error_code &ec) {
+    const_buffer buffer{data, size};
+    return pwritev(&buffer, 1, offset, ec);
+  }
+
+  /**
+   * @brief Gets the size of the file.
+   */
+  virtual std::uint64_t size(error_code &ec) const = 0;
+
+  /**
+   * @brief Makes the writes so far visible to the rest of the filesystem
+   * and, on disk, durable.
+   */
+  virtual void sync(error_code &ec) = 0;
+
+  /**
+   * @brief Allocates storage for a range of the file without changing its
+   * size, so that later writes to it cannot run out of space and land in
+   * contiguous blocks.
+   *
+   * @details Fails with @c file_too_large if the range ends past
+   * @c max_offset, and with @c operation_not_supported by default.
+   */
+  virtual void preallocate(std::uint64_t offset, std::uint64_t length,
+                           error_code &ec) {
+    (void)offset;
+    (void)length;
+    ec = std::make_error_code(std::errc::operation_not_supported);
+  }
+
+  /**
+   * @brief Frees the storage of a range of the file without changing its
+   * size. The range then reads as zeros. It may reach past the end of the
+   * file: a length of @c UINT64_MAX frees everything from @c offset on.
+   *
+   * @details By default, overwrites the range with zeros.
+   */
+  virtual void punch_hole(std::uint64_t offset, std::uint64_t length,
+                          error_code &ec) {
+    auto end = size(ec);
+    if (ec || offset >= end) {
+      return;
+    }
+    end = std::min(end, range_end(offset, length));
+    std::string zeros(std::min<std::uint64_t>(end - offset, 1 << 16), '\0');
+    for (auto pos = offset; pos < end && !ec; pos += zeros.size()) {
+      pwrite(zeros.data(), std::min<std::uint64_t>(zeros.size(), end - pos),
+             pos, ec);
+    }
+  }
+
+  /**
+   * @brief Declares how a range of the file is about to be accessed. A zero
+   * length extends the range to the end of the file.
+   *
+   * @details Only a hint: does nothing by default.
+   */
+  virtual void advise(std::uint64_t offset, std::uint64_t length,
+                      access_advice advice, error_code &ec) {
+    (void)offset;
+    (void)length;
+    (void)advice;
+    ec.clear();
+  }
+
+  /**
+   * @brief Starts reading a range of the file into the cache, without
+   * waiting for it.
+   *
+   * @details By default, advises @c access_advice::willneed.
+   */
+  virtual void readahead(std::uint64_t offset, std::uint64_t length,
+                         error_code &ec) {
+    advise(offset, length, access_advice::willneed, ec);
+  }
+
+  /**
+   * @brief Reports the storage allocated to the file.
+   *
+   * @details By default, reports the file as exactly allocated, with no
+   * holes.
+   */
+  virtual allocation_info allocation(error_code &ec) const {
+    allocation_info info;
+    info.size = info.allocated = size(ec);
+    return info;
+  }
+
+  std::size_t preadv(const mutable_buffer *buffers, std::size_t count,
+                     std::uint64_t offset) {
+    error_code ec;
+    auto ret = preadv(buffers, count, offset, ec);
+    if (ec) {
+      throw filesystem_error("preadv", ec);
+    }
+    return ret;
+  }
+
+  std::size_t pwritev(const const_buffer *buffers, std::size_t count,
+                      std::uint64_t offset) {
+    error_code ec;
+    auto ret = pwritev(buffers, count, offset, ec);
+    if (ec) {
+      throw filesystem_error("pwritev", ec);
+    }
+    return ret;
+  }
+
+  std::size_t pread(void *data, std::size_t size, std::uint64_t offset) {
+    error_code ec;
+    auto ret = pread(data, size, offset, ec);
+    if (ec) {
+      throw filesystem_error("pread", ec);
+    }
+    return ret;
+  }
+
+  std::size_t pwrite(const void *data, std::size_t size,
+                     std::uint64_t offset) {
+    error_code ec;
+    auto ret = pwrite(data, size, offset, ec);
+    if (ec) {
+      throw filesystem_error("pwrite", ec);
+    }
+    return ret;
+  }
+
+  std::uint64_t size() const {
+    error_code ec;
+    auto ret = size(ec);
+    if (ec) {
+      throw filesystem_error("size", ec);
+    }
+    return ret;
+  }
+
+  void sync() {
+    error_code ec;
+    sync(ec);
+    if (ec) {
+      throw filesystem_error("sync", ec);
+    }
+  }
+
+  void preallocate(std::uint64_t offset, std::uint64_t length) {
+    error_code ec;
+    preallocate(offset, length, ec);
+    if (ec) {
+      throw filesystem_error("preallocate", ec);
+    }
+  }
+
+  void punch_hole(std::uint64_t offset, std::uint64_t length) {
+    error_code ec;
+    punch_hole(offset, length, ec);
+    if (ec) {
+      throw filesystem_error("punch_hole", ec);
+    }
+  }
+
+  void advise(std::uint64_t offset, std::uint64_t length,
+              access_advice advice) {
+    error_code ec;
+    advise(offset, length, advice, ec);
+    if (ec) {
+      throw filesystem_error("advise", ec);
+    }
+  }
+
+  void readahead(std::uint64_t offset, std::uint64_t length) {
+    error_code ec;
+    readahead(offset, length, ec);
+    if (ec) {
+      throw filesystem_error("readahead", ec);
+    }
+  }
+
+  allocation_info allocation() const {
+    error_code ec;
+    auto ret = allocation(ec);
+    if (ec) {
+      throw filesystem_error("allocation", ec);
+    }
+    return ret;
+  }
+
+protected:
+  /// Largest offset in a file, as for a signed 64-bit @c off_t.
+  static constexpr std::uint64_t max_offset =
+      std::numeric_limits<std::int64_t>::max();
+
+  /**
+   * @brief Gets the end of the range of @c length bytes at @c offset,
+   * saturated at @c max_offset rather than wrapping around.
+   */
+  static std::uint64_t range_end(std::uint64_t offset,
+                                 std::uint64_t length) noexcept {
+    return offset >= max_offset || length > max_offset - offset
+               ? max_offset
+               : offset + length;
+  }
+};
+
+/**
+ * @brief A file handle over a stream from @c filesystem::open_file, for
+ * filesystems without native handles.
+ *
+ * @details Calls take turns on the stream, seeking before each one. Writes
+ * are published as the stream publishes them: when it is flushed by
+ * @c sync, or destroyed.
+ */
+class stream_file_handle final : public file_handle {
+private:
+  mutable std::mutex mutex_;
+  std::unique_ptr<std::iostream> stream_;
+  bool writable_;
+
+  /**
+   * @pre The mutex is held.
+   */
+  std::uint64_t end() const {
+    stream_->clear();
+    auto ret = stream_->rdbuf()->pubseekoff(0, std::ios_base::end,
+                                            std::ios_base::in);
+    if (ret == std::streampos(-1)) {
+      ret = stream_->rdbuf()->pubseekoff(0, std::ios_base::end,
+                                         std::ios_base::out);
+    }
+    return ret == std::streampos(-1) ? 0 : static_cast<std::uint64_t>(ret);
+  }
+
+public:
+  /**
+   * @param stream An open stream, which the handle owns.
+   * @param mode Mode the stream was opened with.
+   */
+  stream_file_handle(std::unique_ptr<std::iostream> stream,
+                     std::ios_base::openmode mode)
+      : stream_(std::move(stream)),
+        writable_(mode & (std::ios_base::out | std::ios_base::app)) {}
+
+  using file_handle::preadv;
+  using file_handle::pwritev;
+  using file_handle::size;
+  using file_handle::sync;
+
+  std::size_t preadv(const mutable_buffer *buffers, std::size_t count,
+                     std::uint64_t offset, error_code &ec) override {
+    std::lock_guard<std::mutex> lock(mutex_);
+    ec.clear();
+    if (offset >= end()) {
+      return 0;
+    }
+    stream_->clear();
+    if (!stream_->seekg(static_cast<std::streamoff>(offset))) {
+      ec = std::make_error_code(std::errc::io_error);
+      return 0;
+    }
+    std::size_t done = 0;
+    for (std::size_t i = 0; i < count; ++i) {
+      stream_->read(static_cast<char *>(buffers[i].data),
+                    static_cast<std::streamsize>(buffers[i].size));
+      done += static_cast<std::size_t>(stream_->gcount());
+      if (!*stream_) {
+        break;
+      }
+    }
+    return done;
+  }
+
+  std::size_t pwritev(const const_buffer *buffers, std::size_t count,
+                      std::uint64_t offset, error_code &ec) override {
+    if (!writable_) {
+      ec = std::make_error_code(std::errc::bad_file_descriptor);
+      return 0;
+    }
+    std::uint64_t total = 0;
+    for (std::size_t i = 0; i < count; ++i) {
+      if (buffers[i].size > max_offset - total) {
+        ec = std::make_error_code(std::errc::file_too_large);
+        return 0;
+      }
+      total += buffers[i].size;
+    }
+    if (offset > max_offset - total) {
+      ec = std::make_error_code(std::errc::file_too_large);
+      return 0;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto size = end();
+    stream_->clear();
+    stream_->seekp(static_cast<std::streamoff>(std::min(offset, size)));
+    for (; size < offset && *stream_; ++size) {
+      stream_->put('\0');
+    }
+    std::size_t done = 0;
+    for (std::size_t i = 0; i < count && *stream_; ++i) {
+      stream_->write(static_cast<const char *>(buffers[i].data),
+                     static_cast<std::streamsize>(buffers[i].size));
+      done += buffers[i].size;
+    }
+    if (!*stream_) {
+      ec = std::make_error_code(std::errc::io_error);
+      return 0;
+    }
+    ec.clear();
+    return done;
+  }
+
+  std::uint64_t size(error_code &ec) const override {
+    std::lock_guard<std::mutex> lock(mutex_);
+    ec.clear();
+    return end();
+  }
+
+  void sync(error_code &ec) override {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stream_->clear();
+    if (!stream_->flush()) {
+      ec = std::make_error_code(std::errc::io_error);
+      return;
+    }
+    ec.clear();
+  }
+};
+
+} // namespace pfs
+
+#endif
@@ -0,0 +1,58 @@
+#ifndef INCLUDED_PFS_FILE_VIEW_HPP
+#define INCLUDED_PFS_FILE_VIEW_HPP
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+
+namespace pfs {
+
+/**
+ * @brief Read-only view of the whole contents of a regular file, in
+ * contiguous memory.
+ *
+ * @details A view shares ownership of whatever holds the bytes: a mapping of
+ * the file, a node of a fake filesystem, or a buffer the file was read into.
+ * Copies of a view share it too. The bytes are not a snapshot: how long they
+ * stay valid while the file is written depends on where they come from (see
+ * @c filesystem::view_file).
+ */
+class file_view {
+private:
+  std::string_view data_;
+  std::shared_ptr<const void> owner_; ///< Keeps @c data_ alive.
+
+public:
+  file_view() = default;
+
+  /**
+   * @brief Makes a view of bytes kept alive by @c owner.
+   */
+  file_view(std::string_view data, std::shared_ptr<const void> owner) noexcept
+      : data_(data), owner_(std::move(owner)) {}
+
+  /**
+   * @brief Makes a view that owns a copy of a file read into a buffer.
+   */
+  explicit file_view(std::string buffer) {
+    auto owner = std::make_shared<const std::string>(std::move(buffer));
+    data_ = *owner;
+    owner_ = std::move(owner);
+  }
+
+  std::string_view data() const noexcept { return data_; }
+  std::size_t size() const noexcept { return data_.size(); }
+  bool empty() const noexcept { return data_.empty(); }
+
+  /**
+   * @brief Gets what keeps the bytes alive. For a view of a fake filesystem,
+   * this is the file node, so it identifies the file.
+   */
+  const std::shared_ptr<const void> &owner() const noexcept { return owner_; }
+};
+
+} // namespace pfs
+
+#endif
@@ -2,8 +2,18 @@
 #define INCLUDED_PFS_FILESYSTEM_HPP
 
 #include <cstddef>
+#include <cstdint>
 #include <filesystem>
+#include <ios>
+#include <istream>
 #include <memory>
+#include <pfs/file_handle.hpp>
+#include <pfs/file_view.hpp>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <utility>
+#include <vector>
 
 namespace pfs {
 
@@ -17,6 +27,44 @@ class filesystem;
 class directory_iterator;
 class recursive_directory_iterator;
 
+/**
+ * @brief How @c filesystem::write_all makes files durable, where the
+ * filesystem can.
+ */
+enum class atomic_sync {
+  none,  ///< Atomic, but not synced: a crash may lose recent writes.
+  each,  ///< Syncs each file, then its directory, before it returns.
+  group, ///< Shares syncs among the files committed together.
+};
+
+/**
+ * @brief Options of @c filesystem::write_all.
+ */
+struct atomic_write_options {
+  atomic_sync sync = atomic_sync::each;
+};
+
+/**
+ * @brief Counters of atomic writes. The syncs per file show how well
+ * commits were batched.
+ */
+struct atomic_write_stats {
+  std::uintmax_t files;      ///< Files written.
+  std::uintmax_t commits;    ///< Groups of files published together.
+  std::uintmax_t file_syncs; ///< Calls to fsync or fdatasync on files.
+  std::uintmax_t dir_syncs;  ///< Calls to fsync on directories.
+  std::uintmax_t fs_syncs;   ///< Calls to syncfs, each for a whole filesystem.
+
+  atomic_write_stats &operator+=(const atomic_write_stats &other) noexcept {
+    files += other.files;
+    commits += other.commits;
+    file_syncs += other.file_syncs;
+    dir_syncs += other.dir_syncs;
+    fs_syncs += other.fs_syncs;
+    return *this;
+  }
+};
+
 class filesystem {
 public:
   virtual ~filesystem() = default;
@@ -32,8 +80,13 @@ public:
   virtual void current_path(const path &p, error_code &ec) noexcept = 0;
   virtual bool exists(const path &p) const = 0;
   virtual bool exists(const path &p, error_code &ec) const noexcept = 0;
+  virtual std::uintmax_t file_size(const path &p) const = 0;
+  virtual std::uintmax_t file_size(const path &p,
+                                   error_code &ec) const noexcept = 0;
   virtual bool is_directory(const path &p) const = 0;
   virtual bool is_directory(const path &p, error_code &ec) const noexcept = 0;
+  virtual std::unique_ptr<std::iostream>
+  open_file(const path &p, std::ios_base::openmode mode) = 0;
   virtual bool remove(const path &p) = 0;
   virtual bool remove(const path &p, error_code &ec) noexcept = 0;
   virtual std::uintmax_t remove_all(const path &p) = 0;
@@ -51,6 +104,143 @@ public:
   recursive_directory_iterator(const path &p) const = 0;
   virtual std::unique_ptr<pfs::recursive_directory_iterator>
   recursive_directory_iterator(const path &p, error_code &ec) const = 0;
+
+  /**
+   * @brief Creates or replaces files, each atomically: readers, and the
+   * filesystem after a crash, see either the old contents or the new ones.
+   *
+   * @details Each file is atomic on its own; when one fails, others may
+   * still be written. The default implementation only writes each file
+   * through @c open_file, truncating it first, so it is neither atomic nor
+   * synced; filesystems that can do better override it.
+   *
+   * @param files Paths and contents.
+   * @param options How to make the files durable, where the filesystem can.
+   * @param ec Set to the first failure, e.g. if a parent directory does not
+   * exist or a path names a directory.
+   * @return The syncs made. With @c atomic_sync::group, they may include
+   * those of files of concurrent calls, which share them.
+   */
+  virtual atomic_write_stats
+  write_all(const std::vector<std::pair<path, std::string_view>> &files,
+            const atomic_write_options &options, error_code &ec) {
+    (void)options;
+    atomic_write_stats stats{};
+    ec.clear();
+    for (auto &[p, content] : files) {
+      if (status(p, ec).type() == file_type::directory) {
+        ec = std::make_error_code(std::errc::is_a_directory);
+        break;
+      }
+      ec.clear(); // A missing file is created below.
+      auto out = open_file(p, std::ios_base::out | std::ios_base::trunc |
+                                  std::ios_base::binary);
+      out->write(content.data(), static_cast<std::streamsize>(content.size()));
+      out->flush();
+      if (!*out) {
+        ec = std::make_error_code(std::errc::io_error);
+        break;
+      }
+      ++stats.files;
+    }
+    stats.commits = stats.files ? 1 : 0;
+    return stats;
+  }
+
+  virtual atomic_write_stats
+  write_all(const std::vector<std::pair<path, std::string_view>> &files,
+            const atomic_write_options &options) {
+    error_code ec;
+    auto ret = write_all(files, options, ec);
+    if (ec) {
+      throw filesystem_error("write_all", ec);
+    }
+    return ret;
+  }
+
+  /**
+   * @brief Opens a regular file for positional and vectored reads and
+   * writes.
+   *
+   * @details The default implementation wraps @c open_file in a
+   * @c stream_file_handle, whose calls take turns. Filesystems with native
+   * handles override it; see them for which calls may run concurrently.
+   *
+   * @param ec Set if @c p does not exist and is not created, or is not a
+   * regular file.
+   * @return The handle, or null on failure.
+   */
+  virtual std::unique_ptr<file_handle>
+  open_handle(const path &p, std::ios_base::openmode mode, error_code &ec) {
+    if (is_directory(p, ec)) {
+      ec = std::make_error_code(std::errc::is_a_directory);
+      return nullptr;
+    }
+    auto stream = open_file(p, mode | std::ios_base::binary);
+    if (!*stream) {
+      ec = std::make_error_code(std::errc::no_such_file_or_directory);
+      return nullptr;
+    }
+    ec.clear();
+    return std::make_unique<stream_file_handle>(std::move(stream), mode);
+  }
+
+  virtual std::unique_ptr<file_handle>
+  open_handle(const path &p, std::ios_base::openmode mode) {
+    error_code ec;
+    auto ret = open_handle(p, mode, ec);
+    if (ec) {
+      throw filesystem_error("open_handle", p, ec);
+    }
+    return ret;
+  }
+
+  /**
+   * @brief Gets a view of the contents of a regular file.
+   *
+   * @details The default implementation reads the file through
+   * @c open_file into a buffer owned by the view. Filesystems that hold the
+   * contents in memory, or can map them, override it without copying; see
+   * them for how long the bytes stay valid.
+   *
+   * @param ec Set if @c p does not exist, is not a regular file, or cannot
+   * be read.
+   */
+  virtual file_view view_file(const path &p, error_code &ec) {
+    auto size = file_size(p, ec);
+    if (ec) {
+      return {};
+    }
+    std::string buffer(static_cast<std::size_t>(size), '\0');
+    auto in = open_file(p, std::ios_base::in | std::ios_base::binary);
+    in->read(buffer.data(), static_cast<std::streamsize>(size));
+    if (!*in) {
+      ec = std::make_error_code(std::errc::io_error);
+      return {};
+    }
+    return file_view(std::move(buffer));
+  }
+
+  virtual file_view view_file(const path &p) {
+    error_code ec;
+    auto ret = view_file(p, ec);
+    if (ec) {
+      throw filesystem_error("view_file", p, ec);
+    }
+    return ret;
+  }
+
+  /**
+   * @brief Whether queries, reads and views may run on several threads at
+   * once. False unless a filesystem says otherwise.
+   */
+  virtual bool allows_concurrent_reads() const noexcept { return false; }
+
+  /**
+   * @brief Whether modifications may run on several threads at once, with
+   * each other and with reads. False unless a filesystem says otherwise.
+   */
+  virtual bool allows_concurrent_writes() const noexcept { return false; }
 };
 
 class directory_iterator {
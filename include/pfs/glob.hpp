@@ -0,0 +1,499 @@
+#ifndef INCLUDED_PFS_GLOB_HPP
+#define INCLUDED_PFS_GLOB_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <pfs/filesystem.hpp>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace pfs {
+
+/**
+ * @brief A compiled glob pattern over relative paths.
+ *
+ * @details Components are separated by @c /. Within a component, @c * matches
+ * any run of characters, @c ? any one character, @c [abc], @c [a-z] and
+ * @c [!abc] one character of (or not of) a set, and @c \ escapes the next
+ * character. A component that is exactly @c ** matches zero or more whole
+ * components. Unlike a shell, wildcards also match names that start with a
+ * dot.
+ *
+ * The pattern compiles to a nondeterministic automaton whose states are
+ * positions between components. Walking a tree, each directory carries the
+ * set of states its path reaches, so subtrees that reach no state are never
+ * listed, and directories whose states expect only literal components are
+ * looked up instead of listed.
+ */
+class glob_pattern {
+private:
+  /**
+   * @brief One element of a component pattern.
+   */
+  struct token {
+    enum kind_type { literal, any_char, any_run, set } kind;
+    std::string text; ///< Literal characters, or set ranges as pairs.
+    bool negated{false};
+  };
+
+  /**
+   * @brief One component of the pattern.
+   */
+  struct component {
+    enum kind_type { literal, wildcard, recursive } kind;
+    std::string text; ///< The name, if literal.
+    std::vector<token> tokens;
+  };
+
+  std::vector<component> components_;
+  std::uint64_t literal_mask_{0}; ///< States expecting a literal component.
+
+  static component compile_component(std::string_view s) {
+    component c;
+    if (s == "**") {
+      c.kind = component::recursive;
+      return c;
+    }
+    c.kind = component::literal;
+    auto add_char = [&](char ch) {
+      if (c.tokens.empty() || c.tokens.back().kind != token::literal) {
+        c.tokens.push_back({token::literal, {}, false});
+      }
+      c.tokens.back().text += ch;
+      c.text += ch;
+    };
+    for (std::size_t i = 0; i < s.size(); ++i) {
+      char ch = s[i];
+      if (ch == '\\' && i + 1 < s.size()) {
+        add_char(s[++i]);
+      } else if (ch == '*') {
+        c.kind = component::wildcard;
+        if (c.tokens.empty() || c.tokens.back().kind != token::any_run) {
+          c.tokens.push_back({token::any_run, {}, false});
+        }
+      } else if (ch == '?') {
+        c.kind = component::wildcard;
+        c.tokens.push_back({token::any_char, {}, false});
+      } else if (ch == '[') {
+        c.kind = component::wildcard;
+        token t{token::set, {}, false};
+        std::size_t j = i + 1;
+        if (j < s.size() && (s[j] == '!' || s[j] == '^')) {
+          t.negated = true;
+          ++j;
+        }
+        // A ']' right after the opening bracket is a member.
+        for (bool first = true; j < s.size() && (first || s[j] != ']');
+             first = false) {
+          char lo = s[j++];
+          char hi = lo;
+          if (j + 1 < s.size() && s[j] == '-' && s[j + 1] != ']') {
+            hi = s[j + 1];
+            j += 2;
+          }
+          t.text += lo;
+          t.text += hi;
+        }
+        if (j >= s.size()) {
+          throw std::invalid_argument("glob_pattern: unterminated '['");
+        }
+        i = j;
+        c.tokens.push_back(std::move(t));
+      } else {
+        add_char(ch);
+      }
+    }
+    return c;
+  }
+
+  static bool match_set(const token &t, char ch) {
+    bool in = false;
+    for (std::size_t i = 0; i + 1 < t.text.size(); i += 2) {
+      if (t.text[i] <= ch && ch <= t.text[i + 1]) {
+        in = true;
+        break;
+      }
+    }
+    return in != t.negated;
+  }
+
+  /**
+   * @brief Matches one name against a wildcard component.
+   *
+   * @details Backtracks only to the most recent @c *, which is enough
+   * because every other token has a fixed length.
+   */
+  static bool match_component(const component &c, std::string_view name) {
+    const auto &tokens = c.tokens;
+    std::size_t ti = 0, ni = 0;
+    std::size_t star_t = tokens.size(), star_n = 0;
+    while (ni < name.size() || ti < tokens.size()) {
+      if (ti < tokens.size()) {
+        const auto &t = tokens[ti];
+        if (t.kind == token::any_run) {
+          star_t = ti++;
+          star_n = ni;
+          continue;
+        }
+        if (t.kind == token::literal) {
+          if (name.substr(ni, t.text.size()) == t.text) {
+            ++ti;
+            ni += t.text.size();
+            continue;
+          }
+        } else if (ni < name.size() &&
+                   (t.kind == token::any_char || match_set(t, name[ni]))) {
+          ++ti;
+          ++ni;
+          continue;
+        }
+      }
+      if (star_t < tokens.size() && star_n < name.size()) {
+        ti = star_t + 1;
+        ni = ++star_n;
+        continue;
+      }
+      return false;
+    }
+    return true;
+  }
+
+public:
+  /**
+   * @brief A set of automaton states, one bit per position.
+   */
+  using state_set = std::uint64_t;
+
+  /**
+   * @brief Compiles a pattern.
+   *
+   * @throw std::invalid_argument if the pattern is empty, absolute, has an
+   * unterminated @c [, or has more than 63 components.
+   */
+  explicit glob_pattern(std::string_view pattern) {
+    if (pattern.empty() || pattern.front() == '/') {
+      throw std::invalid_argument("glob_pattern: pattern must be relative");
+    }
+    std::size_t start = 0;
+    while (start <= pattern.size()) {
+      auto end = pattern.find('/', start);
+      if (end == std::string_view::npos) {
+        end = pattern.size();
+      }
+      auto s = pattern.substr(start, end - start);
+      // Empty and "." components match nothing more.
+      if (!s.empty() && s != ".") {
+        auto c = compile_component(s);
+        // Consecutive "**" are equivalent to one.
+        if (c.kind != component::recursive || components_.empty() ||
+            components_.back().kind != component::recursive) {
+          components_.push_back(std::move(c));
+        }
+      }
+      start = end + 1;
+    }
+    if (components_.size() > 63) {
+      throw std::invalid_argument("glob_pattern: too many components");
+    }
+    for (std::size_t i = 0; i < components_.size(); ++i) {
+      if (components_[i].kind == component::literal) {
+        literal_mask_ |= std::uint64_t{1} << i;
+      }
+    }
+  }
+
+  /**
+   * @brief The state of the empty path, before any component.
+   */
+  state_set initial() const { return closure(1); }
+
+  /**
+   * @brief Whether a path reaching @c s matches the whole pattern.
+   */
+  bool accepts(state_set s) const {
+    return (s >> components_.size()) & 1;
+  }
+
+  /**
+   * @brief Whether a path reaching @c s has descendants that may match.
+   */
+  bool may_descend(state_set s) const {
+    return (s & ((state_set{1} << components_.size()) - 1)) != 0;
+  }
+
+  /**
+   * @brief Adds the states reachable by letting each @c ** match nothing.
+   */
+  state_set closure(state_set s) const {
+    for (std::size_t i = 0; i < components_.size(); ++i) {
+      if ((s >> i & 1) && components_[i].kind == component::recursive) {
+        s |= state_set{1} << (i + 1);
+      }
+    }
+    return s;
+  }
+
+  /**
+   * @brief The states reached by appending the component @c name to a path
+   * reaching @c s.
+   */
+  state_set step(state_set s, std::string_view name) const {
+    state_set next = 0;
+    for (std::size_t i = 0; i < components_.size(); ++i) {
+      if (!(s >> i & 1)) {
+        continue;
+      }
+      const auto &c = components_[i];
+      if (c.kind == component::recursive) {
+        next |= state_set{1} << i;
+      } else if (c.kind == component::literal ? name == c.text
+                                              : match_component(c, name)) {
+        next |= state_set{1} << (i + 1);
+      }
+    }
+    return closure(next);
+  }
+
+  /**
+   * @brief Whether the children of a directory reaching @c s that may match
+   * can be looked up by name rather than listed.
+   *
+   * @details True when every pending state expects a literal component.
+   */
+  bool lookups_suffice(state_set s) const {
+    return may_descend(s) && (s & ~literal_mask_ &
+                              ((state_set{1} << components_.size()) - 1)) == 0;
+  }
+
+  /**
+   * @brief Gets the names to look up from a directory reaching @c s.
+   *
+   * @pre @c lookups_suffice(s)
+   */
+  std::vector<std::string> literals(state_set s) const {
+    std::vector<std::string> ret;
+    for (std::size_t i = 0; i < components_.size(); ++i) {
+      if (s >> i & 1) {
+        ret.push_back(components_[i].text);
+      }
+    }
+    std::sort(ret.begin(), ret.end());
+    ret.erase(std::unique(ret.begin(), ret.end()), ret.end());
+    return ret;
+  }
+
+  /**
+   * @brief Whether a relative path matches the pattern.
+   */
+  bool match(const path &p) const {
+    auto s = initial();
+    for (const auto &part : p) {
+      auto name = part.string();
+      if (name.empty() || name == ".") {
+        continue;
+      }
+      s = step(s, name);
+      if (!s) {
+        return false;
+      }
+    }
+    return accepts(s);
+  }
+};
+
+namespace detail {
+
+/**
+ * @brief Walks a tree along a compiled pattern.
+ */
+class glob_walker {
+private:
+  const filesystem &fs_;
+  const glob_pattern &pattern_;
+  std::vector<path> &out_;
+
+  /**
+   * @brief Visits the entries below @c dir, whose path reaches @c s.
+   */
+  void walk(const path &dir, glob_pattern::state_set s, error_code &ec) {
+    if (pattern_.lookups_suffice(s)) {
+      for (const auto &name : pattern_.literals(s)) {
+        auto child = dir / name;
+        auto type = fs_.status(child, ec).type();
+        if (type == file_type::not_found) {
+          ec.clear();
+          continue;
+        }
+        if (ec) {
+          return;
+        }
+        visit(child, type, pattern_.step(s, name), ec);
+        if (ec) {
+          return;
+        }
+      }
+      return;
+    }
+
+    // List the subtree, carrying the state of each directory on the way
+    // down.
+    std::vector<glob_pattern::state_set> states{s};
+    auto it = fs_.recursive_directory_iterator(dir, ec);
+    while (!ec && !it->at_end()) {
+      auto depth = static_cast<std::size_t>(it->depth());
+      auto next = pattern_.step(states[depth], it->path().filename().string());
+      bool descend = false;
+      if (next) {
+        if (pattern_.accepts(next)) {
+          out_.push_back(it->path());
+        }
+        auto type = pattern_.may_descend(next) ? it->status(ec).type()
+                                               : file_type::none;
+        if (type == file_type::not_found) {
+          // A dangling symlink, or an entry removed during the walk.
+          ec.clear();
+        } else if (type == file_type::directory) {
+          if (!pattern_.lookups_suffice(next)) {
+            states.resize(depth + 2);
+            states[depth + 1] = next;
+            descend = true;
+          } else {
+            walk(it->path(), next, ec);
+          }
+        }
+        if (ec) {
+          return;
+        }
+      }
+      if (!descend && it->recursion_pending()) {
+        it->disable_recursion_pending();
+      }
+      it->increment(ec);
+    }
+  }
+
+  void visit(const path &p, file_type type, glob_pattern::state_set s,
+             error_code &ec) {
+    if (pattern_.accepts(s)) {
+      out_.push_back(p);
+    }
+    if (pattern_.may_descend(s) && type == file_type::directory) {
+      walk(p, s, ec);
+    }
+  }
+
+public:
+  glob_walker(const filesystem &fs, const glob_pattern &pattern,
+              std::vector<path> &out)
+      : fs_(fs), pattern_(pattern), out_(out) {}
+
+  void run(const path &root, error_code &ec) {
+    auto type = fs_.status(root, ec).type();
+    if (!ec && type == file_type::not_found) {
+      ec = std::make_error_code(std::errc::no_such_file_or_directory);
+    }
+    if (!ec && type != file_type::directory) {
+      ec = std::make_error_code(std::errc::not_a_directory);
+    }
+    if (!ec) {
+      walk(root, pattern_.initial(), ec);
+    }
+  }
+};
+
+} // namespace detail
+
+/**
+ * @brief Finds the entries below @c root whose paths relative to @c root
+ * match @c pattern.
+ *
+ * @details Directories are listed only where the pattern has a wildcard, and
+ * only where some path below them can still match. Symbolic links to
+ * directories are followed only when the pattern names them literally.
+ *
+ * @return The matching paths, each @c root joined with the relative path,
+ * sorted.
+ */
+inline std::vector<path> find(const filesystem &fs, const path &root,
+                              const glob_pattern &pattern, error_code &ec) {
+  std::vector<path> ret;
+  detail::glob_walker(fs, pattern, ret).run(root, ec);
+  if (ec) {
+    return {};
+  }
+  std::sort(ret.begin(), ret.end());
+  return ret;
+}
+
+inline std::vector<path> find(const filesystem &fs, const path &root,
+                              const glob_pattern &pattern) {
+  error_code ec;
+  auto ret = find(fs, root, pattern, ec);
+  if (ec) {
+    throw filesystem_error("find", root, ec);
+  }
+  return ret;
+}
+
+/**
+ * @brief Expands a pattern relative to the current directory, or absolute.
+ *
+ * @details The leading components without wildcards become the directory in
+ * which @c find starts. Nothing matches if that directory does not exist.
+ *
+ * @throw std::invalid_argument if the pattern is malformed.
+ */
+inline std::vector<path> glob(const filesystem &fs, std::string_view pattern,
+                              error_code &ec) {
+  ec.clear();
+  if (pattern.empty()) {
+    return {};
+  }
+  path root = path(std::string(pattern)).root_path();
+  auto rest = pattern.substr(root.string().size());
+  // Move leading literal components into the root.
+  for (;;) {
+    auto end = rest.find('/');
+    auto part = rest.substr(0, end);
+    if (end == std::string_view::npos ||
+        part.find_first_of("*?[\\") != std::string_view::npos) {
+      break;
+    }
+    root /= std::string(part);
+    rest.remove_prefix(end + 1);
+  }
+  if (rest.empty() || rest.find_first_not_of('/') == std::string_view::npos) {
+    // A directory pattern such as "a/b/" matches the directory itself.
+    auto exists = fs.exists(root.empty() ? "." : root, ec);
+    return exists && !ec ? std::vector<path>{root} : std::vector<path>{};
+  }
+  glob_pattern compiled(rest);
+  auto ret = find(fs, root.empty() ? "." : root, compiled, ec);
+  if (ec == std::errc::no_such_file_or_directory ||
+      ec == std::errc::not_a_directory) {
+    ec.clear();
+  }
+  if (root.empty()) {
+    // Drop the "./" that find adds.
+    for (auto &p : ret) {
+      p = p.lexically_relative(".");
+    }
+  }
+  return ret;
+}
+
+inline std::vector<path> glob(const filesystem &fs, std::string_view pattern) {
+  error_code ec;
+  auto ret = glob(fs, pattern, ec);
+  if (ec) {
+    throw filesystem_error("glob", path(std::string(pattern)), ec);
+  }
+  return ret;
+}
+
+} // namespace pfs
+
+#endif
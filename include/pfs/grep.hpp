@@ -0,0 +1,476 @@
+#ifndef INCLUDED_PFS_GREP_HPP
+#define INCLUDED_PFS_GREP_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <pfs/filesystem.hpp>
+#include <pfs/thread_pool.hpp>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace pfs {
+
+namespace detail {
+
+/**
+ * @brief First and last bytes of a needle, each in up to two spellings.
+ */
+struct needle_ends {
+  char first[2];
+  char last[2];
+  std::size_t length;
+
+  bool at(const char *s) const noexcept {
+    return (*s == first[0] || *s == first[1]) &&
+           (s[length - 1] == last[0] || s[length - 1] == last[1]);
+  }
+};
+
+inline unsigned lowest_bit(std::uint32_t mask) noexcept {
+#if defined(_MSC_VER)
+  unsigned long i;
+  _BitScanForward(&i, mask);
+  return static_cast<unsigned>(i);
+#else
+  return static_cast<unsigned>(__builtin_ctz(mask));
+#endif
+}
+
+/**
+ * @brief Calls @c f with every position from @c from where a needle may
+ * start, in order.
+ *
+ * @details A position is a candidate when its byte matches the first byte of
+ * the needle and the byte @c length-1 further on matches the last one. Both
+ * are tested for a whole block of positions at once with SIMD compares,
+ * which rules out almost every position of typical text without looking at
+ * the bytes in between. @c f verifies the candidate, and returns the
+ * position to resume from, which must be greater than the candidate, or
+ * @c npos to stop.
+ */
+template <typename Callback>
+void for_each_candidate(std::string_view text, const needle_ends &needle,
+                        std::size_t from, Callback f) {
+  constexpr auto npos = std::string_view::npos;
+  const auto m = needle.length;
+  if (m == 0 || m > text.size()) {
+    return;
+  }
+  const char *s = text.data();
+  const std::size_t end = text.size() - m + 1; // One past the last start.
+  std::size_t i = from;
+#if defined(__AVX2__)
+  const auto f0 = _mm256_set1_epi8(needle.first[0]);
+  const auto f1 = _mm256_set1_epi8(needle.first[1]);
+  const auto l0 = _mm256_set1_epi8(needle.last[0]);
+  const auto l1 = _mm256_set1_epi8(needle.last[1]);
+  while (i + 32 <= end) {
+    auto a = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(s + i));
+    auto b = _mm256_loadu_si256(
+        reinterpret_cast<const __m256i *>(s + i + m - 1));
+    auto eq = _mm256_and_si256(
+        _mm256_or_si256(_mm256_cmpeq_epi8(a, f0), _mm256_cmpeq_epi8(a, f1)),
+        _mm256_or_si256(_mm256_cmpeq_epi8(b, l0), _mm256_cmpeq_epi8(b, l1)));
+    auto mask = static_cast<std::uint32_t>(_mm256_movemask_epi8(eq));
+    std::size_t next = i + 32;
+    while (mask) {
+      auto resume = f(i + lowest_bit(mask));
+      if (resume == npos) {
+        return;
+      } else if (resume >= i + 32) {
+        next = resume;
+        break;
+      }
+      mask &= ~std::uint32_t{0} << (resume - i);
+    }
+    i = next;
+  }
+#elif defined(__SSE2__)
+  const auto f0 = _mm_set1_epi8(needle.first[0]);
+  const auto f1 = _mm_set1_epi8(needle.first[1]);
+  const auto l0 = _mm_set1_epi8(needle.last[0]);
+  const auto l1 = _mm_set1_epi8(needle.last[1]);
+  while (i + 16 <= end) {
+    auto a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(s + i));
+    auto b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(s + i + m - 1));
+    auto eq = _mm_and_si128(
+        _mm_or_si128(_mm_cmpeq_epi8(a, f0), _mm_cmpeq_epi8(a, f1)),
+        _mm_or_si128(_mm_cmpeq_epi8(b, l0), _mm_cmpeq_epi8(b, l1)));
+    auto mask = static_cast<std::uint32_t>(_mm_movemask_epi8(eq));
+    std::size_t next = i + 16;
+    while (mask) {
+      auto resume = f(i + lowest_bit(mask));
+      if (resume == npos) {
+        return;
+      } else if (resume >= i + 16) {
+        next = resume;
+        break;
+      }
+      mask &= ~std::uint32_t{0} << (resume - i);
+    }
+    i = next;
+  }
+#endif
+  while (i < end) {
+    if (needle.first[0] == needle.first[1]) {
+      // Let the C library skip to the next first byte.
+      auto p = static_cast<const char *>(
+          std::memchr(s + i, needle.first[0], end - i));
+      if (!p) {
+        return;
+      }
+      i = static_cast<std::size_t>(p - s);
+    }
+    if (needle.at(s + i)) {
+      i = f(i);
+      if (i == npos) {
+        return;
+      }
+    } else {
+      ++i;
+    }
+  }
+}
+
+} // namespace detail
+
+/**
+ * @brief A compiled pattern for searching file contents line by line.
+ *
+ * @details Characters match themselves, except that @c . matches any
+ * character but a line break, a leading @c ^ anchors the match to the start
+ * of a line, a trailing @c $ anchors it to the end of a line, and @c \
+ * escapes the next character. Matching ignores the case of ASCII letters if
+ * requested.
+ *
+ * The longest run of literal characters in the pattern is searched for with
+ * SIMD compares (see @c detail::for_each_candidate), and the rest of the
+ * pattern is only checked around its occurrences. Patterns without literal
+ * characters are checked at every position.
+ */
+class grep_pattern {
+private:
+  std::string chars_;    ///< Characters to match, folded if ignoring case.
+  std::string wildcard_; ///< Nonzero where the pattern has a @c . instead.
+  bool line_start_{false};
+  bool line_end_{false};
+  bool ignore_case_{false};
+  std::size_t needle_pos_{0}; ///< Start of the longest literal run.
+  detail::needle_ends needle_{};
+
+  static char fold(char c) noexcept {
+    return c >= 'A' && c <= 'Z' ? static_cast<char>(c - 'A' + 'a') : c;
+  }
+
+  static char unfold(char c) noexcept {
+    return c >= 'a' && c <= 'z' ? static_cast<char>(c - 'a' + 'A') : c;
+  }
+
+  /**
+   * @brief Checks the pattern against @c text at @c start, which leaves room
+   * for the whole pattern.
+   */
+  bool matches_at(std::string_view text, std::size_t start) const noexcept {
+    if (line_start_ && start > 0 && text[start - 1] != '\n') {
+      return false;
+    }
+    auto end = start + chars_.size();
+    if (line_end_ && end < text.size() && text[end] != '\n') {
+      return false;
+    }
+    for (std::size_t k = 0; k < chars_.size(); ++k) {
+      char c = text[start + k];
+      if (wildcard_[k] ? c == '\n'
+                       : (ignore_case_ ? fold(c) : c) != chars_[k]) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+public:
+  /**
+   * @brief Compiles a pattern.
+   *
+   * @throw std::invalid_argument if the pattern is empty or contains a line
+   * break.
+   */
+  explicit grep_pattern(std::string_view pattern, bool ignore_case = false)
+      : ignore_case_(ignore_case) {
+    if (pattern.empty()) {
+      throw std::invalid_argument("grep_pattern: empty pattern");
+    } else if (pattern.find('\n') != std::string_view::npos) {
+      throw std::invalid_argument("grep_pattern: line break in pattern");
+    }
+    if (pattern.front() == '^') {
+      line_start_ = true;
+      pattern.remove_prefix(1);
+    }
+    std::size_t run_start = 0, run_length = 0;
+    for (std::size_t i = 0; i < pattern.size(); ++i) {
+      char c = pattern[i];
+      if (c == '$' && i + 1 == pattern.size()) {
+        line_end_ = true;
+        break;
+      }
+      bool wildcard = c == '.';
+      if (c == '\\' && i + 1 < pattern.size()) {
+        c = pattern[++i];
+      }
+      chars_ += ignore_case ? fold(c) : c;
+      wildcard_ += static_cast<char>(wildcard);
+      if (wildcard) {
+        run_start = chars_.size();
+      } else if (chars_.size() - run_start > run_length) {
+        needle_pos_ = run_start;
+        run_length = chars_.size() - run_start;
+      }
+    }
+    if (run_length > 0) {
+      char first = chars_[needle_pos_];
+      char last = chars_[needle_pos_ + run_length - 1];
+      needle_.first[0] = first;
+      needle_.first[1] = ignore_case ? unfold(first) : first;
+      needle_.last[0] = last;
+      needle_.last[1] = ignore_case ? unfold(last) : last;
+      needle_.length = run_length;
+    }
+  }
+
+  /**
+   * @brief Calls @c f with the bounds of every line of @c text that contains
+   * a match, in order.
+   *
+   * @param text Text whose lines are separated by @c '\n'.
+   * @param f Called as <tt>f(start, end)</tt>, where @c start is the offset
+   * of the line and @c end the offset of its line break, or the size of
+   * @c text for the last line.
+   */
+  template <typename Callback>
+  void for_each_line(std::string_view text, Callback f) const {
+    constexpr auto npos = std::string_view::npos;
+    auto line_end_after = [&](std::size_t pos) {
+      auto end = text.find('\n', pos);
+      return end == npos ? text.size() : end;
+    };
+    if (text.empty()) {
+      return;
+    } else if (needle_.length == 0) {
+      for (std::size_t start = 0; start <= text.size();) {
+        auto end = line_end_after(start);
+        for (auto i = start; i + chars_.size() <= end; ++i) {
+          if (matches_at(text, i)) {
+            f(start, end);
+            break;
+          }
+        }
+        start = end + 1;
+        if (start == text.size()) {
+          // A final line break does not start another line.
+          break;
+        }
+      }
+      return;
+    }
+    detail::for_each_candidate(
+        text, needle_, needle_pos_, [&](std::size_t i) -> std::size_t {
+          auto start = i - needle_pos_;
+          if (start + chars_.size() > text.size()) {
+            // So would every later candidate.
+            return npos;
+          } else if (!matches_at(text, start)) {
+            return i + 1;
+          }
+          auto line = text.rfind('\n', start);
+          auto end = line_end_after(start + chars_.size());
+          f(line == npos ? 0 : line + 1, end);
+          return end >= text.size() ? npos : end + 1 + needle_pos_;
+        });
+  }
+
+  /**
+   * @brief Checks whether a line contains a match.
+   */
+  bool match(std::string_view line) const {
+    bool ret = false;
+    for_each_line(line, [&](std::size_t, std::size_t) { ret = true; });
+    return ret;
+  }
+};
+
+/**
+ * @brief Options of @c grep.
+ */
+struct grep_options {
+  /// Number of threads searching files. 0 means one per CPU if the
+  /// filesystem is known to allow concurrent reads, and one otherwise. Other
+  /// values require it to.
+  unsigned threads = 0;
+};
+
+/**
+ * @brief A line that matches a pattern.
+ */
+struct grep_match {
+  path file;           ///< The file, as found below the root.
+  std::uintmax_t line; ///< Line number, from 1.
+  std::string text;    ///< The line, without its line break.
+};
+
+namespace detail {
+
+/**
+ * @brief Searches the files below a root, one file per task.
+ */
+class content_searcher {
+private:
+  filesystem &fs_;
+  const path &root_;
+  const grep_pattern &pattern_;
+  const grep_options &options_;
+
+  std::vector<path> files_;
+  std::vector<std::vector<grep_match>> matches_; ///< Per file.
+  std::atomic<std::size_t> next_{0};             ///< Next file to search.
+  std::atomic<bool> failed_{false};
+  std::mutex mutex_;
+  error_code ec_; ///< First error, which stops the search.
+
+  void list_files(error_code &ec) {
+    auto type = fs_.status(root_, ec).type();
+    if (!ec && type == file_type::not_found) {
+      ec = std::make_error_code(std::errc::no_such_file_or_directory);
+    }
+    if (ec) {
+      return;
+    } else if (type == file_type::regular) {
+      files_.push_back(root_);
+      return;
+    }
+    auto it = fs_.recursive_directory_iterator(root_, ec);
+    while (!ec && !it->at_end()) {
+      if (it->status(ec).type() == file_type::regular) {
+        files_.push_back(it->path());
+      }
+      // Skip entries without a status to read, such as dangling symlinks.
+      ec.clear();
+      it->increment(ec);
+    }
+    std::sort(files_.begin(), files_.end());
+  }
+
+  void search(std::size_t i, error_code &ec) {
+    auto view = fs_.view_file(files_[i], ec);
+    if (ec == std::errc::no_such_file_or_directory) {
+      // Removed since the listing.
+      ec.clear();
+      return;
+    } else if (ec) {
+      return;
+    }
+    auto text = view.data();
+    std::uintmax_t line = 1;
+    std::size_t counted = 0; // Line breaks are counted up to here.
+    pattern_.for_each_line(text, [&](std::size_t start, std::size_t end) {
+      line += static_cast<std::uintmax_t>(
+          std::count(text.begin() + counted, text.begin() + start, '\n'));
+      counted = start;
+      matches_[i].push_back(
+          {files_[i], line, std::string(text.substr(start, end - start))});
+    });
+  }
+
+  void worker() {
+    for (auto i = next_++; i < files_.size() && !failed_; i = next_++) {
+      error_code ec;
+      search(i, ec);
+      if (ec) {
+        std::lock_guard lock(mutex_);
+        if (!ec_) {
+          ec_ = ec;
+        }
+        failed_ = true;
+      }
+    }
+  }
+
+public:
+  content_searcher(filesystem &fs, const path &root,
+                   const grep_pattern &pattern, const grep_options &options)
+      : fs_(fs), root_(root), pattern_(pattern), options_(options) {}
+
+  std::vector<grep_match> run(error_code &ec) {
+    list_files(ec);
+    if (ec) {
+      return {};
+    }
+    matches_.resize(files_.size());
+    auto threads = pool_size(options_.threads, fs_.allows_concurrent_reads(),
+                             files_.size());
+    run_pool(threads, [this] { worker(); });
+    ec = ec_;
+    if (ec) {
+      return {};
+    }
+    std::vector<grep_match> ret;
+    for (auto &m : matches_) {
+      ret.insert(ret.end(), std::make_move_iterator(m.begin()),
+                 std::make_move_iterator(m.end()));
+    }
+    return ret;
+  }
+};
+
+} // namespace detail
+
+/**
+ * @brief Finds the lines that match a pattern in the regular files at or
+ * below @c root.
+ *
+ * @details The tree is listed first, then the files are searched by a pool
+ * of threads. Each file is searched in place through
+ * @c filesystem::view_file: mapped from disk for @c std_filesystem, and in
+ * the node itself for @c fake_filesystem. Symlinks to directories are not
+ * followed.
+ *
+ * @param fs Filesystem to search.
+ * @param root A directory to search recursively, or a regular file.
+ * @param pattern Pattern to search for.
+ * @param options How to search.
+ * @param ec Set if @c root does not exist, or a file cannot be read.
+ * @return The matching lines, by file path, then by line number.
+ */
+inline std::vector<grep_match> grep(filesystem &fs, const path &root,
+                                    const grep_pattern &pattern,
+                                    const grep_options &options,
+                                    error_code &ec) {
+  return detail::content_searcher(fs, root, pattern, options).run(ec);
+}
+
+inline std::vector<grep_match> grep(filesystem &fs, const path &root,
+                                    const grep_pattern &pattern,
+                                    const grep_options &options = {}) {
+  error_code ec;
+  auto ret = grep(fs, root, pattern, options, ec);
+  if (ec) {
+    throw filesystem_error("grep", root, ec);
+  }
+  return ret;
+}
+
+} // namespace pfs
+
+#endif
@@ -0,0 +1,565 @@
+#ifndef INCLUDED_PFS_HASH_HPP
+#define INCLUDED_PFS_HASH_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <pfs/filesystem.hpp>
+#include <pfs/std_filesystem.hpp>
+#include <pfs/thread_pool.hpp>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace pfs {
+
+namespace detail {
+
+/**
+ * @brief XXH64, a fast non-cryptographic hash of a byte string.
+ *
+ * @details Reads 32 bytes per round in four independent lanes, so it runs at
+ * several bytes per cycle. Words are read in host byte order, so hashes
+ * match the reference implementation on little-endian hosts.
+ */
+inline std::uint64_t xxh64(std::string_view data,
+                           std::uint64_t seed = 0) noexcept {
+  constexpr std::uint64_t p1 = 11400714785074694791ULL;
+  constexpr std::uint64_t p2 = 14029467366897019727ULL;
+  constexpr std::uint64_t p3 = 1609587929392839161ULL;
+  constexpr std::uint64_t p4 = 9650029242287828579ULL;
+  constexpr std::uint64_t p5 = 2870177450012600261ULL;
+  auto rotl = [](std::uint64_t x, int r) { return (x << r) | (x >> (64 - r)); };
+  auto read64 = [](const char *s) {
+    std::uint64_t v;
+    std::memcpy(&v, s, sizeof(v));
+    return v;
+  };
+  auto round = [&](std::uint64_t acc, std::uint64_t input) {
+    return rotl(acc + input * p2, 31) * p1;
+  };
+  auto merge = [&](std::uint64_t acc, std::uint64_t v) {
+    return (acc ^ round(0, v)) * p1 + p4;
+  };
+
+  const char *s = data.data();
+  const char *end = s + data.size();
+  std::uint64_t h;
+  if (data.size() >= 32) {
+    std::uint64_t v1 = seed + p1 + p2, v2 = seed + p2, v3 = seed,
+                  v4 = seed - p1;
+    for (; end - s >= 32; s += 32) {
+      v1 = round(v1, read64(s));
+      v2 = round(v2, read64(s + 8));
+      v3 = round(v3, read64(s + 16));
+      v4 = round(v4, read64(s + 24));
+    }
+    h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+    h = merge(merge(merge(merge(h, v1), v2), v3), v4);
+  } else {
+    h = seed + p5;
+  }
+  h += data.size();
+  for (; end - s >= 8; s += 8) {
+    h = rotl(h ^ round(0, read64(s)), 27) * p1 + p4;
+  }
+  if (end - s >= 4) {
+    std::uint32_t v;
+    std::memcpy(&v, s, sizeof(v));
+    h = rotl(h ^ (v * p1), 23) * p2 + p3;
+    s += 4;
+  }
+  for (; s < end; ++s) {
+    h = rotl(h ^ (static_cast<unsigned char>(*s) * p5), 11) * p1;
+  }
+  h ^= h >> 33;
+  h *= p2;
+  h ^= h >> 29;
+  h *= p3;
+  h ^= h >> 32;
+  return h;
+}
+
+/**
+ * @brief Hashes the chunk hashes of a file, in order.
+ */
+inline std::uint64_t combine_chunks(const std::vector<std::uint64_t> &hashes) {
+  return xxh64({reinterpret_cast<const char *>(hashes.data()),
+                hashes.size() * sizeof(std::uint64_t)});
+}
+
+/**
+ * @brief Hashes the contents of a file: directly if they fit in one chunk,
+ * otherwise by hashing the hashes of its chunks.
+ */
+inline std::uint64_t chunked_hash(std::string_view data,
+                                  std::size_t chunk_size) {
+  if (data.size() <= chunk_size) {
+    return xxh64(data);
+  }
+  std::vector<std::uint64_t> hashes;
+  for (std::size_t i = 0; i < data.size(); i += chunk_size) {
+    hashes.push_back(xxh64(data.substr(i, chunk_size)));
+  }
+  return combine_chunks(hashes);
+}
+
+/**
+ * @brief A regular file found below a root, and its size.
+ */
+struct sized_file {
+  path file;
+  std::uintmax_t size;
+};
+
+/**
+ * @brief Lists the regular files at or below @c root, sorted by path.
+ */
+inline std::vector<sized_file> list_sized_files(filesystem &fs,
+                                                const path &root,
+                                                error_code &ec) {
+  std::vector<sized_file> ret;
+  auto type = fs.status(root, ec).type();
+  if (!ec && type == file_type::not_found) {
+    ec = std::make_error_code(std::errc::no_such_file_or_directory);
+  }
+  if (ec) {
+    return {};
+  } else if (type == file_type::regular) {
+    auto size = fs.file_size(root, ec);
+    ret.push_back({root, size});
+    return ec ? std::vector<sized_file>{} : ret;
+  }
+  auto it = fs.recursive_directory_iterator(root, ec);
+  while (!ec && !it->at_end()) {
+    if (it->status(ec).type() == file_type::regular) {
+      auto size = fs.file_size(it->path(), ec);
+      if (!ec) {
+        ret.push_back({it->path(), size});
+      }
+    }
+    // Skip entries removed during the walk, and dangling symlinks.
+    ec.clear();
+    it->increment(ec);
+  }
+  if (ec) {
+    return {};
+  }
+  std::sort(ret.begin(), ret.end(),
+            [](const sized_file &x, const sized_file &y) {
+              return x.file < y.file;
+            });
+  return ret;
+}
+
+} // namespace detail
+
+/**
+ * @brief Options of @c content_hasher.
+ */
+struct hash_options {
+  /// Number of threads reading files. 0 means one per CPU if the filesystem
+  /// is known to allow concurrent reads, and one otherwise. Other values
+  /// require it to.
+  unsigned threads = 0;
+
+  /// Files larger than this are split into chunks of this size, hashed in
+  /// parallel. Hashes of large files depend on it.
+  std::size_t chunk_size = 4 << 20;
+
+  /// Remember the hashes of files of @c std_filesystem by inode, size and
+  /// modification time, and reuse them while those are unchanged.
+  bool cache = true;
+};
+
+/**
+ * @brief The content hash of a regular file.
+ */
+struct hashed_file {
+  path file;           ///< Path of the file.
+  std::uintmax_t size; ///< Size of the file when it was hashed.
+  std::uint64_t hash;  ///< Hash of its contents.
+};
+
+/**
+ * @brief Computes content hashes of files in parallel, with a cache for
+ * files on disk.
+ *
+ * @details Contents are hashed with XXH64 through @c filesystem::view_file,
+ * so files are read in place: mapped from disk, or straight from the nodes
+ * of a @c fake_filesystem. Work is split into chunks of
+ * @c hash_options::chunk_size, so that a few large files keep every thread
+ * busy; a file larger than one chunk hashes to the XXH64 of its chunk
+ * hashes.
+ *
+ * On POSIX systems, files of a @c std_filesystem are cached by device and
+ * inode, and their hash is reused while their size and modification time
+ * stay the same, without reading them. Files modified in the last two
+ * seconds are not cached, since a write in the same clock tick as the hash
+ * would not change their modification time. Hashes are equal for equal
+ * contents, and differ for different contents with a probability of about
+ * 1 - 2^-64; they are not meant to be stored.
+ *
+ * One hasher may be shared by several threads.
+ */
+class content_hasher {
+public:
+  /**
+   * @brief Counts of the work done by a hasher since it was created.
+   */
+  struct statistics {
+    std::uint64_t files_hashed{0}; ///< Files read and hashed.
+    std::uint64_t bytes_hashed{0}; ///< Bytes read and hashed.
+    std::uint64_t cache_hits{0};   ///< Files whose cached hash was reused.
+  };
+
+private:
+  struct cache_key {
+    std::uint64_t device;
+    std::uint64_t inode;
+
+    bool operator==(const cache_key &other) const noexcept {
+      return device == other.device && inode == other.inode;
+    }
+  };
+
+  struct cache_key_hash {
+    std::size_t operator()(const cache_key &k) const noexcept {
+      return static_cast<std::size_t>(k.inode * 0x9e3779b97f4a7c15ULL ^
+                                      k.device);
+    }
+  };
+
+  struct cache_entry {
+    std::uintmax_t size;
+    std::int64_t mtime; ///< Nanoseconds since the epoch.
+    std::uint64_t hash;
+  };
+
+  /**
+   * @brief Progress of one file through a call to @c hash_files.
+   */
+  struct file_state {
+    std::uintmax_t size{0};
+    std::uint64_t hash{0};
+    bool done{false};      ///< Hash known before reading, from the cache.
+    bool cacheable{false}; ///< Store the hash under @c key when done.
+    cache_key key{};
+    std::int64_t mtime{0};
+    std::once_flag view_once;
+    file_view view;
+    error_code view_ec;
+    std::vector<std::uint64_t> chunks;
+    std::atomic<std::size_t> pending{0}; ///< Chunks not hashed yet.
+  };
+
+  hash_options options_;
+  mutable std::mutex mutex_;
+  std::unordered_map<cache_key, cache_entry, cache_key_hash> cache_;
+  statistics stats_;
+
+  /**
+   * @brief Gets the size of a file and, for files on disk, its cache key.
+   */
+  void identify(filesystem &fs, const path &p, file_state &state,
+                error_code &ec) {
+#if defined(__unix__) || defined(__APPLE__)
+    if (options_.cache && dynamic_cast<std_filesystem *>(&fs)) {
+      struct ::stat st;
+      if (::stat(p.c_str(), &st) != 0) {
+        ec.assign(errno, std::generic_category());
+        return;
+      } else if (S_ISDIR(st.st_mode)) {
+        ec = std::make_error_code(std::errc::is_a_directory);
+        return;
+      } else if (!S_ISREG(st.st_mode)) {
+        ec = std::make_error_code(std::errc::not_supported);
+        return;
+      }
+      ec.clear();
+      state.size = static_cast<std::uintmax_t>(st.st_size);
+      state.key = {static_cast<std::uint64_t>(st.st_dev),
+                   static_cast<std::uint64_t>(st.st_ino)};
+#if defined(__APPLE__)
+      const auto &mtime = st.st_mtimespec;
+#else
+      const auto &mtime = st.st_mtim;
+#endif
+      state.mtime = static_cast<std::int64_t>(mtime.tv_sec) * 1000000000 +
+                    mtime.tv_nsec;
+      auto now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                     std::chrono::system_clock::now().time_since_epoch())
+                     .count();
+      state.cacheable = state.mtime < now - 2000000000;
+      return;
+    }
+#endif
+    state.size = fs.file_size(p, ec);
+  }
+
+  /**
+   * @brief Hashes one chunk of a file, and the file if it was the last.
+   */
+  void hash_chunk(filesystem &fs, const path &p, file_state &state,
+                  std::size_t chunk) {
+    std::call_once(state.view_once,
+                   [&] { state.view = fs.view_file(p, state.view_ec); });
+    if (state.view_ec) {
+      return;
+    }
+    auto data = state.view.data();
+    auto offset = chunk * options_.chunk_size;
+    if (offset < data.size()) {
+      state.chunks[chunk] = detail::xxh64(
+          data.substr(offset, options_.chunk_size));
+    }
+    if (--state.pending > 0) {
+      return;
+    }
+    if (data.size() != state.size) {
+      // Resized since it was listed, so the chunks do not cover it.
+      state.size = data.size();
+      state.cacheable = false;
+      state.hash = detail::chunked_hash(data, options_.chunk_size);
+    } else if (state.chunks.size() == 1) {
+      state.hash = detail::xxh64(data);
+    } else {
+      state.hash = detail::combine_chunks(state.chunks);
+    }
+    state.view = {};
+  }
+
+public:
+  explicit content_hasher(const hash_options &options = {})
+      : options_(options) {
+    if (options_.chunk_size == 0) {
+      options_.chunk_size = hash_options{}.chunk_size;
+    }
+  }
+
+  /**
+   * @brief Hashes regular files.
+   *
+   * @param fs Filesystem of the files.
+   * @param files Paths of the files.
+   * @param ec Set if a file does not exist, is not a regular file, or
+   * cannot be read.
+   * @return The hashes, in the order of @c files.
+   */
+  std::vector<hashed_file> hash_files(filesystem &fs,
+                                      const std::vector<path> &files,
+                                      error_code &ec) {
+    std::vector<file_state> states(files.size());
+    std::vector<std::pair<std::size_t, std::size_t>> tasks; // File, chunk.
+    for (std::size_t i = 0; i < files.size(); ++i) {
+      auto &state = states[i];
+      identify(fs, files[i], state, ec);
+      if (ec) {
+        return {};
+      }
+      if (state.cacheable) {
+        std::lock_guard lock(mutex_);
+        auto it = cache_.find(state.key);
+        if (it != cache_.end() && it->second.size == state.size &&
+            it->second.mtime == state.mtime) {
+          state.hash = it->second.hash;
+          state.done = true;
+          ++stats_.cache_hits;
+          continue;
+        }
+      }
+      auto chunks = static_cast<std::size_t>(
+          std::max<std::uintmax_t>(1, (state.size + options_.chunk_size - 1) /
+                                          options_.chunk_size));
+      state.chunks.resize(chunks);
+      state.pending = chunks;
+      for (std::size_t c = 0; c < chunks; ++c) {
+        tasks.emplace_back(i, c);
+      }
+    }
+
+    std::atomic<std::size_t> next{0};
+    std::atomic<bool> failed{false};
+    auto worker = [&] {
+      for (auto t = next++; t < tasks.size() && !failed; t = next++) {
+        auto [i, chunk] = tasks[t];
+        hash_chunk(fs, files[i], states[i], chunk);
+        if (states[i].view_ec) {
+          failed = true;
+        }
+      }
+    };
+    detail::run_pool(detail::pool_size(options_.threads,
+                                       fs.allows_concurrent_reads(),
+                                       tasks.size()),
+                     worker);
+
+    std::vector<hashed_file> ret;
+    ret.reserve(files.size());
+    std::lock_guard lock(mutex_);
+    for (std::size_t i = 0; i < files.size(); ++i) {
+      auto &state = states[i];
+      if (state.view_ec) {
+        ec = state.view_ec;
+        return {};
+      }
+      if (!state.done) {
+        ++stats_.files_hashed;
+        stats_.bytes_hashed += state.size;
+        if (state.cacheable) {
+          cache_[state.key] = {state.size, state.mtime, state.hash};
+        }
+      }
+      ret.push_back({files[i], state.size, state.hash});
+    }
+    ec.clear();
+    return ret;
+  }
+
+  std::vector<hashed_file> hash_files(filesystem &fs,
+                                      const std::vector<path> &files) {
+    error_code ec;
+    auto ret = hash_files(fs, files, ec);
+    if (ec) {
+      throw filesystem_error("hash_files", ec);
+    }
+    return ret;
+  }
+
+  /**
+   * @brief Hashes the regular files at or below @c root.
+   *
+   * @param ec Set if @c root does not exist, or a file cannot be read.
+   * @return The hashes, sorted by path.
+   */
+  std::vector<hashed_file> hash_tree(filesystem &fs, const path &root,
+                                     error_code &ec) {
+    auto listed = detail::list_sized_files(fs, root, ec);
+    if (ec) {
+      return {};
+    }
+    std::vector<path> files;
+    files.reserve(listed.size());
+    for (auto &f : listed) {
+      files.push_back(std::move(f.file));
+    }
+    return hash_files(fs, files, ec);
+  }
+
+  std::vector<hashed_file> hash_tree(filesystem &fs, const path &root) {
+    error_code ec;
+    auto ret = hash_tree(fs, root, ec);
+    if (ec) {
+      throw filesystem_error("hash_tree", root, ec);
+    }
+    return ret;
+  }
+
+  /**
+   * @brief Gets the counts of the work done so far.
+   */
+  statistics stats() const {
+    std::lock_guard lock(mutex_);
+    return stats_;
+  }
+
+  /**
+   * @brief Gets the number of files in the cache.
+   */
+  std::size_t cache_size() const {
+    std::lock_guard lock(mutex_);
+    return cache_.size();
+  }
+
+  /**
+   * @brief Forgets every cached hash.
+   */
+  void clear_cache() {
+    std::lock_guard lock(mutex_);
+    cache_.clear();
+  }
+};
+
+/**
+ * @brief Finds the regular files at or below @c root with identical
+ * contents.
+ *
+ * @details Files are grouped by size first, which costs no reads, and only
+ * files that share their size with another are hashed. Those are then
+ * grouped by hash. Empty files form a group of their own.
+ *
+ * @param fs Filesystem to search.
+ * @param root A directory to search recursively.
+ * @param hasher Hasher of the contents, whose cache is reused across calls.
+ * @param ec Set if @c root does not exist, or a file cannot be read.
+ * @return Groups of at least two files with the same contents. Each group is
+ * sorted, and the groups are sorted by their first path.
+ */
+inline std::vector<std::vector<path>>
+find_duplicates(filesystem &fs, const path &root, content_hasher &hasher,
+                error_code &ec) {
+  auto files = detail::list_sized_files(fs, root, ec);
+  if (ec) {
+    return {};
+  }
+  std::stable_sort(files.begin(), files.end(),
+                   [](const detail::sized_file &x,
+                      const detail::sized_file &y) { return x.size < y.size; });
+  std::vector<path> candidates;
+  for (std::size_t i = 0, j = 0; i < files.size(); i = j) {
+    j = i + 1;
+    while (j < files.size() && files[j].size == files[i].size) {
+      ++j;
+    }
+    if (j - i > 1) {
+      for (auto k = i; k < j; ++k) {
+        candidates.push_back(std::move(files[k].file));
+      }
+    }
+  }
+  auto hashed = hasher.hash_files(fs, candidates, ec);
+  if (ec) {
+    return {};
+  }
+  std::sort(hashed.begin(), hashed.end(),
+            [](const hashed_file &x, const hashed_file &y) {
+              return std::tie(x.size, x.hash, x.file) <
+                     std::tie(y.size, y.hash, y.file);
+            });
+  std::vector<std::vector<path>> ret;
+  for (std::size_t i = 0, j = 0; i < hashed.size(); i = j) {
+    j = i + 1;
+    while (j < hashed.size() && hashed[j].size == hashed[i].size &&
+           hashed[j].hash == hashed[i].hash) {
+      ++j;
+    }
+    if (j - i > 1) {
+      auto &group = ret.emplace_back();
+      for (auto k = i; k < j; ++k) {
+        group.push_back(std::move(hashed[k].file));
+      }
+    }
+  }
+  std::sort(ret.begin(), ret.end());
+  return ret;
+}
+
+inline std::vector<std::vector<path>>
+find_duplicates(filesystem &fs, const path &root, content_hasher &hasher) {
+  error_code ec;
+  auto ret = find_duplicates(fs, root, hasher, ec);
+  if (ec) {
+    throw filesystem_error("find_duplicates", root, ec);
+  }
+  return ret;
+}
+
+} // namespace pfs
+
+#endif
@@ -0,0 +1,74 @@
+#ifndef INCLUDED_PFS_OPEN_HANDLE_HPP
+#define INCLUDED_PFS_OPEN_HANDLE_HPP
+
+#include <cstdint>
+#include <pfs/filesystem.hpp>
+
+namespace pfs {
+
+/**
+ * @brief Allocates storage for a range of a regular file without changing
+ * its size. See @c file_handle::preallocate.
+ */
+inline void preallocate(filesystem &fs, const path &p, std::uint64_t offset,
+                        std::uint64_t length, error_code &ec) {
+  if (auto h =
+          fs.open_handle(p, std::ios_base::in | std::ios_base::out, ec)) {
+    h->preallocate(offset, length, ec);
+  }
+}
+
+inline void preallocate(filesystem &fs, const path &p, std::uint64_t offset,
+                        std::uint64_t length) {
+  error_code ec;
+  preallocate(fs, p, offset, length, ec);
+  if (ec) {
+    throw filesystem_error("preallocate", p, ec);
+  }
+}
+
+/**
+ * @brief Frees the storage of a range of a regular file without changing
+ * its size. See @c file_handle::punch_hole.
+ */
+inline void punch_hole(filesystem &fs, const path &p, std::uint64_t offset,
+                       std::uint64_t length, error_code &ec) {
+  if (auto h =
+          fs.open_handle(p, std::ios_base::in | std::ios_base::out, ec)) {
+    h->punch_hole(offset, length, ec);
+  }
+}
+
+inline void punch_hole(filesystem &fs, const path &p, std::uint64_t offset,
+                       std::uint64_t length) {
+  error_code ec;
+  punch_hole(fs, p, offset, length, ec);
+  if (ec) {
+    throw filesystem_error("punch_hole", p, ec);
+  }
+}
+
+/**
+ * @brief Reports the storage allocated to a regular file. See
+ * @c file_handle::allocation.
+ */
+inline allocation_info allocation(filesystem &fs, const path &p,
+                                  error_code &ec) {
+  if (auto h = fs.open_handle(p, std::ios_base::in, ec)) {
+    return h->allocation(ec);
+  }
+  return {};
+}
+
+inline allocation_info allocation(filesystem &fs, const path &p) {
+  error_code ec;
+  auto ret = allocation(fs, p, ec);
+  if (ec) {
+    throw filesystem_error("allocation", p, ec);
+  }
+  return ret;
+}
+
+} // namespace pfs
+
+#endif
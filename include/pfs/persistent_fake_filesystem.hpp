@@ -0,0 +1,1089 @@
+#ifndef INCLUDED_PFS_PERSISTENT_FAKE_FILESYSTEM_HPP
+#define INCLUDED_PFS_PERSISTENT_FAKE_FILESYSTEM_HPP
+
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <pfs/fake_filesystem.hpp>
+#include <pfs/filesystem.hpp>
+#include <pfs/hash.hpp>
+#include <pfs/snapshot_iterator.hpp>
+#include <pfs/tar.hpp>
+#include <shared_mutex>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace pfs {
+
+/**
+ * @brief Options of a @c persistent_fake_filesystem.
+ */
+struct persistence_options {
+  /**
+   * @brief Whether each commit syncs the log to stable storage. If false,
+   * committed modifications survive a crash of the process, but not of the
+   * machine.
+   */
+  bool sync = true;
+
+  /**
+   * @brief Size of the log, in bytes, beyond which the next modification
+   * writes a checkpoint. 0 leaves checkpoints to @c checkpoint.
+   */
+  std::uintmax_t checkpoint_bytes = 64 << 20;
+};
+
+/**
+ * @brief Counters of a @c persistent_fake_filesystem's log.
+ */
+struct persistence_stats {
+  std::uintmax_t records;     ///< Records appended to the log.
+  std::uintmax_t commits;     ///< Groups of records written to the log.
+  std::uintmax_t checkpoints; ///< Checkpoints written.
+  std::uintmax_t replayed;    ///< Records replayed on construction.
+  std::uintmax_t log_bytes;   ///< Size of the current log.
+};
+
+/**
+ * @brief A @c fake_filesystem that survives restarts of the process.
+ *
+ * @details Keeps its tree in memory, in a @c fake_filesystem, and persists it
+ * in a directory of the real filesystem as a checkpoint and a write-ahead
+ * log. Every modification is applied to the tree and appended to the log as
+ * one record: creating directories, removing, renaming, and writing a file.
+ * Writes to a stream are recorded as the new contents of the whole file when
+ * the stream is flushed or destroyed, which is when @c fake_filesystem
+ * publishes them too.
+ *
+ * A modification returns once its record is committed. Modifications from
+ * several threads share commits: while one thread writes and syncs the log,
+ * the records of the others queue up, and the next thread to commit writes
+ * them all with a single sync.
+ *
+ * When the log grows beyond @c persistence_options::checkpoint_bytes, or on
+ * @c checkpoint, the whole tree is written as a tar archive and a new, empty
+ * log is started. On construction, the tree is recovered by reading the last
+ * checkpoint and replaying the log that follows it. A record torn by a crash
+ * ends the log, and is discarded. If the log cannot be written, the
+ * modification stays applied in memory, but it and every later modification
+ * fail with the error.
+ *
+ * Safe to use from several threads. Directory iterators iterate a snapshot
+ * taken when they were created. A stream publishes its writes to the path it
+ * was opened with, and drops them if that path no longer names the same file
+ * because it was removed or renamed. Streams must not outlive the instance
+ * that opened them. Only one instance may use a directory at a time.
+ *
+ * Available on POSIX only.
+ */
+class persistent_fake_filesystem final : public filesystem {
+private:
+  /**
+   * @brief Kinds of log records.
+   */
+  enum class op : unsigned char {
+    create_directory = 1,
+    create_directories,
+    remove,
+    remove_all,
+    rename,
+    write, ///< Replaces the contents of a file, creating it if missing.
+  };
+
+  /**
+   * @brief Bytes before each record's payload: its size and its XXH64 hash.
+   */
+  static constexpr std::size_t record_header = 16;
+
+  fake_filesystem fs_;                   ///< The tree.
+  std::filesystem::path dir_;            ///< Holds the checkpoint and the log.
+  persistence_options options_;          ///< Options given on construction.
+  mutable std::shared_mutex tree_mutex_; ///< Guards @c fs_ and the files.
+  mutable std::mutex log_mutex_;         ///< Guards everything below.
+  std::condition_variable committed_;    ///< Signaled after each commit.
+  int dir_fd_{-1};                       ///< Locked against other instances.
+  int log_fd_{-1};                       ///< Current log, opened for appending.
+  std::uint64_t generation_{0};          ///< Number of the current checkpoint.
+  std::string pending_;                  ///< Records not yet written.
+  std::uint64_t appended_{0};            ///< Last sequence number appended.
+  std::uint64_t durable_{0};             ///< Last sequence number committed.
+  bool committing_{false};               ///< True while a thread commits.
+  error_code log_error_;                 ///< First failure to write the log.
+  persistence_stats stats_{};
+
+  static void put_u64(std::string &out, std::uint64_t v) {
+    for (int i = 0; i < 8; ++i) {
+      out += static_cast<char>(v >> (8 * i));
+    }
+  }
+
+  static std::uint64_t get_u64(const char *p) noexcept {
+    std::uint64_t v = 0;
+    for (int i = 0; i < 8; ++i) {
+      v |= std::uint64_t(static_cast<unsigned char>(p[i])) << (8 * i);
+    }
+    return v;
+  }
+
+  /**
+   * @brief Encodes a log record with up to 2 fields: paths or contents.
+   */
+  static std::string encode(op o, std::string_view a, std::string_view b = {}) {
+    std::string record(record_header, '\0');
+    record.reserve(record_header + 17 + a.size() + b.size());
+    record += static_cast<char>(o);
+    put_u64(record, a.size());
+    record += a;
+    put_u64(record, b.size());
+    record += b;
+    std::string header;
+    std::string_view payload(record);
+    payload.remove_prefix(record_header);
+    put_u64(header, payload.size());
+    put_u64(header, detail::xxh64(payload));
+    record.replace(0, record_header, header);
+    return record;
+  }
+
+  /**
+   * @brief Applies a record's payload to the tree, during recovery.
+   *
+   * @return false if the payload is malformed or cannot be applied.
+   */
+  bool apply(std::string_view payload) {
+    std::string_view fields[2];
+    if (payload.empty()) {
+      return false;
+    }
+    auto o = static_cast<op>(payload[0]);
+    payload.remove_prefix(1);
+    for (auto &field : fields) {
+      if (payload.size() < 8 || get_u64(payload.data()) > payload.size() - 8) {
+        return false;
+      }
+      field = payload.substr(8, get_u64(payload.data()));
+      payload.remove_prefix(8 + field.size());
+    }
+    path p = std::string(fields[0]);
+    error_code ec;
+    switch (o) {
+    case op::create_directory:
+      fs_.create_directory(p, ec);
+      break;
+    case op::create_directories:
+      fs_.create_directories(p, ec);
+      break;
+    case op::remove:
+      fs_.remove(p, ec);
+      break;
+    case op::remove_all:
+      fs_.remove_all(p, ec);
+      break;
+    case op::rename:
+      fs_.rename(p, std::string(fields[1]), ec);
+      break;
+    case op::write:
+      fs_.write_file(p, std::string(fields[1]), ec);
+      break;
+    default:
+      return false;
+    }
+    return !ec;
+  }
+
+  static error_code last_error() noexcept {
+    return error_code(errno, std::system_category());
+  }
+
+  static void write_all(int fd, std::string_view data, error_code &ec) {
+    while (!data.empty()) {
+      auto n = ::write(fd, data.data(), data.size());
+      if (n < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        ec = last_error();
+        return;
+      }
+      data.remove_prefix(static_cast<std::size_t>(n));
+    }
+    ec.clear();
+  }
+
+  std::filesystem::path file_name(const char *kind,
+                                  std::uint64_t generation) const {
+    return dir_ / (kind + std::to_string(generation));
+  }
+
+  std::filesystem::path image_name(std::uint64_t generation) const {
+    return dir_ / ("checkpoint-" + std::to_string(generation) + ".tar");
+  }
+
+  /**
+   * @brief Parses the generation out of a file name such as "log-12".
+   */
+  static bool parse_generation(const std::string &name,
+                               std::string_view prefix,
+                               std::string_view suffix,
+                               std::uint64_t &generation) {
+    if (name.size() <= prefix.size() + suffix.size() ||
+        name.compare(0, prefix.size(), prefix) != 0 ||
+        name.compare(name.size() - suffix.size(), suffix.size(), suffix) !=
+            0) {
+      return false;
+    }
+    auto digits = std::string_view(name).substr(
+        prefix.size(), name.size() - prefix.size() - suffix.size());
+    if (digits.size() > 19 || !std::all_of(digits.begin(), digits.end(),
+                                           [](char c) {
+                                             return c >= '0' && c <= '9';
+                                           })) {
+      return false;
+    }
+    generation = std::stoull(std::string(digits));
+    return true;
+  }
+
+  /**
+   * @brief Reads the log of the current generation into the tree, discards
+   * a torn record at its end, and opens it for appending.
+   */
+  void replay(error_code &ec) {
+    auto log = file_name("log-", generation_);
+    log_fd_ = ::open(log.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC,
+                     0644);
+    struct stat st;
+    if (log_fd_ < 0 || ::fstat(log_fd_, &st) != 0) {
+      ec = last_error();
+      return;
+    }
+    std::string data(static_cast<std::size_t>(st.st_size), '\0');
+    std::size_t read = 0;
+    while (read < data.size()) {
+      auto n = ::pread(log_fd_, &data[read], data.size() - read,
+                       static_cast<off_t>(read));
+      if (n < 0 && errno == EINTR) {
+        continue;
+      } else if (n < 0) {
+        ec = last_error();
+        return;
+      } else if (n == 0) {
+        break;
+      }
+      read += static_cast<std::size_t>(n);
+    }
+    std::size_t pos = 0;
+    while (read - pos >= record_header) {
+      auto size = get_u64(&data[pos]);
+      if (size > read - pos - record_header) {
+        break;
+      }
+      std::string_view payload(&data[pos + record_header],
+                               static_cast<std::size_t>(size));
+      if (detail::xxh64(payload) != get_u64(&data[pos + 8])) {
+        break;
+      }
+      if (!apply(payload)) {
+        ec = std::make_error_code(std::errc::bad_message);
+        return;
+      }
+      pos += record_header + payload.size();
+      ++stats_.replayed;
+    }
+    if (pos < data.size()) {
+      // Torn by a crash while it was written.
+      if (::ftruncate(log_fd_, static_cast<off_t>(pos)) != 0 ||
+          (options_.sync && ::fsync(log_fd_) != 0)) {
+        ec = last_error();
+        return;
+      }
+    }
+    stats_.log_bytes = pos;
+    ec.clear();
+  }
+
+  /**
+   * @brief Loads the last checkpoint, replays its log, and removes the files
+   * of older generations.
+   */
+  void recover(error_code &ec) {
+    std::filesystem::create_directories(dir_, ec);
+    if (ec) {
+      return;
+    }
+    dir_fd_ = ::open(dir_.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dir_fd_ < 0) {
+      ec = last_error();
+      return;
+    }
+    if (::flock(dir_fd_, LOCK_EX | LOCK_NB) != 0) {
+      ec = errno == EWOULDBLOCK
+               ? std::make_error_code(std::errc::device_or_resource_busy)
+               : last_error();
+      return;
+    }
+
+    std::vector<std::filesystem::path> files;
+    bool found = false;
+    for (std::filesystem::directory_iterator it(dir_, ec), end;
+         !ec && it != end; it.increment(ec)) {
+      auto name = it->path().filename().string();
+      std::uint64_t generation;
+      if (parse_generation(name, "checkpoint-", ".tar", generation)) {
+        generation_ = found ? std::max(generation_, generation) : generation;
+        found = true;
+      }
+      files.push_back(it->path());
+    }
+    if (ec) {
+      return;
+    }
+    if (found) {
+      std::ifstream in(image_name(generation_), std::ios::binary);
+      if (!in) {
+        ec = std::make_error_code(std::errc::io_error);
+        return;
+      }
+      read_tar(in, fs_, "/", ec);
+      if (ec) {
+        return;
+      }
+    }
+    replay(ec);
+    if (ec) {
+      return;
+    }
+    for (auto &file : files) {
+      auto name = file.filename().string();
+      std::uint64_t generation;
+      if ((parse_generation(name, "checkpoint-", ".tar", generation) ||
+           parse_generation(name, "log-", "", generation)) &&
+          generation != generation_) {
+        std::filesystem::remove(file, ec);
+      } else if (parse_generation(name, "checkpoint-", ".tar.tmp",
+                                  generation)) {
+        // Left by a crash during a checkpoint.
+        std::filesystem::remove(file, ec);
+      }
+      if (ec) {
+        return;
+      }
+    }
+    if (options_.sync && ::fsync(dir_fd_) != 0) {
+      ec = last_error();
+      return;
+    }
+    fs_.compact();
+  }
+
+  /**
+   * @brief Queues a record for the next commit.
+   *
+   * @pre The tree is locked for writing, so records are queued in the order
+   * their modifications were applied.
+   *
+   * @return Its sequence number.
+   */
+  std::uint64_t append(const std::string &record) {
+    std::lock_guard<std::mutex> lock(log_mutex_);
+    pending_ += record;
+    ++stats_.records;
+    return ++appended_;
+  }
+
+  /**
+   * @brief Waits until a record is committed, committing the queue if no
+   * other thread is.
+   */
+  void commit(std::uint64_t sequence, error_code &ec) {
+    std::unique_lock<std::mutex> lock(log_mutex_);
+    while (durable_ < sequence && !log_error_) {
+      if (committing_) {
+        committed_.wait(lock);
+        continue;
+      }
+      committing_ = true;
+      std::string batch;
+      batch.swap(pending_);
+      auto last = appended_;
+      lock.unlock();
+      error_code write_ec;
+      write_all(log_fd_, batch, write_ec);
+      if (!write_ec && options_.sync && ::fdatasync(log_fd_) != 0) {
+        write_ec = last_error();
+      }
+      lock.lock();
+      committing_ = false;
+      if (write_ec) {
+        log_error_ = write_ec;
+      } else {
+        durable_ = last;
+        ++stats_.commits;
+        stats_.log_bytes += batch.size();
+      }
+      committed_.notify_all();
+    }
+    if (durable_ < sequence) {
+      ec = log_error_;
+    }
+  }
+
+  bool checkpoint_due() const {
+    std::lock_guard<std::mutex> lock(log_mutex_);
+    return options_.checkpoint_bytes &&
+           stats_.log_bytes >= options_.checkpoint_bytes && !log_error_;
+  }
+
+  /**
+   * @brief Applies a modification to the tree, and commits its log record.
+   *
+   * @param apply Modifies the tree, setting @c ec on failure, and returns
+   * the record to log, or an empty string if nothing changed.
+   */
+  template <typename Apply> void modify(error_code &ec, Apply apply) {
+    std::uint64_t sequence;
+    {
+      std::unique_lock<std::shared_mutex> lock(tree_mutex_);
+      {
+        std::lock_guard<std::mutex> log_lock(log_mutex_);
+        if (log_error_) {
+          ec = log_error_;
+          return;
+        }
+      }
+      auto record = apply();
+      if (ec || record.empty()) {
+        return;
+      }
+      sequence = append(record);
+    }
+    commit(sequence, ec);
+    if (!ec) {
+      checkpoint_if_due();
+    }
+  }
+
+  /**
+   * @brief Writes a checkpoint if the log has grown past its threshold.
+   *
+   * @details A failed checkpoint leaves the log in use, and is retried by
+   * the next modification.
+   */
+  void checkpoint_if_due() {
+    if (checkpoint_due()) {
+      error_code checkpoint_ec;
+      std::unique_lock<std::shared_mutex> lock(tree_mutex_);
+      if (checkpoint_due()) {
+        write_checkpoint(checkpoint_ec);
+      }
+    }
+  }
+
+  /**
+   * @brief Writes the tree as the checkpoint of the next generation, and
+   * starts its log.
+   *
+   * @pre The tree is locked for writing.
+   */
+  void write_checkpoint(error_code &ec) {
+    std::uint64_t last;
+    {
+      std::lock_guard<std::mutex> lock(log_mutex_);
+      last = appended_;
+    }
+    commit(last, ec);
+    if (ec) {
+      return;
+    }
+    auto next = generation_ + 1;
+    auto image = image_name(next);
+    auto temp = image;
+    temp += ".tmp";
+    {
+      std::ofstream out(temp, std::ios::binary | std::ios::trunc);
+      write_tar(fs_, "/", out, ec);
+      if (!ec && !out.flush()) {
+        ec = std::make_error_code(std::errc::io_error);
+      }
+    }
+    if (!ec && options_.sync) {
+      int fd = ::open(temp.c_str(), O_RDONLY | O_CLOEXEC);
+      if (fd < 0 || ::fsync(fd) != 0) {
+        ec = last_error();
+      }
+      if (fd >= 0) {
+        ::close(fd);
+      }
+    }
+    int log_fd = -1;
+    if (!ec && ::rename(temp.c_str(), image.c_str()) != 0) {
+      ec = last_error();
+    }
+    if (!ec) {
+      log_fd = ::open(file_name("log-", next).c_str(),
+                      O_RDWR | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+      if (log_fd < 0 || (options_.sync && ::fsync(dir_fd_) != 0)) {
+        ec = last_error();
+      }
+    }
+    if (ec) {
+      if (log_fd >= 0) {
+        ::close(log_fd);
+      }
+      // The old checkpoint and log are still complete.
+      error_code ignored;
+      std::filesystem::remove(temp, ignored);
+      return;
+    }
+    {
+      std::lock_guard<std::mutex> lock(log_mutex_);
+      std::swap(log_fd_, log_fd);
+      stats_.log_bytes = 0;
+      ++stats_.checkpoints;
+    }
+    ::close(log_fd);
+    error_code ignored;
+    std::filesystem::remove(image_name(generation_), ignored);
+    std::filesystem::remove(file_name("log-", generation_), ignored);
+    generation_ = next;
+  }
+
+  /**
+   * @brief Publishes the contents of a stream, if its path still names the
+   * file it opened.
+   */
+  void publish(const path &p, const std::weak_ptr<const void> &file,
+               std::string content, error_code &ec) {
+    modify(ec, [&] {
+      auto view = fs_.view_file(p, ec);
+      auto node = view.owner();
+      if (ec || file.owner_before(node) || node.owner_before(file)) {
+        // Removed or renamed since it was opened.
+        ec.clear();
+        return std::string();
+      }
+      if (view.data() == content) {
+        return std::string();
+      }
+      auto record = encode(op::write, p.native(), content);
+      fs_.write_file(p, std::move(content), ec);
+      return record;
+    });
+  }
+
+  /**
+   * @brief Stream buffer over the contents of a file opened for writing.
+   *
+   * @details Like @c fake_filesystem's file streams, the contents are copied
+   * when the file is opened and published back when the stream is flushed or
+   * destroyed. Publishing logs them.
+   */
+  class persistent_filebuf final : public std::stringbuf {
+  private:
+    persistent_fake_filesystem *fs_; ///< Filesystem that opened the file.
+    path path_;                      ///< Absolute path of the file.
+    std::weak_ptr<const void> file_; ///< File node when opened.
+
+  public:
+    persistent_filebuf(persistent_fake_filesystem &fs, path p,
+                       std::weak_ptr<const void> file,
+                       const std::string &content,
+                       std::ios_base::openmode mode)
+        : std::stringbuf(content, (mode & std::ios_base::app)
+                                      ? mode | std::ios_base::out
+                                      : mode),
+          fs_(&fs), path_(std::move(p)), file_(std::move(file)) {}
+
+    ~persistent_filebuf() override { sync(); }
+
+  protected:
+    int sync() override {
+      error_code ec;
+      fs_->publish(path_, file_, str(), ec);
+      return ec ? -1 : 0;
+    }
+  };
+
+  /**
+   * @brief File stream returned by @c open_file for writing.
+   */
+  class persistent_file_stream final : public std::iostream {
+  private:
+    persistent_filebuf buf_;
+
+  public:
+    persistent_file_stream(persistent_fake_filesystem &fs, path p,
+                           std::weak_ptr<const void> file,
+                           const std::string &content,
+                           std::ios_base::openmode mode)
+        : std::iostream(nullptr),
+          buf_(fs, std::move(p), std::move(file), content, mode) {
+      rdbuf(&buf_);
+    }
+  };
+
+  /**
+   * @brief Lists a directory, or its whole subtree in depth-first order.
+   */
+  std::vector<snapshot_entry> snapshot(const path &p, bool recursive,
+                                       error_code &ec) const {
+    std::vector<snapshot_entry> entries;
+    std::shared_lock<std::shared_mutex> lock(tree_mutex_);
+    if (recursive) {
+      auto it = fs_.recursive_directory_iterator(p, ec);
+      for (; !ec && !it->at_end(); it->increment(ec)) {
+        entries.push_back({it->path(), it->status().type(), it->depth()});
+      }
+    } else {
+      auto it = fs_.directory_iterator(p, ec);
+      for (; !ec && !it->at_end(); it->increment(ec)) {
+        entries.push_back({it->path(), it->status().type(), 0});
+      }
+    }
+    if (ec) {
+      entries.clear();
+    }
+    return entries;
+  }
+
+public:
+  /**
+   * @brief Recovers the tree persisted in a directory, or starts an empty
+   * one there.
+   *
+   * @param dir Directory of the real filesystem holding the checkpoint and
+   * the log, created if missing.
+   * @throw filesystem_error if the directory is in use by another instance
+   * (@c std::errc::device_or_resource_busy), a record in the log cannot be
+   * replayed (@c std::errc::bad_message), or the files cannot be read.
+   */
+  explicit persistent_fake_filesystem(const std::filesystem::path &dir,
+                                      persistence_options options = {})
+      : dir_(dir), options_(options) {
+    error_code ec;
+    recover(ec);
+    if (ec) {
+      if (log_fd_ >= 0) {
+        ::close(log_fd_);
+      }
+      if (dir_fd_ >= 0) {
+        ::close(dir_fd_);
+      }
+      throw filesystem_error("persistent_fake_filesystem", dir, ec);
+    }
+  }
+
+  persistent_fake_filesystem(const persistent_fake_filesystem &) = delete;
+  persistent_fake_filesystem &
+  operator=(const persistent_fake_filesystem &) = delete;
+
+  /**
+   * @brief Closes the log. Every modification has already been committed.
+   */
+  ~persistent_fake_filesystem() override {
+    ::close(log_fd_);
+    ::close(dir_fd_);
+  }
+
+  /**
+   * @brief Writes the whole tree as a new checkpoint and starts an empty
+   * log, so that recovery need not replay the current one.
+   *
+   * @details Modifications wait while the checkpoint is written. On failure,
+   * the previous checkpoint and the log remain in use.
+   */
+  void checkpoint(error_code &ec) {
+    std::unique_lock<std::shared_mutex> lock(tree_mutex_);
+    {
+      std::lock_guard<std::mutex> log_lock(log_mutex_);
+      if (log_error_) {
+        ec = log_error_;
+        return;
+      }
+    }
+    write_checkpoint(ec);
+  }
+
+  void checkpoint() {
+    error_code ec;
+    checkpoint(ec);
+    if (ec) {
+      throw filesystem_error("checkpoint", dir_, ec);
+    }
+  }
+
+  /**
+   * @brief Gets the counters of the log. The ratio of records to commits
+   * shows how many modifications shared each sync.
+   */
+  persistence_stats stats() const {
+    std::lock_guard<std::mutex> lock(log_mutex_);
+    return stats_;
+  }
+
+  path absolute(const path &p, error_code &ec) override {
+    std::shared_lock<std::shared_mutex> lock(tree_mutex_);
+    return fs_.absolute(p, ec);
+  }
+
+  path absolute(const path &p) override {
+    error_code ec;
+    auto ret = absolute(p, ec);
+    if (ec) {
+      throw filesystem_error("absolute", ec);
+    }
+    return ret;
+  }
+
+  bool create_directory(const path &p, error_code &ec) noexcept override {
+    bool ret = false;
+    modify(ec, [&] {
+      ret = fs_.create_directory(p, ec);
+      return ret ? encode(op::create_directory, fs_.absolute(p).native())
+                 : std::string();
+    });
+    return ret;
+  }
+
+  bool create_directory(const path &p) override {
+    error_code ec;
+    bool ret = create_directory(p, ec);
+    if (ec) {
+      throw filesystem_error("create_directory", ec);
+    }
+    return ret;
+  }
+
+  bool create_directories(const path &p, error_code &ec) noexcept override {
+    bool ret = false;
+    modify(ec, [&] {
+      // Find the shallowest missing directory, to roll back what a failure
+      // leaves behind rather than leave it out of the log.
+      path top;
+      bool missing = false;
+      error_code exists_ec;
+      for (auto &name : fs_.absolute(p)) {
+        top /= name;
+        if (!fs_.exists(top, exists_ec)) {
+          missing = true;
+          break;
+        }
+      }
+      ret = fs_.create_directories(p, ec);
+      if (ec && missing && fs_.exists(top, exists_ec)) {
+        fs_.remove_all(top, exists_ec);
+        ret = false;
+      }
+      return ret && !ec
+                 ? encode(op::create_directories, fs_.absolute(p).native())
+                 : std::string();
+    });
+    return ret;
+  }
+
+  bool create_directories(const path &p) override {
+    error_code ec;
+    bool ret = create_directories(p, ec);
+    if (ec) {
+      throw filesystem_error("create_directories", ec);
+    }
+    return ret;
+  }
+
+  path current_path(error_code &ec) const noexcept override {
+    std::shared_lock<std::shared_mutex> lock(tree_mutex_);
+    return fs_.current_path(ec);
+  }
+
+  path current_path() const override {
+    std::shared_lock<std::shared_mutex> lock(tree_mutex_);
+    return fs_.current_path();
+  }
+
+  void current_path(const path &p, error_code &ec) noexcept override {
+    std::unique_lock<std::shared_mutex> lock(tree_mutex_);
+    fs_.current_path(p, ec);
+  }
+
+  void current_path(const path &p) override {
+    error_code ec;
+    current_path(p, ec);
+    if (ec) {
+      throw filesystem_error("current_path", ec);
+    }
+  }
+
+  bool exists(const path &p, error_code &ec) const noexcept override {
+    std::shared_lock<std::shared_mutex> lock(tree_mutex_);
+    return fs_.exists(p, ec);
+  }
+
+  bool exists(const path &p) const override {
+    error_code ec;
+    bool ret = exists(p, ec);
+    if (ec) {
+      throw filesystem_error("exists", ec);
+    }
+    return ret;
+  }
+
+  std::uintmax_t file_size(const path &p,
+                           error_code &ec) const noexcept override {
+    std::shared_lock<std::shared_mutex> lock(tree_mutex_);
+    return fs_.file_size(p, ec);
+  }
+
+  std::uintmax_t file_size(const path &p) const override {
+    error_code ec;
+    auto ret = file_size(p, ec);
+    if (ec) {
+      throw filesystem_error("file_size", ec);
+    }
+    return ret;
+  }
+
+  bool is_directory(const path &p, error_code &ec) const noexcept override {
+    std::shared_lock<std::shared_mutex> lock(tree_mutex_);
+    return fs_.is_directory(p, ec);
+  }
+
+  bool is_directory(const path &p) const override {
+    error_code ec;
+    bool ret = is_directory(p, ec);
+    if (ec) {
+      throw filesystem_error("is_directory", ec);
+    }
+    return ret;
+  }
+
+  /**
+   * @brief Opens a regular file, following the rules of @c std::fstream.
+   *
+   * @details See @c fake_filesystem::open_file. Creating or truncating the
+   * file is committed before this returns. On failure, including a failure
+   * to write the log, the returned stream has its failbit set.
+   */
+  std::unique_ptr<std::iostream>
+  open_file(const path &p, std::ios_base::openmode mode) override {
+    if (!(mode & (std::ios_base::out | std::ios_base::app))) {
+      std::shared_lock<std::shared_mutex> lock(tree_mutex_);
+      return fs_.open_file(p, mode);
+    }
+    path file;
+    std::shared_ptr<const void> node;
+    std::string content;
+    error_code ec;
+    modify(ec, [&] {
+      auto size = static_cast<std::uintmax_t>(-1);
+      if (fs_.status(p, ec).type() == file_type::regular) {
+        size = fs_.file_size(p, ec);
+      }
+      ec.clear();
+      if (fs_.open_file(p, mode)->fail()) {
+        return std::string();
+      }
+      file = fs_.absolute(p);
+      auto view = fs_.view_file(file, ec);
+      node = view.owner();
+      content = view.data();
+      // Opening only ever creates or truncates a file.
+      return size == view.size() ? std::string()
+                                 : encode(op::write, file.native());
+    });
+    if (ec || !node) {
+      auto ret = std::make_unique<std::stringstream>();
+      ret->setstate(std::ios_base::failbit);
+      return ret;
+    }
+    return std::make_unique<persistent_file_stream>(*this, std::move(file),
+                                                    node, content, mode);
+  }
+
+  bool remove(const path &p, error_code &ec) noexcept override {
+    bool ret = false;
+    modify(ec, [&] {
+      auto file = fs_.absolute(p);
+      ret = fs_.remove(p, ec);
+      return ret ? encode(op::remove, file.native()) : std::string();
+    });
+    return ret;
+  }
+
+  bool remove(const path &p) override {
+    error_code ec;
+    auto ret = remove(p, ec);
+    if (ec) {
+      throw filesystem_error("remove", ec);
+    }
+    return ret;
+  }
+
+  std::uintmax_t remove_all(const path &p, error_code &ec) noexcept override {
+    std::uintmax_t ret = 0;
+    modify(ec, [&] {
+      auto file = fs_.absolute(p);
+      ret = fs_.remove_all(p, ec);
+      return ret ? encode(op::remove_all, file.native()) : std::string();
+    });
+    return ret;
+  }
+
+  std::uintmax_t remove_all(const path &p) override {
+    error_code ec;
+    auto ret = remove_all(p, ec);
+    if (ec) {
+      throw filesystem_error("remove_all", ec);
+    }
+    return ret;
+  }
+
+  void rename(const path &old_p, const path &new_p,
+              error_code &ec) noexcept override {
+    modify(ec, [&] {
+      auto from = fs_.absolute(old_p);
+      auto to = fs_.absolute(new_p);
+      fs_.rename(old_p, new_p, ec);
+      return encode(op::rename, from.native(), to.native());
+    });
+  }
+
+  void rename(const path &old_p, const path &new_p) override {
+    error_code ec;
+    rename(old_p, new_p, ec);
+    if (ec) {
+      throw filesystem_error("rename", ec);
+    }
+  }
+
+  /**
+   * @brief Creates or replaces files, logging each as a single record.
+   *
+   * @details Each file is replaced in one step, and logged with its whole
+   * contents, so recovery finds either its old contents or its new ones. The
+   * records of all the files are committed together, synced as
+   * @c persistence_options asks rather than as @c options does.
+   */
+  atomic_write_stats
+  write_all(const std::vector<std::pair<path, std::string_view>> &files,
+            const atomic_write_options &options, error_code &ec) override {
+    (void)options;
+    atomic_write_stats stats{};
+    std::uint64_t sequence = 0;
+    {
+      std::unique_lock<std::shared_mutex> lock(tree_mutex_);
+      {
+        std::lock_guard<std::mutex> log_lock(log_mutex_);
+        if (log_error_) {
+          ec = log_error_;
+          return stats;
+        }
+      }
+      ec.clear();
+      for (auto &[p, content] : files) {
+        auto file = fs_.absolute(p, ec);
+        if (!ec) {
+          fs_.write_file(file, std::string(content), ec);
+        }
+        if (ec) {
+          break;
+        }
+        sequence = append(encode(op::write, file.native(), content));
+        ++stats.files;
+      }
+    }
+    if (!sequence) {
+      return stats;
+    }
+    error_code commit_ec;
+    commit(sequence, commit_ec);
+    if (commit_ec) {
+      ec = commit_ec;
+      return stats;
+    }
+    stats.commits = 1;
+    if (!ec) {
+      checkpoint_if_due();
+    }
+    return stats;
+  }
+
+  using filesystem::write_all;
+
+  /**
+   * @brief Gets a view of the contents of a regular file, without copying
+   * them. See @c fake_filesystem::view_file for how long the bytes stay
+   * valid.
+   */
+  file_view view_file(const path &p, error_code &ec) override {
+    std::shared_lock<std::shared_mutex> lock(tree_mutex_);
+    return fs_.view_file(p, ec);
+  }
+
+  using filesystem::view_file;
+
+  bool allows_concurrent_reads() const noexcept override { return true; }
+
+  bool allows_concurrent_writes() const noexcept override { return true; }
+
+  file_status status(const path &p, error_code &ec) const noexcept override {
+    std::shared_lock<std::shared_mutex> lock(tree_mutex_);
+    return fs_.status(p, ec);
+  }
+
+  file_status status(const path &p) const override {
+    error_code ec;
+    auto ret = status(p, ec);
+    if (ec) {
+      throw filesystem_error("status", ec);
+    }
+    return ret;
+  }
+
+  std::unique_ptr<pfs::directory_iterator>
+  directory_iterator(const path &p, error_code &ec) const override {
+    return std::make_unique<snapshot_directory_iterator>(
+        snapshot(p, false, ec));
+  }
+
+  std::unique_ptr<pfs::directory_iterator>
+  directory_iterator(const path &p) const override {
+    error_code ec;
+    auto ret = directory_iterator(p, ec);
+    if (ec) {
+      throw filesystem_error("directory_iterator", ec);
+    }
+    return ret;
+  }
+
+  std::unique_ptr<pfs::recursive_directory_iterator>
+  recursive_directory_iterator(const path &p, error_code &ec) const override {
+    return std::make_unique<snapshot_recursive_directory_iterator>(
+        snapshot(p, true, ec));
+  }
+
+  std::unique_ptr<pfs::recursive_directory_iterator>
+  recursive_directory_iterator(const path &p) const override {
+    error_code ec;
+    auto ret = recursive_directory_iterator(p, ec);
+    if (ec) {
+      throw filesystem_error("recursive_directory_iterator", ec);
+    }
+    return ret;
+  }
+};
+
+} // namespace pfs
+
+#endif
@@ -0,0 +1,647 @@
+#ifndef INCLUDED_PFS_REMOTE_FILESYSTEM_HPP
+#define INCLUDED_PFS_REMOTE_FILESYSTEM_HPP
+
+#include <functional>
+#include <memory>
+#include <pfs/filesystem.hpp>
+#include <pfs/rpc.hpp>
+#include <pfs/snapshot_iterator.hpp>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace pfs {
+
+/**
+ * @brief A filesystem served by another process.
+ *
+ * @details Forwards each operation over a connection to a server, such as
+ * @c pfs_server, that performs it on its own filesystem. See @c pfs::rpc for
+ * the protocol. Operations wait for their reply, which costs a round trip
+ * each; a @c batch sends many operations in a single round trip instead.
+ * Directory iterators fetch the whole listing in a single round trip, then
+ * iterate that snapshot.
+ *
+ * The current directory belongs to the client: relative paths are made
+ * absolute before they are sent. Streams returned by @c open_file hold a copy
+ * of the file, and write it back when flushed or destroyed; they must not
+ * outlive the client. A client is not thread-safe.
+ *
+ * Available on POSIX only.
+ */
+class remote_filesystem final : public filesystem {
+public:
+  class batch;
+
+  /**
+   * @brief The result of an operation in a @c batch.
+   *
+   * @details Becomes ready once the batch is submitted. Until then, its error
+   * is @c std::errc::operation_in_progress.
+   */
+  template <typename T> class pending {
+  private:
+    struct state {
+      T value{};
+      error_code ec{std::make_error_code(std::errc::operation_in_progress)};
+    };
+
+    std::shared_ptr<state> state_{std::make_shared<state>()};
+    const char *name_;
+
+    friend class batch;
+
+    explicit pending(const char *name) : name_(name) {}
+
+  public:
+    /**
+     * @brief Gets the result, or sets @c ec if the operation failed.
+     */
+    const T &get(error_code &ec) const noexcept {
+      ec = state_->ec;
+      return state_->value;
+    }
+
+    /**
+     * @brief Gets the result, or throws @c filesystem_error if the operation
+     * failed.
+     */
+    const T &get() const {
+      if (state_->ec) {
+        throw filesystem_error(name_, state_->ec);
+      }
+      return state_->value;
+    }
+  };
+
+  /**
+   * @brief Queues operations to be sent together.
+   *
+   * @details Operations are sent when @c submit is called, and performed by
+   * the server in the order they were queued. The batch must not outlive the
+   * client, and other operations on the client must not be interleaved with
+   * queueing and submitting a batch.
+   */
+  class batch {
+  private:
+    remote_filesystem &fs_;
+    std::vector<std::function<void(rpc::reader &, error_code)>> replies_;
+    std::uint32_t first_id_;
+
+    friend class remote_filesystem;
+
+    /**
+     * @brief Queues a request and returns the result it will fill in.
+     */
+    template <typename T, typename Args, typename Decode>
+    pending<T> queue(const char *name, rpc::opcode op, Args args,
+                     Decode decode) {
+      pending<T> result(name);
+      rpc::writer out(fs_.channel_.output());
+      auto start = out.begin_frame();
+      out.u32(fs_.next_id_);
+      out.u8(static_cast<std::uint8_t>(op));
+      args(out);
+      if (fs_.channel_.output().size() - start - 4 >
+          rpc::channel::max_frame_size) {
+        // The server would not read it.
+        fs_.channel_.output().resize(start);
+        result.state_->ec = std::make_error_code(std::errc::file_too_large);
+        return result;
+      }
+      ++fs_.next_id_;
+      out.end_frame(start);
+      replies_.emplace_back([state = result.state_,
+                             decode](rpc::reader &in, error_code ec) {
+        if (!ec) {
+          state->value = decode(in);
+          if (in.failed()) {
+            ec = std::make_error_code(std::errc::bad_message);
+          }
+        }
+        state->ec = ec;
+      });
+      return result;
+    }
+
+    template <typename T, typename Decode>
+    pending<T> queue(const char *name, rpc::opcode op, const path &p,
+                     Decode decode) {
+      return queue<T>(
+          name, op, [p = fs_.resolve(p)](rpc::writer &out) { out.path(p); },
+          decode);
+    }
+
+    static file_status decode_status(rpc::reader &in) {
+      return file_status(static_cast<file_type>(in.u8()));
+    }
+
+    static bool decode_bool(rpc::reader &in) { return in.u8() != 0; }
+
+    static std::uintmax_t decode_u64(rpc::reader &in) { return in.u64(); }
+
+  public:
+    explicit batch(remote_filesystem &fs) : fs_(fs), first_id_(fs.next_id_) {}
+
+    batch(const batch &) = delete;
+    batch &operator=(const batch &) = delete;
+
+    /**
+     * @brief Discards the operations queued but not submitted.
+     */
+    ~batch() {
+      if (!replies_.empty()) {
+        fs_.channel_.output().clear();
+        fs_.next_id_ = first_id_;
+      }
+    }
+
+    /**
+     * @brief The number of operations queued.
+     */
+    std::size_t size() const { return replies_.size(); }
+
+    pending<file_status> status(const path &p) {
+      return queue<file_status>("status", rpc::opcode::status, p,
+                                decode_status);
+    }
+
+    pending<std::uintmax_t> file_size(const path &p) {
+      return queue<std::uintmax_t>("file_size", rpc::opcode::file_size, p,
+                                   decode_u64);
+    }
+
+    pending<bool> create_directory(const path &p) {
+      return queue<bool>("create_directory", rpc::opcode::create_directory, p,
+                         decode_bool);
+    }
+
+    pending<bool> create_directories(const path &p) {
+      return queue<bool>("create_directories",
+                         rpc::opcode::create_directories, p, decode_bool);
+    }
+
+    pending<bool> remove(const path &p) {
+      return queue<bool>("remove", rpc::opcode::remove, p, decode_bool);
+    }
+
+    pending<std::uintmax_t> remove_all(const path &p) {
+      return queue<std::uintmax_t>("remove_all", rpc::opcode::remove_all, p,
+                                   decode_u64);
+    }
+
+    /**
+     * @brief Queues a rename. The result is always @c true on success.
+     */
+    pending<bool> rename(const path &old_p, const path &new_p) {
+      return queue<bool>(
+          "rename", rpc::opcode::rename,
+          [old_p = fs_.resolve(old_p),
+           new_p = fs_.resolve(new_p)](rpc::writer &out) {
+            out.path(old_p);
+            out.path(new_p);
+          },
+          [](rpc::reader &) { return true; });
+    }
+
+    /**
+     * @brief Sends the queued operations and waits for all of their results.
+     *
+     * @details If the connection fails, every operation not yet answered
+     * fails with the connection's error, which is also set in @c ec.
+     */
+    void submit(error_code &ec) {
+      fs_.channel_.flush(ec);
+      auto id = first_id_;
+      for (auto &reply : replies_) {
+        if (!ec) {
+          auto frame = fs_.channel_.read_frame(ec);
+          rpc::reader in(frame);
+          if (!ec && (in.u32() != id || in.failed())) {
+            ec = std::make_error_code(std::errc::bad_message);
+          }
+          if (!ec) {
+            auto value = in.u32();
+            reply(in, value ? error_code(static_cast<int>(value),
+                                         std::generic_category())
+                            : error_code());
+            ++id;
+            continue;
+          }
+        }
+        rpc::reader none({});
+        reply(none, ec);
+      }
+      replies_.clear();
+      first_id_ = fs_.next_id_;
+    }
+
+    void submit() {
+      error_code ec;
+      submit(ec);
+      if (ec) {
+        throw filesystem_error("submit", ec);
+      }
+    }
+  };
+
+private:
+  /**
+   * @brief A stream buffer holding a copy of a remote file.
+   */
+  class remote_filebuf final : public std::stringbuf {
+  private:
+    remote_filesystem &fs_;
+    path path_;
+
+  public:
+    remote_filebuf(remote_filesystem &fs, path p, const std::string &content,
+                   std::ios_base::openmode mode)
+        : std::stringbuf(content, mode), fs_(fs), path_(std::move(p)) {}
+
+    ~remote_filebuf() override { sync(); }
+
+  protected:
+    int sync() override {
+      error_code ec;
+      fs_.write_file(path_, str(), ec);
+      return ec ? -1 : 0;
+    }
+  };
+
+  class remote_file_stream final : public std::iostream {
+  private:
+    std::unique_ptr<std::stringbuf> buf_;
+
+  public:
+    explicit remote_file_stream(std::unique_ptr<std::stringbuf> buf)
+        : std::iostream(buf.get()), buf_(std::move(buf)) {}
+
+    remote_file_stream()
+        : remote_file_stream(std::make_unique<std::stringbuf>()) {
+      setstate(std::ios_base::failbit);
+    }
+  };
+
+  std::unique_ptr<rpc::transport> transport_;
+  rpc::channel channel_;
+  std::uint32_t next_id_{0};
+  path cwd_{"/"};
+
+  path resolve(const path &p) const {
+    return p.empty() || p.is_absolute() ? p : cwd_ / p;
+  }
+
+  /**
+   * @brief Performs a single operation in its own round trip.
+   */
+  template <typename T, typename Queue>
+  T call(Queue queue, error_code &ec) noexcept {
+    try {
+      batch b(*this);
+      auto result = queue(b);
+      b.submit(ec);
+      if (!ec) {
+        return result.get(ec);
+      }
+    } catch (const std::bad_alloc &) {
+      ec = std::make_error_code(std::errc::not_enough_memory);
+    }
+    return T{};
+  }
+
+  /**
+   * @brief Fetches the content of a file, opening it on the server.
+   */
+  std::string open_remote(const path &p, std::ios_base::openmode mode,
+                          error_code &ec) {
+    return call<std::string>(
+        [&](batch &b) {
+          return b.template queue<std::string>(
+              "open_file", rpc::opcode::open,
+              [&](rpc::writer &out) {
+                out.path(p);
+                out.u32(static_cast<std::uint32_t>(mode));
+              },
+              [](rpc::reader &in) { return std::string(in.str()); });
+        },
+        ec);
+  }
+
+  void write_file(const path &p, const std::string &content, error_code &ec) {
+    call<bool>(
+        [&](batch &b) {
+          return b.template queue<bool>(
+              "open_file", rpc::opcode::write,
+              [&](rpc::writer &out) {
+                out.path(p);
+                out.str(content);
+              },
+              [](rpc::reader &) { return true; });
+        },
+        ec);
+  }
+
+  std::vector<snapshot_entry> list(const path &p, bool recursive,
+                                   error_code &ec) const {
+    auto &self = const_cast<remote_filesystem &>(*this);
+    return self.call<std::vector<snapshot_entry>>(
+        [&](batch &b) {
+          return b.template queue<std::vector<snapshot_entry>>(
+              recursive ? "recursive_directory_iterator"
+                        : "directory_iterator",
+              recursive ? rpc::opcode::list_recursive : rpc::opcode::list,
+              resolve(p), [&p, recursive](rpc::reader &in) {
+                std::vector<snapshot_entry> entries(in.u32());
+                for (auto &e : entries) {
+                  e.path = p / in.path();
+                  e.type = static_cast<file_type>(in.u8());
+                  e.depth = recursive ? static_cast<int>(in.u32()) : 0;
+                  if (in.failed()) {
+                    entries.clear();
+                    break;
+                  }
+                }
+                return entries;
+              });
+        },
+        ec);
+  }
+
+public:
+  /**
+   * @brief Connects to a server listening on a Unix domain socket.
+   */
+  explicit remote_filesystem(const path &socket_path)
+      : remote_filesystem(connect(socket_path)) {}
+
+  /**
+   * @brief Uses an established connection to a server.
+   */
+  explicit remote_filesystem(std::unique_ptr<rpc::transport> t)
+      : transport_(std::move(t)), channel_(*transport_) {}
+
+  remote_filesystem(const remote_filesystem &) = delete;
+  remote_filesystem &operator=(const remote_filesystem &) = delete;
+
+  static std::unique_ptr<rpc::transport> connect(const path &socket_path) {
+    error_code ec;
+    auto t = rpc::socket_transport::connect(socket_path, ec);
+    if (ec) {
+      throw filesystem_error("remote_filesystem", socket_path, ec);
+    }
+    return t;
+  }
+
+  path absolute(const path &p) override { return resolve(p); }
+
+  path absolute(const path &p, error_code &ec) override {
+    ec.clear();
+    return resolve(p);
+  }
+
+  bool create_directory(const path &p) override {
+    error_code ec;
+    auto result = create_directory(p, ec);
+    if (ec) {
+      throw filesystem_error("create_directory", p, ec);
+    }
+    return result;
+  }
+
+  bool create_directory(const path &p, error_code &ec) noexcept override {
+    return call<bool>([&](batch &b) { return b.create_directory(p); }, ec);
+  }
+
+  bool create_directories(const path &p) override {
+    error_code ec;
+    auto result = create_directories(p, ec);
+    if (ec) {
+      throw filesystem_error("create_directories", p, ec);
+    }
+    return result;
+  }
+
+  bool create_directories(const path &p, error_code &ec) noexcept override {
+    return call<bool>([&](batch &b) { return b.create_directories(p); }, ec);
+  }
+
+  path current_path() const override { return cwd_; }
+
+  path current_path(error_code &ec) const noexcept override {
+    ec.clear();
+    return cwd_;
+  }
+
+  void current_path(const path &p) override {
+    error_code ec;
+    current_path(p, ec);
+    if (ec) {
+      throw filesystem_error("current_path", p, ec);
+    }
+  }
+
+  void current_path(const path &p, error_code &ec) noexcept override {
+    auto s = status(p, ec);
+    if (ec) {
+      return;
+    }
+    if (s.type() != file_type::directory) {
+      ec = std::make_error_code(s.type() == file_type::not_found
+                                    ? std::errc::no_such_file_or_directory
+                                    : std::errc::not_a_directory);
+      return;
+    }
+    cwd_ = resolve(p).lexically_normal();
+    if (!cwd_.has_filename() && cwd_ != cwd_.root_path()) {
+      cwd_ = cwd_.parent_path();
+    }
+  }
+
+  bool exists(const path &p) const override {
+    return status(p).type() != file_type::not_found;
+  }
+
+  bool exists(const path &p, error_code &ec) const noexcept override {
+    auto s = status(p, ec);
+    if (s.type() == file_type::not_found) {
+      ec.clear();
+      return false;
+    }
+    return !ec;
+  }
+
+  std::uintmax_t file_size(const path &p) const override {
+    error_code ec;
+    auto result = file_size(p, ec);
+    if (ec) {
+      throw filesystem_error("file_size", p, ec);
+    }
+    return result;
+  }
+
+  std::uintmax_t file_size(const path &p,
+                           error_code &ec) const noexcept override {
+    auto &self = const_cast<remote_filesystem &>(*this);
+    auto result = self.call<std::uintmax_t>(
+        [&](batch &b) { return b.file_size(p); }, ec);
+    return ec ? static_cast<std::uintmax_t>(-1) : result;
+  }
+
+  bool is_directory(const path &p) const override {
+    return status(p).type() == file_type::directory;
+  }
+
+  bool is_directory(const path &p, error_code &ec) const noexcept override {
+    return status(p, ec).type() == file_type::directory;
+  }
+
+  std::unique_ptr<std::iostream>
+  open_file(const path &p, std::ios_base::openmode mode) override {
+    error_code ec;
+    auto abs = resolve(p);
+    auto content = open_remote(abs, mode, ec);
+    if (ec) {
+      return std::make_unique<remote_file_stream>();
+    }
+    std::unique_ptr<std::stringbuf> buf;
+    if (mode & std::ios_base::app) {
+      // Unlike a file buffer, a string buffer does not imply out from app.
+      mode |= std::ios_base::out;
+    }
+    if (mode & std::ios_base::out) {
+      buf = std::make_unique<remote_filebuf>(*this, std::move(abs), content,
+                                             mode);
+    } else {
+      buf = std::make_unique<std::stringbuf>(content, mode);
+    }
+    return std::make_unique<remote_file_stream>(std::move(buf));
+  }
+
+  bool remove(const path &p) override {
+    error_code ec;
+    auto result = remove(p, ec);
+    if (ec) {
+      throw filesystem_error("remove", p, ec);
+    }
+    return result;
+  }
+
+  bool remove(const path &p, error_code &ec) noexcept override {
+    return call<bool>([&](batch &b) { return b.remove(p); }, ec);
+  }
+
+  std::uintmax_t remove_all(const path &p) override {
+    error_code ec;
+    auto result = remove_all(p, ec);
+    if (ec) {
+      throw filesystem_error("remove_all", p, ec);
+    }
+    return result;
+  }
+
+  std::uintmax_t remove_all(const path &p, error_code &ec) noexcept override {
+    auto result =
+        call<std::uintmax_t>([&](batch &b) { return b.remove_all(p); }, ec);
+    return ec ? static_cast<std::uintmax_t>(-1) : result;
+  }
+
+  void rename(const path &old_p, const path &new_p) override {
+    error_code ec;
+    rename(old_p, new_p, ec);
+    if (ec) {
+      throw filesystem_error("rename", old_p, new_p, ec);
+    }
+  }
+
+  void rename(const path &old_p, const path &new_p,
+              error_code &ec) noexcept override {
+    call<bool>([&](batch &b) { return b.rename(old_p, new_p); }, ec);
+  }
+
+  /**
+   * @brief Creates or replaces files with a single request, which the server
+   * performs with @c write_all on its own filesystem.
+   *
+   * @param ec Set to @c file_too_large if the files do not fit in one frame.
+   */
+  atomic_write_stats
+  write_all(const std::vector<std::pair<path, std::string_view>> &files,
+            const atomic_write_options &options, error_code &ec) override {
+    return call<atomic_write_stats>(
+        [&](batch &b) {
+          return b.template queue<atomic_write_stats>(
+              "write_all", rpc::opcode::write_all,
+              [&](rpc::writer &out) {
+                out.u8(static_cast<std::uint8_t>(options.sync));
+                out.u32(static_cast<std::uint32_t>(files.size()));
+                for (auto &[p, content] : files) {
+                  out.path(resolve(p));
+                  out.str(content);
+                }
+              },
+              [](rpc::reader &in) {
+                atomic_write_stats stats{};
+                stats.files = in.u64();
+                stats.commits = in.u64();
+                stats.file_syncs = in.u64();
+                stats.dir_syncs = in.u64();
+                stats.fs_syncs = in.u64();
+                return stats;
+              });
+        },
+        ec);
+  }
+
+  using filesystem::write_all;
+
+  file_status status(const path &p) const override {
+    error_code ec;
+    auto result = status(p, ec);
+    if (ec) {
+      throw filesystem_error("status", p, ec);
+    }
+    return result;
+  }
+
+  file_status status(const path &p, error_code &ec) const noexcept override {
+    auto &self = const_cast<remote_filesystem &>(*this);
+    return self.call<file_status>([&](batch &b) { return b.status(p); }, ec);
+  }
+
+  std::unique_ptr<pfs::directory_iterator>
+  directory_iterator(const path &p) const override {
+    error_code ec;
+    auto it = directory_iterator(p, ec);
+    if (ec) {
+      throw filesystem_error("directory_iterator", p, ec);
+    }
+    return it;
+  }
+
+  std::unique_ptr<pfs::directory_iterator>
+  directory_iterator(const path &p, error_code &ec) const override {
+    return std::make_unique<snapshot_directory_iterator>(list(p, false, ec));
+  }
+
+  std::unique_ptr<pfs::recursive_directory_iterator>
+  recursive_directory_iterator(const path &p) const override {
+    error_code ec;
+    auto it = recursive_directory_iterator(p, ec);
+    if (ec) {
+      throw filesystem_error("recursive_directory_iterator", p, ec);
+    }
+    return it;
+  }
+
+  std::unique_ptr<pfs::recursive_directory_iterator>
+  recursive_directory_iterator(const path &p, error_code &ec) const override {
+    return std::make_unique<snapshot_recursive_directory_iterator>(
+        list(p, true, ec));
+  }
+};
+
+} // namespace pfs
+
+#endif
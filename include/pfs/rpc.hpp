@@ -0,0 +1,577 @@
+#ifndef INCLUDED_PFS_RPC_HPP
+#define INCLUDED_PFS_RPC_HPP
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <pfs/filesystem.hpp>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/**
+ * @brief The protocol spoken between @c remote_filesystem and a server.
+ *
+ * @details A connection carries frames in both directions. Each frame starts
+ * with its length as a 32-bit integer, not counting the length itself. A
+ * request frame continues with a request id and an @c opcode, followed by the
+ * arguments. A response frame continues with the id of its request and an
+ * error value, followed by the results when the error value is zero. Error
+ * values are @c std::errc values. Integers are little-endian, and strings
+ * and paths are a 32-bit length followed by their bytes.
+ *
+ * Servers answer requests in the order they arrive, so a client may send many
+ * requests before reading any response. Servers write their responses only
+ * once they have no more requests buffered, so a batch of requests that
+ * arrives together is answered together.
+ *
+ * Available on POSIX only.
+ */
+namespace pfs::rpc {
+
+/**
+ * @brief The operations a server performs.
+ */
+enum class opcode : std::uint8_t {
+  status = 1,
+  file_size,
+  create_directory,
+  create_directories,
+  remove,
+  remove_all,
+  rename,
+  list,
+  list_recursive,
+  open,
+  write,
+  write_all,
+};
+
+/**
+ * @brief A reliable, ordered byte stream between a client and a server.
+ */
+class transport {
+public:
+  virtual ~transport() = default;
+
+  /**
+   * @brief Reads at least one byte, blocking until one is available.
+   *
+   * @return The number of bytes read, or zero at the end of the stream or on
+   * error.
+   */
+  virtual std::size_t read_some(char *data, std::size_t size,
+                                error_code &ec) = 0;
+
+  /**
+   * @brief Writes all of the bytes, blocking until they have been written.
+   */
+  virtual void write(const char *data, std::size_t size, error_code &ec) = 0;
+};
+
+/**
+ * @brief A transport over a connected stream socket.
+ */
+class socket_transport final : public transport {
+private:
+  int fd_;
+
+public:
+  /**
+   * @brief Takes ownership of a connected socket.
+   */
+  explicit socket_transport(int fd) : fd_(fd) {}
+
+  socket_transport(const socket_transport &) = delete;
+  socket_transport &operator=(const socket_transport &) = delete;
+
+  ~socket_transport() override { ::close(fd_); }
+
+  /**
+   * @brief Connects to a server listening on a Unix domain socket.
+   */
+  static std::unique_ptr<socket_transport>
+  connect(const path &socket_path, error_code &ec) {
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    if (socket_path.native().size() >= sizeof(addr.sun_path)) {
+      ec = std::make_error_code(std::errc::filename_too_long);
+      return nullptr;
+    }
+    std::strcpy(addr.sun_path, socket_path.c_str());
+    int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+      ec = error_code(errno, std::generic_category());
+      return nullptr;
+    }
+    if (::connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) <
+        0) {
+      ec = error_code(errno, std::generic_category());
+      ::close(fd);
+      return nullptr;
+    }
+    ec.clear();
+    return std::make_unique<socket_transport>(fd);
+  }
+
+  std::size_t read_some(char *data, std::size_t size,
+                        error_code &ec) override {
+    for (;;) {
+      auto n = ::read(fd_, data, size);
+      if (n >= 0) {
+        ec.clear();
+        return static_cast<std::size_t>(n);
+      }
+      if (errno != EINTR) {
+        ec = error_code(errno, std::generic_category());
+        return 0;
+      }
+    }
+  }
+
+  void write(const char *data, std::size_t size, error_code &ec) override {
+    while (size > 0) {
+      auto n = ::send(fd_, data, size, MSG_NOSIGNAL);
+      if (n < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        ec = error_code(errno, std::generic_category());
+        return;
+      }
+      data += n;
+      size -= static_cast<std::size_t>(n);
+    }
+    ec.clear();
+  }
+};
+
+/**
+ * @brief Creates a Unix domain socket listening at @c socket_path.
+ *
+ * @return The listening socket, or -1 on error.
+ */
+inline int listen(const path &socket_path, error_code &ec) {
+  sockaddr_un addr{};
+  addr.sun_family = AF_UNIX;
+  if (socket_path.native().size() >= sizeof(addr.sun_path)) {
+    ec = std::make_error_code(std::errc::filename_too_long);
+    return -1;
+  }
+  std::strcpy(addr.sun_path, socket_path.c_str());
+  int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0 ||
+      ::bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0 ||
+      ::listen(fd, SOMAXCONN) < 0) {
+    ec = error_code(errno, std::generic_category());
+    if (fd >= 0) {
+      ::close(fd);
+    }
+    return -1;
+  }
+  ec.clear();
+  return fd;
+}
+
+/**
+ * @brief Appends values to a frame.
+ */
+class writer {
+private:
+  std::string &out_;
+
+public:
+  explicit writer(std::string &out) : out_(out) {}
+
+  void u8(std::uint8_t v) { out_.push_back(static_cast<char>(v)); }
+
+  void u32(std::uint32_t v) {
+    for (int i = 0; i < 4; ++i) {
+      out_.push_back(static_cast<char>(v >> (8 * i)));
+    }
+  }
+
+  void u64(std::uint64_t v) {
+    for (int i = 0; i < 8; ++i) {
+      out_.push_back(static_cast<char>(v >> (8 * i)));
+    }
+  }
+
+  void str(std::string_view s) {
+    u32(static_cast<std::uint32_t>(s.size()));
+    out_.append(s);
+  }
+
+  void path(const pfs::path &p) { str(p.native()); }
+
+  /**
+   * @brief Reserves room for a 32-bit value to be filled in by @c patch.
+   *
+   * @return The position of the value.
+   */
+  std::size_t placeholder() {
+    auto pos = out_.size();
+    u32(0);
+    return pos;
+  }
+
+  void patch(std::size_t pos, std::uint32_t v) {
+    for (int i = 0; i < 4; ++i) {
+      out_[pos + i] = static_cast<char>(v >> (8 * i));
+    }
+  }
+
+  /**
+   * @brief Starts a frame.
+   *
+   * @return The position to pass to @c end_frame.
+   */
+  std::size_t begin_frame() { return placeholder(); }
+
+  /**
+   * @brief Fills in the length of a frame once all of it is written.
+   */
+  void end_frame(std::size_t start) {
+    patch(start, static_cast<std::uint32_t>(out_.size() - start - 4));
+  }
+};
+
+/**
+ * @brief Reads values from a frame.
+ *
+ * @details Reading past the end of the frame yields zeros and empty strings,
+ * and marks the reader as failed.
+ */
+class reader {
+private:
+  std::string_view in_;
+  bool failed_{false};
+
+  bool take(std::size_t n) {
+    if (in_.size() < n) {
+      failed_ = true;
+      in_ = {};
+      return false;
+    }
+    return true;
+  }
+
+  template <typename T> T integer() {
+    T v = 0;
+    if (take(sizeof(T))) {
+      for (std::size_t i = 0; i < sizeof(T); ++i) {
+        v |= static_cast<T>(static_cast<unsigned char>(in_[i])) << (8 * i);
+      }
+      in_.remove_prefix(sizeof(T));
+    }
+    return v;
+  }
+
+public:
+  explicit reader(std::string_view in) : in_(in) {}
+
+  bool failed() const { return failed_; }
+
+  std::uint8_t u8() { return integer<std::uint8_t>(); }
+
+  std::uint32_t u32() { return integer<std::uint32_t>(); }
+
+  std::uint64_t u64() { return integer<std::uint64_t>(); }
+
+  std::string_view str() {
+    auto n = u32();
+    if (!take(n)) {
+      return {};
+    }
+    auto s = in_.substr(0, n);
+    in_.remove_prefix(n);
+    return s;
+  }
+
+  pfs::path path() { return pfs::path(str()); }
+};
+
+/**
+ * @brief Buffers frames in both directions over a transport.
+ */
+class channel {
+private:
+  transport &transport_;
+  std::string in_;
+  std::size_t in_pos_{0};
+  std::string out_;
+
+  /**
+   * @brief Reads until at least @c n unconsumed bytes are buffered.
+   */
+  bool fill(std::size_t n, error_code &ec) {
+    if (in_pos_ > 0 && in_.size() - in_pos_ < n) {
+      in_.erase(0, in_pos_);
+      in_pos_ = 0;
+    }
+    while (in_.size() - in_pos_ < n) {
+      // Grow with the data received rather than with the length announced.
+      auto old = in_.size();
+      in_.resize(std::max(old + 4096, std::min(in_pos_ + n, old + (1 << 20))));
+      auto got = transport_.read_some(in_.data() + old, in_.size() - old, ec);
+      in_.resize(old + got);
+      if (got == 0) {
+        if (!ec) {
+          ec = std::make_error_code(std::errc::connection_aborted);
+        }
+        return false;
+      }
+    }
+    return true;
+  }
+
+public:
+  /// Largest frame, without its length, that a channel reads.
+  static constexpr std::uint32_t max_frame_size = 256u << 20;
+
+  explicit channel(transport &t) : transport_(t) {}
+
+  /**
+   * @brief Reads the next frame, without its length.
+   *
+   * @return A view of the frame, valid until the next call, or an empty view
+   * with @c ec set if the stream ended or failed, or to @c bad_message if
+   * the frame is longer than @c max_frame_size.
+   */
+  std::string_view read_frame(error_code &ec) {
+    if (!fill(4, ec)) {
+      return {};
+    }
+    auto size = reader(std::string_view(in_).substr(in_pos_, 4)).u32();
+    if (size > max_frame_size) {
+      ec = std::make_error_code(std::errc::bad_message);
+      return {};
+    }
+    if (!fill(4 + std::size_t(size), ec)) {
+      return {};
+    }
+    auto frame = std::string_view(in_).substr(in_pos_ + 4, size);
+    in_pos_ += 4 + std::size_t(size);
+    ec.clear();
+    return frame;
+  }
+
+  /**
+   * @brief Whether a complete frame has been received but not yet read.
+   */
+  bool frame_buffered() const {
+    auto avail = in_.size() - in_pos_;
+    return avail >= 4 &&
+           avail - 4 >= reader(std::string_view(in_).substr(in_pos_, 4)).u32();
+  }
+
+  /**
+   * @brief The buffer of frames waiting to be sent.
+   */
+  std::string &output() { return out_; }
+
+  /**
+   * @brief Sends the buffered frames.
+   */
+  void flush(error_code &ec) {
+    ec.clear();
+    if (!out_.empty()) {
+      transport_.write(out_.data(), out_.size(), ec);
+      out_.clear();
+    }
+  }
+};
+
+namespace detail {
+
+/**
+ * @brief Performs one request and writes its results.
+ */
+inline void perform(filesystem &fs, opcode op, reader &in, writer &out,
+                    error_code &ec) {
+  switch (op) {
+  case opcode::status: {
+    auto type = fs.status(in.path(), ec).type();
+    if (type == file_type::not_found) {
+      // Backends differ on whether a missing file is an error.
+      ec.clear();
+    }
+    out.u8(static_cast<std::uint8_t>(type));
+    break;
+  }
+  case opcode::file_size:
+    out.u64(fs.file_size(in.path(), ec));
+    break;
+  case opcode::create_directory:
+    out.u8(fs.create_directory(in.path(), ec));
+    break;
+  case opcode::create_directories:
+    out.u8(fs.create_directories(in.path(), ec));
+    break;
+  case opcode::remove:
+    out.u8(fs.remove(in.path(), ec));
+    break;
+  case opcode::remove_all:
+    out.u64(fs.remove_all(in.path(), ec));
+    break;
+  case opcode::rename: {
+    auto old_p = in.path();
+    fs.rename(old_p, in.path(), ec);
+    break;
+  }
+  case opcode::list: {
+    auto p = in.path();
+    auto it = fs.directory_iterator(p, ec);
+    auto count = out.placeholder();
+    std::uint32_t n = 0;
+    for (; !ec && !it->at_end(); it->increment(ec), ++n) {
+      out.path(it->path().filename());
+      out.u8(static_cast<std::uint8_t>(it->status().type()));
+    }
+    out.patch(count, n);
+    break;
+  }
+  case opcode::list_recursive: {
+    auto p = in.path();
+    auto it = fs.recursive_directory_iterator(p, ec);
+    auto count = out.placeholder();
+    std::uint32_t n = 0;
+    for (; !ec && !it->at_end(); it->increment(ec), ++n) {
+      out.path(it->path().lexically_relative(p));
+      out.u8(static_cast<std::uint8_t>(it->status().type()));
+      out.u32(static_cast<std::uint32_t>(it->depth()));
+    }
+    out.patch(count, n);
+    break;
+  }
+  case opcode::open: {
+    auto p = in.path();
+    auto mode = static_cast<std::ios_base::openmode>(in.u32());
+    auto file = fs.open_file(p, mode);
+    if (file->fail()) {
+      ec = std::make_error_code(fs.is_directory(p)
+                                    ? std::errc::is_a_directory
+                                    : std::errc::no_such_file_or_directory);
+      break;
+    }
+    std::ostringstream content;
+    if (!(mode & std::ios_base::in) && (mode & std::ios_base::app)) {
+      file = fs.open_file(p, std::ios_base::in);
+    }
+    if ((mode & (std::ios_base::in | std::ios_base::app)) &&
+        file->peek() != std::char_traits<char>::eof()) {
+      content << file->rdbuf();
+    }
+    out.str(content.str());
+    break;
+  }
+  case opcode::write: {
+    auto p = in.path();
+    auto content = in.str();
+    auto file = fs.open_file(p, std::ios_base::out | std::ios_base::trunc);
+    if (!file->write(content.data(), content.size()).flush()) {
+      ec = std::make_error_code(std::errc::io_error);
+    }
+    break;
+  }
+  case opcode::write_all: {
+    atomic_write_options options;
+    auto sync = in.u8();
+    options.sync = static_cast<atomic_sync>(sync);
+    std::vector<std::pair<pfs::path, std::string_view>> files;
+    // Grows with the files read rather than with the count announced.
+    for (auto n = in.u32(); n > 0 && !in.failed(); --n) {
+      auto p = in.path();
+      files.emplace_back(std::move(p), in.str());
+    }
+    if (in.failed() || sync > static_cast<std::uint8_t>(atomic_sync::group)) {
+      ec = std::make_error_code(std::errc::bad_message);
+      break;
+    }
+    auto stats = fs.write_all(files, options, ec);
+    out.u64(stats.files);
+    out.u64(stats.commits);
+    out.u64(stats.file_syncs);
+    out.u64(stats.dir_syncs);
+    out.u64(stats.fs_syncs);
+    break;
+  }
+  default:
+    ec = std::make_error_code(std::errc::operation_not_supported);
+    break;
+  }
+}
+
+} // namespace detail
+
+/**
+ * @brief Answers requests from a connection until it closes.
+ *
+ * @param fs The filesystem the requests operate on.
+ * @param t The connection.
+ * @param fs_mutex If not null, held while each request is performed, so that
+ * several connections may share @c fs.
+ */
+inline void serve(filesystem &fs, transport &t,
+                  std::mutex *fs_mutex = nullptr) {
+  channel ch(t);
+  error_code io_ec;
+  for (;;) {
+    auto frame = ch.read_frame(io_ec);
+    if (io_ec) {
+      return;
+    }
+    reader in(frame);
+    auto id = in.u32();
+    auto op = static_cast<opcode>(in.u8());
+    writer out(ch.output());
+    auto start = out.begin_frame();
+    out.u32(id);
+    auto status = out.placeholder();
+    auto results = ch.output().size();
+    error_code ec;
+    try {
+      std::unique_lock<std::mutex> lock;
+      if (fs_mutex) {
+        lock = std::unique_lock<std::mutex>(*fs_mutex);
+      }
+      detail::perform(fs, op, in, out, ec);
+      if (in.failed()) {
+        ec = std::make_error_code(std::errc::bad_message);
+      }
+    } catch (const filesystem_error &e) {
+      ec = e.code();
+    } catch (const std::bad_alloc &) {
+      ec = std::make_error_code(std::errc::not_enough_memory);
+    } catch (const std::exception &) {
+      ec = std::make_error_code(std::errc::io_error);
+    }
+    if (!ec && ch.output().size() - start - 4 > channel::max_frame_size) {
+      ec = std::make_error_code(std::errc::file_too_large);
+    }
+    if (ec) {
+      ch.output().resize(results);
+      out.patch(status, static_cast<std::uint32_t>(ec.value()));
+    }
+    out.end_frame(start);
+    if (!ch.frame_buffered()) {
+      ch.flush(io_ec);
+      if (io_ec) {
+        return;
+      }
+    }
+  }
+}
+
+} // namespace pfs::rpc
+
+#endif
@@ -0,0 +1,1195 @@
+#ifndef INCLUDED_PFS_SHARED_FAKE_FILESYSTEM_HPP
+#define INCLUDED_PFS_SHARED_FAKE_FILESYSTEM_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <pfs/filesystem.hpp>
+#include <pfs/snapshot_iterator.hpp>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace pfs {
+
+/**
+ * @brief An in-memory filesystem that several processes can attach to.
+ *
+ * @details Behaves like @c fake_filesystem, but keeps its tree in a POSIX
+ * shared memory object, so every process that attaches by the same name sees
+ * the same tree without serializing it. Nodes refer to each other by offsets
+ * into the mapping, because each process may map it at a different address.
+ * A process-shared reader/writer lock protects the tree: queries take it for
+ * reading and modifications for writing. When uncontended, neither takes a
+ * system call.
+ *
+ * The tree has a single root directory, "/". The current directory belongs
+ * to each instance, like a process's own working directory. The size of the
+ * mapping is fixed when the tree is created; modifications that would exceed
+ * it fail with @c std::errc::not_enough_memory. A process that dies while
+ * holding the lock leaves it locked, and the tree must then be destroyed.
+ *
+ * Directory iterators iterate a snapshot of the tree taken when they were
+ * created. Streams returned by @c open_file must not outlive the instance
+ * that opened them.
+ *
+ * Available on POSIX only.
+ */
+class shared_fake_filesystem final : public filesystem {
+private:
+  /**
+   * @brief Byte offset into the mapping. The null offset is 0.
+   */
+  using offset = std::uint64_t;
+
+  /**
+   * @brief Identifies an initialized mapping.
+   */
+  static constexpr std::uint64_t magic = 0x326d68732d736670; // "pfs-shm2"
+
+  /**
+   * @brief Node in the shared tree.
+   */
+  struct node {
+    offset parent; ///< Directory containing this node. The root is its own
+                   ///< parent. Next free node once the node is freed.
+    std::uint64_t id; ///< Unique while the node exists. 0 once freed.
+                      ///< Node blocks are only ever reused as nodes, so an
+                      ///< (offset, id) pair never matches a different node.
+    offset name;      ///< Characters of the name.
+    offset data;      ///< Sorted children if this is a directory, or the
+                      ///< contents if this is a regular file.
+    std::uint64_t size;        ///< Number of children, or bytes of contents.
+    std::uint64_t capacity;    ///< Capacity of @c data, in the same units.
+    std::uint32_t name_length; ///< Number of characters in the name.
+    file_type type;            ///< Type of node: regular file, directory.
+  };
+
+  /**
+   * @brief Number of allocator size classes. Class @c i holds blocks of
+   * 2^i bytes.
+   */
+  static constexpr int size_classes = 48;
+
+  /**
+   * @brief State at the start of the mapping.
+   */
+  struct header {
+    std::uint64_t magic;             ///< Set to @c magic once initialized.
+    std::atomic<std::uint32_t> ready; ///< Nonzero once initialized.
+    std::uint64_t size;              ///< Size of the mapping in bytes.
+    pthread_rwlock_t lock;           ///< Guards everything below.
+    offset root;                     ///< The root directory.
+    offset bump;                     ///< Start of never-allocated space.
+    std::uint64_t next_id;           ///< Last node id handed out.
+    offset free_lists[size_classes]; ///< Freed blocks by size class.
+    offset free_nodes;               ///< Freed nodes, linked by parent.
+  };
+
+  /**
+   * @brief Holds a reader/writer lock for reading.
+   */
+  class read_lock {
+  private:
+    pthread_rwlock_t *lock_;
+
+  public:
+    explicit read_lock(pthread_rwlock_t &lock) : lock_(&lock) {
+      pthread_rwlock_rdlock(lock_);
+    }
+    read_lock(const read_lock &) = delete;
+    read_lock &operator=(const read_lock &) = delete;
+    ~read_lock() { pthread_rwlock_unlock(lock_); }
+  };
+
+  /**
+   * @brief Holds a reader/writer lock for writing.
+   */
+  class write_lock {
+  private:
+    pthread_rwlock_t *lock_;
+
+  public:
+    explicit write_lock(pthread_rwlock_t &lock) : lock_(&lock) {
+      pthread_rwlock_wrlock(lock_);
+    }
+    write_lock(const write_lock &) = delete;
+    write_lock &operator=(const write_lock &) = delete;
+    ~write_lock() { pthread_rwlock_unlock(lock_); }
+  };
+
+  char *base_{nullptr}; ///< Address of the mapping in this process.
+  std::size_t size_{0}; ///< Size of the mapping.
+  path cwd_{"/"};       ///< Current directory of this instance.
+
+  header &hdr() const noexcept { return *reinterpret_cast<header *>(base_); }
+
+  template <typename T> T *ptr(offset o) const noexcept {
+    return reinterpret_cast<T *>(base_ + o);
+  }
+
+  node &at(offset o) const noexcept { return *ptr<node>(o); }
+
+  /**
+   * @brief Allocates a block from the mapping.
+   *
+   * @details Blocks are rounded up to a power of two, with an 8 byte prefix
+   * recording the size class, and are recycled through per-class free lists.
+   *
+   * @pre The write lock is held.
+   * @throw std::bad_alloc if the mapping is full.
+   */
+  offset allocate(std::uint64_t bytes) {
+    int cls = 4;
+    while ((std::uint64_t{1} << cls) < bytes + sizeof(std::uint64_t)) {
+      ++cls;
+    }
+    if (cls >= size_classes) {
+      throw std::bad_alloc();
+    }
+    auto &h = hdr();
+    offset block = h.free_lists[cls];
+    if (block) {
+      h.free_lists[cls] = *ptr<offset>(block + sizeof(std::uint64_t));
+    } else {
+      auto block_size = std::uint64_t{1} << cls;
+      if (h.bump + block_size > h.size) {
+        throw std::bad_alloc();
+      }
+      block = h.bump;
+      h.bump += block_size;
+      *ptr<std::uint64_t>(block) = cls;
+    }
+    return block + sizeof(std::uint64_t);
+  }
+
+  /**
+   * @brief Returns a block to its free list. Does nothing for offset 0.
+   *
+   * @pre The write lock is held.
+   */
+  void deallocate(offset p) noexcept {
+    if (p) {
+      auto block = p - sizeof(std::uint64_t);
+      auto cls = *ptr<std::uint64_t>(block);
+      *ptr<offset>(p) = hdr().free_lists[cls];
+      hdr().free_lists[cls] = block;
+    }
+  }
+
+  /**
+   * @brief Allocates a node, reusing a freed one if there is one.
+   *
+   * @details Nodes have their own free list rather than sharing the size
+   * classes, so that a freed node's memory is never reused for names or
+   * contents.
+   *
+   * @pre The write lock is held.
+   * @throw std::bad_alloc if the mapping is full.
+   */
+  offset allocate_node() {
+    auto &h = hdr();
+    if (offset n = h.free_nodes) {
+      h.free_nodes = at(n).parent;
+      return n;
+    }
+    return allocate(sizeof(node));
+  }
+
+  /**
+   * @brief Returns a node to the node free list, marking it freed.
+   *
+   * @pre The write lock is held.
+   */
+  void deallocate_node(offset n) noexcept {
+    auto &nd = at(n);
+    nd.id = 0;
+    nd.parent = hdr().free_nodes;
+    hdr().free_nodes = n;
+  }
+
+  std::string_view name_of(const node &n) const noexcept {
+    return {ptr<char>(n.name), n.name_length};
+  }
+
+  offset *children(const node &dir) const noexcept {
+    return ptr<offset>(dir.data);
+  }
+
+  /**
+   * @brief Finds where a name belongs among a directory's sorted children.
+   *
+   * @return Pointer to the first child whose name is not less than @c name,
+   * and whether that child's name equals @c name.
+   */
+  std::pair<offset *, bool> find_child(const node &dir,
+                                       std::string_view name) const noexcept {
+    auto first = children(dir);
+    auto last = first + dir.size;
+    auto it = std::lower_bound(first, last, name,
+                               [this](offset child, std::string_view name) {
+                                 return name_of(at(child)) < name;
+                               });
+    return {it, it != last && name_of(at(*it)) == name};
+  }
+
+  /**
+   * @brief Makes a path absolute and lexically normal, without a trailing
+   * separator.
+   */
+  path normalize(const path &p) const {
+    auto ret = (p.is_absolute() ? p : cwd_ / p).lexically_normal();
+    if (ret.filename().empty() && ret.has_relative_path()) {
+      ret = ret.parent_path();
+    }
+    return ret;
+  }
+
+  /**
+   * @brief Finds the node at a normalized path.
+   *
+   * @pre The lock is held.
+   * @return The node, or 0 if it does not exist.
+   */
+  offset find(const path &normal) const noexcept {
+    offset n = hdr().root;
+    for (auto it = std::next(normal.begin()); it != normal.end(); ++it) {
+      const auto &dir = at(n);
+      if (dir.type != file_type::directory) {
+        return 0;
+      }
+      auto [pos, found] = find_child(dir, it->native());
+      if (!found) {
+        return 0;
+      }
+      n = *pos;
+    }
+    return n;
+  }
+
+  /**
+   * @brief Finds the node at a path, following parent links for "..".
+   *
+   * @details Unlike @c find, does not need a normalized path, so queries can
+   * skip the allocations of normalizing.
+   *
+   * @pre The lock is held.
+   * @return The node, or 0 if it does not exist.
+   */
+  offset lookup(const path &p) const noexcept {
+    offset n = p.is_absolute() ? hdr().root : find(cwd_);
+    for (const auto &part : p) {
+      const auto &name = part.native();
+      if (!n) {
+        return 0;
+      } else if (name == "/") {
+        n = hdr().root;
+      } else if (name.empty() || name == ".") {
+        continue;
+      } else if (name == "..") {
+        n = at(n).parent;
+      } else if (at(n).type != file_type::directory) {
+        return 0;
+      } else {
+        auto [pos, found] = find_child(at(n), name);
+        n = found ? *pos : 0;
+      }
+    }
+    return n;
+  }
+
+  /**
+   * @brief Creates an unlinked node.
+   *
+   * @pre The write lock is held.
+   * @throw std::bad_alloc if the mapping is full.
+   */
+  offset make_node(std::string_view name, file_type type) {
+    auto name_offset = allocate(name.size());
+    offset n;
+    try {
+      n = allocate_node();
+    } catch (...) {
+      deallocate(name_offset);
+      throw;
+    }
+    std::memcpy(ptr<char>(name_offset), name.data(), name.size());
+    auto &nd = at(n);
+    nd = node{};
+    nd.id = ++hdr().next_id;
+    nd.name = name_offset;
+    nd.name_length = static_cast<std::uint32_t>(name.size());
+    nd.type = type;
+    return n;
+  }
+
+  /**
+   * @brief Ensures a directory has room for one more child.
+   *
+   * @pre The write lock is held.
+   * @throw std::bad_alloc if the mapping is full.
+   */
+  void reserve_child(offset dir_offset) {
+    auto &dir = at(dir_offset);
+    if (dir.size == dir.capacity) {
+      auto capacity = std::max<std::uint64_t>(4, dir.capacity * 2);
+      auto data = allocate(capacity * sizeof(offset));
+      std::memcpy(ptr<offset>(data), children(dir), dir.size * sizeof(offset));
+      deallocate(dir.data);
+      dir.data = data;
+      dir.capacity = capacity;
+    }
+  }
+
+  /**
+   * @brief Links a node into a directory.
+   *
+   * @pre The write lock is held, and @c reserve_child was called.
+   */
+  void insert_child(offset dir_offset, offset child) noexcept {
+    auto &dir = at(dir_offset);
+    auto first = children(dir);
+    auto pos = find_child(dir, name_of(at(child))).first;
+    std::memmove(pos + 1, pos, (first + dir.size - pos) * sizeof(offset));
+    *pos = child;
+    ++dir.size;
+    at(child).parent = dir_offset;
+  }
+
+  /**
+   * @brief Unlinks a node from its directory.
+   *
+   * @pre The write lock is held.
+   */
+  void erase_child(offset child) noexcept {
+    auto &dir = at(at(child).parent);
+    auto first = children(dir);
+    auto pos = find_child(dir, name_of(at(child))).first;
+    std::memmove(pos, pos + 1, (first + dir.size - pos - 1) * sizeof(offset));
+    --dir.size;
+  }
+
+  /**
+   * @brief Frees an unlinked node and its descendants.
+   *
+   * @pre The write lock is held.
+   * @return Number of nodes freed.
+   */
+  std::uintmax_t free_tree(offset n) noexcept {
+    std::uintmax_t count = 1;
+    auto &nd = at(n);
+    if (nd.type == file_type::directory) {
+      for (std::uint64_t i = 0; i < nd.size; ++i) {
+        count += free_tree(children(nd)[i]);
+      }
+    }
+    deallocate(nd.data);
+    deallocate(nd.name);
+    deallocate_node(n);
+    return count;
+  }
+
+  /**
+   * @brief Replaces the contents of a file, if it still exists.
+   *
+   * @return false if the file was removed or the mapping is full.
+   */
+  bool publish(offset n, std::uint64_t id, std::string_view content) {
+    write_lock lock(hdr().lock);
+    auto &file = at(n);
+    if (file.id != id) {
+      // Removed since it was opened.
+      return true;
+    }
+    if (content.size() > file.capacity) {
+      offset data;
+      try {
+        data = allocate(content.size());
+      } catch (const std::bad_alloc &) {
+        return false;
+      }
+      deallocate(file.data);
+      file.data = data;
+      file.capacity = content.size();
+    }
+    std::memcpy(ptr<char>(file.data), content.data(), content.size());
+    file.size = content.size();
+    return true;
+  }
+
+  /**
+   * @brief Stream buffer over the contents of a shared file.
+   *
+   * @details Like @c fake_filesystem's file streams, the contents are copied
+   * when the file is opened and published back when the stream is flushed or
+   * destroyed.
+   */
+  class shared_filebuf final : public std::stringbuf {
+  private:
+    shared_fake_filesystem *fs_; ///< Filesystem that opened the file.
+    offset node_;                ///< File node.
+    std::uint64_t id_;           ///< Id of the file node when opened.
+    bool writable_;              ///< False if opened for reading only.
+
+  public:
+    shared_filebuf(shared_fake_filesystem &fs, offset n, std::uint64_t id,
+                   const std::string &content, std::ios_base::openmode mode)
+        : std::stringbuf(content, (mode & std::ios_base::app)
+                                      ? mode | std::ios_base::out
+                                      : mode),
+          fs_(&fs), node_(n), id_(id),
+          writable_(mode & (std::ios_base::out | std::ios_base::app)) {}
+
+    ~shared_filebuf() override { sync(); }
+
+  protected:
+    int sync() override {
+      if (writable_ && !fs_->publish(node_, id_, str())) {
+        return -1;
+      }
+      return 0;
+    }
+  };
+
+  /**
+   * @brief File stream returned by @c open_file.
+   */
+  class shared_file_stream final : public std::iostream {
+  private:
+    shared_filebuf buf_;
+
+  public:
+    shared_file_stream(shared_fake_filesystem &fs, offset n, std::uint64_t id,
+                       const std::string &content,
+                       std::ios_base::openmode mode)
+        : std::iostream(nullptr), buf_(fs, n, id, content, mode) {
+      rdbuf(&buf_);
+    }
+  };
+
+  /**
+   * @brief Lists a directory, or its whole subtree in depth-first order.
+   *
+   * @pre The read lock is held, and @c dir is a directory.
+   */
+  std::vector<snapshot_entry> snapshot(offset dir, const path &p,
+                                       bool recursive) const {
+    std::vector<snapshot_entry> entries;
+    std::vector<std::pair<offset, std::uint64_t>> stack{{dir, 0}};
+    std::vector<pfs::path> paths{p};
+    while (!stack.empty()) {
+      auto &[n, i] = stack.back();
+      const auto &nd = at(n);
+      if (i == nd.size) {
+        stack.pop_back();
+        paths.pop_back();
+        continue;
+      }
+      const auto &child = at(children(nd)[i++]);
+      entries.push_back({paths.back() / name_of(child), child.type,
+                         static_cast<int>(stack.size()) - 1});
+      if (recursive && child.type == file_type::directory) {
+        paths.push_back(entries.back().path);
+        stack.emplace_back(children(nd)[i - 1], 0);
+      }
+    }
+    return entries;
+  }
+
+  /**
+   * @brief Initializes a newly created mapping.
+   */
+  void initialize() {
+    auto &h = *new (base_) header();
+    h.magic = magic;
+    h.size = size_;
+    h.bump = (sizeof(header) + 63) / 64 * 64;
+    pthread_rwlockattr_t attr;
+    pthread_rwlockattr_init(&attr);
+    pthread_rwlockattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_rwlock_init(&h.lock, &attr);
+    pthread_rwlockattr_destroy(&attr);
+    h.root = make_node("/", file_type::directory);
+    at(h.root).parent = h.root;
+    h.ready.store(1, std::memory_order_release);
+  }
+
+  /**
+   * @brief Maps a shared memory object, creating and initializing it if it
+   * does not exist.
+   */
+  void attach(const std::string &name, std::size_t size, error_code &ec) {
+    using namespace std::chrono_literals;
+    auto fail = [&ec](int fd) {
+      ec.assign(errno, std::generic_category());
+      if (fd >= 0) {
+        ::close(fd);
+      }
+    };
+    bool created = true;
+    int fd = ::shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0 && errno == EEXIST) {
+      created = false;
+      fd = ::shm_open(name.c_str(), O_RDWR, 0);
+    }
+    if (fd < 0) {
+      return fail(fd);
+    }
+    auto deadline = std::chrono::steady_clock::now() + 10s;
+    if (created) {
+      if (::ftruncate(fd, static_cast<off_t>(size)) != 0) {
+        fail(fd);
+        ::shm_unlink(name.c_str());
+        return;
+      }
+    } else {
+      // Wait for the creator to size the object.
+      struct stat st {};
+      while (::fstat(fd, &st) == 0 && st.st_size == 0) {
+        if (std::chrono::steady_clock::now() > deadline) {
+          errno = ETIMEDOUT;
+          return fail(fd);
+        }
+        std::this_thread::sleep_for(1ms);
+      }
+      size = static_cast<std::size_t>(st.st_size);
+    }
+    void *base =
+        ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED) {
+      return fail(fd);
+    }
+    ::close(fd);
+    base_ = static_cast<char *>(base);
+    size_ = size;
+    if (created) {
+      initialize();
+      return;
+    }
+    // Wait for the creator to initialize the tree.
+    while (!hdr().ready.load(std::memory_order_acquire)) {
+      if (std::chrono::steady_clock::now() > deadline) {
+        ec = std::make_error_code(std::errc::timed_out);
+        return;
+      }
+      std::this_thread::sleep_for(1ms);
+    }
+    if (hdr().magic != magic) {
+      ec = std::make_error_code(std::errc::invalid_argument);
+    }
+  }
+
+public:
+  /**
+   * @brief Default size of a new shared tree. Pages are only committed when
+   * used.
+   */
+  static constexpr std::size_t default_size = std::size_t{64} << 20;
+
+  /**
+   * @brief Attaches to a shared tree, creating it if it does not exist.
+   *
+   * @details A new tree consists of an empty root directory. The current
+   * directory of the new instance is the root directory.
+   *
+   * @param name Name of the shared memory object, as for @c shm_open. Should
+   * begin with a slash, e.g. "/pfs-test".
+   * @param size Size of the mapping in bytes, if the tree is created.
+   * Ignored when attaching to an existing tree.
+   * @throw std::invalid_argument if @c size is too small to hold a tree.
+   * @throw filesystem_error if the shared memory object cannot be created,
+   * opened or mapped.
+   */
+  explicit shared_fake_filesystem(const std::string &name,
+                                  std::size_t size = default_size) {
+    if (size < 4096) {
+      throw std::invalid_argument("shared_fake_filesystem size is too small");
+    }
+    error_code ec;
+    attach(name, size, ec);
+    if (ec) {
+      if (base_) {
+        ::munmap(base_, size_);
+      }
+      throw filesystem_error("shared_fake_filesystem", path(name), ec);
+    }
+  }
+
+  shared_fake_filesystem(const shared_fake_filesystem &) = delete;
+  shared_fake_filesystem &operator=(const shared_fake_filesystem &) = delete;
+
+  /**
+   * @brief Detaches from the shared tree. The tree remains until it is
+   * destroyed.
+   */
+  ~shared_fake_filesystem() override { ::munmap(base_, size_); }
+
+  /**
+   * @brief Removes the name of a shared tree.
+   *
+   * @details Instances that are attached keep working. The memory is freed
+   * when the last one detaches. A later instance with the same name creates a
+   * new tree.
+   *
+   * @return true if the tree existed.
+   */
+  static bool destroy(const std::string &name) noexcept {
+    return ::shm_unlink(name.c_str()) == 0;
+  }
+
+  /**
+   * @brief Gets the number of bytes of the mapping in use, including freed
+   * blocks that are ready for reuse.
+   */
+  std::size_t used_bytes() const {
+    read_lock lock(hdr().lock);
+    return hdr().bump;
+  }
+
+  path absolute(const path &p, error_code &ec) override {
+    ec.clear();
+    if (p.empty() || p.is_absolute()) {
+      return p;
+    }
+    return normalize(p);
+  }
+
+  path absolute(const path &p) override {
+    error_code ec;
+    auto ret = absolute(p, ec);
+    if (ec) {
+      throw filesystem_error("absolute", ec);
+    }
+    return ret;
+  }
+
+  bool create_directory(const path &p, error_code &ec) noexcept override {
+    if (p.empty()) {
+      ec = std::make_error_code(std::errc::no_such_file_or_directory);
+      return false;
+    }
+    try {
+      auto normal = normalize(p);
+      write_lock lock(hdr().lock);
+      if (auto n = find(normal)) {
+        if (at(n).type == file_type::directory) {
+          ec.clear();
+        } else {
+          ec = std::make_error_code(std::errc::not_a_directory);
+        }
+        return false;
+      }
+      auto parent = find(normal.parent_path());
+      if (!parent || at(parent).type != file_type::directory) {
+        ec = std::make_error_code(std::errc::no_such_file_or_directory);
+        return false;
+      }
+      reserve_child(parent);
+      insert_child(parent,
+                   make_node(normal.filename().native(), file_type::directory));
+      ec.clear();
+      return true;
+    } catch (const std::bad_alloc &) {
+      ec = std::make_error_code(std::errc::not_enough_memory);
+      return false;
+    }
+  }
+
+  bool create_directory(const path &p) override {
+    error_code ec;
+    bool ret = create_directory(p, ec);
+    if (ec) {
+      throw filesystem_error("create_directory", ec);
+    }
+    return ret;
+  }
+
+  bool create_directories(const path &p, error_code &ec) noexcept override {
+    if (p.empty()) {
+      ec = std::make_error_code(std::errc::no_such_file_or_directory);
+      return false;
+    }
+    try {
+      auto normal = normalize(p);
+      write_lock lock(hdr().lock);
+      offset n = hdr().root;
+      offset first = 0; // Highest directory created.
+      try {
+        for (auto it = std::next(normal.begin()); it != normal.end(); ++it) {
+          if (at(n).type != file_type::directory) {
+            // Cannot make directories under a file.
+            ec = std::make_error_code(std::errc::no_such_file_or_directory);
+            return false;
+          }
+          auto [pos, found] = find_child(at(n), it->native());
+          if (found) {
+            n = *pos;
+            continue;
+          }
+          reserve_child(n);
+          auto child = make_node(it->native(), file_type::directory);
+          insert_child(n, child);
+          n = child;
+          first = first ? first : child;
+        }
+      } catch (const std::bad_alloc &) {
+        // Remove the directories created so far, which form a chain below
+        // the first.
+        if (first) {
+          erase_child(first);
+          free_tree(first);
+        }
+        throw;
+      }
+      if (at(n).type != file_type::directory) {
+        ec = std::make_error_code(std::errc::not_a_directory);
+        return false;
+      }
+      ec.clear();
+      return first != 0;
+    } catch (const std::bad_alloc &) {
+      ec = std::make_error_code(std::errc::not_enough_memory);
+      return false;
+    }
+  }
+
+  bool create_directories(const path &p) override {
+    error_code ec;
+    bool ret = create_directories(p, ec);
+    if (ec) {
+      throw filesystem_error("create_directories", ec);
+    }
+    return ret;
+  }
+
+  path current_path(error_code &ec) const noexcept override {
+    ec.clear();
+    return cwd_;
+  }
+
+  path current_path() const override { return cwd_; }
+
+  void current_path(const path &p, error_code &ec) noexcept override {
+    if (p.empty()) {
+      ec = std::make_error_code(std::errc::no_such_file_or_directory);
+      return;
+    }
+    path normal;
+    try {
+      normal = normalize(p);
+    } catch (const std::bad_alloc &) {
+      ec = std::make_error_code(std::errc::not_enough_memory);
+      return;
+    }
+    read_lock lock(hdr().lock);
+    auto n = find(normal);
+    if (!n || at(n).type != file_type::directory) {
+      ec = std::make_error_code(std::errc::no_such_file_or_directory);
+      return;
+    }
+    cwd_ = std::move(normal);
+    ec.clear();
+  }
+
+  void current_path(const path &p) override {
+    error_code ec;
+    current_path(p, ec);
+    if (ec) {
+      throw filesystem_error("current_path", ec);
+    }
+  }
+
+  bool exists(const path &p, error_code &ec) const noexcept override {
+    return status(p, ec).type() != file_type::not_found;
+  }
+
+  bool exists(const path &p) const override {
+    error_code ec;
+    bool ret = exists(p, ec);
+    if (ec) {
+      throw filesystem_error("exists", ec);
+    }
+    return ret;
+  }
+
+  std::uintmax_t file_size(const path &p,
+                           error_code &ec) const noexcept override {
+    if (!p.empty()) {
+      read_lock lock(hdr().lock);
+      if (auto n = lookup(p)) {
+        if (at(n).type == file_type::directory) {
+          ec = std::make_error_code(std::errc::is_a_directory);
+          return static_cast<std::uintmax_t>(-1);
+        }
+        ec.clear();
+        return at(n).size;
+      }
+    }
+    ec = std::make_error_code(std::errc::no_such_file_or_directory);
+    return static_cast<std::uintmax_t>(-1);
+  }
+
+  std::uintmax_t file_size(const path &p) const override {
+    error_code ec;
+    auto ret = file_size(p, ec);
+    if (ec) {
+      throw filesystem_error("file_size", ec);
+    }
+    return ret;
+  }
+
+  bool is_directory(const path &p, error_code &ec) const noexcept override {
+    return status(p, ec).type() == file_type::directory;
+  }
+
+  bool is_directory(const path &p) const override {
+    error_code ec;
+    bool ret = is_directory(p, ec);
+    if (ec) {
+      throw filesystem_error("is_directory", ec);
+    }
+    return ret;
+  }
+
+  /**
+   * @brief Opens a regular file, following the rules of @c std::fstream.
+   *
+   * @details See @c fake_filesystem::open_file. On failure, including when the
+   * mapping is full, the returned stream has its failbit set.
+   */
+  std::unique_ptr<std::iostream>
+  open_file(const path &p, std::ios_base::openmode mode) override {
+    using std::ios_base;
+    bool create = (mode & ios_base::app) ||
+                  ((mode & ios_base::out) &&
+                   (!(mode & ios_base::in) || (mode & ios_base::trunc)));
+    bool truncate =
+        (mode & ios_base::trunc) ||
+        ((mode & ios_base::out) && !(mode & (ios_base::in | ios_base::app)));
+
+    offset file = 0;
+    std::uint64_t id = 0;
+    std::string content;
+    if (!p.empty()) {
+      try {
+        auto normal = normalize(p);
+        write_lock lock(hdr().lock);
+        file = find(normal);
+        if (file && at(file).type != file_type::regular) {
+          file = 0;
+        } else if (!file && create && normal.has_relative_path()) {
+          auto parent = find(normal.parent_path());
+          if (parent && at(parent).type == file_type::directory) {
+            reserve_child(parent);
+            file = make_node(normal.filename().native(), file_type::regular);
+            insert_child(parent, file);
+          }
+        }
+        if (file) {
+          auto &nd = at(file);
+          if (truncate) {
+            nd.size = 0;
+          }
+          content.assign(ptr<char>(nd.data), nd.size);
+          id = nd.id;
+        }
+      } catch (const std::bad_alloc &) {
+        file = 0;
+      }
+    }
+    if (!file) {
+      auto ret = std::make_unique<std::stringstream>();
+      ret->setstate(std::ios_base::failbit);
+      return ret;
+    }
+    return std::make_unique<shared_file_stream>(*this, file, id, content,
+                                                mode);
+  }
+
+  bool remove(const path &p, error_code &ec) noexcept override {
+    if (p.empty()) {
+      ec.clear();
+      return false;
+    }
+    path normal;
+    try {
+      normal = normalize(p);
+    } catch (const std::bad_alloc &) {
+      ec = std::make_error_code(std::errc::not_enough_memory);
+      return false;
+    }
+    write_lock lock(hdr().lock);
+    auto n = find(normal);
+    if (!n) {
+      ec.clear();
+      return false;
+    }
+    if (n == hdr().root) {
+      ec = std::make_error_code(std::errc::permission_denied);
+      return false;
+    }
+    if (at(n).type == file_type::directory && at(n).size != 0) {
+      ec = std::make_error_code(std::errc::directory_not_empty);
+      return false;
+    }
+    erase_child(n);
+    free_tree(n);
+    ec.clear();
+    return true;
+  }
+
+  bool remove(const path &p) override {
+    error_code ec;
+    auto ret = remove(p, ec);
+    if (ec) {
+      throw filesystem_error("remove", ec);
+    }
+    return ret;
+  }
+
+  std::uintmax_t remove_all(const path &p, error_code &ec) noexcept override {
+    if (p.empty()) {
+      ec.clear();
+      return 0;
+    }
+    path normal;
+    try {
+      normal = normalize(p);
+    } catch (const std::bad_alloc &) {
+      ec = std::make_error_code(std::errc::not_enough_memory);
+      return 0;
+    }
+    write_lock lock(hdr().lock);
+    auto n = find(normal);
+    if (!n) {
+      ec.clear();
+      return 0;
+    }
+    if (n == hdr().root) {
+      ec = std::make_error_code(std::errc::permission_denied);
+      return 0;
+    }
+    erase_child(n);
+    ec.clear();
+    return free_tree(n);
+  }
+
+  std::uintmax_t remove_all(const path &p) override {
+    error_code ec;
+    auto ret = remove_all(p, ec);
+    if (ec) {
+      throw filesystem_error("remove_all", ec);
+    }
+    return ret;
+  }
+
+  /**
+   * @brief Moves or renames a file or directory.
+   *
+   * @details Unlike @c std::filesystem::rename, never replaces an existing
+   * file or directory, as in @c fake_filesystem.
+   *
+   * @param ec Set to @c permission_denied if @c new_p exists (unless it
+   * names @c old_p itself) or @c old_p is the root, and to
+   * @c invalid_argument if @c new_p is inside the directory @c old_p.
+   */
+  void rename(const path &old_p, const path &new_p,
+              error_code &ec) noexcept override {
+    if (old_p.empty() || new_p.empty()) {
+      ec = std::make_error_code(std::errc::no_such_file_or_directory);
+      return;
+    }
+    try {
+      auto old_normal = normalize(old_p);
+      auto new_normal = normalize(new_p);
+      write_lock lock(hdr().lock);
+      auto n = find(old_normal);
+      if (!n) {
+        ec = std::make_error_code(std::errc::no_such_file_or_directory);
+        return;
+      }
+      if (old_normal == new_normal) {
+        ec.clear();
+        return;
+      }
+      if (n == hdr().root || find(new_normal)) {
+        ec = std::make_error_code(std::errc::permission_denied);
+        return;
+      }
+      auto new_parent = find(new_normal.parent_path());
+      if (!new_parent) {
+        ec = std::make_error_code(std::errc::no_such_file_or_directory);
+        return;
+      }
+      if (at(new_parent).type != file_type::directory) {
+        ec = std::make_error_code(std::errc::not_a_directory);
+        return;
+      }
+      for (auto a = new_parent; a != hdr().root; a = at(a).parent) {
+        if (a == n) {
+          // Cannot move a directory into itself.
+          ec = std::make_error_code(std::errc::invalid_argument);
+          return;
+        }
+      }
+      // Allocate first, so that nothing changes if the mapping is full.
+      reserve_child(new_parent);
+      auto name = new_normal.filename().native();
+      auto name_offset = allocate(name.size());
+      std::memcpy(ptr<char>(name_offset), name.data(), name.size());
+      erase_child(n);
+      deallocate(at(n).name);
+      at(n).name = name_offset;
+      at(n).name_length = static_cast<std::uint32_t>(name.size());
+      insert_child(new_parent, n);
+      ec.clear();
+    } catch (const std::bad_alloc &) {
+      ec = std::make_error_code(std::errc::not_enough_memory);
+    }
+  }
+
+  void rename(const path &old_p, const path &new_p) override {
+    error_code ec;
+    rename(old_p, new_p, ec);
+    if (ec) {
+      throw filesystem_error("rename", ec);
+    }
+  }
+
+  file_status status(const path &p, error_code &ec) const noexcept override {
+    ec.clear();
+    if (p.empty()) {
+      return file_status(file_type::not_found);
+    }
+    read_lock lock(hdr().lock);
+    auto n = lookup(p);
+    return file_status(n ? at(n).type : file_type::not_found);
+  }
+
+  file_status status(const path &p) const override {
+    error_code ec;
+    auto ret = status(p, ec);
+    if (ec) {
+      throw filesystem_error("status", ec);
+    }
+    return ret;
+  }
+
+  /**
+   * @brief Gets a copy of the contents of a regular file, taken in a single
+   * step under the read lock.
+   *
+   * @details The bytes are copied because other processes may move or free
+   * the contents in the mapping at any time.
+   */
+  file_view view_file(const path &p, error_code &ec) override {
+    if (p.empty()) {
+      ec = std::make_error_code(std::errc::no_such_file_or_directory);
+      return {};
+    }
+    std::string content;
+    {
+      read_lock lock(hdr().lock);
+      auto n = lookup(p);
+      if (!n) {
+        ec = std::make_error_code(std::errc::no_such_file_or_directory);
+        return {};
+      } else if (at(n).type == file_type::directory) {
+        ec = std::make_error_code(std::errc::is_a_directory);
+        return {};
+      } else if (at(n).type != file_type::regular) {
+        ec = std::make_error_code(std::errc::not_supported);
+        return {};
+      }
+      content.assign(ptr<char>(at(n).data), at(n).size);
+    }
+    ec.clear();
+    return file_view(std::move(content));
+  }
+
+  using filesystem::view_file;
+
+  bool allows_concurrent_reads() const noexcept override { return true; }
+
+  bool allows_concurrent_writes() const noexcept override { return true; }
+
+  std::unique_ptr<pfs::directory_iterator>
+  directory_iterator(const path &p, error_code &ec) const override {
+    if (p.empty()) {
+      ec = std::make_error_code(std::errc::no_such_file_or_directory);
+      return std::make_unique<snapshot_directory_iterator>();
+    }
+    read_lock lock(hdr().lock);
+    auto n = lookup(p);
+    if (!n) {
+      ec = std::make_error_code(std::errc::no_such_file_or_directory);
+      return std::make_unique<snapshot_directory_iterator>();
+    }
+    if (at(n).type != file_type::directory) {
+      ec = std::make_error_code(std::errc::not_a_directory);
+      return std::make_unique<snapshot_directory_iterator>();
+    }
+    ec.clear();
+    return std::make_unique<snapshot_directory_iterator>(
+        snapshot(n, p, false));
+  }
+
+  std::unique_ptr<pfs::directory_iterator>
+  directory_iterator(const path &p) const override {
+    error_code ec;
+    auto ret = directory_iterator(p, ec);
+    if (ec) {
+      throw filesystem_error("directory_iterator", ec);
+    }
+    return ret;
+  }
+
+  std::unique_ptr<pfs::recursive_directory_iterator>
+  recursive_directory_iterator(const path &p, error_code &ec) const override {
+    if (p.empty()) {
+      ec = std::make_error_code(std::errc::no_such_file_or_directory);
+      return std::make_unique<snapshot_recursive_directory_iterator>();
+    }
+    read_lock lock(hdr().lock);
+    auto n = lookup(p);
+    if (!n) {
+      ec = std::make_error_code(std::errc::no_such_file_or_directory);
+      return std::make_unique<snapshot_recursive_directory_iterator>();
+    }
+    if (at(n).type != file_type::directory) {
+      ec = std::make_error_code(std::errc::not_a_directory);
+      return std::make_unique<snapshot_recursive_directory_iterator>();
+    }
+    ec.clear();
+    return std::make_unique<snapshot_recursive_directory_iterator>(
+        snapshot(n, p, true));
+  }
+
+  std::unique_ptr<pfs::recursive_directory_iterator>
+  recursive_directory_iterator(const path &p) const override {
+    error_code ec;
+    auto ret = recursive_directory_iterator(p, ec);
+    if (ec) {
+      throw filesystem_error("recursive_directory_iterator", ec);
+    }
+    return ret;
+  }
+};
+
+} // namespace pfs
+
+#endif
@@ -0,0 +1,374 @@
+#ifndef INCLUDED_PFS_SHM_TRANSPORT_HPP
+#define INCLUDED_PFS_SHM_TRANSPORT_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <pfs/rpc.hpp>
+#include <string>
+#include <thread>
+
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace pfs::rpc {
+
+/**
+ * @brief A transport between two processes on one host, through a pair of
+ * rings in shared memory.
+ *
+ * @details A named shared memory object holds one ring for each direction.
+ * Each ring has a single producer and a single consumer, which exchange bytes
+ * through two counters and no locks. A side that finds its ring empty, or
+ * full, spins briefly and then sleeps on a futex; the other side only makes
+ * the system call that wakes it when it is actually asleep. Bytes written in
+ * one call become visible to the peer together, so a batch of requests costs
+ * at most one wakeup.
+ *
+ * The server creates the object and the client opens it. An object connects
+ * exactly one client to one server, and the connection ends when either side
+ * destroys its transport. A side that dies without doing so leaves the other
+ * waiting.
+ *
+ * Each side checks the index the peer writes before using it: a head more
+ * than the capacity ahead of its tail, or a tail outside the bytes written,
+ * fails the call with @c std::errc::bad_message rather than reading or
+ * writing outside the ring.
+ *
+ * Available on Linux only.
+ */
+class shm_transport final : public transport {
+private:
+  static constexpr std::uint64_t magic = 0x316e69722d736670; // "pfs-rin1"
+
+  /**
+   * @brief How many times a side checks its ring before sleeping.
+   */
+  static constexpr int spin_limit = 256;
+
+  /**
+   * @brief Indexes and wakeup state of a ring. The data follows the header.
+   *
+   * @details The indexes count bytes ever written and read, so the ring is
+   * empty when they are equal and full when they differ by the capacity.
+   * Each index is on its own cache line, written only by its owner.
+   */
+  struct ring {
+    alignas(64) std::atomic<std::uint64_t> head{0}; ///< Written by producer.
+    std::atomic<std::uint32_t> space_event{0};       ///< Futex for producer.
+    std::atomic<std::uint32_t> producer_waiting{0};
+    alignas(64) std::atomic<std::uint64_t> tail{0}; ///< Written by consumer.
+    std::atomic<std::uint32_t> data_event{0};        ///< Futex for consumer.
+    std::atomic<std::uint32_t> consumer_waiting{0};
+  };
+
+  struct header {
+    std::uint64_t magic;
+    std::uint64_t capacity;           ///< Bytes in each ring's data.
+    std::atomic<std::uint32_t> ready; ///< Nonzero once initialized.
+    std::atomic<std::uint32_t> closed[2];
+    ring rings[2]; ///< Indexed by the side that produces into the ring.
+  };
+
+  static_assert(std::atomic<std::uint64_t>::is_always_lock_free,
+                "rings need lock-free 64-bit atomics");
+
+  /**
+   * @brief The side that creates the object.
+   */
+  static constexpr int server_side = 0;
+
+  char *base_{nullptr};
+  std::size_t size_{0};
+  int side_;
+  std::uint64_t tx_head_{0}; ///< Our copy of the head of our ring.
+  std::uint64_t rx_tail_{0}; ///< Our copy of the tail of the peer's ring.
+
+  header &hdr() const { return *reinterpret_cast<header *>(base_); }
+
+  ring &tx() const { return hdr().rings[side_]; }
+
+  ring &rx() const { return hdr().rings[1 - side_]; }
+
+  char *data(int producer) const {
+    return base_ + sizeof(header) + producer * hdr().capacity;
+  }
+
+  bool peer_closed() const {
+    return hdr().closed[1 - side_].load(std::memory_order_acquire) != 0;
+  }
+
+  static void futex_wait(std::atomic<std::uint32_t> &word,
+                         std::uint32_t expected) {
+    ::syscall(SYS_futex, reinterpret_cast<std::uint32_t *>(&word), FUTEX_WAIT,
+              expected, nullptr, nullptr, 0);
+  }
+
+  static void futex_wake(std::atomic<std::uint32_t> &word) {
+    ::syscall(SYS_futex, reinterpret_cast<std::uint32_t *>(&word), FUTEX_WAKE,
+              INT_MAX, nullptr, nullptr, 0);
+  }
+
+  static void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+  }
+
+  /**
+   * @brief Blocks until @c ready returns true.
+   *
+   * @details Announces itself in @c waiting before sleeping, then checks
+   * again, so a peer that changes the ring afterwards sees the announcement
+   * and wakes it.
+   */
+  template <typename Ready>
+  static void wait(std::atomic<std::uint32_t> &waiting,
+                   std::atomic<std::uint32_t> &event, Ready ready) {
+    // With a single CPU the peer cannot make progress while we spin.
+    static const bool spin = std::thread::hardware_concurrency() > 1;
+    for (int i = 0; i < spin_limit; ++i) {
+      if (ready()) {
+        return;
+      }
+      if (spin && i < spin_limit / 2) {
+        cpu_relax();
+      } else {
+        std::this_thread::yield();
+      }
+    }
+    for (;;) {
+      auto e = event.load(std::memory_order_acquire);
+      waiting.store(1, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      if (ready()) {
+        break;
+      }
+      futex_wait(event, e);
+    }
+    waiting.store(0, std::memory_order_relaxed);
+  }
+
+  /**
+   * @brief Wakes the peer if it announced it is waiting on @c event.
+   *
+   * @pre The change the peer waits for has been stored.
+   */
+  static void notify(std::atomic<std::uint32_t> &waiting,
+                     std::atomic<std::uint32_t> &event) {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (waiting.load(std::memory_order_relaxed)) {
+      event.fetch_add(1, std::memory_order_release);
+      futex_wake(event);
+    }
+  }
+
+  shm_transport(char *base, std::size_t size, int side)
+      : base_(base), size_(size), side_(side) {}
+
+public:
+  /**
+   * @brief Default capacity of each ring.
+   */
+  static constexpr std::size_t default_capacity = std::size_t{1} << 20;
+
+  shm_transport(const shm_transport &) = delete;
+  shm_transport &operator=(const shm_transport &) = delete;
+
+  /**
+   * @brief Ends the connection, waking the peer if it waits.
+   */
+  ~shm_transport() override {
+    hdr().closed[side_].store(1, std::memory_order_release);
+    for (auto &r : hdr().rings) {
+      r.space_event.fetch_add(1, std::memory_order_release);
+      futex_wake(r.space_event);
+      r.data_event.fetch_add(1, std::memory_order_release);
+      futex_wake(r.data_event);
+    }
+    ::munmap(base_, size_);
+  }
+
+  /**
+   * @brief Creates the shared memory object for a server.
+   *
+   * @param name Name of the object, as for @c shm_open. Must not exist.
+   * @param capacity Bytes in each ring. Must be a power of two.
+   */
+  static std::unique_ptr<shm_transport>
+  create(const std::string &name, std::size_t capacity, error_code &ec) {
+    if (capacity < 64 || (capacity & (capacity - 1)) != 0) {
+      ec = std::make_error_code(std::errc::invalid_argument);
+      return nullptr;
+    }
+    int fd = ::shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0) {
+      ec.assign(errno, std::generic_category());
+      return nullptr;
+    }
+    auto size = sizeof(header) + 2 * capacity;
+    void *base = MAP_FAILED;
+    if (::ftruncate(fd, static_cast<off_t>(size)) == 0) {
+      base = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    if (base == MAP_FAILED) {
+      ec.assign(errno, std::generic_category());
+      ::close(fd);
+      ::shm_unlink(name.c_str());
+      return nullptr;
+    }
+    ::close(fd);
+    auto &h = *new (base) header();
+    h.magic = magic;
+    h.capacity = capacity;
+    h.ready.store(1, std::memory_order_release);
+    ec.clear();
+    return std::unique_ptr<shm_transport>(
+        new shm_transport(static_cast<char *>(base), size, server_side));
+  }
+
+  /**
+   * @brief Opens the shared memory object created by a server.
+   */
+  static std::unique_ptr<shm_transport> open(const std::string &name,
+                                             error_code &ec) {
+    using namespace std::chrono_literals;
+    int fd = ::shm_open(name.c_str(), O_RDWR, 0);
+    if (fd < 0) {
+      ec.assign(errno, std::generic_category());
+      return nullptr;
+    }
+    // Wait for the creator to size the object.
+    auto deadline = std::chrono::steady_clock::now() + 10s;
+    struct stat st {};
+    while (::fstat(fd, &st) == 0 &&
+           static_cast<std::size_t>(st.st_size) < sizeof(header)) {
+      if (std::chrono::steady_clock::now() > deadline) {
+        ::close(fd);
+        ec = std::make_error_code(std::errc::timed_out);
+        return nullptr;
+      }
+      std::this_thread::sleep_for(1ms);
+    }
+    auto size = static_cast<std::size_t>(st.st_size);
+    void *base =
+        ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (base == MAP_FAILED) {
+      ec.assign(errno, std::generic_category());
+      return nullptr;
+    }
+    std::unique_ptr<shm_transport> t(
+        new shm_transport(static_cast<char *>(base), size, 1 - server_side));
+    while (!t->hdr().ready.load(std::memory_order_acquire)) {
+      if (std::chrono::steady_clock::now() > deadline) {
+        ec = std::make_error_code(std::errc::timed_out);
+        return nullptr;
+      }
+      std::this_thread::sleep_for(1ms);
+    }
+    if (t->hdr().magic != magic ||
+        size != sizeof(header) + 2 * t->hdr().capacity) {
+      ec = std::make_error_code(std::errc::invalid_argument);
+      return nullptr;
+    }
+    ec.clear();
+    return t;
+  }
+
+  /**
+   * @brief Removes the name of a shared memory object. Transports that have
+   * it open keep working.
+   *
+   * @return true if the object existed.
+   */
+  static bool destroy(const std::string &name) {
+    return ::shm_unlink(name.c_str()) == 0;
+  }
+
+  std::size_t read_some(char *dst, std::size_t size, error_code &ec) override {
+    auto &r = rx();
+    auto head = r.head.load(std::memory_order_acquire);
+    if (head == rx_tail_) {
+      wait(r.consumer_waiting, r.data_event, [&] {
+        head = r.head.load(std::memory_order_acquire);
+        return head != rx_tail_ || peer_closed();
+      });
+      if (head == rx_tail_) {
+        // Closed, but bytes written before closing must still be read.
+        head = r.head.load(std::memory_order_acquire);
+        if (head == rx_tail_) {
+          ec.clear();
+          return 0;
+        }
+      }
+    }
+    auto capacity = hdr().capacity;
+    if (head - rx_tail_ > capacity) {
+      // The peer wrote more than the ring holds, or moved its head back.
+      ec = std::make_error_code(std::errc::bad_message);
+      return 0;
+    }
+    auto n = std::min<std::uint64_t>(size, head - rx_tail_);
+    auto offset = rx_tail_ & (capacity - 1);
+    auto first = std::min<std::uint64_t>(n, capacity - offset);
+    const char *src = data(1 - side_);
+    std::memcpy(dst, src + offset, first);
+    std::memcpy(dst + first, src, n - first);
+    rx_tail_ += n;
+    r.tail.store(rx_tail_, std::memory_order_release);
+    notify(r.producer_waiting, r.space_event);
+    ec.clear();
+    return static_cast<std::size_t>(n);
+  }
+
+  void write(const char *src, std::size_t size, error_code &ec) override {
+    auto &r = tx();
+    auto capacity = hdr().capacity;
+    char *dst = data(side_);
+    while (size > 0) {
+      if (peer_closed()) {
+        ec = std::make_error_code(std::errc::broken_pipe);
+        return;
+      }
+      auto tail = r.tail.load(std::memory_order_acquire);
+      if (tx_head_ - tail > capacity) {
+        // The peer read past our head, or moved its tail back.
+        ec = std::make_error_code(std::errc::bad_message);
+        return;
+      }
+      if (tx_head_ - tail == capacity) {
+        wait(r.producer_waiting, r.space_event, [&] {
+          tail = r.tail.load(std::memory_order_acquire);
+          return tx_head_ - tail != capacity || peer_closed();
+        });
+        continue;
+      }
+      auto n = std::min<std::uint64_t>(size, capacity - (tx_head_ - tail));
+      auto offset = tx_head_ & (capacity - 1);
+      auto first = std::min<std::uint64_t>(n, capacity - offset);
+      std::memcpy(dst + offset, src, first);
+      std::memcpy(dst, src + first, n - first);
+      tx_head_ += n;
+      r.head.store(tx_head_, std::memory_order_release);
+      notify(r.consumer_waiting, r.data_event);
+      src += n;
+      size -= n;
+    }
+    ec.clear();
+  }
+};
+
+} // namespace pfs::rpc
+
+#endif
@@ -0,0 +1,138 @@
+#ifndef INCLUDED_PFS_SNAPSHOT_ITERATOR_HPP
+#define INCLUDED_PFS_SNAPSHOT_ITERATOR_HPP
+
+#include <pfs/filesystem.hpp>
+#include <utility>
+#include <vector>
+
+namespace pfs {
+
+/**
+ * @brief An entry of a directory snapshot.
+ */
+struct snapshot_entry {
+  pfs::path path;
+  file_type type;
+  int depth;
+};
+
+/**
+ * @brief Iterates a directory listing taken in advance.
+ *
+ * @details Used by backends that cannot iterate their tree in place, such as
+ * trees shared with other processes or served over a connection.
+ */
+class snapshot_directory_iterator final : public pfs::directory_iterator {
+private:
+  std::vector<snapshot_entry> entries_;
+  std::size_t index_{0};
+
+public:
+  snapshot_directory_iterator() = default;
+
+  explicit snapshot_directory_iterator(std::vector<snapshot_entry> entries)
+      : entries_(std::move(entries)) {}
+
+  pfs::directory_iterator &increment() override {
+    ++index_;
+    return *this;
+  }
+
+  pfs::directory_iterator &increment(error_code &ec) override {
+    ec.clear();
+    return increment();
+  }
+
+  bool at_end() const override { return index_ >= entries_.size(); }
+
+  const pfs::path &path() const noexcept override {
+    return entries_[index_].path;
+  }
+
+  file_status status() const override {
+    return file_status(entries_[index_].type);
+  }
+
+  file_status status(error_code &ec) const override {
+    ec.clear();
+    return status();
+  }
+};
+
+/**
+ * @brief Iterates a subtree listing taken in advance, in depth-first order.
+ */
+class snapshot_recursive_directory_iterator final
+    : public pfs::recursive_directory_iterator {
+private:
+  std::vector<snapshot_entry> entries_;
+  std::size_t index_{0};
+  bool recursion_pending_{true};
+
+  /**
+   * @brief Moves to the next entry at most @c depth deep.
+   */
+  void skip_deeper_than(int depth) {
+    while (++index_ < entries_.size() && entries_[index_].depth > depth) {
+    }
+  }
+
+public:
+  snapshot_recursive_directory_iterator() = default;
+
+  explicit snapshot_recursive_directory_iterator(
+      std::vector<snapshot_entry> entries)
+      : entries_(std::move(entries)) {}
+
+  pfs::recursive_directory_iterator &increment(error_code &ec) override {
+    if (recursion_pending_) {
+      ++index_;
+    } else {
+      skip_deeper_than(entries_[index_].depth);
+    }
+    recursion_pending_ = true;
+    ec.clear();
+    return *this;
+  }
+
+  pfs::recursive_directory_iterator &increment() override {
+    error_code ec;
+    return increment(ec);
+  }
+
+  bool at_end() const override { return index_ >= entries_.size(); }
+
+  int depth() const override { return entries_[index_].depth; }
+
+  bool recursion_pending() const override { return recursion_pending_; }
+
+  void pop(error_code &ec) override {
+    skip_deeper_than(entries_[index_].depth - 1);
+    recursion_pending_ = true;
+    ec.clear();
+  }
+
+  void pop() override {
+    error_code ec;
+    pop(ec);
+  }
+
+  void disable_recursion_pending() override { recursion_pending_ = false; }
+
+  const pfs::path &path() const noexcept override {
+    return entries_[index_].path;
+  }
+
+  file_status status() const override {
+    return file_status(entries_[index_].type);
+  }
+
+  file_status status(error_code &ec) const override {
+    ec.clear();
+    return status();
+  }
+};
+
+} // namespace pfs
+
+#endif
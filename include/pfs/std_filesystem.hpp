@@ -1,8 +1,31 @@
 #ifndef INCLUDED_PFS_STD_FILESYSTEM_HPP
 #define INCLUDED_PFS_STD_FILESYSTEM_HPP
 
+#include <fstream>
+#include <pfs/file_handle.hpp>
+#include <pfs/file_view.hpp>
 #include <pfs/filesystem.hpp>
 
+#if defined(__unix__) || defined(__APPLE__)
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <climits>
+#include <condition_variable>
+#include <cstdint>
+#include <fcntl.h>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+#endif
+
 namespace pfs {
 
 class std_directory_iterator final : public directory_iterator {
@@ -73,7 +96,569 @@ public:
   file_status status(error_code &ec) const override { return it_->status(ec); }
 };
 
+#if defined(__unix__) || defined(__APPLE__)
+/**
+ * @brief A file handle over a POSIX file descriptor.
+ *
+ * @details Each call is a positional system call, repeated while the kernel
+ * transfers fewer bytes than asked, so any number of threads may read and
+ * write the handle at once. On Linux, @c preallocate and @c punch_hole call
+ * @c fallocate and @c readahead calls @c readahead; elsewhere they keep the
+ * @c file_handle defaults. Hints go to @c posix_fadvise where it exists.
+ */
+class std_file_handle final : public file_handle {
+private:
+  int fd_;
+
+  /**
+   * @brief Calls @c preadv or @c pwritev until every buffer is transferred,
+   * or a read reaches the end of the file.
+   */
+  template <typename Buffer, typename Call>
+  std::size_t transfer(const Buffer *buffers, std::size_t count,
+                       std::uint64_t offset, error_code &ec, Call call) {
+    std::vector<iovec> iov(count);
+    for (std::size_t i = 0; i < count; ++i) {
+      iov[i].iov_base = const_cast<void *>(buffers[i].data);
+      iov[i].iov_len = buffers[i].size;
+    }
+    std::size_t done = 0;
+    std::size_t first = 0;
+    while (first < count) {
+      if (iov[first].iov_len == 0) {
+        ++first;
+        continue;
+      }
+      auto n = call(fd_, &iov[first],
+                    static_cast<int>(
+                        std::min<std::size_t>(count - first, IOV_MAX)),
+                    static_cast<off_t>(offset + done));
+      if (n < 0 && errno == EINTR) {
+        continue;
+      } else if (n < 0) {
+        ec.assign(errno, std::generic_category());
+        return done;
+      } else if (n == 0) {
+        break;
+      }
+      done += static_cast<std::size_t>(n);
+      for (auto left = static_cast<std::size_t>(n); left;) {
+        auto step = std::min(left, iov[first].iov_len);
+        iov[first].iov_base = static_cast<char *>(iov[first].iov_base) + step;
+        iov[first].iov_len -= step;
+        left -= step;
+        if (iov[first].iov_len == 0) {
+          ++first;
+        }
+      }
+    }
+    ec.clear();
+    return done;
+  }
+
+#ifdef __linux__
+  /**
+   * @brief Calls @c fallocate, doing nothing for an empty range.
+   */
+  void allocate(int mode, std::uint64_t offset, std::uint64_t length,
+                error_code &ec) {
+    if (length == 0) {
+      ec.clear();
+      return;
+    }
+    if (::fallocate(fd_, mode, static_cast<off_t>(offset),
+                    static_cast<off_t>(length)) != 0) {
+      ec.assign(errno, std::generic_category());
+      return;
+    }
+    ec.clear();
+  }
+#endif
+
+public:
+  /**
+   * @param fd An open file descriptor, which the handle owns.
+   */
+  explicit std_file_handle(int fd) noexcept : fd_(fd) {}
+  std_file_handle(const std_file_handle &) = delete;
+  std_file_handle &operator=(const std_file_handle &) = delete;
+  ~std_file_handle() override { ::close(fd_); }
+
+  using file_handle::advise;
+  using file_handle::allocation;
+  using file_handle::preadv;
+  using file_handle::preallocate;
+  using file_handle::punch_hole;
+  using file_handle::pwritev;
+  using file_handle::readahead;
+  using file_handle::size;
+  using file_handle::sync;
+
+  int native_handle() const noexcept { return fd_; }
+
+  std::size_t preadv(const mutable_buffer *buffers, std::size_t count,
+                     std::uint64_t offset, error_code &ec) override {
+    return transfer(buffers, count, offset, ec,
+                    [](int fd, const iovec *iov, int n, off_t off) {
+                      return ::preadv(fd, iov, n, off);
+                    });
+  }
+
+  std::size_t pwritev(const const_buffer *buffers, std::size_t count,
+                      std::uint64_t offset, error_code &ec) override {
+    return transfer(buffers, count, offset, ec,
+                    [](int fd, const iovec *iov, int n, off_t off) {
+                      return ::pwritev(fd, iov, n, off);
+                    });
+  }
+
+  std::uint64_t size(error_code &ec) const override {
+    struct ::stat st;
+    if (::fstat(fd_, &st) != 0) {
+      ec.assign(errno, std::generic_category());
+      return 0;
+    }
+    ec.clear();
+    return static_cast<std::uint64_t>(st.st_size);
+  }
+
+  /**
+   * @brief Waits until the file's contents are on stable storage.
+   */
+  void sync(error_code &ec) override {
+    if (::fdatasync(fd_) != 0) {
+      ec.assign(errno, std::generic_category());
+      return;
+    }
+    ec.clear();
+  }
+
+#ifdef __linux__
+  void preallocate(std::uint64_t offset, std::uint64_t length,
+                   error_code &ec) override {
+    if (offset > max_offset || length > max_offset - offset) {
+      ec = std::make_error_code(std::errc::file_too_large);
+      return;
+    }
+    allocate(FALLOC_FL_KEEP_SIZE, offset, length, ec);
+  }
+
+  void punch_hole(std::uint64_t offset, std::uint64_t length,
+                  error_code &ec) override {
+    constexpr int mode = FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE;
+    offset = std::min(offset, max_offset);
+    allocate(mode, offset, range_end(offset, length) - offset, ec);
+    if (ec == std::errc::file_too_large) {
+      // The range ends past the largest file this filesystem holds, so
+      // punch up to the end of the file instead.
+      auto end = size(ec);
+      if (!ec) {
+        allocate(mode, offset, end > offset ? end - offset : 0, ec);
+      }
+    }
+  }
+
+  void readahead(std::uint64_t offset, std::uint64_t length,
+                 error_code &ec) override {
+    if (::readahead(fd_, static_cast<off_t>(offset),
+                    static_cast<std::size_t>(length)) != 0) {
+      ec.assign(errno, std::generic_category());
+      return;
+    }
+    ec.clear();
+  }
+#endif
+
+#ifdef POSIX_FADV_NORMAL
+  void advise(std::uint64_t offset, std::uint64_t length,
+              access_advice advice, error_code &ec) override {
+    static constexpr int advices[] = {POSIX_FADV_NORMAL, POSIX_FADV_SEQUENTIAL,
+                                      POSIX_FADV_RANDOM, POSIX_FADV_WILLNEED,
+                                      POSIX_FADV_DONTNEED};
+    if (int err = ::posix_fadvise(fd_, static_cast<off_t>(offset),
+                                  static_cast<off_t>(
+                                      range_end(offset, length) -
+                                      std::min(offset, max_offset)),
+                                  advices[static_cast<int>(advice)])) {
+      ec.assign(err, std::generic_category());
+      return;
+    }
+    ec.clear();
+  }
+#endif
+
+  /**
+   * @brief Reports the blocks allocated to the file, and its holes where the
+   * system can find them (@c SEEK_HOLE).
+   *
+   * @details Counts whole blocks, so small files report more than their size
+   * and holes are aligned to the block size.
+   */
+  allocation_info allocation(error_code &ec) const override {
+    allocation_info info;
+    struct ::stat st;
+    if (::fstat(fd_, &st) != 0) {
+      ec.assign(errno, std::generic_category());
+      return info;
+    }
+    info.size = static_cast<std::uint64_t>(st.st_size);
+    info.allocated = static_cast<std::uint64_t>(st.st_blocks) * 512;
+#ifdef SEEK_HOLE
+    // Walk the data runs. Each call returns its own offset, so concurrent
+    // calls do not disturb each other.
+    off_t pos = 0;
+    while (pos < st.st_size) {
+      off_t data = ::lseek(fd_, pos, SEEK_DATA);
+      if (data < 0 && errno == ENXIO) {
+        data = st.st_size;
+      } else if (data < 0) {
+        ec.assign(errno, std::generic_category());
+        return info;
+      }
+      if (data > pos) {
+        info.holes.emplace_back(pos, std::min(data, st.st_size));
+      }
+      if (data >= st.st_size) {
+        break;
+      }
+      pos = ::lseek(fd_, data, SEEK_HOLE);
+      if (pos < 0) {
+        ec.assign(errno, std::generic_category());
+        return info;
+      }
+    }
+#endif
+    ec.clear();
+    return info;
+  }
+};
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+/**
+ * @brief Replaces files of the real filesystem atomically. Implements
+ * @c std_filesystem::write_all.
+ *
+ * @details Each file is written to an unnamed temporary file in its
+ * directory (@c O_TMPFILE, where the kernel and the filesystem support it,
+ * or else a hidden temporary name), then linked into place with @c linkat,
+ * or renamed over the file it replaces. With @c atomic_sync::each, that
+ * costs a sync of the file and one of its directory. With
+ * @c atomic_sync::group, the files committed together share their syncs:
+ * one @c syncfs per filesystem for their contents (or a sync per file where
+ * @c syncfs is missing), then one sync per directory. Concurrent calls from
+ * several threads are committed together: while one thread syncs, the
+ * files of the others queue up, and the next thread to commit publishes
+ * them all. A call stages at most @c max_staged files at a time, so long
+ * lists do not run out of file descriptors.
+ */
+class std_atomic_writer {
+public:
+  /// Most files a call to @c write_all keeps open before publishing them.
+  static constexpr std::size_t max_staged = 64;
+
+private:
+  /**
+   * @brief A file written, but not yet published.
+   */
+  struct staged_file {
+    std::uint64_t sequence{0}; ///< Order in which it was staged.
+    path target;               ///< Path to publish it at.
+    path temp;                 ///< Temporary name, if it has one.
+    int fd{-1};                ///< Open for writing.
+    dev_t device{};            ///< Filesystem holding it.
+
+    staged_file() = default;
+    staged_file(const staged_file &) = delete;
+    staged_file &operator=(const staged_file &) = delete;
+
+    staged_file(staged_file &&other) noexcept
+        : sequence(other.sequence), target(std::move(other.target)),
+          temp(std::move(other.temp)), fd(std::exchange(other.fd, -1)),
+          device(other.device) {
+      other.temp.clear();
+    }
+
+    /**
+     * @brief Discards the file, unless it was published.
+     */
+    ~staged_file() {
+      if (fd >= 0) {
+        ::close(fd);
+      }
+      if (!temp.empty()) {
+        ::unlink(temp.c_str());
+      }
+    }
+  };
+
+  std::mutex mutex_;                    ///< Guards everything below.
+  std::condition_variable committed_;   ///< Signaled after each commit.
+  std::vector<staged_file> staged_;     ///< Files waiting for a commit.
+  std::uint64_t staged_sequence_{0};    ///< Last sequence number staged.
+  std::uint64_t committed_sequence_{0}; ///< Last sequence number committed.
+  bool committing_{false};              ///< True while a thread commits.
+  std::map<std::uint64_t, error_code> failures_; ///< Unclaimed failures.
+
+  static error_code last_error() noexcept {
+    return error_code(errno, std::system_category());
+  }
+
+  /**
+   * @brief Gets a hidden name next to a file, unique within the host.
+   */
+  static path temp_name(const path &target) {
+    static std::atomic<std::uint64_t> counter{0};
+    return target.parent_path() /
+           ("." + target.filename().string() + ".pfs-" +
+            std::to_string(::getpid()) + "-" + std::to_string(++counter));
+  }
+
+  static path parent_of(const path &p) {
+    auto parent = p.parent_path();
+    return parent.empty() ? path(".") : parent;
+  }
+
+  /**
+   * @brief Writes the contents of a file to a temporary file in its
+   * directory.
+   */
+  static void stage(const path &p, std::string_view content, staged_file &f,
+                    error_code &ec) {
+    if (!p.has_filename()) {
+      ec = std::make_error_code(std::errc::is_a_directory);
+      return;
+    }
+    f.target = p;
+#ifdef O_TMPFILE
+    f.fd = ::open(parent_of(p).c_str(), O_TMPFILE | O_WRONLY | O_CLOEXEC,
+                  0666);
+    if (f.fd < 0 && errno != EOPNOTSUPP && errno != EISDIR &&
+        errno != EINVAL) {
+      ec = last_error();
+      return;
+    }
+#endif
+    if (f.fd < 0) {
+      // No unnamed temporary files here.
+      f.temp = temp_name(p);
+      f.fd = ::open(f.temp.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC,
+                    0666);
+      if (f.fd < 0) {
+        ec = last_error();
+        f.temp.clear();
+        return;
+      }
+    }
+    while (!content.empty()) {
+      auto n = ::write(f.fd, content.data(), content.size());
+      if (n < 0 && errno == EINTR) {
+        continue;
+      } else if (n < 0) {
+        ec = last_error();
+        return;
+      }
+      content.remove_prefix(static_cast<std::size_t>(n));
+    }
+    struct stat st;
+    if (::fstat(f.fd, &st) != 0) {
+      ec = last_error();
+      return;
+    }
+    f.device = st.st_dev;
+    ec.clear();
+  }
+
+  /**
+   * @brief Gives a staged file its final name, replacing any file there.
+   */
+  static void place(staged_file &f, error_code &ec) {
+#ifdef O_TMPFILE
+    if (f.temp.empty()) {
+      auto fd_path = "/proc/self/fd/" + std::to_string(f.fd);
+      if (::linkat(AT_FDCWD, fd_path.c_str(), AT_FDCWD, f.target.c_str(),
+                   AT_SYMLINK_FOLLOW) == 0) {
+        ec.clear();
+        return;
+      } else if (errno != EEXIST) {
+        ec = last_error();
+        return;
+      }
+      // Links cannot replace a file, so link under a temporary name first.
+      auto temp = temp_name(f.target);
+      if (::linkat(AT_FDCWD, fd_path.c_str(), AT_FDCWD, temp.c_str(),
+                   AT_SYMLINK_FOLLOW) != 0) {
+        ec = last_error();
+        return;
+      }
+      f.temp = std::move(temp);
+    }
+#endif
+    if (::rename(f.temp.c_str(), f.target.c_str()) != 0) {
+      ec = last_error();
+      return;
+    }
+    f.temp.clear();
+    ec.clear();
+  }
+
+  static bool sync_directory(const path &dir) {
+    int fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+      return false;
+    }
+    bool ok = ::fsync(fd) == 0;
+    ::close(fd);
+    return ok;
+  }
+
+  /**
+   * @brief Syncs and publishes staged files.
+   *
+   * @param sync How to make them durable.
+   * @param failures Receives the sequence number and error of each file
+   * that could not be published.
+   * @return The syncs made.
+   */
+  static atomic_write_stats
+  publish(std::vector<staged_file> &files, atomic_sync sync,
+          std::vector<std::pair<std::uint64_t, error_code>> &failures) {
+    atomic_write_stats stats{};
+    stats.files = files.size();
+    stats.commits = 1;
+    std::vector<error_code> errors(files.size());
+    bool data_synced = sync == atomic_sync::none;
+#ifdef __linux__
+    if (sync == atomic_sync::group) {
+      data_synced = true;
+      std::set<dev_t> devices;
+      for (auto &f : files) {
+        if (devices.insert(f.device).second) {
+          ++stats.fs_syncs;
+          data_synced = data_synced && ::syncfs(f.fd) == 0;
+        }
+      }
+    }
+#endif
+    if (!data_synced) {
+      // Each file on its own, or where syncfs is missing or failed.
+      for (std::size_t i = 0; i < files.size(); ++i) {
+        ++stats.file_syncs;
+        if (::fdatasync(files[i].fd) != 0) {
+          errors[i] = last_error();
+        }
+      }
+    }
+    std::set<path> dirs;
+    for (std::size_t i = 0; i < files.size(); ++i) {
+      if (!errors[i]) {
+        place(files[i], errors[i]);
+      }
+      if (errors[i]) {
+        failures.emplace_back(files[i].sequence, errors[i]);
+        continue;
+      }
+      auto dir = parent_of(files[i].target);
+      if (sync == atomic_sync::each ||
+          (sync == atomic_sync::group && dirs.insert(dir).second)) {
+        ++stats.dir_syncs;
+        if (!sync_directory(dir)) {
+          failures.emplace_back(files[i].sequence, last_error());
+        }
+      }
+    }
+    files.clear();
+    return stats;
+  }
+
+  /**
+   * @brief Writes files [begin, end) of a list, and commits them.
+   *
+   * @return The syncs made by this call.
+   */
+  atomic_write_stats
+  write_chunk(const std::vector<std::pair<path, std::string_view>> &in,
+              std::size_t begin, std::size_t end, atomic_sync sync,
+              error_code &ec) {
+    std::vector<staged_file> files(end - begin);
+    for (std::size_t i = begin; i < end; ++i) {
+      stage(in[i].first, in[i].second, files[i - begin], ec);
+      if (ec) {
+        return {};
+      }
+    }
+    std::vector<std::pair<std::uint64_t, error_code>> failures;
+    if (sync != atomic_sync::group) {
+      auto stats = publish(files, sync, failures);
+      ec = failures.empty() ? error_code() : failures.front().second;
+      return stats;
+    }
+
+    atomic_write_stats stats{};
+    std::unique_lock<std::mutex> lock(mutex_);
+    auto first = staged_sequence_ + 1;
+    for (auto &f : files) {
+      f.sequence = ++staged_sequence_;
+      staged_.push_back(std::move(f));
+    }
+    auto last = staged_sequence_;
+    while (committed_sequence_ < last) {
+      if (committing_) {
+        committed_.wait(lock);
+        continue;
+      }
+      committing_ = true;
+      std::vector<staged_file> batch;
+      batch.swap(staged_);
+      auto batch_last = staged_sequence_;
+      lock.unlock();
+      stats += publish(batch, sync, failures);
+      lock.lock();
+      committing_ = false;
+      committed_sequence_ = batch_last;
+      failures_.insert(failures.begin(), failures.end());
+      failures.clear();
+      committed_.notify_all();
+    }
+    // Claim the failures of this call's files.
+    ec.clear();
+    for (auto it = failures_.lower_bound(first);
+         it != failures_.end() && it->first <= last;) {
+      if (!ec) {
+        ec = it->second;
+      }
+      it = failures_.erase(it);
+    }
+    return stats;
+  }
+
+public:
+  /**
+   * @brief Writes files in chunks of at most @c max_staged, stopping at the
+   * first chunk that fails. See @c filesystem::write_all.
+   */
+  atomic_write_stats
+  write_all(const std::vector<std::pair<path, std::string_view>> &in,
+            const atomic_write_options &options, error_code &ec) {
+    atomic_write_stats stats{};
+    ec.clear();
+    for (std::size_t begin = 0; begin < in.size() && !ec;
+         begin += max_staged) {
+      stats += write_chunk(in, begin, std::min(in.size(), begin + max_staged),
+                           options.sync, ec);
+    }
+    return stats;
+  }
+};
+#endif
+
 class std_filesystem final : public filesystem {
+#if defined(__unix__) || defined(__APPLE__)
+  /// Shared by copies, so that their writes are committed together.
+  std::shared_ptr<std_atomic_writer> writer_ =
+      std::make_shared<std_atomic_writer>();
+#endif
+
 public:
   path absolute(const path &p) override { return std::filesystem::absolute(p); }
 
@@ -117,6 +702,15 @@ public:
     return std::filesystem::exists(p, ec);
   }
 
+  std::uintmax_t file_size(const path &p) const override {
+    return std::filesystem::file_size(p);
+  }
+
+  std::uintmax_t file_size(const path &p,
+                           error_code &ec) const noexcept override {
+    return std::filesystem::file_size(p, ec);
+  }
+
   bool is_directory(const path &p) const override {
     return std::filesystem::is_directory(p);
   }
@@ -125,6 +719,11 @@ public:
     return std::filesystem::is_directory(p);
   }
 
+  std::unique_ptr<std::iostream>
+  open_file(const path &p, std::ios_base::openmode mode) override {
+    return std::make_unique<std::fstream>(p, mode);
+  }
+
   bool remove(const path &p) { return std::filesystem::remove(p); }
 
   bool remove(const path &p, error_code &ec) noexcept {
@@ -179,6 +778,156 @@ public:
     std::filesystem::recursive_directory_iterator it(p, ec);
     return std::make_unique<std_recursive_directory_iterator>(std::move(it));
   }
+
+  /**
+   * @brief Gets a view of the contents of a regular file.
+   *
+   * @details On POSIX systems the file is mapped read-only, so its pages are
+   * read on demand from the page cache rather than copied. The bytes change
+   * if the file is written, and touching pages past a point where it was
+   * truncated raises SIGBUS. Elsewhere, the file is read into a buffer.
+   */
+  file_view view_file(const path &p, error_code &ec) override {
+#if defined(__unix__) || defined(__APPLE__)
+    int fd = ::open(p.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+      ec.assign(errno, std::generic_category());
+      return {};
+    }
+    struct ::stat st;
+    if (::fstat(fd, &st) != 0) {
+      ec.assign(errno, std::generic_category());
+    } else if (S_ISDIR(st.st_mode)) {
+      ec = std::make_error_code(std::errc::is_a_directory);
+    } else if (!S_ISREG(st.st_mode)) {
+      ec = std::make_error_code(std::errc::not_supported);
+    } else {
+      ec.clear();
+    }
+    if (ec || st.st_size == 0) {
+      ::close(fd);
+      return {};
+    }
+    auto size = static_cast<std::size_t>(st.st_size);
+    void *addr = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    int err = errno;
+    ::close(fd);
+    if (addr == MAP_FAILED) {
+      ec.assign(err, std::generic_category());
+      return {};
+    }
+    ::madvise(addr, size, MADV_SEQUENTIAL);
+    std::shared_ptr<const void> mapping(addr, [size](const void *a) {
+      ::munmap(const_cast<void *>(a), size);
+    });
+    return file_view({static_cast<const char *>(addr), size},
+                     std::move(mapping));
+#else
+    auto type = std::filesystem::status(p, ec).type();
+    if (!ec && type == file_type::directory) {
+      ec = std::make_error_code(std::errc::is_a_directory);
+    } else if (!ec && type != file_type::regular) {
+      ec = std::make_error_code(std::errc::not_supported);
+    }
+    auto size = ec ? 0 : std::filesystem::file_size(p, ec);
+    if (ec) {
+      return {};
+    }
+    std::string buffer(static_cast<std::size_t>(size), '\0');
+    std::ifstream in(p, std::ios_base::binary);
+    in.read(buffer.data(), static_cast<std::streamsize>(size));
+    if (!in) {
+      ec = std::make_error_code(std::errc::io_error);
+      return {};
+    }
+    return file_view(std::move(buffer));
+#endif
+  }
+
+  file_view view_file(const path &p) override {
+    error_code ec;
+    auto ret = view_file(p, ec);
+    if (ec) {
+      throw filesystem_error("view_file", p, ec);
+    }
+    return ret;
+  }
+
+  /**
+   * @brief Opens a regular file for positional and vectored reads and
+   * writes.
+   *
+   * @details The file is created and truncated as by @c open_file with the
+   * same mode. On POSIX systems the handle is a @c std_file_handle over a
+   * file descriptor; elsewhere it wraps a file stream.
+   */
+  std::unique_ptr<file_handle> open_handle(const path &p,
+                                           std::ios_base::openmode mode,
+                                           error_code &ec) override {
+#if defined(__unix__) || defined(__APPLE__)
+    using std::ios_base;
+    bool read = mode & ios_base::in;
+    bool write = mode & (ios_base::out | ios_base::app);
+    bool create = (mode & ios_base::app) ||
+                  ((mode & ios_base::out) &&
+                   (!read || (mode & ios_base::trunc)));
+    bool truncate = (mode & ios_base::trunc) ||
+                    ((mode & ios_base::out) && !read &&
+                     !(mode & ios_base::app));
+    int flags = O_CLOEXEC;
+    flags |= read && write ? O_RDWR : write ? O_WRONLY : O_RDONLY;
+    flags |= (create ? O_CREAT : 0) | (truncate ? O_TRUNC : 0);
+    int fd = ::open(p.c_str(), flags, 0666);
+    if (fd < 0) {
+      ec.assign(errno, std::generic_category());
+      return nullptr;
+    }
+    struct ::stat st;
+    if (::fstat(fd, &st) != 0) {
+      ec.assign(errno, std::generic_category());
+    } else if (!S_ISREG(st.st_mode)) {
+      ec = std::make_error_code(S_ISDIR(st.st_mode)
+                                    ? std::errc::is_a_directory
+                                    : std::errc::not_supported);
+    } else {
+      ec.clear();
+      return std::make_unique<std_file_handle>(fd);
+    }
+    ::close(fd);
+    return nullptr;
+#else
+    return filesystem::open_handle(p, mode, ec);
+#endif
+  }
+
+  std::unique_ptr<file_handle>
+  open_handle(const path &p, std::ios_base::openmode mode) override {
+    error_code ec;
+    auto ret = open_handle(p, mode, ec);
+    if (ec) {
+      throw filesystem_error("open_handle", p, ec);
+    }
+    return ret;
+  }
+
+  bool allows_concurrent_reads() const noexcept override { return true; }
+
+  bool allows_concurrent_writes() const noexcept override { return true; }
+
+#if defined(__unix__) || defined(__APPLE__)
+  /**
+   * @brief Creates or replaces files, each atomically, and returns once
+   * they are published and synced as the options ask. See
+   * @c std_atomic_writer.
+   */
+  atomic_write_stats
+  write_all(const std::vector<std::pair<path, std::string_view>> &files,
+            const atomic_write_options &options, error_code &ec) override {
+    return writer_->write_all(files, options, ec);
+  }
+
+  using filesystem::write_all;
+#endif
 };
 
 } // namespace pfs
@@ -0,0 +1,403 @@
+#ifndef INCLUDED_PFS_SYNC_HPP
+#define INCLUDED_PFS_SYNC_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <pfs/diff.hpp>
+#include <pfs/fake_filesystem.hpp>
+#include <pfs/filesystem.hpp>
+#include <pfs/thread_pool.hpp>
+#include <string>
+#include <vector>
+
+namespace pfs {
+
+/**
+ * @brief Options of @c sync_tree.
+ */
+struct sync_options {
+  /// Number of threads transferring files. 0 means one per CPU if the
+  /// source allows concurrent reads, and one otherwise. Other values require
+  /// it to. A destination that does not allow concurrent writes (see
+  /// @c filesystem::allows_concurrent_writes) is always written by one
+  /// thread.
+  unsigned threads = 0;
+
+  /// Compute the statistics without changing the destination.
+  bool dry_run = false;
+
+  /// Compare the contents of files of equal size. If false, files of equal
+  /// size are considered up to date.
+  bool compare_content = true;
+
+  /// Files of unchanged size at least this large are updated block by block
+  /// instead of being rewritten.
+  std::uintmax_t delta_threshold = std::uintmax_t{1} << 20;
+
+  /// Size of the blocks compared and written by a delta update.
+  std::size_t block_size = 64 << 10;
+};
+
+/**
+ * @brief What @c sync_tree did, or would do in a dry run.
+ */
+struct sync_stats {
+  std::uintmax_t directories_created{0};
+  std::uintmax_t files_copied{0};    ///< Files written whole.
+  std::uintmax_t files_patched{0};   ///< Files updated block by block.
+  std::uintmax_t bytes_written{0};   ///< Bytes written to the destination.
+  std::uintmax_t entries_removed{0}; ///< Entries removed, with descendants.
+};
+
+namespace detail {
+
+/**
+ * @brief Applies a diff of the destination against the source.
+ */
+class tree_syncer {
+private:
+  /// A regular file to bring up to date, relative to the roots.
+  struct file_job {
+    path rel;
+    bool patch; ///< Update block by block rather than rewrite.
+  };
+
+  filesystem &src_fs_;
+  filesystem &dst_fs_;
+  const path &src_;
+  const path &dst_;
+  const sync_options &options_;
+
+  std::vector<path> dirs_; ///< Directories to create, parents first.
+  std::vector<file_job> files_;
+  std::vector<path> replaced_; ///< Entries whose type changed.
+  std::vector<path> removed_;  ///< Entries only in the destination.
+
+  std::atomic<std::uintmax_t> files_copied_{0};
+  std::atomic<std::uintmax_t> files_patched_{0};
+  std::atomic<std::uintmax_t> bytes_written_{0};
+
+  static path join(const path &root, const path &rel) {
+    return rel.empty() ? root : root / rel;
+  }
+
+  /**
+   * @brief Plans the creation of a source entry missing from the
+   * destination, with its descendants.
+   */
+  void plan_copy(const path &rel, file_type type, error_code &ec) {
+    if (type == file_type::regular) {
+      files_.push_back({rel, false});
+      return;
+    }
+    if (type != file_type::directory) {
+      return;
+    }
+    dirs_.push_back(rel);
+    auto root = join(src_, rel);
+    auto it = src_fs_.recursive_directory_iterator(root, ec);
+    while (!ec && !it->at_end()) {
+      auto child = rel / it->path().lexically_relative(root);
+      auto child_type = it->status(ec).type();
+      if (ec) {
+        return;
+      }
+      if (child_type == file_type::directory) {
+        dirs_.push_back(std::move(child));
+      } else if (child_type == file_type::regular) {
+        files_.push_back({std::move(child), false});
+      }
+      it->increment(ec);
+    }
+  }
+
+  /**
+   * @brief Counts the entries that removing @c p would remove.
+   */
+  std::uintmax_t count_entries(const path &p, error_code &ec) {
+    if (!dst_fs_.is_directory(p, ec) || ec) {
+      return ec ? 0 : 1;
+    }
+    std::uintmax_t ret = 1;
+    auto it = dst_fs_.recursive_directory_iterator(p, ec);
+    while (!ec && !it->at_end()) {
+      ++ret;
+      it->increment(ec);
+    }
+    return ret;
+  }
+
+  /**
+   * @brief Rewrites a destination file with the source's content.
+   */
+  void copy_file(const path &rel, error_code &ec) {
+    auto in = src_fs_.open_file(join(src_, rel),
+                                std::ios_base::in | std::ios_base::binary);
+    if (!*in) {
+      ec = std::make_error_code(std::errc::io_error);
+      return;
+    }
+    std::unique_ptr<std::iostream> out;
+    if (!options_.dry_run) {
+      out = dst_fs_.open_file(join(dst_, rel), std::ios_base::out |
+                                                   std::ios_base::trunc |
+                                                   std::ios_base::binary);
+      if (!*out) {
+        ec = std::make_error_code(std::errc::io_error);
+        return;
+      }
+    }
+    std::string buf(options_.block_size, '\0');
+    std::uintmax_t written = 0;
+    do {
+      in->read(buf.data(), static_cast<std::streamsize>(buf.size()));
+      if (out) {
+        out->write(buf.data(), in->gcount());
+      }
+      written += static_cast<std::uintmax_t>(in->gcount());
+    } while (*in);
+    if (out && !out->flush()) {
+      ec = std::make_error_code(std::errc::io_error);
+      return;
+    }
+    ++files_copied_;
+    bytes_written_ += written;
+  }
+
+  /**
+   * @brief Writes only the blocks of a destination file that differ from
+   * the source.
+   *
+   * @pre Both files have the same size.
+   */
+  void patch_file(const path &rel, error_code &ec) {
+    using std::ios_base;
+    auto in =
+        src_fs_.open_file(join(src_, rel), ios_base::in | ios_base::binary);
+    auto out = dst_fs_.open_file(join(dst_, rel),
+                                 options_.dry_run
+                                     ? ios_base::in | ios_base::binary
+                                     : ios_base::in | ios_base::out |
+                                           ios_base::binary);
+    if (!*in || !*out) {
+      ec = std::make_error_code(std::errc::io_error);
+      return;
+    }
+    std::string a(options_.block_size, '\0'), b(options_.block_size, '\0');
+    std::uintmax_t written = 0;
+    std::streamoff offset = 0;
+    for (;;) {
+      in->read(a.data(), static_cast<std::streamsize>(a.size()));
+      auto n = in->gcount();
+      if (n == 0) {
+        break;
+      }
+      out->clear();
+      out->seekg(offset);
+      out->read(b.data(), n);
+      if (out->gcount() != n ||
+          std::memcmp(a.data(), b.data(), static_cast<std::size_t>(n))) {
+        if (!options_.dry_run) {
+          out->clear();
+          out->seekp(offset);
+          out->write(a.data(), n);
+        }
+        written += static_cast<std::uintmax_t>(n);
+      }
+      offset += n;
+    }
+    if (!out->flush()) {
+      ec = std::make_error_code(std::errc::io_error);
+      return;
+    }
+    ++files_patched_;
+    bytes_written_ += written;
+  }
+
+  /**
+   * @brief Runs the file jobs on a pool of threads, stopping at the first
+   * error.
+   */
+  void transfer_files(error_code &ec) {
+    auto threads = pool_size(options_.threads,
+                             src_fs_.allows_concurrent_reads() &&
+                                 dst_fs_.allows_concurrent_writes(),
+                             files_.size());
+    if (!dst_fs_.allows_concurrent_writes()) {
+      threads = 1;
+    }
+    std::atomic<std::size_t> next{0};
+    std::mutex mutex;
+    auto worker = [&] {
+      for (;;) {
+        auto i = next.fetch_add(1);
+        if (i >= files_.size()) {
+          return;
+        }
+        error_code job_ec;
+        if (files_[i].patch) {
+          patch_file(files_[i].rel, job_ec);
+        } else {
+          copy_file(files_[i].rel, job_ec);
+        }
+        if (job_ec) {
+          std::lock_guard lock(mutex);
+          if (!ec) {
+            ec = job_ec;
+          }
+          next = files_.size();
+        }
+      }
+    };
+    run_pool(threads, worker);
+  }
+
+public:
+  tree_syncer(filesystem &src_fs, const path &src, filesystem &dst_fs,
+              const path &dst, const sync_options &options)
+      : src_fs_(src_fs), dst_fs_(dst_fs), src_(src), dst_(dst),
+        options_(options) {}
+
+  sync_stats run(error_code &ec) {
+    sync_stats stats;
+    if (!src_fs_.is_directory(src_, ec)) {
+      if (!ec) {
+        ec = std::make_error_code(std::errc::not_a_directory);
+      }
+      return stats;
+    }
+
+    // Plan. The diff runs from the destination to the source, so "added"
+    // entries are the ones to copy.
+    diff_result d;
+    bool exists = dst_fs_.exists(dst_, ec);
+    if (ec) {
+      return stats;
+    }
+    if (exists) {
+      diff_options diff_opts;
+      diff_opts.threads = options_.threads;
+      diff_opts.compare_content = options_.compare_content;
+      d = diff(dst_fs_, dst_, src_fs_, src_, diff_opts, ec);
+      if (!ec && !d.changed.empty() && d.changed.front().empty()) {
+        // The destination root is not a directory.
+        ec = std::make_error_code(std::errc::not_a_directory);
+      }
+    } else {
+      dirs_.emplace_back();
+      auto it = src_fs_.directory_iterator(src_, ec);
+      while (!ec && !it->at_end()) {
+        d.added.push_back(it->path().filename());
+        it->increment(ec);
+      }
+    }
+    for (auto it = d.changed.begin(); !ec && it != d.changed.end(); ++it) {
+      auto src_type = src_fs_.status(join(src_, *it), ec).type();
+      auto dst_type =
+          ec ? src_type : dst_fs_.status(join(dst_, *it), ec).type();
+      if (ec) {
+        break;
+      }
+      if (src_type == file_type::regular && dst_type == file_type::regular) {
+        auto size = src_fs_.file_size(join(src_, *it), ec);
+        bool same_size = !ec && size == dst_fs_.file_size(join(dst_, *it), ec);
+        files_.push_back({*it, same_size && size >= options_.delta_threshold});
+      } else {
+        // The type changed. Replace the entry.
+        replaced_.push_back(*it);
+        plan_copy(*it, src_type, ec);
+      }
+    }
+    for (auto it = d.added.begin(); !ec && it != d.added.end(); ++it) {
+      plan_copy(*it, src_fs_.status(join(src_, *it), ec).type(), ec);
+    }
+    removed_ = std::move(d.removed);
+    if (ec) {
+      return stats;
+    }
+
+    // Replaced entries go first, deepest first, then the new directories
+    // with their parents first, then the files. Entries that only the
+    // destination has are removed last, once everything else is in place.
+    auto remove = [&](const path &rel) {
+      auto p = join(dst_, rel);
+      if (options_.dry_run) {
+        stats.entries_removed += count_entries(p, ec);
+      } else {
+        stats.entries_removed += dst_fs_.remove_all(p, ec);
+      }
+    };
+    for (auto it = replaced_.rbegin(); !ec && it != replaced_.rend(); ++it) {
+      remove(*it);
+    }
+    std::sort(dirs_.begin(), dirs_.end());
+    for (auto it = dirs_.begin(); !ec && it != dirs_.end(); ++it) {
+      if (!options_.dry_run) {
+        if (it->empty()) {
+          dst_fs_.create_directories(dst_, ec);
+        } else {
+          dst_fs_.create_directory(join(dst_, *it), ec);
+        }
+      }
+      ++stats.directories_created;
+    }
+    if (!ec) {
+      transfer_files(ec);
+    }
+    for (auto it = removed_.rbegin(); !ec && it != removed_.rend(); ++it) {
+      remove(*it);
+    }
+    stats.files_copied = files_copied_;
+    stats.files_patched = files_patched_;
+    stats.bytes_written = bytes_written_;
+    return stats;
+  }
+};
+
+} // namespace detail
+
+/**
+ * @brief Makes the tree at @c dst in @c dst_fs match the tree at @c src in
+ * @c src_fs.
+ *
+ * @details Only the entries that differ are touched, as found by @c diff.
+ * Missing directories are created and missing or changed files are written,
+ * by a pool of threads. A large file whose size is unchanged is updated
+ * block by block, writing only the blocks that differ. Entries whose type
+ * changed are replaced. Entries that exist only in the destination are
+ * removed at the end, deepest first, so a failure part way leaves no
+ * destination entry missing that the source has.
+ *
+ * Entries other than directories and regular files are not copied.
+ *
+ * @param src_fs Filesystem of the source tree.
+ * @param src Root of the source tree. Must be a directory.
+ * @param dst_fs Filesystem of the destination tree.
+ * @param dst Root of the destination tree. Created if it does not exist.
+ * @param options How to compare and transfer.
+ * @param ec Set if an entry cannot be read or written. The destination is
+ * then partly synchronized.
+ * @return What was done, or with @c sync_options::dry_run what would be.
+ */
+inline sync_stats sync_tree(filesystem &src_fs, const path &src,
+                            filesystem &dst_fs, const path &dst,
+                            const sync_options &options, error_code &ec) {
+  return detail::tree_syncer(src_fs, src, dst_fs, dst, options).run(ec);
+}
+
+inline sync_stats sync_tree(filesystem &src_fs, const path &src,
+                            filesystem &dst_fs, const path &dst,
+                            const sync_options &options = {}) {
+  error_code ec;
+  auto ret = sync_tree(src_fs, src, dst_fs, dst, options, ec);
+  if (ec) {
+    throw filesystem_error("sync_tree", src, dst, ec);
+  }
+  return ret;
+}
+
+} // namespace pfs
+
+#endif
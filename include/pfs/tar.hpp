@@ -0,0 +1,654 @@
+#ifndef INCLUDED_PFS_TAR_HPP
+#define INCLUDED_PFS_TAR_HPP
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <istream>
+#include <limits>
+#include <ostream>
+#include <pfs/fake_filesystem.hpp>
+#include <pfs/filesystem.hpp>
+#include <pfs/std_filesystem.hpp>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace pfs {
+
+/**
+ * @brief Counts of the entries written by @c write_tar or read by
+ * @c read_tar.
+ */
+struct tar_stats {
+  std::uint64_t directories{0}; ///< Directory entries.
+  std::uint64_t files{0};       ///< Regular file entries.
+  std::uint64_t bytes{0};       ///< Bytes of regular file contents.
+  std::uint64_t skipped{0};     ///< Entries of other types, not copied.
+};
+
+namespace detail {
+
+/**
+ * @brief Layout of a ustar header block.
+ */
+struct tar_header {
+  static constexpr std::size_t block = 512;
+
+  static constexpr std::size_t name = 0, name_size = 100;
+  static constexpr std::size_t mode = 100, mode_size = 8;
+  static constexpr std::size_t uid = 108, gid = 116, id_size = 8;
+  static constexpr std::size_t size = 124, size_size = 12;
+  static constexpr std::size_t mtime = 136, mtime_size = 12;
+  static constexpr std::size_t checksum = 148, checksum_size = 8;
+  static constexpr std::size_t type = 156;
+  static constexpr std::size_t magic = 257, magic_size = 6;
+  static constexpr std::size_t version = 263;
+  static constexpr std::size_t prefix = 345, prefix_size = 155;
+
+  /**
+   * @brief Sums the bytes of a header, counting the checksum field as
+   * spaces.
+   */
+  static std::uint32_t sum(const char *h) noexcept {
+    std::uint32_t ret = 0;
+    for (std::size_t i = 0; i < block; ++i) {
+      bool in_field = i >= checksum && i < checksum + checksum_size;
+      ret += in_field ? ' ' : static_cast<unsigned char>(h[i]);
+    }
+    return ret;
+  }
+};
+
+/**
+ * @brief Writes a tree as a ustar archive, with pax headers for names and
+ * sizes that ustar cannot hold.
+ */
+class tar_writer {
+private:
+  using header = tar_header;
+
+  std::ostream &out_;
+  tar_stats stats_;
+
+  static void put_octal(char *field, std::size_t width, std::uint64_t v) {
+    // Zero-padded digits, then a NUL.
+    field[width - 1] = '\0';
+    for (std::size_t i = width - 1; i-- > 0; v >>= 3) {
+      field[i] = static_cast<char>('0' + (v & 7));
+    }
+  }
+
+  static bool fits_octal(std::uint64_t v, std::size_t width) {
+    return v >> (3 * (width - 1)) == 0;
+  }
+
+  /**
+   * @brief Formats a pax record, whose length prefix counts itself.
+   */
+  static std::string pax_record(std::string_view key, std::string_view value) {
+    auto body = ' ' + std::string(key) + '=' + std::string(value) + '\n';
+    auto length = body.size() + 1;
+    while (std::to_string(length).size() + body.size() != length) {
+      ++length;
+    }
+    return std::to_string(length) + body;
+  }
+
+  void write(const char *data, std::size_t n) {
+    out_.write(data, static_cast<std::streamsize>(n));
+  }
+
+  void pad(std::uint64_t size) {
+    static const char zeros[header::block] = {};
+    if (auto rem = size % header::block) {
+      write(zeros, header::block - rem);
+    }
+  }
+
+  void write_header(const std::string &name, char type, std::uint64_t size,
+                    unsigned mode) {
+    std::string pax;
+    std::string_view short_name = name, prefix;
+    if (name.size() > header::name_size) {
+      // Split at a separator, so that both parts fit their fields.
+      auto cut = name.find('/', name.size() - header::name_size - 1);
+      if (cut != std::string::npos && cut > 0 &&
+          cut <= header::prefix_size && cut + 1 < name.size()) {
+        prefix = std::string_view(name).substr(0, cut);
+        short_name = std::string_view(name).substr(cut + 1);
+      } else {
+        pax += pax_record("path", name);
+        short_name = short_name.substr(0, header::name_size);
+      }
+    }
+    if (!fits_octal(size, header::size_size)) {
+      pax += pax_record("size", std::to_string(size));
+    }
+    if (!pax.empty()) {
+      write_header("././@PaxHeader", 'x', pax.size(), 0644);
+      write(pax.data(), pax.size());
+      pad(pax.size());
+    }
+
+    char h[header::block] = {};
+    std::copy(short_name.begin(), short_name.end(), h + header::name);
+    std::copy(prefix.begin(), prefix.end(), h + header::prefix);
+    put_octal(h + header::mode, header::mode_size, mode);
+    put_octal(h + header::uid, header::id_size, 0);
+    put_octal(h + header::gid, header::id_size, 0);
+    put_octal(h + header::size, header::size_size,
+              fits_octal(size, header::size_size) ? size : 0);
+    put_octal(h + header::mtime, header::mtime_size, 0);
+    h[header::type] = type;
+    std::memcpy(h + header::magic, "ustar", header::magic_size);
+    std::memcpy(h + header::version, "00", 2);
+    // Six digits, a NUL and a space.
+    put_octal(h + header::checksum, 7, header::sum(h));
+    h[header::checksum + 7] = ' ';
+    write(h, header::block);
+  }
+
+  static unsigned mode_of(const file_status &status, unsigned fallback) {
+    auto perms = status.permissions();
+    return perms == std::filesystem::perms::unknown
+               ? fallback
+               : static_cast<unsigned>(perms) & 07777;
+  }
+
+  void add_file(filesystem &fs, const path &p, const std::string &name,
+                const file_status &status, error_code &ec) {
+    auto size = fs.file_size(p, ec);
+    if (ec) {
+      return;
+    }
+    bool in_place = dynamic_cast<const fake_filesystem *>(&fs) ||
+                    dynamic_cast<const std_filesystem *>(&fs);
+    file_view view;
+    if (in_place) {
+      view = fs.view_file(p, ec);
+      if (ec) {
+        return;
+      }
+      size = view.size();
+    }
+    write_header(name, '0', size, mode_of(status, 0644));
+    if (in_place) {
+      write(view.data().data(), view.size());
+    } else {
+      // Copy through a small buffer rather than staging the file.
+      auto in = fs.open_file(p, std::ios_base::in | std::ios_base::binary);
+      std::array<char, 64 << 10> buffer;
+      std::uint64_t copied = 0;
+      while (copied < size && *in) {
+        auto chunk = std::min<std::uint64_t>(buffer.size(), size - copied);
+        in->read(buffer.data(), static_cast<std::streamsize>(chunk));
+        write(buffer.data(), static_cast<std::size_t>(in->gcount()));
+        copied += static_cast<std::uint64_t>(in->gcount());
+      }
+      if (copied != size) {
+        // Truncated while it was read. The archive is unusable.
+        ec = std::make_error_code(std::errc::io_error);
+        return;
+      }
+    }
+    pad(size);
+    ++stats_.files;
+    stats_.bytes += size;
+  }
+
+  void add_tree(filesystem &fs, const path &dir, const std::string &prefix,
+                error_code &ec) {
+    std::vector<std::pair<std::string, file_status>> entries;
+    auto it = fs.directory_iterator(dir, ec);
+    while (!ec && !it->at_end()) {
+      auto status = it->status(ec);
+      if (ec) {
+        // A dangling symlink, or an entry removed since the listing.
+        ec.clear();
+        status = file_status(file_type::unknown);
+      }
+      entries.emplace_back(it->path().filename().generic_string(), status);
+      it->increment(ec);
+    }
+    if (ec) {
+      return;
+    }
+    std::sort(entries.begin(), entries.end(),
+              [](const auto &x, const auto &y) { return x.first < y.first; });
+    for (const auto &[name, status] : entries) {
+      auto p = dir / name;
+      if (status.type() == file_type::directory) {
+        write_header(prefix + name + '/', '5', 0, mode_of(status, 0755));
+        ++stats_.directories;
+        add_tree(fs, p, prefix + name + '/', ec);
+      } else if (status.type() == file_type::regular) {
+        add_file(fs, p, prefix + name, status, ec);
+      } else {
+        ++stats_.skipped;
+      }
+      if (ec || !out_) {
+        break;
+      }
+    }
+  }
+
+public:
+  explicit tar_writer(std::ostream &out) : out_(out) {}
+
+  tar_stats run(filesystem &fs, const path &root, error_code &ec) {
+    auto status = fs.status(root, ec);
+    if (!ec && status.type() == file_type::not_found) {
+      ec = std::make_error_code(std::errc::no_such_file_or_directory);
+    }
+    if (ec) {
+      return {};
+    }
+    if (status.type() == file_type::regular) {
+      add_file(fs, root, root.filename().generic_string(), status, ec);
+    } else {
+      add_tree(fs, root, {}, ec);
+    }
+    if (!ec) {
+      // The end of the archive.
+      static const char zeros[2 * header::block] = {};
+      write(zeros, sizeof(zeros));
+      out_.flush();
+    }
+    if (!ec && !out_) {
+      ec = std::make_error_code(std::errc::io_error);
+    }
+    return ec ? tar_stats{} : stats_;
+  }
+};
+
+/**
+ * @brief Reads a ustar, pax or GNU archive into a tree, one entry at a
+ * time.
+ */
+class tar_reader {
+private:
+  using header = tar_header;
+
+  std::istream &in_;
+  filesystem &fs_;
+  const path &root_;
+  fake_filesystem *fake_; ///< Set to build nodes directly.
+  tar_stats stats_;
+  path last_parent_; ///< Last parent directory known to exist.
+
+  /// Values of the last pax or GNU long name header, for the next entry.
+  std::string next_name_;
+  std::uint64_t next_size_{0};
+  bool has_next_size_{false};
+
+  /// Largest member size accepted, as for a signed 64-bit @c off_t.
+  static constexpr std::uint64_t max_size =
+      std::numeric_limits<std::int64_t>::max();
+  /// Largest pax or GNU long name header accepted.
+  static constexpr std::uint64_t max_header_size = 1 << 20;
+
+  static error_code bad_archive() {
+    return std::make_error_code(std::errc::bad_message);
+  }
+
+  bool read(char *data, std::uint64_t n) {
+    in_.read(data, static_cast<std::streamsize>(n));
+    return static_cast<std::uint64_t>(in_.gcount()) == n;
+  }
+
+  /**
+   * @brief Reads @c n bytes into a string, growing it as the data arrives
+   * rather than trusting @c n up front, so a bogus size in a short archive
+   * fails without allocating it.
+   */
+  bool read(std::string &s, std::uint64_t n) {
+    constexpr std::uint64_t chunk_size = 1 << 20;
+    s.clear();
+    while (n > 0) {
+      auto chunk = std::min(n, chunk_size);
+      auto old = s.size();
+      s.resize(old + static_cast<std::size_t>(chunk));
+      if (!read(s.data() + old, chunk)) {
+        return false;
+      }
+      n -= chunk;
+    }
+    return true;
+  }
+
+  bool skip(std::uint64_t n) {
+    std::array<char, 64 << 10> buffer;
+    while (n > 0) {
+      auto chunk = std::min<std::uint64_t>(n, buffer.size());
+      if (!read(buffer.data(), chunk)) {
+        return false;
+      }
+      n -= chunk;
+    }
+    return true;
+  }
+
+  static std::uint64_t padding(std::uint64_t size) {
+    return (header::block - size % header::block) % header::block;
+  }
+
+  /**
+   * @brief Parses a numeric field: octal digits, or base-256 if the high bit
+   * of the first byte is set.
+   */
+  static bool parse_number(const char *field, std::size_t width,
+                           std::uint64_t &v) {
+    v = 0;
+    if (static_cast<unsigned char>(field[0]) & 0x80) {
+      v = static_cast<unsigned char>(field[0]) & 0x3f;
+      for (std::size_t i = 1; i < width; ++i) {
+        if (v >> 56) {
+          // Does not fit in 64 bits.
+          return false;
+        }
+        v = v << 8 | static_cast<unsigned char>(field[i]);
+      }
+      return true;
+    }
+    std::size_t i = 0;
+    while (i < width && field[i] == ' ') {
+      ++i;
+    }
+    for (; i < width && field[i] >= '0' && field[i] <= '7'; ++i) {
+      v = v << 3 | static_cast<std::uint64_t>(field[i] - '0');
+    }
+    return i == width || field[i] == ' ' || field[i] == '\0';
+  }
+
+  static std::string field(const char *h, std::size_t offset,
+                           std::size_t width) {
+    auto begin = h + offset;
+    return std::string(begin, std::find(begin, begin + width, '\0'));
+  }
+
+  /**
+   * @brief Applies the records of a pax header to the next entry.
+   */
+  bool parse_pax(std::string_view records) {
+    while (!records.empty()) {
+      auto space = records.find(' ');
+      if (space == std::string_view::npos) {
+        return false;
+      }
+      std::size_t length = 0;
+      for (auto c : records.substr(0, space)) {
+        if (c < '0' || c > '9') {
+          return false;
+        }
+        length = length * 10 + static_cast<std::size_t>(c - '0');
+      }
+      if (length <= space + 1 || length > records.size() ||
+          records[length - 1] != '\n') {
+        return false;
+      }
+      auto record = records.substr(space + 1, length - space - 2);
+      records.remove_prefix(length);
+      auto eq = record.find('=');
+      if (eq == std::string_view::npos) {
+        return false;
+      }
+      auto key = record.substr(0, eq);
+      auto value = record.substr(eq + 1);
+      if (key == "path") {
+        next_name_ = value;
+      } else if (key == "size") {
+        next_size_ = 0;
+        for (auto c : value) {
+          auto digit = static_cast<std::uint64_t>(c - '0');
+          if (c < '0' || c > '9' || next_size_ > (max_size - digit) / 10) {
+            return false;
+          }
+          next_size_ = next_size_ * 10 + digit;
+        }
+        has_next_size_ = true;
+      }
+    }
+    return true;
+  }
+
+  /**
+   * @brief Converts a member name to a path below the root, or an empty
+   * path if it names the root itself.
+   */
+  static bool relative_path(const std::string &name, path &rel) {
+    rel.clear();
+    for (const auto &part : path(name).relative_path()) {
+      if (part == "..") {
+        // Would escape the root.
+        return false;
+      } else if (!part.empty() && part != ".") {
+        rel /= part;
+      }
+    }
+    return true;
+  }
+
+  void make_parent(const path &p, error_code &ec) {
+    auto parent = p.parent_path();
+    if (parent != last_parent_) {
+      fs_.create_directories(parent, ec);
+      if (!ec) {
+        last_parent_ = std::move(parent);
+      }
+    }
+  }
+
+  void extract_file(const path &p, std::uint64_t size, error_code &ec) {
+    make_parent(p, ec);
+    if (ec) {
+      return;
+    }
+    if (fake_) {
+      // Read straight into the string that becomes the node contents.
+      std::string content;
+      if (!read(content, size)) {
+        ec = bad_archive();
+        return;
+      }
+      fake_->write_file(p, std::move(content), ec);
+    } else {
+      auto out = fs_.open_file(p, std::ios_base::out | std::ios_base::trunc |
+                                      std::ios_base::binary);
+      std::array<char, 64 << 10> buffer;
+      for (auto left = size; left > 0 && *out;) {
+        auto chunk = std::min<std::uint64_t>(left, buffer.size());
+        if (!read(buffer.data(), chunk)) {
+          ec = bad_archive();
+          return;
+        }
+        out->write(buffer.data(), static_cast<std::streamsize>(chunk));
+        left -= chunk;
+      }
+      out->flush();
+      if (!*out) {
+        ec = std::make_error_code(std::errc::io_error);
+        return;
+      }
+    }
+    ++stats_.files;
+    stats_.bytes += size;
+  }
+
+public:
+  tar_reader(std::istream &in, filesystem &fs, const path &root)
+      : in_(in), fs_(fs), root_(root),
+        fake_(dynamic_cast<fake_filesystem *>(&fs)) {}
+
+  tar_stats run(error_code &ec) {
+    fs_.create_directories(root_, ec);
+    if (ec) {
+      return {};
+    }
+    last_parent_ = root_;
+    char h[header::block];
+    for (;;) {
+      in_.read(h, header::block);
+      if (in_.gcount() == 0) {
+        // Ended without the end-of-archive blocks, as some writers do.
+        break;
+      } else if (in_.gcount() != header::block) {
+        ec = bad_archive();
+        break;
+      } else if (std::all_of(h, h + header::block,
+                             [](char c) { return c == '\0'; })) {
+        break;
+      }
+      std::uint64_t checksum, size;
+      if (!parse_number(h + header::checksum, header::checksum_size,
+                        checksum) ||
+          checksum != header::sum(h) ||
+          !parse_number(h + header::size, header::size_size, size)) {
+        ec = bad_archive();
+        break;
+      }
+      std::string name;
+      if (!next_name_.empty()) {
+        name = std::move(next_name_);
+        next_name_.clear();
+      } else {
+        name = field(h, header::name, header::name_size);
+        auto prefix = field(h, header::prefix, header::prefix_size);
+        if (!prefix.empty() && field(h, header::magic, 5) == "ustar") {
+          name = prefix + '/' + name;
+        }
+      }
+      if (has_next_size_) {
+        size = next_size_;
+        has_next_size_ = false;
+      }
+      if (size > max_size) {
+        ec = bad_archive();
+        break;
+      }
+
+      char type = h[header::type];
+      if (type == 'x' || type == 'L') {
+        std::string data;
+        if (size > max_header_size || !read(data, size) ||
+            !skip(padding(size))) {
+          ec = bad_archive();
+          break;
+        }
+        if (type == 'L') {
+          next_name_ = data.substr(0, data.find('\0'));
+        } else if (!parse_pax(data)) {
+          ec = bad_archive();
+          break;
+        }
+        continue;
+      }
+
+      path rel;
+      if (!relative_path(name, rel)) {
+        ec = bad_archive();
+        break;
+      }
+      auto p = rel.empty() ? root_ : root_ / rel;
+      auto unread = size; // Data not consumed by the entry.
+      if (type == '5') {
+        if (!rel.empty()) {
+          make_parent(p, ec);
+          if (!ec) {
+            fs_.create_directory(p, ec);
+          }
+          ++stats_.directories;
+        }
+      } else if ((type == '0' || type == '\0' || type == '7') &&
+                 !rel.empty()) {
+        extract_file(p, size, ec);
+        unread = 0;
+      } else {
+        // Links, devices and global pax headers.
+        if (type != 'g') {
+          ++stats_.skipped;
+        }
+      }
+      if (ec) {
+        break;
+      } else if (!skip(unread) || !skip(padding(size))) {
+        ec = bad_archive();
+        break;
+      }
+    }
+    return ec ? tar_stats{} : stats_;
+  }
+};
+
+} // namespace detail
+
+/**
+ * @brief Writes the tree at @c root as a tar archive to a stream.
+ *
+ * @details Entries are named relative to @c root, with directories before
+ * their contents and siblings sorted by name, so equal trees give equal
+ * archives. Headers are ustar, with a pax header for paths longer than
+ * ustar allows and files of 8 GiB or more. Modes are the permissions of the
+ * entries, or 0755 and 0644 where the filesystem does not track them;
+ * owners and modification times are zero. File contents are copied from
+ * @c view_file, or through a small buffer, so nothing is staged. Entries
+ * other than directories and regular files are skipped.
+ *
+ * @param fs Filesystem of the tree.
+ * @param root A directory, whose contents are archived, or a regular file.
+ * @param out Stream receiving the archive.
+ * @param ec Set if @c root does not exist, an entry cannot be read, or the
+ * stream fails.
+ */
+inline tar_stats write_tar(filesystem &fs, const path &root,
+                           std::ostream &out, error_code &ec) {
+  return detail::tar_writer(out).run(fs, root, ec);
+}
+
+inline tar_stats write_tar(filesystem &fs, const path &root,
+                           std::ostream &out) {
+  error_code ec;
+  auto ret = write_tar(fs, root, out, ec);
+  if (ec) {
+    throw filesystem_error("write_tar", root, ec);
+  }
+  return ret;
+}
+
+/**
+ * @brief Reads a tar archive from a stream into the tree at @c root.
+ *
+ * @details Reads the archive in a single pass: ustar headers, pax extended
+ * headers for paths and sizes, and GNU long names. Directories and regular
+ * files are created below @c root, with any missing parent directories;
+ * other entries are skipped. Into a @c fake_filesystem, each file is read
+ * straight into the string that becomes its node with
+ * @c fake_filesystem::write_file. Modes, owners and times are ignored.
+ *
+ * @param in Stream of the archive.
+ * @param fs Filesystem receiving the tree.
+ * @param root Directory receiving the entries, created if missing.
+ * @param ec Set to @c std::errc::bad_message if the archive is malformed,
+ * truncated, or has a member outside @c root, or to the error of a failed
+ * filesystem operation. Entries extracted before the error are kept.
+ */
+inline tar_stats read_tar(std::istream &in, filesystem &fs, const path &root,
+                          error_code &ec) {
+  return detail::tar_reader(in, fs, root).run(ec);
+}
+
+inline tar_stats read_tar(std::istream &in, filesystem &fs,
+                          const path &root) {
+  error_code ec;
+  auto ret = read_tar(in, fs, root, ec);
+  if (ec) {
+    throw filesystem_error("read_tar", root, ec);
+  }
+  return ret;
+}
+
+} // namespace pfs
+
+#endif
@@ -0,0 +1,77 @@
+#ifndef INCLUDED_PFS_THREAD_POOL_HPP
+#define INCLUDED_PFS_THREAD_POOL_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <exception>
+#include <limits>
+#include <mutex>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+namespace pfs {
+namespace detail {
+
+/**
+ * @brief Resolves a requested number of threads.
+ *
+ * @param requested Threads asked for, or 0 for one per CPU when
+ * @c concurrent is true and one otherwise.
+ * @param concurrent Whether the filesystems involved allow the work to run
+ * on several threads (see @c filesystem::allows_concurrent_reads).
+ * @param jobs Number of jobs, which bounds the number of threads.
+ * @return At least 1.
+ */
+inline unsigned
+pool_size(unsigned requested, bool concurrent,
+          std::size_t jobs = std::numeric_limits<std::size_t>::max()) {
+  auto threads = requested    ? requested
+                 : concurrent ? std::thread::hardware_concurrency()
+                              : 1u;
+  return static_cast<unsigned>(
+      std::max<std::size_t>(1, std::min<std::size_t>(threads, jobs)));
+}
+
+/**
+ * @brief Calls @c worker on @c threads threads, one of them the calling
+ * thread, and waits for every call to return.
+ *
+ * @throw The first exception thrown by a call to @c worker, once every call
+ * has returned. Other calls are not interrupted.
+ */
+template <typename Worker> void run_pool(unsigned threads, Worker worker) {
+  std::mutex mutex;
+  std::exception_ptr error;
+  auto guarded = [&] {
+    try {
+      worker();
+    } catch (...) {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (!error) {
+        error = std::current_exception();
+      }
+    }
+  };
+  std::vector<std::thread> pool;
+  for (unsigned i = 1; i < threads; ++i) {
+    try {
+      pool.emplace_back(guarded);
+    } catch (const std::system_error &) {
+      // Out of threads: those already running share the work.
+      break;
+    }
+  }
+  guarded();
+  for (auto &t : pool) {
+    t.join();
+  }
+  if (error) {
+    std::rethrow_exception(error);
+  }
+}
+
+} // namespace detail
+} // namespace pfs
+
+#endif
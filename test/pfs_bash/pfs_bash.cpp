@@ -1,9 +1,17 @@
+#include <chrono>
+#include <fstream>
+#include <iomanip>
 #include <iostream>
+#include <optional>
 #include <pfs/fake_filesystem.hpp>
+#include <pfs/glob.hpp>
+#include <pfs/grep.hpp>
 #include <pfs/std_filesystem.hpp>
+#include <pfs_gen/workload.hpp>
 #include <sstream>
 #include <stdexcept>
 #include <string>
+#include <vector>
 
 std::ostream &operator<<(std::ostream &out, pfs::file_type t) {
   using ft = std::filesystem::file_type;
@@ -61,6 +69,9 @@ private:
   pfs::std_filesystem real_fs_;
   pfs::fake_filesystem fake_fs_;
   pfs::filesystem *fs_{&fake_fs_};
+  std::istream *in_{&std::cin}; ///< Source of commands.
+  bool interactive_{true};      ///< Print prompts and the help banner.
+  std::size_t line_number_{0};  ///< Lines read from in_.
 
   static void print_help() {
     std::cout << '\n'
@@ -74,6 +85,11 @@ private:
               << "  ls [DIR]       List contents of directory.\n"
               << "  lr [DIR]       Recursively list contents of directory.\n"
               << "  li [DIR]       Interactively recurse directory contents.\n"
+              << "  find PATTERN   List paths matching a glob pattern, such\n"
+              << "                 as src/**/*.cpp.\n"
+              << "  grep PAT [DIR] Print lines of files in DIR (default .)\n"
+              << "                 that contain PAT. In PAT, . matches any\n"
+              << "                 character, and ^ and $ anchor to lines.\n"
               << "  mkdir DIR      Create new directory. Parent must exist.\n"
               << "  mkdirs DIR     Create directory and subdirectories.\n"
               << "  rm PATH        Remove file or empty directory.\n"
@@ -84,7 +100,17 @@ private:
               << "  exist PATH     Checks if the path exists.\n"
               << "  isdir PATH     Checks if the path is a directory.\n"
               << "  path PATH      Decompose a path.\n"
+              << "  mem            Print memory used by the fake filesystem.\n"
+              << "  shrink         Release unused memory of fake filesystem.\n"
+              << "  time CMD       Run a command and print how long it took.\n"
+              << "  repeat N CMD   Run a command N times.\n"
+              << "  bench [N] [T]  Run N metadata operations (default 10000)\n"
+              << "                 on T threads (default 1) in ./pfs_bench.\n"
+              << "                 Prints throughput and latency percentiles.\n"
               << "  x, exit        Exit this program.\n"
+              << '\n'
+              << "Run `pfs_bash FILE` to execute the commands in FILE without\n"
+              << "prompts. Execution stops at the first failing command.\n"
               << std::endl;
   }
 
@@ -122,9 +148,16 @@ private:
     std::cout.flush();
   }
 
-  static std::vector<std::string> read_command() {
+  /**
+   * @brief Reads and tokenizes the next command.
+   * @return The tokens, or nullopt at the end of input.
+   */
+  std::optional<std::vector<std::string>> read_command() {
     std::string line;
-    std::getline(std::cin, line);
+    if (!std::getline(*in_, line)) {
+      return std::nullopt;
+    }
+    ++line_number_;
 
     enum { IN_WHITESPACE, IN_QUOTED, IN_UNQUOTED } state = IN_WHITESPACE;
 
@@ -212,7 +245,11 @@ private:
     try {
       for (;;) {
         print_lsri_prompt(*it);
-        auto tokens = read_command();
+        auto line = read_command();
+        if (!line) {
+          break;
+        }
+        auto &tokens = *line;
         if (tokens.empty()) {
           continue;
 
@@ -254,107 +291,244 @@ private:
     };
   }
 
+  /**
+   * @brief Runs a mix of metadata operations on the current filesystem and
+   * prints throughput and latency percentiles.
+   */
+  void bench(std::uint64_t operations, unsigned threads) {
+    pfs_gen::workload_spec spec;
+    spec.operations = operations / threads;
+    spec.threads = threads;
+    // The fake filesystem is not thread-safe.
+    spec.serialize = (fs_ == &fake_fs_) && threads > 1;
+    pfs::path root = "pfs_bench";
+    if (fs_->exists(root)) {
+      throw invalid_command_error("`pfs_bench` already exists.");
+    }
+    auto result = pfs_gen::run_workload(*fs_, root, spec);
+    fs_->remove_all(root);
+
+    using us = std::chrono::duration<double, std::micro>;
+    auto print_row = [](const char *name, std::uint64_t count,
+                        std::uint64_t errors, auto p50, auto p90, auto p99,
+                        auto max) {
+      std::cout << std::setw(8) << std::left << name << std::right
+                << std::setw(9) << count << std::setw(7) << errors
+                << std::fixed << std::setprecision(1) << std::setw(10)
+                << us(p50).count() << std::setw(10) << us(p90).count()
+                << std::setw(10) << us(p99).count() << std::setw(11)
+                << us(max).count() << '\n';
+    };
+    std::cout << "Operations: " << result.operations() << " on " << threads
+              << " thread(s) in "
+              << std::chrono::duration<double>(result.elapsed).count()
+              << " s\n"
+              << "Throughput: " << std::fixed << std::setprecision(0)
+              << result.throughput() << " ops/s\n\n"
+              << "op          count errors   p50(us)   p90(us)   p99(us)"
+                 "    max(us)\n";
+    for (std::size_t i = 0; i < pfs_gen::operation_count; ++i) {
+      auto op = static_cast<pfs_gen::operation>(i);
+      print_row(pfs_gen::to_string(op), result.latencies[i].size(),
+                result.errors[i], result.percentile(op, 50),
+                result.percentile(op, 90), result.percentile(op, 99),
+                result.percentile(op, 100));
+    }
+    std::uint64_t errors = 0;
+    for (auto e : result.errors) {
+      errors += e;
+    }
+    print_row("all", result.operations(), errors, result.percentile(50),
+              result.percentile(90), result.percentile(99),
+              result.percentile(100));
+    std::cout.unsetf(std::ios::floatfield);
+    std::cout << std::setprecision(6) << std::flush;
+  }
+
+  /**
+   * @brief Executes one command.
+   *
+   * @return false if the command asks to exit the program.
+   * @throw invalid_command_error if the command is malformed.
+   * @throw std::exception if the command fails.
+   */
+  bool execute(const std::vector<std::string> &tokens) {
+    if (tokens.empty()) {
+      return true;
+
+    } else if (parsed(tokens, "h") || parsed(tokens, "help")) {
+      print_help();
+
+    } else if (parsed(tokens, "x") || parsed(tokens, "exit")) {
+      return false;
+
+    } else if (parsed(tokens, "time", "CMD")) {
+      std::vector<std::string> command(tokens.begin() + 1, tokens.end());
+      auto start = std::chrono::steady_clock::now();
+      bool ret = execute(command);
+      std::chrono::duration<double, std::milli> elapsed =
+          std::chrono::steady_clock::now() - start;
+      std::cout << "time: " << elapsed.count() << " ms" << std::endl;
+      return ret;
+
+    } else if (parsed(tokens, "repeat", "N", "CMD")) {
+      auto n = std::stoull(tokens[1]);
+      std::vector<std::string> command(tokens.begin() + 2, tokens.end());
+      for (unsigned long long i = 0; i < n; ++i) {
+        if (!execute(command)) {
+          return false;
+        }
+      }
+
+    } else if (parsed(tokens, "bench")) {
+      std::uint64_t operations = tokens.size() > 1 ? std::stoull(tokens[1])
+                                                   : 10000;
+      unsigned threads =
+          tokens.size() > 2 ? static_cast<unsigned>(std::stoul(tokens[2])) : 1;
+      if (threads == 0) {
+        throw invalid_command_error("`bench` needs at least 1 thread.");
+      }
+      bench(operations, threads);
+
+    } else if (parsed(tokens, "mem")) {
+      auto info = fake_fs_.memory_stats();
+      auto row = [](const char *name, std::uintmax_t value) {
+        std::cout << "  " << std::setw(26) << std::left << name << std::right
+                  << std::setw(14) << value << '\n';
+      };
+      std::cout << "Fake filesystem memory (bytes):\n";
+      row("nodes (count)", info.nodes);
+      row("nodes", info.node_bytes);
+      row("names", info.name_bytes);
+      row("directory entries (used)", info.dents_used_bytes);
+      row("directory entries (total)", info.dents_capacity_bytes);
+      row("file contents (used)", info.content_used_bytes);
+      row("file contents (total)", info.content_capacity_bytes);
+      row("allocations (count)", info.allocations);
+      row("allocator overhead (est.)", info.allocator_overhead_bytes);
+      row("total", info.total_bytes());
+      std::cout << std::flush;
+
+    } else if (parsed(tokens, "shrink")) {
+      std::cout << "Released " << fake_fs_.shrink_to_fit() << " bytes."
+                << std::endl;
+
+    } else if (parsed(tokens, "real")) {
+      fs_ = &real_fs_;
+
+    } else if (parsed(tokens, "fake")) {
+      fs_ = &fake_fs_;
+
+    } else if (parsed(tokens, "pwd")) {
+      std::cout << fs_->current_path().string() << std::endl;
+
+    } else if (parsed(tokens, "cd", "DIR")) {
+      fs_->current_path(tokens[1]);
+
+    } else if (parsed(tokens, "ls")) {
+      std::string target = tokens.size() > 1 ? tokens[1] : ".";
+      for (auto it = fs_->directory_iterator(target); !it->at_end();
+           it->increment()) {
+        std::cout << it->status().permissions() << "  " << std::setw(9)
+                  << std::left << it->status().type() << "  "
+                  << it->path().filename().string() << std::endl;
+      }
+
+    } else if (parsed(tokens, "lr")) {
+      std::string target = tokens.size() > 1 ? tokens[1] : ".";
+      for (auto it = fs_->recursive_directory_iterator(target); !it->at_end();
+           it->increment()) {
+        std::cout << it->status().permissions() << "  " << std::setw(9)
+                  << std::left << it->status().type() << "  "
+                  << it->path().string() << std::endl;
+      }
+
+    } else if (parsed(tokens, "find", "PATTERN")) {
+      for (const auto &p : pfs::glob(*fs_, tokens[1])) {
+        std::cout << p.string() << '\n';
+      }
+      std::cout << std::flush;
+
+    } else if (parsed(tokens, "grep", "PATTERN")) {
+      std::string target = tokens.size() > 2 ? tokens[2] : ".";
+      for (const auto &m :
+           pfs::grep(*fs_, target, pfs::grep_pattern(tokens[1]))) {
+        std::cout << m.file.string() << ':' << m.line << ':' << m.text << '\n';
+      }
+      std::cout << std::flush;
+
+    } else if (parsed(tokens, "li")) {
+      std::string target = tokens.size() > 1 ? tokens[1] : ".";
+      interactive_recursive_list(target);
+
+    } else if (parsed(tokens, "mkdir", "DIR")) {
+      std::cout << fs_->create_directory(tokens[1]) << std::endl;
+
+    } else if (parsed(tokens, "mkdirs", "DIR")) {
+      std::cout << fs_->create_directories(tokens[1]) << std::endl;
+
+    } else if (parsed(tokens, "rm", "PATH")) {
+      std::cout << fs_->remove(tokens[1]) << std::endl;
+
+    } else if (parsed(tokens, "rmr", "PATH")) {
+      std::cout << fs_->remove_all(tokens[1]) << std::endl;
+
+    } else if (parsed(tokens, "mv", "SRC", "DST")) {
+      fs_->rename(tokens[1], tokens[2]);
+
+    } else if (parsed(tokens, "abs", "PATH")) {
+      std::cout << fs_->absolute(tokens[1]) << std::endl;
+
+    } else if (parsed(tokens, "stat", "PATH")) {
+      auto status = fs_->status(tokens[1]);
+      std::cout << "type: " << status.type() << '\n'
+                << "perms: " << status.permissions() << std::endl;
+
+    } else if (parsed(tokens, "exist", "PATH")) {
+      std::cout << fs_->exists(tokens[1]) << std::endl;
+
+    } else if (parsed(tokens, "isdir", "PATH")) {
+      std::cout << fs_->is_directory(tokens[1]) << std::endl;
+
+    } else if (parsed(tokens, "path", "PATH")) {
+      pfs::path p(tokens[1]);
+      std::cout << "Path: \"" << p.string() << "\"\n"
+                << "Root Name: \"" << p.root_name().string() << "\"\n"
+                << "Root Directory: \"" << p.root_directory().string()
+                << "\"\n"
+                << "Relative Path: \"" << p.relative_path().string() << "\"\n"
+                << "Filename: \"" << p.filename().string() << "\"\n"
+                << "Stem: \"" << p.stem().string() << "\"\n"
+                << "Extension: \"" << p.extension().string() << "\""
+                << std::endl;
+      std::cout << "Iteration: ";
+      for (auto part : p) {
+        std::cout << "\"" << part.string() << "\" ";
+      }
+      std::cout << std::endl;
+
+    } else if (interactive_) {
+      std::cout << "Unrecognized command. Try running `help`." << std::endl;
+
+    } else {
+      throw invalid_command_error("Unrecognized command.");
+    }
+    return true;
+  }
+
 public:
+  /**
+   * @brief Reads commands from stdin with a prompt until `exit`.
+   */
   void run() {
     std::cout << std::boolalpha;
     print_help();
-    std::string line;
     for (;;) {
       try {
         print_prompt();
         auto tokens = read_command();
-        if (tokens.empty()) {
-          continue;
-
-        } else if (parsed(tokens, "h") || parsed(tokens, "help")) {
-          print_help();
-
-        } else if (parsed(tokens, "x") || parsed(tokens, "exit")) {
+        if (!tokens || !execute(*tokens)) {
           break;
-
-        } else if (parsed(tokens, "real")) {
-          fs_ = &real_fs_;
-
-        } else if (parsed(tokens, "fake")) {
-          fs_ = &fake_fs_;
-
-        } else if (parsed(tokens, "pwd")) {
-          std::cout << fs_->current_path().string() << std::endl;
-
-        } else if (parsed(tokens, "cd", "DIR")) {
-          fs_->current_path(tokens[1]);
-
-        } else if (parsed(tokens, "ls")) {
-          std::string target = tokens.size() > 1 ? tokens[1] : ".";
-          for (auto it = fs_->directory_iterator(target); !it->at_end();
-               it->increment()) {
-            std::cout << it->status().permissions() << "  " << std::setw(9)
-                      << std::left << it->status().type() << "  "
-                      << it->path().filename().string() << std::endl;
-          }
-
-        } else if (parsed(tokens, "lr")) {
-          std::string target = tokens.size() > 1 ? tokens[1] : ".";
-          for (auto it = fs_->recursive_directory_iterator(target);
-               !it->at_end(); it->increment()) {
-            std::cout << it->status().permissions() << "  " << std::setw(9)
-                      << std::left << it->status().type() << "  "
-                      << it->path().string() << std::endl;
-          }
-
-        } else if (parsed(tokens, "li")) {
-          std::string target = tokens.size() > 1 ? tokens[1] : ".";
-          interactive_recursive_list(target);
-
-        } else if (parsed(tokens, "mkdir", "DIR")) {
-          std::cout << fs_->create_directory(tokens[1]) << std::endl;
-
-        } else if (parsed(tokens, "mkdirs", "DIR")) {
-          std::cout << fs_->create_directories(tokens[1]) << std::endl;
-
-        } else if (parsed(tokens, "rm", "PATH")) {
-          std::cout << fs_->remove(tokens[1]) << std::endl;
-
-        } else if (parsed(tokens, "rmr", "PATH")) {
-          std::cout << fs_->remove_all(tokens[1]) << std::endl;
-
-        } else if (parsed(tokens, "mv", "SRC", "DST")) {
-          fs_->rename(tokens[1], tokens[2]);
-
-        } else if (parsed(tokens, "abs", "PATH")) {
-          std::cout << fs_->absolute(tokens[1]) << std::endl;
-
-        } else if (parsed(tokens, "stat", "PATH")) {
-          auto status = fs_->status(tokens[1]);
-          std::cout << "type: " << status.type() << '\n'
-                    << "perms: " << status.permissions() << std::endl;
-
-        } else if (parsed(tokens, "exist", "PATH")) {
-          std::cout << fs_->exists(tokens[1]) << std::endl;
-
-        } else if (parsed(tokens, "isdir", "PATH")) {
-          std::cout << fs_->is_directory(tokens[1]) << std::endl;
-
-        } else if (parsed(tokens, "path", "PATH")) {
-          pfs::path p(tokens[1]);
-          std::cout << "Path: \"" << p.string() << "\"\n"
-                    << "Root Name: \"" << p.root_name().string() << "\"\n"
-                    << "Root Directory: \"" << p.root_directory().string()
-                    << "\"\n"
-                    << "Relative Path: \"" << p.relative_path().string()
-                    << "\"\n"
-                    << "Filename: \"" << p.filename().string() << "\"\n"
-                    << "Stem: \"" << p.stem().string() << "\"\n"
-                    << "Extension: \"" << p.extension().string() << "\""
-                    << std::endl;
-          std::cout << "Iteration: ";
-          for (auto part : p) {
-            std::cout << "\"" << part.string() << "\" ";
-          }
-          std::cout << std::endl;
-
-        } else {
-          std::cout << "Unrecognized command. Try running `help`." << std::endl;
         }
       } catch (const invalid_command_error &e) {
         std::cout << "Invalid command. " << e.what() << std::endl;
@@ -363,9 +537,42 @@ public:
       }
     }
   }
+
+  /**
+   * @brief Executes the commands in a file without prompts.
+   *
+   * @return Process exit status: 0 if every command succeeded, or 1 if the
+   * file could not be read or a command failed. Execution stops at the first
+   * failing command.
+   */
+  int run_script(const std::string &filename) {
+    std::ifstream script(filename);
+    if (!script) {
+      std::cerr << filename << ": cannot open file" << std::endl;
+      return 1;
+    }
+    std::cout << std::boolalpha;
+    in_ = &script;
+    interactive_ = false;
+    for (;;) {
+      try {
+        auto tokens = read_command();
+        if (!tokens || !execute(*tokens)) {
+          return 0;
+        }
+      } catch (const std::exception &e) {
+        std::cerr << filename << ':' << line_number_ << ": " << e.what()
+                  << std::endl;
+        return 1;
+      }
+    }
+  }
 };
 
-int main() {
+int main(int argc, char *argv[]) {
   application app;
+  if (argc > 1) {
+    return app.run_script(argv[1]);
+  }
   app.run();
-}
\ No newline at end of file
+}
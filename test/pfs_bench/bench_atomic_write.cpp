@@ -0,0 +1,86 @@
+#include "bench_filesystem.hpp"
+#include <pfs/atomic_write.hpp>
+#include <thread>
+#include <vector>
+
+// Replaces small files atomically from several threads, syncing each file
+// and its directory, or sharing syncs by group commit. Files are written
+// under bench_base_dir(): set PFS_BENCH_DIR to a disk-backed directory to
+// measure real syncs rather than tmpfs.
+
+namespace {
+
+constexpr int files_per_thread = 32;
+
+template <pfs::atomic_sync Sync>
+void bm_atomic_write(benchmark::State &state) {
+  auto threads = static_cast<int>(state.range(0));
+  pfs_bench::std_backend b;
+  pfs::atomic_write_options options;
+  options.sync = Sync;
+  pfs::atomic_writer writer(b.fs, options);
+  std::string content(256, 'x');
+  for (auto _ : state) {
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; ++t) {
+      workers.emplace_back([&, t] {
+        for (int i = 0; i < files_per_thread; ++i) {
+          writer.write(b.root / (std::to_string(t) + "_" + std::to_string(i)),
+                       content);
+        }
+      });
+    }
+    for (auto &w : workers) {
+      w.join();
+    }
+  }
+  auto stats = writer.stats();
+  state.SetItemsProcessed(static_cast<std::int64_t>(stats.files));
+  state.counters["syncs_per_file"] =
+      static_cast<double>(stats.file_syncs + stats.dir_syncs +
+                          stats.fs_syncs) /
+      static_cast<double>(stats.files);
+}
+
+template <pfs::atomic_sync Sync>
+void bm_atomic_write_all(benchmark::State &state) {
+  pfs_bench::std_backend b;
+  pfs::atomic_write_options options;
+  options.sync = Sync;
+  pfs::atomic_writer writer(b.fs, options);
+  std::string content(256, 'x');
+  std::vector<std::pair<pfs::path, std::string_view>> files;
+  for (int i = 0; i < files_per_thread; ++i) {
+    files.emplace_back(b.root / std::to_string(i), content);
+  }
+  for (auto _ : state) {
+    writer.write_all(files);
+  }
+  auto stats = writer.stats();
+  state.SetItemsProcessed(static_cast<std::int64_t>(stats.files));
+  state.counters["syncs_per_file"] =
+      static_cast<double>(stats.file_syncs + stats.dir_syncs +
+                          stats.fs_syncs) /
+      static_cast<double>(stats.files);
+}
+
+} // namespace
+
+BENCHMARK_TEMPLATE(bm_atomic_write, pfs::atomic_sync::each)
+    ->ArgName("threads")
+    ->Arg(1)
+    ->Arg(8)
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+BENCHMARK_TEMPLATE(bm_atomic_write, pfs::atomic_sync::group)
+    ->ArgName("threads")
+    ->Arg(1)
+    ->Arg(8)
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+BENCHMARK_TEMPLATE(bm_atomic_write_all, pfs::atomic_sync::each)
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+BENCHMARK_TEMPLATE(bm_atomic_write_all, pfs::atomic_sync::group)
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
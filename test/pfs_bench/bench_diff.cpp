@@ -0,0 +1,94 @@
+#include "bench_filesystem.hpp"
+#include <pfs/diff.hpp>
+#include <pfs/sync.hpp>
+#include <pfs_gen/tree_generator.hpp>
+
+// Compares a generated tree in a fake against an equal copy in each backend.
+// Against a fake, equal subtrees are recognized by their hashes; against the
+// std backend, every directory is listed and every file is read. The sync
+// benchmarks materialize the same tree in the std backend, and refresh a copy
+// that is already up to date.
+
+namespace {
+
+pfs_gen::tree_spec diff_spec() {
+  pfs_gen::tree_spec spec;
+  spec.depth = 3;
+  spec.file_size = pfs_gen::distribution::lognormal(1024, 1.0, 64 << 10);
+  return spec;
+}
+
+template <typename Backend> void bm_diff(benchmark::State &state) {
+  auto spec = diff_spec();
+  pfs_bench::fake_backend expected;
+  auto stats = pfs_gen::generate_tree(expected.fs, expected.root, spec);
+  Backend b;
+  pfs_gen::generate_tree(b.fs, b.root, spec);
+  pfs::diff_options options;
+  options.threads = static_cast<unsigned>(state.range(0));
+  options.compare_content = state.range(1) != 0;
+  for (auto _ : state) {
+    auto ret = pfs::diff(expected.fs, expected.root, b.fs, b.root, options);
+    benchmark::DoNotOptimize(ret);
+  }
+  state.SetItemsProcessed(static_cast<std::int64_t>(
+      state.iterations() * (stats.directories + stats.files)));
+}
+
+void bm_sync_materialize(benchmark::State &state) {
+  auto spec = diff_spec();
+  pfs_bench::fake_backend src;
+  auto stats = pfs_gen::generate_tree(src.fs, src.root, spec);
+  pfs::sync_options options;
+  options.threads = static_cast<unsigned>(state.range(0));
+  for (auto _ : state) {
+    state.PauseTiming();
+    auto dst = std::make_unique<pfs_bench::std_backend>();
+    state.ResumeTiming();
+    pfs::sync_tree(src.fs, src.root, dst->fs, dst->root / "tree", options);
+    state.PauseTiming();
+    dst.reset();
+    state.ResumeTiming();
+  }
+  state.SetBytesProcessed(
+      static_cast<std::int64_t>(state.iterations() * stats.bytes));
+}
+
+void bm_sync_refresh(benchmark::State &state) {
+  auto spec = diff_spec();
+  pfs_bench::fake_backend src;
+  auto stats = pfs_gen::generate_tree(src.fs, src.root, spec);
+  pfs_bench::std_backend dst;
+  pfs::sync_options options;
+  options.threads = static_cast<unsigned>(state.range(0));
+  pfs::sync_tree(src.fs, src.root, dst.fs, dst.root, options);
+  for (auto _ : state) {
+    pfs::sync_tree(src.fs, src.root, dst.fs, dst.root, options);
+  }
+  state.SetItemsProcessed(static_cast<std::int64_t>(
+      state.iterations() * (stats.directories + stats.files)));
+}
+
+} // namespace
+
+using pfs_bench::fake_backend;
+using pfs_bench::std_backend;
+
+BENCHMARK_TEMPLATE(bm_diff, fake_backend)
+    ->ArgNames({"threads", "content"})
+    ->Args({1, 1})
+    ->Unit(benchmark::kMicrosecond);
+BENCHMARK_TEMPLATE(bm_diff, std_backend)
+    ->ArgNames({"threads", "content"})
+    ->ArgsProduct({{1, 4}, {0, 1}})
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK(bm_sync_materialize)
+    ->ArgName("threads")
+    ->Arg(1)
+    ->Arg(4)
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK(bm_sync_refresh)
+    ->ArgName("threads")
+    ->Arg(1)
+    ->Arg(4)
+    ->Unit(benchmark::kMillisecond);
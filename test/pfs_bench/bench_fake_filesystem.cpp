@@ -0,0 +1,193 @@
+#include "bench_filesystem.hpp"
+#include <algorithm>
+#include <pfs_gen/tree_generator.hpp>
+
+namespace {
+
+/**
+ * @brief Tree shapes as {fanout, depth}: a flat directory, a few balanced
+ * trees of growing size, and a narrow deep chain.
+ */
+void tree_shapes(benchmark::internal::Benchmark *b) {
+  b->ArgNames({"fanout", "depth"});
+  b->Args({16, 1});
+  b->Args({1024, 1});
+  b->Args({8, 3});
+  b->Args({8, 5});
+  b->Args({2, 12});
+  b->Args({1, 64});
+}
+
+/**
+ * @brief Styles of names for @c bm_child_lookup.
+ */
+enum name_style {
+  short_names,    ///< d0, d1, ...
+  prefixed_names, ///< entry_000000, entry_000001, ...
+  random_names,   ///< 12 random characters.
+};
+
+std::string child_name(name_style style, pfs_gen::engine &rng, int i) {
+  switch (style) {
+  case short_names:
+    return pfs_bench::dir_name(i);
+  case prefixed_names: {
+    auto digits = std::to_string(i);
+    return "entry_" + std::string(6 - digits.size(), '0') + digits;
+  }
+  default:
+    return pfs_gen::random_name(rng, 12);
+  }
+}
+
+/**
+ * @brief Looks up existing children of one large directory by name.
+ *
+ * @details The CWD is the directory, so each lookup resolves a single path
+ * component and the time is dominated by the search of the directory.
+ */
+void bm_child_lookup(benchmark::State &state) {
+  auto entries = static_cast<int>(state.range(0));
+  auto style = static_cast<name_style>(state.range(1));
+  pfs::fake_filesystem fs;
+  fs.create_directory("/dir");
+  fs.current_path("/dir");
+  pfs_gen::engine rng(1);
+  std::vector<pfs::path> names;
+  for (int i = 0; i < entries; ++i) {
+    names.push_back(child_name(style, rng, i));
+    fs.create_directory(names.back());
+  }
+  std::shuffle(names.begin(), names.end(), rng);
+  std::size_t i = 0;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(fs.exists(names[i]));
+    if (++i == names.size()) {
+      i = 0;
+    }
+  }
+}
+
+/**
+ * @brief Recursively iterates a tree built by inserts and renames in random
+ * order, so that its nodes are scattered across the heap, optionally after
+ * compacting it.
+ */
+void bm_iterate_scattered(benchmark::State &state) {
+  auto entries = static_cast<int>(state.range(0));
+  bool compacted = state.range(1);
+  constexpr int dirs = 256;
+  pfs::fake_filesystem fs;
+  for (int d = 0; d < dirs; ++d) {
+    fs.create_directory("/" + pfs_bench::dir_name(d));
+  }
+  pfs_gen::engine rng(1);
+  std::vector<int> order(entries);
+  for (int i = 0; i < entries; ++i) {
+    order[i] = i;
+  }
+  std::shuffle(order.begin(), order.end(), rng);
+  auto entry_path = [](int d, int i) {
+    return "/" + pfs_bench::dir_name(d) + "/e" + std::to_string(i);
+  };
+  std::vector<int> dir_of(entries);
+  for (auto i : order) {
+    dir_of[i] = i % dirs;
+    fs.create_directory(entry_path(dir_of[i], i));
+  }
+  std::uniform_int_distribution<int> any_entry(0, entries - 1);
+  std::uniform_int_distribution<int> any_dir(0, dirs - 1);
+  for (int r = 0; r < entries / 4; ++r) {
+    auto i = any_entry(rng);
+    auto d = any_dir(rng);
+    fs.rename(entry_path(dir_of[i], i), entry_path(d, i));
+    dir_of[i] = d;
+  }
+  if (compacted) {
+    fs.compact();
+  }
+
+  std::int64_t count = 0;
+  for (auto _ : state) {
+    for (auto it = fs.recursive_directory_iterator("/"); !it->at_end();
+         it->increment()) {
+      benchmark::DoNotOptimize(it->status());
+      ++count;
+    }
+  }
+  state.SetItemsProcessed(count);
+}
+
+/**
+ * @brief Makes changes to a large fixture inside a transaction, then rolls
+ * them back. The time should depend on the number of changes only.
+ */
+void bm_transaction_rollback(benchmark::State &state) {
+  auto entries = static_cast<int>(state.range(0));
+  auto changes = static_cast<int>(state.range(1));
+  pfs::fake_filesystem fs;
+  pfs_bench::build_tree(fs, "/", entries, 1);
+  std::vector<pfs::path> paths;
+  for (int i = 0; i < changes; ++i) {
+    paths.push_back("/" + pfs_bench::dir_name(i % entries) + "/new");
+  }
+  for (auto _ : state) {
+    fs.begin();
+    for (const auto &p : paths) {
+      fs.create_directory(p);
+    }
+    fs.rollback();
+  }
+  state.SetItemsProcessed(state.iterations() * changes);
+}
+
+/**
+ * @brief Finds the entries with a rare name in a large tree, through the name
+ * index or by a recursive scan.
+ */
+void bm_find_by_name(benchmark::State &state) {
+  bool indexed = state.range(0);
+  pfs::fake_filesystem fs;
+  pfs_bench::build_tree(fs, "/", 8, 5);
+  fs.open_file("/d1/d2/needle", std::ios::out);
+  fs.open_file("/d7/d0/d3/needle", std::ios::out);
+  if (indexed) {
+    fs.enable_name_index();
+  }
+  for (auto _ : state) {
+    std::vector<pfs::path> found;
+    if (indexed) {
+      found = fs.find_by_name("needle");
+    } else {
+      for (auto it = fs.recursive_directory_iterator("/"); !it->at_end();
+           it->increment()) {
+        if (it->path().filename() == "needle") {
+          found.push_back(it->path());
+        }
+      }
+    }
+    benchmark::DoNotOptimize(found);
+  }
+}
+
+} // namespace
+
+using namespace pfs_bench;
+
+PFS_BENCH_ALL(fake_backend, tree_shapes);
+
+BENCHMARK(bm_child_lookup)
+    ->ArgNames({"entries", "style"})
+    ->ArgsProduct({{16, 128, 1024, 8192},
+                   {short_names, prefixed_names, random_names}});
+
+BENCHMARK(bm_iterate_scattered)
+    ->ArgNames({"entries", "compacted"})
+    ->ArgsProduct({{1 << 14, 1 << 17, 1 << 20}, {0, 1}})
+    ->Unit(benchmark::kMillisecond);
+
+BENCHMARK(bm_transaction_rollback)
+    ->ArgNames({"entries", "changes"})
+    ->ArgsProduct({{1 << 10, 1 << 17}, {16, 1024}});
+
+BENCHMARK(bm_find_by_name)->ArgName("indexed")->Arg(0)->Arg(1);
@@ -0,0 +1,165 @@
+#include "bench_filesystem.hpp"
+#include <mutex>
+#include <pfs/open_handle.hpp>
+#include <thread>
+#include <vector>
+
+// Reads 4 KiB blocks at scattered offsets of one file from several threads,
+// through a shared file handle or through a shared stream that each read
+// must lock and seek. Also writes a record of several fields with one
+// pwritev against one pwrite per field, and appends a large file on disk
+// with and without preallocating it first. Set PFS_BENCH_DIR to a
+// disk-backed directory to measure real allocation rather than tmpfs.
+
+namespace {
+
+constexpr std::size_t file_size = 8 << 20;
+constexpr std::size_t block_size = 4096;
+constexpr int reads_per_thread = 4096;
+
+template <typename Backend>
+pfs::path make_file(Backend &b) {
+  auto p = b.root / "data";
+  *b.fs.open_file(p, std::ios::out | std::ios::binary)
+      << std::string(file_size, 'x');
+  return p;
+}
+
+/**
+ * @brief Runs @c read(offset, buffer) for scattered offsets on each of
+ * @c threads threads.
+ */
+template <typename Read>
+void read_blocks(int threads, Read read) {
+  std::vector<std::thread> workers;
+  for (int t = 0; t < threads; ++t) {
+    workers.emplace_back([&, t] {
+      std::vector<char> buf(block_size);
+      std::uint64_t blocks = file_size / block_size;
+      for (int i = 0; i < reads_per_thread; ++i) {
+        auto block = (static_cast<std::uint64_t>(t) * 7919 + i * 104729) %
+                     blocks;
+        read(block * block_size, buf.data());
+      }
+    });
+  }
+  for (auto &w : workers) {
+    w.join();
+  }
+}
+
+template <typename Backend> void bm_handle_pread(benchmark::State &state) {
+  auto threads = static_cast<int>(state.range(0));
+  Backend b;
+  auto h = b.fs.open_handle(make_file(b), std::ios::in);
+  for (auto _ : state) {
+    read_blocks(threads, [&](std::uint64_t offset, char *buf) {
+      h->pread(buf, block_size, offset);
+    });
+  }
+  state.SetBytesProcessed(state.iterations() * threads * reads_per_thread *
+                          static_cast<std::int64_t>(block_size));
+}
+
+template <typename Backend> void bm_stream_pread(benchmark::State &state) {
+  auto threads = static_cast<int>(state.range(0));
+  Backend b;
+  auto in = b.fs.open_file(make_file(b), std::ios::in | std::ios::binary);
+  std::mutex mutex;
+  for (auto _ : state) {
+    read_blocks(threads, [&](std::uint64_t offset, char *buf) {
+      std::lock_guard<std::mutex> lock(mutex);
+      in->seekg(static_cast<std::streamoff>(offset));
+      in->read(buf, block_size);
+    });
+  }
+  state.SetBytesProcessed(state.iterations() * threads * reads_per_thread *
+                          static_cast<std::int64_t>(block_size));
+}
+
+/**
+ * @brief Writes records of eight 64-byte fields, with one call per record
+ * or one per field.
+ */
+template <bool Vectored> void bm_handle_pwritev(benchmark::State &state) {
+  pfs_bench::std_backend b;
+  auto h = b.fs.open_handle(b.root / "log", std::ios::out);
+  std::vector<std::string> fields(8, std::string(64, 'x'));
+  std::vector<pfs::const_buffer> buffers;
+  for (const auto &f : fields) {
+    buffers.push_back({f.data(), f.size()});
+  }
+  std::uint64_t offset = 0;
+  for (auto _ : state) {
+    if (Vectored) {
+      offset += h->pwritev(buffers.data(), buffers.size(), offset);
+    } else {
+      for (const auto &f : fields) {
+        offset += h->pwrite(f.data(), f.size(), offset);
+      }
+    }
+    if (offset > file_size) {
+      offset = 0;
+    }
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+/**
+ * @brief Appends 64 KiB blocks to a new 64 MiB file on disk and syncs it,
+ * after preallocating the whole file or not.
+ */
+template <bool Preallocate> void bm_append(benchmark::State &state) {
+  constexpr std::uint64_t total = 64 << 20;
+  pfs_bench::std_backend b;
+  std::string block(64 << 10, 'x');
+  for (auto _ : state) {
+    auto h = b.fs.open_handle(b.root / "append", std::ios::out);
+    if (Preallocate) {
+      h->preallocate(0, total);
+    }
+    for (std::uint64_t off = 0; off < total; off += block.size()) {
+      h->pwrite(block.data(), block.size(), off);
+    }
+    h->sync();
+    state.PauseTiming();
+    h.reset();
+    b.fs.remove(b.root / "append");
+    state.ResumeTiming();
+  }
+  state.SetBytesProcessed(state.iterations() *
+                          static_cast<std::int64_t>(total));
+}
+
+} // namespace
+
+BENCHMARK_TEMPLATE(bm_handle_pread, pfs_bench::fake_backend)
+    ->ArgName("threads")
+    ->Arg(1)
+    ->Arg(8)
+    ->UseRealTime();
+BENCHMARK_TEMPLATE(bm_stream_pread, pfs_bench::fake_backend)
+    ->ArgName("threads")
+    ->Arg(1)
+    ->Arg(8)
+    ->UseRealTime();
+BENCHMARK_TEMPLATE(bm_handle_pread, pfs_bench::std_backend)
+    ->ArgName("threads")
+    ->Arg(1)
+    ->Arg(8)
+    ->UseRealTime();
+BENCHMARK_TEMPLATE(bm_stream_pread, pfs_bench::std_backend)
+    ->ArgName("threads")
+    ->Arg(1)
+    ->Arg(8)
+    ->UseRealTime();
+BENCHMARK_TEMPLATE(bm_handle_pwritev, true);
+BENCHMARK_TEMPLATE(bm_handle_pwritev, false);
+#ifdef __linux__
+BENCHMARK_TEMPLATE(bm_append, true)
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+#endif
+BENCHMARK_TEMPLATE(bm_append, false)
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
@@ -0,0 +1,301 @@
+#ifndef INCLUDED_PFS_BENCH_FILESYSTEM_HPP
+#define INCLUDED_PFS_BENCH_FILESYSTEM_HPP
+
+#include <benchmark/benchmark.h>
+#include <cstdlib>
+#include <pfs/fake_filesystem.hpp>
+#include <pfs/std_filesystem.hpp>
+#include <random>
+#include <string>
+
+namespace pfs_bench {
+
+/**
+ * @brief Gets the name of the i'th directory at any level of a bench tree.
+ */
+inline std::string dir_name(int i) { return "d" + std::to_string(i); }
+
+/**
+ * @brief Creates a tree of directories through the pfs interface.
+ *
+ * @details Every directory at depths [0, depth) contains @c fanout child
+ * directories named d0, d1, ... The tree therefore holds
+ * fanout + fanout^2 + ... + fanout^depth directories below @c root.
+ *
+ * @param fs Filesystem in which the tree is built.
+ * @param root Existing directory that becomes the root of the tree.
+ * @param fanout Number of children per directory.
+ * @param depth Number of levels below the root.
+ * @return Number of directories created.
+ */
+inline std::int64_t build_tree(pfs::filesystem &fs, const pfs::path &root,
+                               int fanout, int depth) {
+  if (depth == 0) {
+    return 0;
+  }
+  std::int64_t count = 0;
+  for (int i = 0; i < fanout; ++i) {
+    auto child = root / dir_name(i);
+    fs.create_directory(child);
+    count += 1 + build_tree(fs, child, fanout, depth - 1);
+  }
+  return count;
+}
+
+/**
+ * @brief Gets the path of the last directory at the deepest level of a tree
+ * created by @c build_tree.
+ */
+inline pfs::path deepest_path(const pfs::path &root, int fanout, int depth) {
+  auto p = root;
+  for (int i = 0; i < depth; ++i) {
+    p /= dir_name(fanout - 1);
+  }
+  return p;
+}
+
+/**
+ * @brief Backend for fake_filesystem benchmarks.
+ */
+struct fake_backend {
+  pfs::fake_filesystem fs;
+  pfs::path root;
+
+  fake_backend() : root(fs.default_root() / "bench") {
+    fs.create_directory(root);
+  }
+};
+
+/**
+ * @brief Gets the directory in which std backends create their trees.
+ *
+ * @details Prefers the PFS_BENCH_DIR environment variable, then /dev/shm
+ * (tmpfs on Linux) so that results reflect the kernel's metadata path rather
+ * than the disk, then the system temp directory.
+ */
+inline std::filesystem::path bench_base_dir() {
+  if (const char *dir = std::getenv("PFS_BENCH_DIR")) {
+    return dir;
+  }
+  std::error_code ec;
+  if (std::filesystem::is_directory("/dev/shm", ec)) {
+    return "/dev/shm";
+  }
+  return std::filesystem::temp_directory_path();
+}
+
+/**
+ * @brief Backend for std_filesystem benchmarks, in a fresh directory that is
+ * removed on destruction.
+ */
+struct std_backend {
+  pfs::std_filesystem fs;
+  pfs::path root;
+  pfs::path saved_cwd;
+
+  std_backend() : saved_cwd(std::filesystem::current_path()) {
+    std::random_device rd;
+    root = bench_base_dir() / ("pfs_bench_" + std::to_string(rd()));
+    std::filesystem::create_directory(root);
+  }
+
+  ~std_backend() {
+    std::error_code ec;
+    std::filesystem::current_path(saved_cwd, ec);
+    std::filesystem::remove_all(root, ec);
+  }
+};
+
+// ---------------------------------------------------------------------------
+// Benchmarks parameterized by a backend. A backend is a default-constructible
+// type exposing `fs` (a pfs::filesystem) and `root` (an empty directory that
+// the backend cleans up on destruction). Benchmarks taking a tree receive
+// {fanout, depth} as their arguments.
+// ---------------------------------------------------------------------------
+
+template <typename Backend> void bm_exists(benchmark::State &state) {
+  Backend b;
+  int fanout = state.range(0), depth = state.range(1);
+  build_tree(b.fs, b.root, fanout, depth);
+  auto target = deepest_path(b.root, fanout, depth);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(b.fs.exists(target));
+  }
+}
+
+template <typename Backend> void bm_exists_missing(benchmark::State &state) {
+  Backend b;
+  int fanout = state.range(0), depth = state.range(1);
+  build_tree(b.fs, b.root, fanout, depth);
+  auto target = deepest_path(b.root, fanout, depth) / "missing";
+  pfs::error_code ec;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(b.fs.exists(target, ec));
+  }
+}
+
+template <typename Backend> void bm_is_directory(benchmark::State &state) {
+  Backend b;
+  int fanout = state.range(0), depth = state.range(1);
+  build_tree(b.fs, b.root, fanout, depth);
+  auto target = deepest_path(b.root, fanout, depth);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(b.fs.is_directory(target));
+  }
+}
+
+template <typename Backend> void bm_status(benchmark::State &state) {
+  Backend b;
+  int fanout = state.range(0), depth = state.range(1);
+  build_tree(b.fs, b.root, fanout, depth);
+  auto target = deepest_path(b.root, fanout, depth);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(b.fs.status(target));
+  }
+}
+
+template <typename Backend> void bm_absolute(benchmark::State &state) {
+  Backend b;
+  int fanout = state.range(0), depth = state.range(1);
+  build_tree(b.fs, b.root, fanout, depth);
+  b.fs.current_path(b.root);
+  auto target = deepest_path(".", fanout, depth);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(b.fs.absolute(target));
+  }
+}
+
+template <typename Backend> void bm_current_path_get(benchmark::State &state) {
+  Backend b;
+  int fanout = state.range(0), depth = state.range(1);
+  build_tree(b.fs, b.root, fanout, depth);
+  b.fs.current_path(deepest_path(b.root, fanout, depth));
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(b.fs.current_path());
+  }
+}
+
+template <typename Backend> void bm_current_path_set(benchmark::State &state) {
+  Backend b;
+  int fanout = state.range(0), depth = state.range(1);
+  build_tree(b.fs, b.root, fanout, depth);
+  auto target = deepest_path(b.root, fanout, depth);
+  for (auto _ : state) {
+    b.fs.current_path(target);
+  }
+}
+
+template <typename Backend>
+void bm_create_remove_directory(benchmark::State &state) {
+  Backend b;
+  int fanout = state.range(0), depth = state.range(1);
+  build_tree(b.fs, b.root, fanout, depth);
+  auto target = deepest_path(b.root, fanout, depth) / "new";
+  for (auto _ : state) {
+    b.fs.create_directory(target);
+    b.fs.remove(target);
+  }
+}
+
+template <typename Backend>
+void bm_create_directories(benchmark::State &state) {
+  Backend b;
+  int fanout = state.range(0), depth = state.range(1);
+  build_tree(b.fs, b.root, fanout, depth);
+  auto base = deepest_path(b.root, fanout, depth) / "new";
+  auto target = base / "a/b/c";
+  for (auto _ : state) {
+    b.fs.create_directories(target);
+    state.PauseTiming();
+    b.fs.remove_all(base);
+    state.ResumeTiming();
+  }
+}
+
+template <typename Backend> void bm_rename(benchmark::State &state) {
+  Backend b;
+  int fanout = state.range(0), depth = state.range(1);
+  build_tree(b.fs, b.root, fanout, depth);
+  auto parent = deepest_path(b.root, fanout, depth);
+  auto p1 = parent / "old";
+  auto p2 = parent / "new";
+  b.fs.create_directory(p1);
+  for (auto _ : state) {
+    b.fs.rename(p1, p2);
+    b.fs.rename(p2, p1);
+  }
+}
+
+template <typename Backend> void bm_remove_all(benchmark::State &state) {
+  Backend b;
+  int fanout = state.range(0), depth = state.range(1);
+  auto target = b.root / "victim";
+  std::int64_t count = 0;
+  for (auto _ : state) {
+    state.PauseTiming();
+    b.fs.create_directory(target);
+    count += build_tree(b.fs, target, fanout, depth);
+    state.ResumeTiming();
+    b.fs.remove_all(target);
+  }
+  state.SetItemsProcessed(count);
+}
+
+template <typename Backend>
+void bm_directory_iterator(benchmark::State &state) {
+  Backend b;
+  int fanout = state.range(0), depth = state.range(1);
+  build_tree(b.fs, b.root, fanout, depth);
+  std::int64_t count = 0;
+  for (auto _ : state) {
+    for (auto it = b.fs.directory_iterator(b.root); !it->at_end();
+         it->increment()) {
+      benchmark::DoNotOptimize(it->path());
+      ++count;
+    }
+  }
+  state.SetItemsProcessed(count);
+}
+
+template <typename Backend>
+void bm_recursive_directory_iterator(benchmark::State &state) {
+  Backend b;
+  int fanout = state.range(0), depth = state.range(1);
+  build_tree(b.fs, b.root, fanout, depth);
+  std::int64_t count = 0;
+  for (auto _ : state) {
+    for (auto it = b.fs.recursive_directory_iterator(b.root); !it->at_end();
+         it->increment()) {
+      benchmark::DoNotOptimize(it->path());
+      benchmark::DoNotOptimize(it->status());
+      ++count;
+    }
+  }
+  state.SetItemsProcessed(count);
+}
+
+} // namespace pfs_bench
+
+/**
+ * @brief Registers every templated benchmark for a backend over a list of
+ * {fanout, depth} tree shapes.
+ *
+ * @details Must be expanded where the pfs_bench namespace is visible, because
+ * the benchmark registration macros cannot take qualified names.
+ */
+#define PFS_BENCH_ALL(Backend, Shapes)                                         \
+  BENCHMARK_TEMPLATE(bm_exists, Backend)->Apply(Shapes);                       \
+  BENCHMARK_TEMPLATE(bm_exists_missing, Backend)->Apply(Shapes);               \
+  BENCHMARK_TEMPLATE(bm_is_directory, Backend)->Apply(Shapes);                 \
+  BENCHMARK_TEMPLATE(bm_status, Backend)->Apply(Shapes);                       \
+  BENCHMARK_TEMPLATE(bm_absolute, Backend)->Apply(Shapes);                     \
+  BENCHMARK_TEMPLATE(bm_current_path_get, Backend)->Apply(Shapes);             \
+  BENCHMARK_TEMPLATE(bm_current_path_set, Backend)->Apply(Shapes);             \
+  BENCHMARK_TEMPLATE(bm_create_remove_directory, Backend)->Apply(Shapes);      \
+  BENCHMARK_TEMPLATE(bm_create_directories, Backend)->Apply(Shapes);           \
+  BENCHMARK_TEMPLATE(bm_rename, Backend)->Apply(Shapes);                       \
+  BENCHMARK_TEMPLATE(bm_remove_all, Backend)->Apply(Shapes);                   \
+  BENCHMARK_TEMPLATE(bm_directory_iterator, Backend)->Apply(Shapes);           \
+  BENCHMARK_TEMPLATE(bm_recursive_directory_iterator, Backend)->Apply(Shapes)
+
+#endif
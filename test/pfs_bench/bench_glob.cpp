@@ -0,0 +1,49 @@
+#include "bench_filesystem.hpp"
+#include <pfs/glob.hpp>
+
+// A selective pattern over a bench tree, matched by find, which lists only
+// the directories the pattern can reach, and by a walk of the whole tree
+// that filters every path.
+
+namespace {
+
+constexpr int glob_fanout = 8;
+constexpr int glob_depth = 4;
+constexpr const char *glob_text = "d1/*/d2/*";
+
+template <typename Backend> void bm_find(benchmark::State &state) {
+  Backend b;
+  pfs_bench::build_tree(b.fs, b.root, glob_fanout, glob_depth);
+  pfs::glob_pattern pattern(glob_text);
+  for (auto _ : state) {
+    auto ret = pfs::find(b.fs, b.root, pattern);
+    benchmark::DoNotOptimize(ret);
+  }
+}
+
+template <typename Backend> void bm_walk_filter(benchmark::State &state) {
+  Backend b;
+  pfs_bench::build_tree(b.fs, b.root, glob_fanout, glob_depth);
+  pfs::glob_pattern pattern(glob_text);
+  for (auto _ : state) {
+    std::vector<pfs::path> ret;
+    for (auto it = b.fs.recursive_directory_iterator(b.root); !it->at_end();
+         it->increment()) {
+      if (pattern.match(it->path().lexically_relative(b.root))) {
+        ret.push_back(it->path());
+      }
+    }
+    benchmark::DoNotOptimize(ret);
+  }
+}
+
+} // namespace
+
+using pfs_bench::fake_backend;
+using pfs_bench::std_backend;
+
+BENCHMARK_TEMPLATE(bm_find, fake_backend)->Unit(benchmark::kMicrosecond);
+BENCHMARK_TEMPLATE(bm_walk_filter, fake_backend)
+    ->Unit(benchmark::kMicrosecond);
+BENCHMARK_TEMPLATE(bm_find, std_backend)->Unit(benchmark::kMicrosecond);
+BENCHMARK_TEMPLATE(bm_walk_filter, std_backend)->Unit(benchmark::kMicrosecond);
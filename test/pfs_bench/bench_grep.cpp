@@ -0,0 +1,76 @@
+#include "bench_filesystem.hpp"
+#include <pfs/grep.hpp>
+#include <pfs_gen/tree_generator.hpp>
+#include <string>
+
+// Searches a generated tree for a string it does not contain, so every byte
+// is scanned. bm_grep searches views of the files with SIMD compares;
+// bm_grep_getline reads them through streams line by line and searches
+// each line with std::string::find, as a baseline.
+
+namespace {
+
+constexpr const char *grep_text = "xyzzy";
+
+pfs_gen::tree_spec grep_spec() {
+  pfs_gen::tree_spec spec;
+  spec.depth = 2;
+  spec.file_size = pfs_gen::distribution::lognormal(64 << 10, 0.5, 1 << 20);
+  return spec;
+}
+
+template <typename Backend> void bm_grep(benchmark::State &state) {
+  Backend b;
+  auto stats = pfs_gen::generate_tree(b.fs, b.root, grep_spec());
+  pfs::grep_pattern pattern(grep_text);
+  pfs::grep_options options;
+  options.threads = static_cast<unsigned>(state.range(0));
+  for (auto _ : state) {
+    auto ret = pfs::grep(b.fs, b.root, pattern, options);
+    benchmark::DoNotOptimize(ret);
+  }
+  state.SetBytesProcessed(
+      static_cast<std::int64_t>(state.iterations() * stats.bytes));
+}
+
+template <typename Backend> void bm_grep_getline(benchmark::State &state) {
+  Backend b;
+  auto stats = pfs_gen::generate_tree(b.fs, b.root, grep_spec());
+  for (auto _ : state) {
+    std::size_t found = 0;
+    for (auto it = b.fs.recursive_directory_iterator(b.root); !it->at_end();
+         it->increment()) {
+      if (it->status().type() != pfs::file_type::regular) {
+        continue;
+      }
+      auto in = b.fs.open_file(it->path(), std::ios::in);
+      std::string line;
+      while (std::getline(*in, line)) {
+        found += line.find(grep_text) != std::string::npos;
+      }
+    }
+    benchmark::DoNotOptimize(found);
+  }
+  state.SetBytesProcessed(
+      static_cast<std::int64_t>(state.iterations() * stats.bytes));
+}
+
+} // namespace
+
+using pfs_bench::fake_backend;
+using pfs_bench::std_backend;
+
+BENCHMARK_TEMPLATE(bm_grep, fake_backend)
+    ->ArgName("threads")
+    ->Arg(1)
+    ->Arg(4)
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(bm_grep_getline, fake_backend)
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(bm_grep, std_backend)
+    ->ArgName("threads")
+    ->Arg(1)
+    ->Arg(4)
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(bm_grep_getline, std_backend)
+    ->Unit(benchmark::kMillisecond);
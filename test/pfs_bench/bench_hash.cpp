@@ -0,0 +1,69 @@
+#include "bench_filesystem.hpp"
+#include <chrono>
+#include <pfs/hash.hpp>
+#include <pfs_gen/tree_generator.hpp>
+
+// Hashes a generated tree. bm_hash_tree reads every file of the tree each
+// time, through a hasher without a cache; bm_hash_tree_cached reuses one
+// hasher whose cache already holds every file, as a second scan of an
+// unchanged tree on disk does.
+
+namespace {
+
+pfs_gen::tree_spec hash_spec() {
+  pfs_gen::tree_spec spec;
+  spec.depth = 2;
+  spec.file_size = pfs_gen::distribution::lognormal(64 << 10, 1.5, 16 << 20);
+  return spec;
+}
+
+template <typename Backend> void bm_hash_tree(benchmark::State &state) {
+  Backend b;
+  auto stats = pfs_gen::generate_tree(b.fs, b.root, hash_spec());
+  pfs::hash_options options;
+  options.threads = static_cast<unsigned>(state.range(0));
+  options.cache = false;
+  pfs::content_hasher hasher(options);
+  for (auto _ : state) {
+    auto ret = hasher.hash_tree(b.fs, b.root);
+    benchmark::DoNotOptimize(ret);
+  }
+  state.SetBytesProcessed(
+      static_cast<std::int64_t>(state.iterations() * stats.bytes));
+}
+
+void bm_hash_tree_cached(benchmark::State &state) {
+  pfs_bench::std_backend b;
+  auto stats = pfs_gen::generate_tree(b.fs, b.root, hash_spec());
+  // Files modified in the last seconds are not cached.
+  auto old = std::filesystem::file_time_type::clock::now() -
+             std::chrono::hours(1);
+  for (auto &e : std::filesystem::recursive_directory_iterator(b.root)) {
+    std::filesystem::last_write_time(e.path(), old);
+  }
+  pfs::content_hasher hasher;
+  hasher.hash_tree(b.fs, b.root);
+  for (auto _ : state) {
+    auto ret = hasher.hash_tree(b.fs, b.root);
+    benchmark::DoNotOptimize(ret);
+  }
+  state.SetItemsProcessed(
+      static_cast<std::int64_t>(state.iterations() * stats.files));
+}
+
+} // namespace
+
+using pfs_bench::fake_backend;
+using pfs_bench::std_backend;
+
+BENCHMARK_TEMPLATE(bm_hash_tree, fake_backend)
+    ->ArgName("threads")
+    ->Arg(1)
+    ->Arg(4)
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(bm_hash_tree, std_backend)
+    ->ArgName("threads")
+    ->Arg(1)
+    ->Arg(4)
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK(bm_hash_tree_cached)->Unit(benchmark::kMillisecond);
@@ -0,0 +1,107 @@
+#include "bench_filesystem.hpp"
+#include <memory>
+#include <pfs/persistent_fake_filesystem.hpp>
+#include <thread>
+#include <vector>
+
+// Writes small files into a persistent fake from several threads, which share
+// log syncs by group commit, and recovers a tree from its log and from a
+// checkpoint. The log lives under bench_base_dir(): set PFS_BENCH_DIR to a
+// disk-backed directory to measure real syncs rather than tmpfs.
+
+namespace {
+
+/**
+ * @brief A persistent fake in a fresh log directory that is removed on
+ * destruction.
+ */
+struct wal_dir {
+  std::filesystem::path dir;
+
+  wal_dir() {
+    std::random_device rd;
+    dir = pfs_bench::bench_base_dir() / ("pfs_bench_wal_" +
+                                         std::to_string(rd()));
+  }
+
+  ~wal_dir() {
+    std::error_code ec;
+    std::filesystem::remove_all(dir, ec);
+  }
+};
+
+constexpr int files_per_thread = 64;
+
+void bm_wal_write(benchmark::State &state) {
+  auto threads = static_cast<int>(state.range(0));
+  wal_dir d;
+  pfs::persistence_options options;
+  options.checkpoint_bytes = 0;
+  pfs::persistent_fake_filesystem fs(d.dir, options);
+  for (int t = 0; t < threads; ++t) {
+    fs.create_directory("/t" + std::to_string(t));
+  }
+  auto before = fs.stats();
+  for (auto _ : state) {
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; ++t) {
+      workers.emplace_back([&fs, t] {
+        auto dir = "/t" + std::to_string(t) + "/";
+        for (int i = 0; i < files_per_thread; ++i) {
+          *fs.open_file(dir + std::to_string(i), std::ios::out) << i;
+        }
+      });
+    }
+    for (auto &w : workers) {
+      w.join();
+    }
+  }
+  auto after = fs.stats();
+  state.SetItemsProcessed(static_cast<std::int64_t>(
+      state.iterations() * threads * files_per_thread));
+  state.counters["records_per_commit"] =
+      static_cast<double>(after.records - before.records) /
+      static_cast<double>(after.commits - before.commits);
+}
+
+void bm_wal_recover(benchmark::State &state) {
+  bool checkpoint = state.range(0);
+  wal_dir d;
+  pfs::persistence_options options;
+  options.sync = false;
+  options.checkpoint_bytes = 0;
+  std::int64_t records;
+  {
+    pfs::persistent_fake_filesystem fs(d.dir, options);
+    pfs_bench::build_tree(fs, "/", 16, 3);
+    for (int i = 0; i < 4096; ++i) {
+      *fs.open_file("/d0/f" + std::to_string(i), std::ios::out) << i;
+    }
+    records = static_cast<std::int64_t>(fs.stats().records);
+    if (checkpoint) {
+      fs.checkpoint();
+    }
+  }
+  for (auto _ : state) {
+    auto fs = std::make_unique<pfs::persistent_fake_filesystem>(d.dir, options);
+    state.PauseTiming();
+    fs.reset();
+    state.ResumeTiming();
+  }
+  state.SetItemsProcessed(state.iterations() * records);
+}
+
+} // namespace
+
+BENCHMARK(bm_wal_write)
+    ->ArgName("threads")
+    ->Arg(1)
+    ->Arg(4)
+    ->Arg(16)
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+BENCHMARK(bm_wal_recover)
+    ->ArgName("checkpoint")
+    ->Arg(0)
+    ->Arg(1)
+    ->Unit(benchmark::kMillisecond);
@@ -0,0 +1,166 @@
+#include "bench_filesystem.hpp"
+#include <pfs/remote_filesystem.hpp>
+#include <system_error>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <pfs/shm_transport.hpp>
+#endif
+
+namespace {
+
+/**
+ * @brief Small trees only: bm_remove_all rebuilds its tree, one round trip
+ * per directory, outside the timed region of every iteration.
+ */
+void tree_shapes(benchmark::internal::Benchmark *b) {
+  b->ArgNames({"fanout", "depth"});
+  b->Args({16, 1});
+  b->Args({4, 2});
+}
+
+} // namespace
+
+namespace pfs_bench {
+
+/**
+ * @brief Both ends of a connection.
+ */
+using transport_pair = std::pair<std::unique_ptr<pfs::rpc::transport>,
+                                 std::unique_ptr<pfs::rpc::transport>>;
+
+/**
+ * @brief Connects a client and a server over a socket pair.
+ */
+struct socket_pair {
+  static transport_pair connect() {
+    int fds[2];
+    if (::socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) != 0) {
+      throw std::system_error(errno, std::generic_category(), "socketpair");
+    }
+    return {std::make_unique<pfs::rpc::socket_transport>(fds[0]),
+            std::make_unique<pfs::rpc::socket_transport>(fds[1])};
+  }
+};
+
+#ifdef __linux__
+/**
+ * @brief Connects a client and a server over shared memory rings.
+ */
+struct shm_rings {
+  static transport_pair connect() {
+    auto name = "/pfs_bench_ring_" + std::to_string(::getpid());
+    pfs::error_code ec;
+    auto server = pfs::rpc::shm_transport::create(
+        name, pfs::rpc::shm_transport::default_capacity, ec);
+    auto client = server ? pfs::rpc::shm_transport::open(name, ec) : nullptr;
+    pfs::rpc::shm_transport::destroy(name);
+    if (!client) {
+      throw std::system_error(ec, "shm_transport");
+    }
+    return {std::move(client), std::move(server)};
+  }
+};
+#endif
+
+/**
+ * @brief Backend for remote_filesystem benchmarks, served a fake filesystem
+ * by a thread.
+ *
+ * @details Serving a fake filesystem leaves mostly the cost of the round
+ * trips to be measured.
+ *
+ * @tparam Transports Connects the client to the server.
+ */
+template <typename Transports> struct basic_remote_backend {
+  pfs::fake_filesystem served;
+  std::thread server;
+  std::unique_ptr<pfs::remote_filesystem> client;
+  pfs::filesystem &fs;
+  pfs::path root;
+
+  basic_remote_backend() : client(connect()), fs(*client), root("/bench") {
+    fs.create_directory(root);
+  }
+
+  ~basic_remote_backend() {
+    client.reset();
+    server.join();
+  }
+
+  std::unique_ptr<pfs::remote_filesystem> connect() {
+    auto [client_t, server_t] = Transports::connect();
+    server = std::thread([this, t = std::move(server_t)] {
+      pfs::rpc::serve(served, *t);
+    });
+    return std::make_unique<pfs::remote_filesystem>(std::move(client_t));
+  }
+};
+
+using remote_backend = basic_remote_backend<socket_pair>;
+#ifdef __linux__
+using remote_shm_backend = basic_remote_backend<shm_rings>;
+#endif
+
+} // namespace pfs_bench
+
+using namespace pfs_bench;
+
+PFS_BENCH_ALL(remote_backend, tree_shapes);
+#ifdef __linux__
+PFS_BENCH_ALL(remote_shm_backend, tree_shapes);
+#endif
+
+namespace {
+
+/**
+ * @brief Queries the status of 1024 directories, sending @c batch_size
+ * queries per round trip.
+ */
+template <typename Backend>
+void bm_remote_status_batched(benchmark::State &state) {
+  constexpr int entries = 1024;
+  auto batch_size = static_cast<int>(state.range(0));
+  Backend backend;
+  build_tree(backend.fs, backend.root, entries, 1);
+  std::vector<pfs::path> paths;
+  for (int i = 0; i < entries; ++i) {
+    paths.push_back(backend.root / dir_name(i));
+  }
+  std::vector<pfs::remote_filesystem::pending<pfs::file_status>> results;
+  for (auto _ : state) {
+    for (int i = 0; i < entries; i += batch_size) {
+      pfs::remote_filesystem::batch b(*backend.client);
+      results.clear();
+      for (int j = i; j < i + batch_size; ++j) {
+        results.push_back(b.status(paths[j]));
+      }
+      b.submit();
+      for (auto &r : results) {
+        benchmark::DoNotOptimize(r.get());
+      }
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * entries);
+}
+
+void batch_sizes(benchmark::internal::Benchmark *b) {
+  b->ArgName("batch")->Unit(benchmark::kMicrosecond);
+  for (int size : {1, 16, 256, 1024}) {
+    b->Arg(size);
+  }
+}
+
+} // namespace
+
+BENCHMARK_TEMPLATE(bm_remote_status_batched, remote_backend)
+    ->Apply(batch_sizes);
+#ifdef __linux__
+BENCHMARK_TEMPLATE(bm_remote_status_batched, remote_shm_backend)
+    ->Apply(batch_sizes);
+#endif
@@ -0,0 +1,48 @@
+#include "bench_filesystem.hpp"
+#include <pfs/shared_fake_filesystem.hpp>
+#include <unistd.h>
+
+namespace {
+
+void tree_shapes(benchmark::internal::Benchmark *b) {
+  b->ArgNames({"fanout", "depth"});
+  b->Args({16, 1});
+  b->Args({1024, 1});
+  b->Args({8, 3});
+  b->Args({1, 64});
+}
+
+/**
+ * @brief Gives each backend instance its own shared memory object.
+ */
+std::string shm_name() {
+  static int count = 0;
+  return "/pfs_bench_" + std::to_string(::getpid()) + "_" +
+         std::to_string(count++);
+}
+
+} // namespace
+
+namespace pfs_bench {
+
+/**
+ * @brief Backend for shared_fake_filesystem benchmarks, in a shared memory
+ * object that is destroyed on destruction.
+ */
+struct shared_backend {
+  std::string name;
+  pfs::shared_fake_filesystem fs;
+  pfs::path root;
+
+  shared_backend() : name(shm_name()), fs(name), root("/bench") {
+    fs.create_directory(root);
+  }
+
+  ~shared_backend() { pfs::shared_fake_filesystem::destroy(name); }
+};
+
+} // namespace pfs_bench
+
+using namespace pfs_bench;
+
+PFS_BENCH_ALL(shared_backend, tree_shapes);
@@ -0,0 +1,104 @@
+#include "bench_filesystem.hpp"
+
+namespace {
+
+void tree_shapes(benchmark::internal::Benchmark *b) {
+  b->ArgNames({"fanout", "depth"});
+  b->Args({16, 1});
+  b->Args({1024, 1});
+  b->Args({8, 3});
+  b->Args({1, 64});
+}
+
+// ---------------------------------------------------------------------------
+// Raw std::filesystem baselines. These mirror the templated benchmarks but
+// skip the pfs virtual interface, so the difference to the std_backend
+// results is the wrapper overhead.
+// ---------------------------------------------------------------------------
+
+void bm_raw_exists(benchmark::State &state) {
+  pfs_bench::std_backend b;
+  int fanout = state.range(0), depth = state.range(1);
+  pfs_bench::build_tree(b.fs, b.root, fanout, depth);
+  auto target = pfs_bench::deepest_path(b.root, fanout, depth);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(std::filesystem::exists(target));
+  }
+}
+
+void bm_raw_status(benchmark::State &state) {
+  pfs_bench::std_backend b;
+  int fanout = state.range(0), depth = state.range(1);
+  pfs_bench::build_tree(b.fs, b.root, fanout, depth);
+  auto target = pfs_bench::deepest_path(b.root, fanout, depth);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(std::filesystem::status(target));
+  }
+}
+
+void bm_raw_create_remove_directory(benchmark::State &state) {
+  pfs_bench::std_backend b;
+  int fanout = state.range(0), depth = state.range(1);
+  pfs_bench::build_tree(b.fs, b.root, fanout, depth);
+  auto target = pfs_bench::deepest_path(b.root, fanout, depth) / "new";
+  for (auto _ : state) {
+    std::filesystem::create_directory(target);
+    std::filesystem::remove(target);
+  }
+}
+
+void bm_raw_rename(benchmark::State &state) {
+  pfs_bench::std_backend b;
+  int fanout = state.range(0), depth = state.range(1);
+  pfs_bench::build_tree(b.fs, b.root, fanout, depth);
+  auto parent = pfs_bench::deepest_path(b.root, fanout, depth);
+  auto p1 = parent / "old";
+  auto p2 = parent / "new";
+  std::filesystem::create_directory(p1);
+  for (auto _ : state) {
+    std::filesystem::rename(p1, p2);
+    std::filesystem::rename(p2, p1);
+  }
+}
+
+void bm_raw_directory_iterator(benchmark::State &state) {
+  pfs_bench::std_backend b;
+  int fanout = state.range(0), depth = state.range(1);
+  pfs_bench::build_tree(b.fs, b.root, fanout, depth);
+  std::int64_t count = 0;
+  for (auto _ : state) {
+    for (auto &dent : std::filesystem::directory_iterator(b.root)) {
+      benchmark::DoNotOptimize(dent.path());
+      ++count;
+    }
+  }
+  state.SetItemsProcessed(count);
+}
+
+void bm_raw_recursive_directory_iterator(benchmark::State &state) {
+  pfs_bench::std_backend b;
+  int fanout = state.range(0), depth = state.range(1);
+  pfs_bench::build_tree(b.fs, b.root, fanout, depth);
+  std::int64_t count = 0;
+  for (auto _ : state) {
+    for (auto &dent : std::filesystem::recursive_directory_iterator(b.root)) {
+      benchmark::DoNotOptimize(dent.path());
+      benchmark::DoNotOptimize(dent.status());
+      ++count;
+    }
+  }
+  state.SetItemsProcessed(count);
+}
+
+} // namespace
+
+using namespace pfs_bench;
+
+PFS_BENCH_ALL(std_backend, tree_shapes);
+
+BENCHMARK(bm_raw_exists)->Apply(tree_shapes);
+BENCHMARK(bm_raw_status)->Apply(tree_shapes);
+BENCHMARK(bm_raw_create_remove_directory)->Apply(tree_shapes);
+BENCHMARK(bm_raw_rename)->Apply(tree_shapes);
+BENCHMARK(bm_raw_directory_iterator)->Apply(tree_shapes);
+BENCHMARK(bm_raw_recursive_directory_iterator)->Apply(tree_shapes);
@@ -0,0 +1,59 @@
+#include "bench_filesystem.hpp"
+#include <memory>
+#include <pfs/tar.hpp>
+#include <pfs_gen/tree_generator.hpp>
+#include <sstream>
+
+// Loads a generated tree from a tar archive in memory into a fresh fake, as
+// a test fixture would, and writes the tree back out as an archive.
+
+namespace {
+
+pfs_gen::tree_spec tar_spec() {
+  pfs_gen::tree_spec spec;
+  spec.depth = 3;
+  spec.file_size = pfs_gen::distribution::lognormal(1024, 1.0, 64 << 10);
+  return spec;
+}
+
+void bm_tar_import(benchmark::State &state) {
+  pfs_bench::fake_backend src;
+  auto stats = pfs_gen::generate_tree(src.fs, src.root, tar_spec());
+  std::ostringstream out;
+  pfs::write_tar(src.fs, src.root, out);
+  auto archive = out.str();
+  for (auto _ : state) {
+    std::istringstream in(archive);
+    auto fs = std::make_unique<pfs::fake_filesystem>();
+    pfs::read_tar(in, *fs, "/fixture");
+    state.PauseTiming();
+    fs.reset();
+    state.ResumeTiming();
+  }
+  state.SetItemsProcessed(static_cast<std::int64_t>(
+      state.iterations() * (stats.directories + stats.files)));
+  state.SetBytesProcessed(
+      static_cast<std::int64_t>(state.iterations() * archive.size()));
+}
+
+template <typename Backend> void bm_tar_export(benchmark::State &state) {
+  Backend b;
+  auto stats = pfs_gen::generate_tree(b.fs, b.root, tar_spec());
+  for (auto _ : state) {
+    std::ostringstream out;
+    pfs::write_tar(b.fs, b.root, out);
+    benchmark::DoNotOptimize(out);
+  }
+  state.SetItemsProcessed(static_cast<std::int64_t>(
+      state.iterations() * (stats.directories + stats.files)));
+}
+
+} // namespace
+
+using pfs_bench::fake_backend;
+using pfs_bench::std_backend;
+
+BENCHMARK(bm_tar_import)->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(bm_tar_export, fake_backend)
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(bm_tar_export, std_backend)->Unit(benchmark::kMillisecond);
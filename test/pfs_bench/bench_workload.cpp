@@ -0,0 +1,84 @@
+#include "bench_filesystem.hpp"
+#include <chrono>
+#include <memory>
+#include <pfs_gen/tree_generator.hpp>
+#include <pfs_gen/workload.hpp>
+#include <type_traits>
+
+// Realistic loads from pfs_gen, for comparing backends on the same trees and
+// operation mixes. The workload benchmarks report their own timing (the
+// measured phase only) and latency percentiles as counters.
+
+namespace {
+
+template <typename Backend> void bm_generate_tree(benchmark::State &state) {
+  pfs_gen::tree_spec spec;
+  spec.depth = static_cast<int>(state.range(0));
+  spec.file_size = pfs_gen::distribution::lognormal(1024, 1.0, 64 << 10);
+  std::int64_t entries = 0, bytes = 0;
+  for (auto _ : state) {
+    state.PauseTiming();
+    auto b = std::make_unique<Backend>();
+    state.ResumeTiming();
+    auto stats = pfs_gen::generate_tree(b->fs, b->root / "tree", spec);
+    state.PauseTiming();
+    entries += static_cast<std::int64_t>(stats.directories + stats.files);
+    bytes += static_cast<std::int64_t>(stats.bytes);
+    b.reset();
+    state.ResumeTiming();
+  }
+  state.SetItemsProcessed(entries);
+  state.SetBytesProcessed(bytes);
+}
+
+template <typename Backend> void bm_workload(benchmark::State &state) {
+  pfs_gen::workload_spec spec;
+  spec.threads = static_cast<unsigned>(state.range(0));
+  spec.operations = 20000 / spec.threads;
+  spec.file_size = pfs_gen::distribution::uniform(0, 4096);
+  // The fake filesystem is not thread-safe.
+  spec.serialize =
+      std::is_same_v<Backend, pfs_bench::fake_backend> && spec.threads > 1;
+  Backend b;
+  int run = 0;
+  pfs_gen::workload_result last;
+  std::int64_t operations = 0;
+  for (auto _ : state) {
+    auto root = b.root / ("run" + std::to_string(run++));
+    last = pfs_gen::run_workload(b.fs, root, spec);
+    operations += static_cast<std::int64_t>(last.operations());
+    state.SetIterationTime(
+        std::chrono::duration<double>(last.elapsed).count());
+  }
+  state.SetItemsProcessed(operations);
+  state.counters["p50_ns"] = static_cast<double>(last.percentile(50).count());
+  state.counters["p99_ns"] = static_cast<double>(last.percentile(99).count());
+  state.counters["p999_ns"] =
+      static_cast<double>(last.percentile(99.9).count());
+}
+
+} // namespace
+
+using pfs_bench::fake_backend;
+using pfs_bench::std_backend;
+
+BENCHMARK_TEMPLATE(bm_generate_tree, fake_backend)
+    ->ArgName("depth")
+    ->DenseRange(2, 4)
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(bm_generate_tree, std_backend)
+    ->ArgName("depth")
+    ->DenseRange(2, 3)
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(bm_workload, fake_backend)
+    ->ArgName("threads")
+    ->Arg(1)
+    ->Arg(4)
+    ->UseManualTime()
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(bm_workload, std_backend)
+    ->ArgName("threads")
+    ->Arg(1)
+    ->Arg(4)
+    ->UseManualTime()
+    ->Unit(benchmark::kMillisecond);
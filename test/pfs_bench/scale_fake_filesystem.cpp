@@ -0,0 +1,331 @@
+#include "bench_filesystem.hpp"
+#include <algorithm>
+#include <pfs/fake_filesystem.hpp>
+#include <random>
+#include <vector>
+#ifdef __linux__
+#include <fstream>
+#include <malloc.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+
+// Scaling suite for fake_filesystem. Each shape is generated at growing sizes
+// and measured for build time, lookup time, full recursive iteration and
+// remove_all. Google Benchmark fits a complexity curve over the sizes of each
+// shape (see the *_BigO and *_RMS rows).
+//
+// Memory counters:
+//   rss       Growth of the resident set while building one tree. Freed heap
+//             memory is trimmed before each build (glibc only).
+//   peak_rss  High-water mark of the whole process. Because it never goes
+//             down, run one shape at a time (--benchmark_filter) to attribute
+//             peaks to a shape.
+
+namespace {
+
+/**
+ * @brief Gets the current resident set size in bytes, or 0 if unknown.
+ */
+double current_rss() {
+#ifdef __linux__
+  std::ifstream statm("/proc/self/statm");
+  long pages_total = 0, pages_resident = 0;
+  statm >> pages_total >> pages_resident;
+  return static_cast<double>(pages_resident) * sysconf(_SC_PAGESIZE);
+#else
+  return 0;
+#endif
+}
+
+/**
+ * @brief Returns freed heap memory to the OS where the allocator supports it,
+ * so that the next RSS delta reflects new allocations.
+ */
+void release_free_memory() {
+#ifdef __GLIBC__
+  malloc_trim(0);
+#endif
+}
+
+/**
+ * @brief Gets the peak resident set size of the process in bytes, or 0 if
+ * unknown.
+ */
+double peak_rss() {
+#ifdef __linux__
+  rusage usage{};
+  getrusage(RUSAGE_SELF, &usage);
+  return static_cast<double>(usage.ru_maxrss) * 1024;
+#else
+  return 0;
+#endif
+}
+
+/**
+ * @brief A tree to be measured.
+ *
+ * @details A builder creates the tree below @c root, and records a sample of
+ * existing paths in @c targets for the lookup benchmark.
+ */
+struct tree {
+  pfs::fake_filesystem fs;
+  pfs::path root;
+  std::vector<pfs::path> targets;
+  std::int64_t entries{0}; ///< Number of entries below the root.
+  std::int64_t n{0}; ///< Size plotted on the scaling curve of the shape.
+
+  tree() : root(fs.default_root() / "scale") { fs.create_directory(root); }
+};
+
+constexpr std::size_t max_targets = 1024;
+
+/**
+ * @brief Samples at most @c max_targets paths evenly from a list.
+ */
+std::vector<pfs::path> sample(const std::vector<pfs::path> &paths) {
+  std::vector<pfs::path> ret;
+  std::size_t step = std::max<std::size_t>(1, paths.size() / max_targets);
+  for (std::size_t i = 0; i < paths.size(); i += step) {
+    ret.push_back(paths[i]);
+  }
+  return ret;
+}
+
+std::string entry_name(std::int64_t i) {
+  auto s = std::to_string(i);
+  return "e" + std::string(8 - std::min<std::size_t>(8, s.size()), '0') + s;
+}
+
+/**
+ * @brief N entries in one directory, created in name order (appends only).
+ */
+void flat_sorted(tree &t, std::int64_t n) {
+  std::vector<pfs::path> paths;
+  for (std::int64_t i = 0; i < n; ++i) {
+    paths.push_back(t.root / entry_name(i));
+    t.fs.create_directory(paths.back());
+  }
+  t.targets = sample(paths);
+  t.entries = n;
+  t.n = n;
+}
+
+/**
+ * @brief N entries in one directory, created in a shuffled order. Each
+ * insertion lands in the middle of the sorted child list.
+ */
+void flat_shuffled(tree &t, std::int64_t n) {
+  std::vector<pfs::path> paths;
+  for (std::int64_t i = 0; i < n; ++i) {
+    paths.push_back(t.root / entry_name(i));
+  }
+  std::shuffle(paths.begin(), paths.end(), std::mt19937_64(n));
+  for (auto &p : paths) {
+    t.fs.create_directory(p);
+  }
+  t.targets = sample(paths);
+  t.entries = n;
+  t.n = n;
+}
+
+/**
+ * @brief A single chain of N nested directories.
+ */
+void chain(tree &t, std::int64_t n) {
+  // Deep paths are large, so only a few of them are kept as targets. This
+  // keeps them from dominating the measured RSS.
+  auto step = std::max<std::int64_t>(1, n / 16);
+  auto p = t.root;
+  for (std::int64_t i = 1; i <= n; ++i) {
+    p /= "c";
+    if (i % step == 0) {
+      t.targets.push_back(p);
+    }
+  }
+  t.fs.create_directories(p);
+  t.entries = n;
+  t.n = n;
+}
+
+/**
+ * @brief A balanced tree with a fanout of 10 and a depth of N. Its scaling
+ * curve is plotted over the number of entries rather than the depth.
+ */
+void balanced(tree &t, std::int64_t n) {
+  t.entries = pfs_bench::build_tree(t.fs, t.root, 10, static_cast<int>(n));
+  t.n = t.entries;
+  for (std::int64_t i = 0; i < static_cast<std::int64_t>(max_targets); ++i) {
+    auto p = t.root;
+    for (auto j = i; j < i + n; ++j) {
+      p /= pfs_bench::dir_name(static_cast<int>(j % 10));
+    }
+    t.targets.push_back(p);
+  }
+}
+
+/**
+ * @brief 1024 entries in one directory, with names N characters long.
+ */
+void long_names(tree &t, std::int64_t n) {
+  std::vector<pfs::path> paths;
+  for (std::int64_t i = 0; i < 1024; ++i) {
+    auto name = entry_name(i);
+    name.resize(static_cast<std::size_t>(n), 'x');
+    // Keep the distinguishing digits at the end, so that comparisons must
+    // scan the whole name.
+    std::rotate(name.begin(), name.begin() + 9, name.end());
+    paths.push_back(t.root / name);
+    t.fs.create_directory(paths.back());
+  }
+  t.targets = sample(paths);
+  t.entries = 1024;
+  t.n = n;
+}
+
+using builder = void (*)(tree &, std::int64_t);
+
+/**
+ * @brief Keeps the most recently built tree, so that read-only benchmarks do
+ * not rebuild large trees every time the framework re-runs them.
+ */
+struct tree_cache {
+  builder build{nullptr};
+  std::int64_t n{0};
+  std::unique_ptr<tree> t;
+
+  const tree &get(builder b, std::int64_t size) {
+    if (!t || build != b || n != size) {
+      t.reset();
+      t = std::make_unique<tree>();
+      b(*t, size);
+      build = b;
+      n = size;
+    }
+    return *t;
+  }
+
+  void clear() { t.reset(); }
+};
+
+tree_cache cache;
+
+template <builder Build> void scale_build(benchmark::State &state) {
+  auto n = state.range(0);
+  double rss = 0;
+  std::int64_t entries = 0, complexity_n = 0;
+  cache.clear();
+  for (auto _ : state) {
+    state.PauseTiming();
+    release_free_memory();
+    auto before = current_rss();
+    state.ResumeTiming();
+    auto t = std::make_unique<tree>();
+    Build(*t, n);
+    state.PauseTiming();
+    rss = std::max(rss, current_rss() - before);
+    entries += t->entries;
+    complexity_n = t->n;
+    t.reset();
+    state.ResumeTiming();
+  }
+  state.counters["rss"] = rss;
+  state.counters["peak_rss"] = peak_rss();
+  state.SetItemsProcessed(entries);
+  state.SetComplexityN(complexity_n);
+}
+
+template <builder Build> void scale_lookup(benchmark::State &state) {
+  auto n = state.range(0);
+  auto &t = cache.get(Build, n);
+  std::size_t i = 0;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(t.fs.exists(t.targets[i]));
+    if (++i == t.targets.size()) {
+      i = 0;
+    }
+  }
+  state.SetComplexityN(t.n);
+}
+
+template <builder Build> void scale_iterate(benchmark::State &state) {
+  auto n = state.range(0);
+  auto &t = cache.get(Build, n);
+  std::int64_t count = 0;
+  for (auto _ : state) {
+    for (auto it = t.fs.recursive_directory_iterator(t.root); !it->at_end();
+         it->increment()) {
+      benchmark::DoNotOptimize(it->path());
+      ++count;
+    }
+  }
+  state.SetItemsProcessed(count);
+  state.SetComplexityN(t.n);
+}
+
+template <builder Build> void scale_remove_all(benchmark::State &state) {
+  auto n = state.range(0);
+  std::int64_t entries = 0, complexity_n = 0;
+  cache.clear();
+  for (auto _ : state) {
+    state.PauseTiming();
+    auto t = std::make_unique<tree>();
+    Build(*t, n);
+    complexity_n = t->n;
+    state.ResumeTiming();
+    entries += static_cast<std::int64_t>(t->fs.remove_all(t->root));
+    state.PauseTiming();
+    t.reset();
+    state.ResumeTiming();
+  }
+  state.SetItemsProcessed(entries);
+  state.SetComplexityN(complexity_n);
+}
+
+} // namespace
+
+#define PFS_SCALE(Build, Sizes)                                                \
+  BENCHMARK_TEMPLATE(scale_build, Build)                                       \
+      ->Apply(Sizes)                                                           \
+      ->Unit(benchmark::kMillisecond)                                          \
+      ->Complexity();                                                          \
+  BENCHMARK_TEMPLATE(scale_lookup, Build)->Apply(Sizes)->Complexity();         \
+  BENCHMARK_TEMPLATE(scale_iterate, Build)                                     \
+      ->Apply(Sizes)                                                           \
+      ->Unit(benchmark::kMillisecond)                                          \
+      ->Complexity();                                                          \
+  BENCHMARK_TEMPLATE(scale_remove_all, Build)                                  \
+      ->Apply(Sizes)                                                           \
+      ->Unit(benchmark::kMillisecond)                                          \
+      ->Iterations(1)                                                          \
+      ->Complexity()
+
+namespace {
+
+void flat_sorted_sizes(benchmark::internal::Benchmark *b) {
+  b->ArgName("entries")->RangeMultiplier(8)->Range(1 << 10, 1 << 20);
+}
+
+void flat_shuffled_sizes(benchmark::internal::Benchmark *b) {
+  b->ArgName("entries")->RangeMultiplier(4)->Range(1 << 10, 1 << 16);
+}
+
+void chain_sizes(benchmark::internal::Benchmark *b) {
+  b->ArgName("depth")->RangeMultiplier(10)->Range(10, 10000);
+}
+
+void balanced_sizes(benchmark::internal::Benchmark *b) {
+  b->ArgName("depth")->DenseRange(2, 6);
+}
+
+void long_names_sizes(benchmark::internal::Benchmark *b) {
+  b->ArgName("name_length")->RangeMultiplier(4)->Range(16, 4096);
+}
+
+} // namespace
+
+PFS_SCALE(flat_sorted, flat_sorted_sizes);
+PFS_SCALE(flat_shuffled, flat_shuffled_sizes);
+PFS_SCALE(chain, chain_sizes);
+PFS_SCALE(balanced, balanced_sizes);
+PFS_SCALE(long_names, long_names_sizes);
@@ -0,0 +1,53 @@
+#include <algorithm>
+#include <cmath>
+#include <pfs_gen/distribution.hpp>
+
+namespace pfs_gen {
+
+namespace {
+
+/**
+ * @brief Draws a double uniformly from (0, 1].
+ */
+double unit(engine &rng) {
+  return (static_cast<double>(rng() >> 11) + 1.0) * 0x1.0p-53;
+}
+
+} // namespace
+
+std::uint64_t distribution::operator()(engine &rng) const {
+  switch (kind_) {
+  case kind::constant:
+    return a_;
+
+  case kind::uniform: {
+    auto span = b_ - a_ + 1;
+    return span == 0 ? rng() : a_ + rng() % span;
+  }
+
+  case kind::geometric: {
+    // Number of failures before the first success, with success probability
+    // 1 / (mean + 1).
+    if (a_ == 0) {
+      return 0;
+    }
+    double q = static_cast<double>(a_) / static_cast<double>(a_ + 1);
+    auto x = std::floor(std::log(unit(rng)) / std::log(q));
+    return std::min(b_, static_cast<std::uint64_t>(x));
+  }
+
+  case kind::lognormal: {
+    // Box-Muller transform for a standard normal variate.
+    constexpr double two_pi = 6.283185307179586;
+    double z = std::sqrt(-2.0 * std::log(unit(rng))) *
+               std::cos(two_pi * unit(rng));
+    double x = static_cast<double>(a_) * std::exp(sigma_ * z);
+    return x >= static_cast<double>(b_) ? b_ : static_cast<std::uint64_t>(x);
+  }
+
+  default:
+    return a_;
+  }
+}
+
+} // namespace pfs_gen
@@ -0,0 +1,73 @@
+#ifndef INCLUDED_PFS_GEN_DISTRIBUTION_HPP
+#define INCLUDED_PFS_GEN_DISTRIBUTION_HPP
+
+#include <cstdint>
+#include <random>
+
+namespace pfs_gen {
+
+/**
+ * @brief Random engine used by all generators. Fixed so that a seed produces
+ * the same trees and workloads on every platform.
+ */
+using engine = std::mt19937_64;
+
+/**
+ * @brief A distribution of non-negative integers, used for fanouts, name
+ * lengths and file sizes.
+ *
+ * @details Samples are drawn with hand-written transforms of the engine's
+ * output rather than the standard distribution classes, whose algorithms are
+ * implementation-defined. This keeps generated trees identical across
+ * standard libraries.
+ */
+class distribution {
+public:
+  enum class kind {
+    constant,  ///< Always @c a.
+    uniform,   ///< Uniform over the closed range [a, b].
+    geometric, ///< Geometric with mean @c a, capped at @c b.
+    lognormal, ///< Log-normal with median @c a and shape @c sigma, capped at
+               ///< @c b. A common model for file sizes.
+  };
+
+private:
+  kind kind_{kind::constant};
+  std::uint64_t a_{0};
+  std::uint64_t b_{0};
+  double sigma_{0};
+
+  distribution(kind k, std::uint64_t a, std::uint64_t b, double sigma)
+      : kind_(k), a_(a), b_(b), sigma_(sigma) {}
+
+public:
+  distribution() = default;
+
+  static distribution constant(std::uint64_t value) {
+    return {kind::constant, value, value, 0};
+  }
+
+  static distribution uniform(std::uint64_t min, std::uint64_t max) {
+    return {kind::uniform, min, max, 0};
+  }
+
+  static distribution geometric(std::uint64_t mean, std::uint64_t max) {
+    return {kind::geometric, mean, max, 0};
+  }
+
+  static distribution lognormal(std::uint64_t median, double sigma,
+                                std::uint64_t max) {
+    return {kind::lognormal, median, max, sigma};
+  }
+
+  kind type() const noexcept { return kind_; }
+
+  /**
+   * @brief Draws a sample.
+   */
+  std::uint64_t operator()(engine &rng) const;
+};
+
+} // namespace pfs_gen
+
+#endif
@@ -0,0 +1,65 @@
+#ifndef INCLUDED_PFS_GEN_TREE_GENERATOR_HPP
+#define INCLUDED_PFS_GEN_TREE_GENERATOR_HPP
+
+#include <cstdint>
+#include <pfs/filesystem.hpp>
+#include <pfs_gen/distribution.hpp>
+#include <string>
+
+namespace pfs_gen {
+
+/**
+ * @brief Parameters of a synthetic directory tree.
+ */
+struct tree_spec {
+  /// Number of subdirectories in each directory above the deepest level.
+  distribution dir_fanout = distribution::uniform(2, 6);
+
+  /// Number of regular files in each directory, at every level.
+  distribution file_fanout = distribution::uniform(0, 16);
+
+  /// Number of directory levels below the root.
+  int depth = 3;
+
+  /// Length of each file and directory name.
+  distribution name_length = distribution::uniform(4, 16);
+
+  /// Size of each regular file in bytes.
+  distribution file_size = distribution::lognormal(4096, 1.5, 1 << 20);
+
+  /// Seed for every random choice. Equal specs produce equal trees.
+  std::uint64_t seed = 0;
+};
+
+/**
+ * @brief Summary of a generated tree.
+ */
+struct tree_stats {
+  std::uint64_t directories{0}; ///< Directories created below the root.
+  std::uint64_t files{0};       ///< Regular files created.
+  std::uint64_t bytes{0};       ///< Total size of the regular files.
+};
+
+/**
+ * @brief Generates a random name.
+ *
+ * @details Names consist of lowercase letters and digits, so they are valid
+ * on every platform.
+ */
+std::string random_name(engine &rng, std::uint64_t length);
+
+/**
+ * @brief Builds a tree described by @c spec below @c root.
+ *
+ * @details The root is created if it does not exist. Names are unique within
+ * each directory. Files are written through @c pfs::filesystem::open_file
+ * with deterministic contents.
+ *
+ * @throw pfs::filesystem_error if the filesystem rejects an operation.
+ */
+tree_stats generate_tree(pfs::filesystem &fs, const pfs::path &root,
+                         const tree_spec &spec);
+
+} // namespace pfs_gen
+
+#endif
@@ -0,0 +1,112 @@
+#ifndef INCLUDED_PFS_GEN_WORKLOAD_HPP
+#define INCLUDED_PFS_GEN_WORKLOAD_HPP
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <pfs/filesystem.hpp>
+#include <pfs_gen/distribution.hpp>
+#include <vector>
+
+namespace pfs_gen {
+
+/**
+ * @brief Metadata operations of a workload.
+ */
+enum class operation {
+  create,  ///< Create and write a new regular file.
+  stat,    ///< Get the status of an existing file.
+  readdir, ///< List the working directory.
+  rename,  ///< Rename an existing file within the working directory.
+  unlink,  ///< Remove an existing file.
+};
+
+constexpr std::size_t operation_count = 5;
+
+/**
+ * @brief Gets the name of an operation.
+ */
+const char *to_string(operation op) noexcept;
+
+/**
+ * @brief Parameters of a mixed metadata workload, in the style of mdtest.
+ *
+ * @details Each thread works in its own directory below the workload root,
+ * which it first fills with @c initial_files files. Then it performs
+ * @c operations operations, each chosen at random with probability
+ * proportional to its weight. Operations that need an existing file fall
+ * back to @c create when the thread has none left.
+ */
+struct workload_spec {
+  /// Relative weight of each operation, indexed by @c operation.
+  std::array<unsigned, operation_count> weights{4, 8, 1, 2, 4};
+
+  /// Operations performed by each thread.
+  std::uint64_t operations = 10000;
+
+  /// Number of threads. Each works in its own directory.
+  unsigned threads = 1;
+
+  /// Files created by each thread before measuring.
+  std::uint64_t initial_files = 100;
+
+  /// Length of created file names.
+  distribution name_length = distribution::uniform(8, 16);
+
+  /// Size in bytes of created files.
+  distribution file_size = distribution::constant(0);
+
+  /// Seed for every random choice. Thread i uses seed + i.
+  std::uint64_t seed = 0;
+
+  /// Serializes every filesystem call behind one mutex. Required for
+  /// backends that are not thread-safe, such as fake_filesystem, when
+  /// threads > 1.
+  bool serialize = false;
+};
+
+/**
+ * @brief Measurements of a workload run.
+ */
+class workload_result {
+public:
+  using duration = std::chrono::nanoseconds;
+
+  /// Wall-clock time of the measured phase.
+  duration elapsed{0};
+
+  /// Latency of every operation, indexed by @c operation. Latencies include
+  /// the time spent waiting for the lock when the spec is serialized.
+  std::array<std::vector<duration>, operation_count> latencies;
+
+  /// Operations that reported an error, indexed by @c operation.
+  std::array<std::uint64_t, operation_count> errors{};
+
+  /// Total number of operations performed.
+  std::uint64_t operations() const noexcept;
+
+  /// Operations per second over the measured phase.
+  double throughput() const noexcept;
+
+  /// Latency at percentile @c p (in [0, 100]) over all operations.
+  duration percentile(double p) const;
+
+  /// Latency at percentile @c p (in [0, 100]) for one operation.
+  duration percentile(operation op, double p) const;
+};
+
+/**
+ * @brief Runs a mixed metadata workload below @c root.
+ *
+ * @details The root is created if it does not exist, and it is left with
+ * whatever files remain at the end of the run.
+ *
+ * @throw pfs::filesystem_error if the setup phase fails. Errors during the
+ * measured phase are counted in the result instead.
+ */
+workload_result run_workload(pfs::filesystem &fs, const pfs::path &root,
+                             const workload_spec &spec);
+
+} // namespace pfs_gen
+
+#endif
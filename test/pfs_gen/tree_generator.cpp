@@ -0,0 +1,92 @@
+#include <algorithm>
+#include <pfs_gen/tree_generator.hpp>
+#include <set>
+
+namespace pfs_gen {
+
+namespace {
+
+/**
+ * @brief State threaded through the recursive generation.
+ */
+struct generator {
+  pfs::filesystem &fs;
+  const tree_spec &spec;
+  engine rng;
+  tree_stats stats;
+  std::string content; ///< Scratch buffer for file contents.
+
+  /**
+   * @brief Draws a name that is not yet used in the current directory.
+   */
+  std::string unique_name(std::set<std::string> &used) {
+    for (int attempt = 0;; ++attempt) {
+      auto length = std::max<std::uint64_t>(1, spec.name_length(rng));
+      auto name = random_name(rng, length);
+      if (attempt >= 8) {
+        // The name space is too small for this fanout. Disambiguate.
+        name += std::to_string(used.size());
+      }
+      if (used.insert(name).second) {
+        return name;
+      }
+    }
+  }
+
+  void write_file(const pfs::path &p) {
+    auto size = spec.file_size(rng);
+    content.resize(size);
+    auto offset = rng();
+    for (std::uint64_t i = 0; i < size; ++i) {
+      content[i] = static_cast<char>('a' + (offset + i) % 26);
+    }
+    auto f = fs.open_file(p, std::ios::out | std::ios::binary);
+    f->write(content.data(), static_cast<std::streamsize>(size));
+    f->flush();
+    if (!*f) {
+      throw pfs::filesystem_error(
+          "generate_tree", p, std::make_error_code(std::errc::io_error));
+    }
+    ++stats.files;
+    stats.bytes += size;
+  }
+
+  void generate(const pfs::path &dir, int level) {
+    std::set<std::string> used;
+    auto files = spec.file_fanout(rng);
+    for (std::uint64_t i = 0; i < files; ++i) {
+      write_file(dir / unique_name(used));
+    }
+    if (level == spec.depth) {
+      return;
+    }
+    auto dirs = spec.dir_fanout(rng);
+    for (std::uint64_t i = 0; i < dirs; ++i) {
+      auto child = dir / unique_name(used);
+      fs.create_directory(child);
+      ++stats.directories;
+      generate(child, level + 1);
+    }
+  }
+};
+
+} // namespace
+
+std::string random_name(engine &rng, std::uint64_t length) {
+  static constexpr char alphabet[] = "abcdefghijklmnopqrstuvwxyz0123456789";
+  std::string name(length, ' ');
+  for (auto &ch : name) {
+    ch = alphabet[rng() % (sizeof(alphabet) - 1)];
+  }
+  return name;
+}
+
+tree_stats generate_tree(pfs::filesystem &fs, const pfs::path &root,
+                         const tree_spec &spec) {
+  fs.create_directories(root);
+  generator gen{fs, spec, engine(spec.seed), {}, {}};
+  gen.generate(root, 0);
+  return gen.stats;
+}
+
+} // namespace pfs_gen
@@ -0,0 +1,264 @@
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <numeric>
+#include <pfs_gen/tree_generator.hpp>
+#include <pfs_gen/workload.hpp>
+#include <string>
+#include <thread>
+
+namespace pfs_gen {
+
+namespace {
+
+using clock = std::chrono::steady_clock;
+
+/**
+ * @brief One thread of a workload, working in its own directory.
+ */
+class worker {
+private:
+  pfs::filesystem &fs_;
+  const workload_spec &spec_;
+  std::mutex &mutex_;
+  pfs::path dir_;
+  engine rng_;
+  std::vector<std::string> live_; ///< Names of the files in dir_.
+  std::uint64_t next_id_{0};      ///< Suffix that keeps new names unique.
+  std::string content_;           ///< Scratch buffer for file contents.
+
+  std::string new_name() {
+    return random_name(rng_, spec_.name_length(rng_)) + "." +
+           std::to_string(next_id_++);
+  }
+
+  bool create(const pfs::path &p) {
+    content_.assign(spec_.file_size(rng_), 'x');
+    auto f = fs_.open_file(p, std::ios::out | std::ios::binary);
+    f->write(content_.data(), static_cast<std::streamsize>(content_.size()));
+    f->flush();
+    return static_cast<bool>(*f);
+  }
+
+  std::size_t pick() { return rng_() % live_.size(); }
+
+public:
+  workload_result result;
+
+  worker(pfs::filesystem &fs, const workload_spec &spec, std::mutex &mutex,
+         pfs::path dir, std::uint64_t seed)
+      : fs_(fs), spec_(spec), mutex_(mutex), dir_(std::move(dir)),
+        rng_(seed) {}
+
+  /**
+   * @brief Creates the working directory and the initial files.
+   */
+  void setup() {
+    fs_.create_directories(dir_);
+    for (std::uint64_t i = 0; i < spec_.initial_files; ++i) {
+      live_.push_back(new_name());
+      if (!create(dir_ / live_.back())) {
+        throw pfs::filesystem_error("run_workload", dir_ / live_.back(),
+                                    std::make_error_code(std::errc::io_error));
+      }
+    }
+  }
+
+  /**
+   * @brief Performs the measured operations.
+   */
+  void run() {
+    auto total_weight = std::accumulate(spec_.weights.begin(),
+                                        spec_.weights.end(), std::uint64_t{0});
+    for (auto &l : result.latencies) {
+      l.reserve(spec_.operations / operation_count);
+    }
+    pfs::error_code ec;
+    for (std::uint64_t i = 0; i < spec_.operations; ++i) {
+      // Choose an operation in proportion to the weights.
+      auto ticket = total_weight ? rng_() % total_weight : 0;
+      std::size_t op_index = 0;
+      while (op_index + 1 < operation_count &&
+             ticket >= spec_.weights[op_index]) {
+        ticket -= spec_.weights[op_index++];
+      }
+      auto op = static_cast<operation>(op_index);
+      if (live_.empty() && op != operation::readdir) {
+        op = operation::create;
+        op_index = static_cast<std::size_t>(operation::create);
+      }
+
+      // Prepare arguments outside of the measured region.
+      std::size_t victim = live_.empty() ? 0 : pick();
+      pfs::path p1, p2;
+      std::string renamed;
+      switch (op) {
+      case operation::create:
+        live_.push_back(new_name());
+        p1 = dir_ / live_.back();
+        break;
+      case operation::stat:
+      case operation::unlink:
+        p1 = dir_ / live_[victim];
+        break;
+      case operation::readdir:
+        break;
+      case operation::rename:
+        renamed = new_name();
+        p1 = dir_ / live_[victim];
+        p2 = dir_ / renamed;
+        break;
+      }
+
+      bool ok = true;
+      auto start = clock::now();
+      {
+        std::unique_lock<std::mutex> lock(mutex_, std::defer_lock);
+        if (spec_.serialize) {
+          lock.lock();
+        }
+        switch (op) {
+        case operation::create:
+          ok = create(p1);
+          break;
+        case operation::stat:
+          ok = fs_.status(p1, ec).type() == pfs::file_type::regular;
+          break;
+        case operation::readdir:
+          for (auto it = fs_.directory_iterator(dir_, ec); !ec && !it->at_end();
+               it->increment(ec)) {
+          }
+          ok = !ec;
+          break;
+        case operation::rename:
+          fs_.rename(p1, p2, ec);
+          ok = !ec;
+          break;
+        case operation::unlink:
+          ok = fs_.remove(p1, ec) && !ec;
+          break;
+        }
+      }
+      auto stop = clock::now();
+
+      // Update the bookkeeping of live files.
+      if (op == operation::rename && ok) {
+        live_[victim] = std::move(renamed);
+      } else if (op == operation::unlink && ok) {
+        live_[victim] = std::move(live_.back());
+        live_.pop_back();
+      } else if (op == operation::create && !ok) {
+        live_.pop_back();
+      }
+      result.latencies[op_index].push_back(stop - start);
+      if (!ok) {
+        ++result.errors[op_index];
+      }
+    }
+  }
+};
+
+} // namespace
+
+const char *to_string(operation op) noexcept {
+  switch (op) {
+  case operation::create:
+    return "create";
+  case operation::stat:
+    return "stat";
+  case operation::readdir:
+    return "readdir";
+  case operation::rename:
+    return "rename";
+  case operation::unlink:
+    return "unlink";
+  default:
+    return "unknown";
+  }
+}
+
+std::uint64_t workload_result::operations() const noexcept {
+  std::uint64_t count = 0;
+  for (auto &l : latencies) {
+    count += l.size();
+  }
+  return count;
+}
+
+double workload_result::throughput() const noexcept {
+  auto seconds = std::chrono::duration<double>(elapsed).count();
+  return seconds > 0 ? static_cast<double>(operations()) / seconds : 0;
+}
+
+namespace {
+
+using duration_list = std::vector<workload_result::duration>;
+
+workload_result::duration nth_percentile(duration_list v, double p) {
+  if (v.empty()) {
+    return {};
+  }
+  p = std::clamp(p, 0.0, 100.0);
+  auto rank = std::min(
+      static_cast<std::size_t>(p / 100.0 * static_cast<double>(v.size())),
+      v.size() - 1);
+  auto nth = v.begin() + static_cast<std::ptrdiff_t>(rank);
+  std::nth_element(v.begin(), nth, v.end());
+  return *nth;
+}
+
+} // namespace
+
+workload_result::duration workload_result::percentile(double p) const {
+  std::vector<duration> all;
+  all.reserve(operations());
+  for (auto &l : latencies) {
+    all.insert(all.end(), l.begin(), l.end());
+  }
+  return nth_percentile(std::move(all), p);
+}
+
+workload_result::duration workload_result::percentile(operation op,
+                                                      double p) const {
+  return nth_percentile(latencies[static_cast<std::size_t>(op)], p);
+}
+
+workload_result run_workload(pfs::filesystem &fs, const pfs::path &root,
+                             const workload_spec &spec) {
+  std::mutex mutex;
+  std::vector<worker> workers;
+  auto threads = std::max(1u, spec.threads);
+  workers.reserve(threads);
+  for (unsigned i = 0; i < threads; ++i) {
+    workers.emplace_back(fs, spec, mutex, root / ("t" + std::to_string(i)),
+                         spec.seed + i);
+    workers.back().setup();
+  }
+
+  workload_result result;
+  auto start = clock::now();
+  if (threads == 1) {
+    workers.front().run();
+  } else {
+    std::vector<std::thread> pool;
+    for (auto &w : workers) {
+      pool.emplace_back([&w] { w.run(); });
+    }
+    for (auto &t : pool) {
+      t.join();
+    }
+  }
+  result.elapsed = clock::now() - start;
+
+  for (auto &w : workers) {
+    for (std::size_t op = 0; op < operation_count; ++op) {
+      auto &from = w.result.latencies[op];
+      auto &to = result.latencies[op];
+      to.insert(to.end(), from.begin(), from.end());
+      result.errors[op] += w.result.errors[op];
+    }
+  }
+  return result;
+}
+
+} // namespace pfs_gen
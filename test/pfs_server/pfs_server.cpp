@@ -0,0 +1,102 @@
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <pfs/fake_filesystem.hpp>
+#include <pfs/rpc.hpp>
+#include <pfs/std_filesystem.hpp>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <pfs/shm_transport.hpp>
+#endif
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace {
+
+void print_usage() {
+  std::cerr << "Usage: pfs_server [--shm] ADDRESS [fake]\n"
+            << '\n'
+            << "Serves the real filesystem, or an empty fake filesystem, to\n"
+            << "remote_filesystem clients connecting to the Unix domain\n"
+            << "socket ADDRESS. Each client is served on its own thread.\n"
+            << '\n'
+            << "With --shm, creates the shared memory rings named ADDRESS\n"
+            << "instead (Linux only), serves the one client that opens them,\n"
+            << "and exits when it disconnects.\n";
+}
+
+int serve_socket(pfs::filesystem &fs, const char *address) {
+  std::mutex fs_mutex;
+
+  // A socket left behind by a previous server would fail the bind.
+  ::unlink(address);
+  std::error_code ec;
+  int listener = pfs::rpc::listen(address, ec);
+  if (listener < 0) {
+    std::cerr << "pfs_server: " << address << ": " << ec.message() << '\n';
+    return 1;
+  }
+
+  for (;;) {
+    int fd = ::accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+    if (fd < 0) {
+      if (errno == EINTR || errno == ECONNABORTED) {
+        continue;
+      }
+      std::cerr << "pfs_server: accept: " << std::strerror(errno) << '\n';
+      return 1;
+    }
+    std::thread([&fs, &fs_mutex, fd] {
+      pfs::rpc::socket_transport t(fd);
+      pfs::rpc::serve(fs, t, &fs_mutex);
+    }).detach();
+  }
+}
+
+int serve_shm(pfs::filesystem &fs, const char *address) {
+#ifdef __linux__
+  // Rings left behind by a previous server would fail the create.
+  pfs::rpc::shm_transport::destroy(address);
+  std::error_code ec;
+  auto t = pfs::rpc::shm_transport::create(
+      address, pfs::rpc::shm_transport::default_capacity, ec);
+  if (!t) {
+    std::cerr << "pfs_server: " << address << ": " << ec.message() << '\n';
+    return 1;
+  }
+  pfs::rpc::serve(fs, *t);
+  pfs::rpc::shm_transport::destroy(address);
+  return 0;
+#else
+  (void)fs;
+  std::cerr << "pfs_server: " << address << ": --shm requires Linux\n";
+  return 1;
+#endif
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  std::vector<std::string> args(argv + 1, argv + argc);
+  bool shm = !args.empty() && args[0] == "--shm";
+  if (shm) {
+    args.erase(args.begin());
+  }
+  if (args.empty() || args.size() > 2 ||
+      (args.size() == 2 && args[1] != "fake")) {
+    print_usage();
+    return 2;
+  }
+
+  pfs::std_filesystem real_fs;
+  pfs::fake_filesystem fake_fs;
+  pfs::filesystem &fs =
+      args.size() == 2 ? static_cast<pfs::filesystem &>(fake_fs) : real_fs;
+  return shm ? serve_shm(fs, args[0].c_str())
+             : serve_socket(fs, args[0].c_str());
+}
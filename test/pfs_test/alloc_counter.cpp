@@ -0,0 +1,157 @@
+#include "alloc_counter.hpp"
+#include <cstdlib>
+#include <new>
+
+namespace {
+
+// Running totals for the current thread. Plain integers with static storage
+// so they are usable before any constructor runs.
+thread_local std::size_t allocations = 0;
+thread_local std::size_t deallocations = 0;
+thread_local std::size_t bytes = 0;
+
+void *allocate(std::size_t size) noexcept {
+  ++allocations;
+  bytes += size;
+  return std::malloc(size == 0 ? 1 : size);
+}
+
+void *allocate(std::size_t size, std::align_val_t align) noexcept {
+  ++allocations;
+  bytes += size;
+  auto alignment = static_cast<std::size_t>(align);
+  size = (size + alignment - 1) / alignment * alignment;
+#ifdef _WIN32
+  return _aligned_malloc(size == 0 ? alignment : size, alignment);
+#else
+  return std::aligned_alloc(alignment, size == 0 ? alignment : size);
+#endif
+}
+
+void deallocate(void *p) noexcept {
+  if (p) {
+    ++deallocations;
+    std::free(p);
+  }
+}
+
+void deallocate(void *p, std::align_val_t) noexcept {
+  if (p) {
+    ++deallocations;
+#ifdef _WIN32
+    _aligned_free(p);
+#else
+    std::free(p);
+#endif
+  }
+}
+
+} // namespace
+
+namespace pfs_test {
+
+alloc_counter::alloc_counter() noexcept { reset(); }
+
+std::size_t alloc_counter::allocations() const noexcept {
+  return ::allocations - allocations_start_;
+}
+
+std::size_t alloc_counter::deallocations() const noexcept {
+  return ::deallocations - deallocations_start_;
+}
+
+std::size_t alloc_counter::bytes() const noexcept {
+  return ::bytes - bytes_start_;
+}
+
+void alloc_counter::reset() noexcept {
+  allocations_start_ = ::allocations;
+  deallocations_start_ = ::deallocations;
+  bytes_start_ = ::bytes;
+}
+
+} // namespace pfs_test
+
+// ---------------------------------------------------------------------------
+// Replacements for the global allocation functions.
+// ---------------------------------------------------------------------------
+
+void *operator new(std::size_t size) {
+  if (auto p = allocate(size)) {
+    return p;
+  }
+  throw std::bad_alloc();
+}
+
+void *operator new[](std::size_t size) { return operator new(size); }
+
+void *operator new(std::size_t size, const std::nothrow_t &) noexcept {
+  return allocate(size);
+}
+
+void *operator new[](std::size_t size, const std::nothrow_t &) noexcept {
+  return allocate(size);
+}
+
+void *operator new(std::size_t size, std::align_val_t align) {
+  if (auto p = allocate(size, align)) {
+    return p;
+  }
+  throw std::bad_alloc();
+}
+
+void *operator new[](std::size_t size, std::align_val_t align) {
+  return operator new(size, align);
+}
+
+void *operator new(std::size_t size, std::align_val_t align,
+                   const std::nothrow_t &) noexcept {
+  return allocate(size, align);
+}
+
+void *operator new[](std::size_t size, std::align_val_t align,
+                     const std::nothrow_t &) noexcept {
+  return allocate(size, align);
+}
+
+void operator delete(void *p) noexcept { deallocate(p); }
+
+void operator delete[](void *p) noexcept { deallocate(p); }
+
+void operator delete(void *p, std::size_t) noexcept { deallocate(p); }
+
+void operator delete[](void *p, std::size_t) noexcept { deallocate(p); }
+
+void operator delete(void *p, const std::nothrow_t &) noexcept {
+  deallocate(p);
+}
+
+void operator delete[](void *p, const std::nothrow_t &) noexcept {
+  deallocate(p);
+}
+
+void operator delete(void *p, std::align_val_t align) noexcept {
+  deallocate(p, align);
+}
+
+void operator delete[](void *p, std::align_val_t align) noexcept {
+  deallocate(p, align);
+}
+
+void operator delete(void *p, std::size_t, std::align_val_t align) noexcept {
+  deallocate(p, align);
+}
+
+void operator delete[](void *p, std::size_t, std::align_val_t align) noexcept {
+  deallocate(p, align);
+}
+
+void operator delete(void *p, std::align_val_t align,
+                     const std::nothrow_t &) noexcept {
+  deallocate(p, align);
+}
+
+void operator delete[](void *p, std::align_val_t align,
+                       const std::nothrow_t &) noexcept {
+  deallocate(p, align);
+}
@@ -0,0 +1,60 @@
+#ifndef INCLUDED_PFS_TEST_ALLOC_COUNTER_HPP
+#define INCLUDED_PFS_TEST_ALLOC_COUNTER_HPP
+
+#include <cstddef>
+
+namespace pfs_test {
+
+/**
+ * @brief Counts heap allocations made by the current thread while in scope.
+ *
+ * @details The counts come from replacements of the global @c operator new and
+ * @c operator delete (see alloc_counter.cpp), so every allocation made through
+ * a standard allocator is seen. Only the thread that created the counter is
+ * counted, so background threads of the test framework do not disturb the
+ * results. Counters may be nested; each one sees the allocations made during
+ * its own lifetime.
+ *
+ * @code
+ * pfs_test::alloc_counter counter;
+ * fs.exists("/a/b/c");
+ * REQUIRE(counter.allocations() == 0);
+ * @endcode
+ */
+class alloc_counter {
+private:
+  std::size_t allocations_start_;
+  std::size_t deallocations_start_;
+  std::size_t bytes_start_;
+
+public:
+  alloc_counter() noexcept;
+  alloc_counter(const alloc_counter &) = delete;
+  alloc_counter &operator=(const alloc_counter &) = delete;
+
+  /**
+   * @brief Number of calls to any form of operator new since construction.
+   */
+  std::size_t allocations() const noexcept;
+
+  /**
+   * @brief Number of calls to any form of operator delete (with a non-null
+   * pointer) since construction.
+   */
+  std::size_t deallocations() const noexcept;
+
+  /**
+   * @brief Total number of bytes requested from operator new since
+   * construction.
+   */
+  std::size_t bytes() const noexcept;
+
+  /**
+   * @brief Restarts counting from zero.
+   */
+  void reset() noexcept;
+};
+
+} // namespace pfs_test
+
+#endif
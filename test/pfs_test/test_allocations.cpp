@@ -0,0 +1,115 @@
+#include "alloc_counter.hpp"
+#include <catch2/catch_test_macros.hpp>
+#include <memory>
+#include <pfs/fake_filesystem.hpp>
+
+TEST_CASE("alloc_counter") {
+  pfs_test::alloc_counter counter;
+  auto p = std::make_unique<int>(42);
+  REQUIRE(counter.allocations() == 1);
+  REQUIRE(counter.bytes() >= sizeof(int));
+  REQUIRE(counter.deallocations() == 0);
+  p.reset();
+  REQUIRE(counter.deallocations() == 1);
+  counter.reset();
+  REQUIRE(counter.allocations() == 0);
+  REQUIRE(counter.bytes() == 0);
+}
+
+TEST_CASE("fake_filesystem allocation budgets") {
+  pfs::fake_filesystem fs;
+  auto root = fs.default_root();
+  REQUIRE(fs.create_directories(root / "one/two/three"));
+  REQUIRE(fs.create_directories(root / "one/two/four"));
+  REQUIRE(fs.create_directories(root / "one/five"));
+  REQUIRE_NOTHROW(fs.current_path(root / "one"));
+
+  // Paths are built before counting, and results are checked after counting,
+  // so that only the queries are measured.
+  pfs::path absolute_path = root / "one/two/three";
+  pfs::path relative_path = "two/../two/./four";
+  pfs::path missing_path = root / "one/two/missing";
+  std::error_code ec;
+
+  SECTION("exists") {
+    pfs_test::alloc_counter counter;
+    bool found_absolute = fs.exists(absolute_path);
+    bool found_relative = fs.exists(relative_path);
+    bool found_missing = fs.exists(missing_path);
+    bool found_ec = fs.exists(absolute_path, ec);
+    auto allocations = counter.allocations();
+    REQUIRE(found_absolute);
+    REQUIRE(found_relative);
+    REQUIRE(!found_missing);
+    REQUIRE(found_ec);
+    REQUIRE(allocations == 0);
+  }
+
+  SECTION("is_directory") {
+    pfs_test::alloc_counter counter;
+    bool dir_absolute = fs.is_directory(absolute_path);
+    bool dir_relative = fs.is_directory(relative_path);
+    bool dir_missing = fs.is_directory(missing_path);
+    auto allocations = counter.allocations();
+    REQUIRE(dir_absolute);
+    REQUIRE(dir_relative);
+    REQUIRE(!dir_missing);
+    REQUIRE(allocations == 0);
+  }
+
+  SECTION("status") {
+    pfs_test::alloc_counter counter;
+    auto status_found = fs.status(absolute_path);
+    auto status_missing = fs.status(missing_path);
+    auto allocations = counter.allocations();
+    REQUIRE(status_found.type() == pfs::file_type::directory);
+    REQUIRE(status_missing.type() == pfs::file_type::not_found);
+    REQUIRE(allocations == 0);
+  }
+
+  SECTION("directory_iterator step") {
+    for (auto name : {"a", "b", "c", "d"}) {
+      REQUIRE(fs.create_directory(root / "one/five" / name));
+    }
+    auto it = fs.directory_iterator(root / "one/five");
+    while (!it->at_end()) {
+      pfs_test::alloc_counter counter;
+      it->increment();
+      auto allocations = counter.allocations();
+      REQUIRE(allocations == 0);
+    }
+  }
+
+  SECTION("recursive_directory_iterator step") {
+    for (auto name : {"a", "b", "c", "d"}) {
+      REQUIRE(fs.create_directory(root / "one/five" / name));
+    }
+    auto it = fs.recursive_directory_iterator(root / "one/five");
+    while (!it->at_end()) {
+      // Siblings without children: each step stays in the same directory.
+      pfs_test::alloc_counter counter;
+      it->increment();
+      auto allocations = counter.allocations();
+      REQUIRE(allocations == 0);
+    }
+  }
+
+  SECTION("recursive walk") {
+    // Entering and leaving directories may grow the iterator's path, but
+    // the walk as a whole should allocate far less than once per entry.
+    std::size_t entries = 0;
+    for (auto i : {"a", "b", "c", "d", "e", "f", "g", "h"}) {
+      for (auto j : {"a", "b", "c", "d", "e", "f", "g", "h"}) {
+        REQUIRE(fs.create_directories(root / "walk" / i / j));
+        ++entries;
+      }
+      ++entries;
+    }
+    auto it = fs.recursive_directory_iterator(root / "walk");
+    pfs_test::alloc_counter counter;
+    for (; !it->at_end(); it->increment()) {
+    }
+    auto allocations = counter.allocations();
+    REQUIRE(allocations < entries / 2);
+  }
+}
@@ -0,0 +1,147 @@
+#include <catch2/catch_test_macros.hpp>
+#include <algorithm>
+#include <filesystem>
+#include <pfs/atomic_write.hpp>
+#include <pfs/fake_filesystem.hpp>
+#include <pfs/std_filesystem.hpp>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/resource.h>
+#endif
+
+namespace {
+
+std::string read(pfs::filesystem &fs, const pfs::path &p) {
+  std::string content;
+  std::getline(*fs.open_file(p, std::ios::in), content, '\0');
+  return content;
+}
+
+std::size_t count_entries(const std::filesystem::path &dir) {
+  std::size_t n = 0;
+  for (auto it = std::filesystem::recursive_directory_iterator(dir);
+       it != std::filesystem::recursive_directory_iterator(); ++it) {
+    ++n;
+  }
+  return n;
+}
+
+} // namespace
+
+TEST_CASE("atomic_writer") {
+  SECTION("fake") {
+    pfs::fake_filesystem fs;
+    fs.create_directory("/d");
+    auto stats = pfs::write_file_atomic(fs, "/d/f", "first");
+    REQUIRE(read(fs, "/d/f") == "first");
+    pfs::write_file_atomic(fs, "/d/f", "second");
+    REQUIRE(read(fs, "/d/f") == "second");
+    REQUIRE(stats.files == 1);
+    REQUIRE(stats.file_syncs + stats.dir_syncs + stats.fs_syncs == 0);
+    REQUIRE_THROWS(pfs::write_file_atomic(fs, "/missing/f", "x"));
+    REQUIRE_THROWS(pfs::write_file_atomic(fs, "/d", "x"));
+  }
+
+  SECTION("std") {
+    pfs::std_filesystem fs;
+    std::random_device rd;
+    auto root = std::filesystem::temp_directory_path() /
+                ("pfs_test_atomic_" + std::to_string(rd()));
+    fs.create_directories(root / "a");
+    fs.create_directories(root / "b");
+
+    // Two syncs per file: its contents, then its directory.
+    auto stats = pfs::write_file_atomic(fs, root / "a" / "f", "first");
+    REQUIRE(read(fs, root / "a" / "f") == "first");
+    REQUIRE(stats.file_syncs == 1);
+    REQUIRE(stats.dir_syncs == 1);
+    pfs::write_file_atomic(fs, root / "a" / "f", "second");
+    REQUIRE(read(fs, root / "a" / "f") == "second");
+
+    pfs::atomic_write_options options;
+    options.sync = pfs::atomic_sync::group;
+    pfs::atomic_writer writer(fs, options);
+    std::vector<std::string> contents;
+    std::vector<std::pair<pfs::path, std::string_view>> files;
+    for (int i = 0; i < 10; ++i) {
+      contents.push_back(std::to_string(i));
+    }
+    for (int i = 0; i < 10; ++i) {
+      files.emplace_back(root / (i % 2 ? "a" : "b") / contents[i],
+                         contents[i]);
+    }
+    writer.write_all(files);
+    stats = writer.stats();
+    REQUIRE(stats.files == 10);
+    REQUIRE(stats.commits == 1);
+    REQUIRE(stats.dir_syncs == 2);
+#ifdef __linux__
+    REQUIRE(stats.fs_syncs == 1);
+    REQUIRE(stats.file_syncs == 0);
+#endif
+    REQUIRE(read(fs, root / "b" / "4") == "4");
+
+    // Concurrent writes share commits.
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t) {
+      threads.emplace_back([&, t] {
+        for (int i = 0; i < 20; ++i) {
+          writer.write(root / "a" / ("t" + std::to_string(t)),
+                       std::to_string(i));
+        }
+      });
+    }
+    for (auto &t : threads) {
+      t.join();
+    }
+    stats = writer.stats();
+    REQUIRE(stats.files == 90);
+    REQUIRE(stats.commits <= 81);
+    REQUIRE(read(fs, root / "a" / "t3") == "19");
+
+    // Failures leave no temporary files behind.
+    pfs::error_code ec;
+    writer.write(root / "missing" / "f", "x", ec);
+    REQUIRE(ec == std::errc::no_such_file_or_directory);
+    writer.write_all({{root / "a" / "ok", "ok"}, {root / "b", "dir"}}, ec);
+    REQUIRE(ec);
+    REQUIRE(read(fs, root / "a" / "ok") == "ok");
+    REQUIRE_THROWS(writer.write(root / "a" / "", "x"));
+    REQUIRE(count_entries(root) == 2 + 1 + 10 + 4 + 1);
+
+#if defined(__unix__) || defined(__APPLE__)
+    // Long lists are published in chunks, within a small descriptor limit.
+    rlimit limit;
+    REQUIRE(::getrlimit(RLIMIT_NOFILE, &limit) == 0);
+    auto lowered = limit;
+    lowered.rlim_cur = std::min<rlim_t>(limit.rlim_cur, 128);
+    REQUIRE(::setrlimit(RLIMIT_NOFILE, &lowered) == 0);
+    fs.create_directories(root / "many");
+    std::vector<std::string> names;
+    std::vector<std::pair<pfs::path, std::string_view>> many;
+    for (int i = 0; i < 300; ++i) {
+      names.push_back(std::to_string(i));
+    }
+    for (auto &name : names) {
+      many.emplace_back(root / "many" / name, name);
+    }
+    auto before = writer.stats();
+    writer.write_all(many, ec);
+    ::setrlimit(RLIMIT_NOFILE, &limit);
+    REQUIRE(!ec);
+    REQUIRE(writer.stats().commits - before.commits == 5);
+    REQUIRE(read(fs, root / "many" / "299") == "299");
+    REQUIRE(count_entries(root / "many") == 300);
+#endif
+
+    options.sync = pfs::atomic_sync::none;
+    stats = pfs::write_file_atomic(fs, root / "a" / "f", "third", options);
+    REQUIRE(read(fs, root / "a" / "f") == "third");
+    REQUIRE(stats.file_syncs + stats.dir_syncs + stats.fs_syncs == 0);
+    std::filesystem::remove_all(root);
+  }
+}
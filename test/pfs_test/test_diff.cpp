@@ -0,0 +1,127 @@
+#include <catch2/catch_test_macros.hpp>
+#include <catch2/generators/catch_generators.hpp>
+#include <pfs/diff.hpp>
+#include <pfs/fake_filesystem.hpp>
+#include <pfs/std_filesystem.hpp>
+#include <atomic>
+#include <random>
+#include <stdexcept>
+#include <string>
+
+namespace {
+
+/**
+ * @brief Builds the same small tree in any filesystem.
+ */
+void build(pfs::filesystem &fs, const pfs::path &root) {
+  fs.create_directories(root / "src" / "lib");
+  fs.create_directories(root / "docs");
+  *fs.open_file(root / "src" / "main.cpp", std::ios::out) << "int main() {}";
+  *fs.open_file(root / "src" / "lib" / "a.cpp", std::ios::out) << "a";
+  *fs.open_file(root / "docs" / "big.txt", std::ios::out)
+      << std::string(200000, 'x');
+  fs.open_file(root / "empty", std::ios::out);
+}
+
+/**
+ * @brief Makes a fixed set of changes to a tree built by @c build.
+ */
+void change(pfs::filesystem &fs, const pfs::path &root) {
+  // Same size, different content, past the first chunk.
+  auto big = fs.open_file(root / "docs" / "big.txt",
+                          std::ios::in | std::ios::out);
+  big->seekp(150000);
+  *big << 'y';
+  big.reset();
+  *fs.open_file(root / "src" / "lib" / "a.cpp", std::ios::out) << "ab";
+  fs.remove(root / "src" / "main.cpp");
+  fs.create_directories(root / "new" / "sub");
+  fs.remove(root / "empty");
+  fs.create_directory(root / "empty");
+}
+
+pfs::diff_result expected_changes() {
+  pfs::diff_result ret;
+  ret.added = {"new"};
+  ret.removed = {"src/main.cpp"};
+  ret.changed = {"docs/big.txt", "empty", "src/lib/a.cpp"};
+  return ret;
+}
+
+void require_equal(const pfs::diff_result &actual,
+                   const pfs::diff_result &expected) {
+  REQUIRE(actual.added == expected.added);
+  REQUIRE(actual.removed == expected.removed);
+  REQUIRE(actual.changed == expected.changed);
+}
+
+} // namespace
+
+TEST_CASE("diff") {
+  pfs::fake_filesystem a;
+  pfs::fake_filesystem b;
+  build(a, "/tree");
+  build(b, "/copy/tree");
+  pfs::diff_options options;
+  options.threads = GENERATE(1u, 4u);
+
+  SECTION("equal trees") {
+    REQUIRE(pfs::diff(a, "/tree", b, "/copy/tree", options).empty());
+    REQUIRE(pfs::diff(a, "/tree", a, "/tree", options).empty());
+  }
+
+  SECTION("fake trees") {
+    change(b, "/copy/tree");
+    require_equal(pfs::diff(a, "/tree", b, "/copy/tree", options),
+                  expected_changes());
+    auto reverse = pfs::diff(b, "/copy/tree", a, "/tree", options);
+    REQUIRE(reverse.added == expected_changes().removed);
+    REQUIRE(reverse.removed == expected_changes().added);
+  }
+
+  SECTION("roots") {
+    REQUIRE(pfs::diff(a, "/tree/src/lib/a.cpp", b, "/copy/tree/src/lib/a.cpp",
+                      options)
+                .empty());
+    auto ret = pfs::diff(a, "/tree/src", b, "/copy/tree/docs", options);
+    REQUIRE(ret.added == std::vector<pfs::path>{"big.txt"});
+    REQUIRE(ret.removed == std::vector<pfs::path>{"lib", "main.cpp"});
+    REQUIRE(pfs::diff(a, "/tree/src", b, "/copy/tree/empty", options)
+                .changed == std::vector<pfs::path>{""});
+    REQUIRE_THROWS(pfs::diff(a, "/missing", b, "/copy/tree", options));
+    std::error_code ec;
+    pfs::diff(a, "/tree", b, "/missing", options, ec);
+    REQUIRE(ec == std::errc::no_such_file_or_directory);
+  }
+
+  SECTION("fake and std trees") {
+    pfs::std_filesystem real;
+    std::random_device rd;
+    auto root = std::filesystem::temp_directory_path() /
+                ("pfs_test_diff_" + std::to_string(rd()));
+    build(real, root);
+    REQUIRE(pfs::diff(a, "/tree", real, root, options).empty());
+    change(real, root);
+    require_equal(pfs::diff(a, "/tree", real, root, options),
+                  expected_changes());
+
+    // Without content comparison, files of equal size are equal.
+    options.compare_content = false;
+    auto ret = pfs::diff(a, "/tree", real, root, options);
+    REQUIRE(ret.changed == std::vector<pfs::path>{"empty", "src/lib/a.cpp"});
+    std::filesystem::remove_all(root);
+  }
+}
+
+TEST_CASE("run_pool") {
+  // An exception in a worker is rethrown once every thread is joined.
+  std::atomic<int> calls{0};
+  auto worker = [&] {
+    if (++calls % 2 == 0) {
+      throw std::runtime_error("worker");
+    }
+  };
+  REQUIRE_THROWS_AS(pfs::detail::run_pool(4, worker), std::runtime_error);
+  REQUIRE(calls == 4);
+  REQUIRE_NOTHROW(pfs::detail::run_pool(1, [] {}));
+}
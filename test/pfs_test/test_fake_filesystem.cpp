@@ -1,6 +1,10 @@
+#include <algorithm>
 #include <catch2/catch_test_macros.hpp>
 #include <pfs/fake_filesystem.hpp>
+#include <random>
 #include <set>
+#include <string>
+#include <vector>
 
 TEST_CASE("fake_filesystem") {
   pfs::fake_filesystem fs;
@@ -115,6 +119,20 @@ TEST_CASE("fake_filesystem") {
     REQUIRE_NOTHROW(fs.rename("a/b/c", "a/foo"));
     REQUIRE(fs.is_directory("a/foo"));
     REQUIRE(!fs.is_directory("a/b/c"));
+    REQUIRE(fs.open_file("a/file", std::ios::out)->good());
+    REQUIRE_THROWS(fs.rename("a/foo", "a/file/foo"));
+    REQUIRE(!fs.exists("a/file/foo"));
+    REQUIRE(fs.is_directory("a/foo"));
+
+    // A directory cannot move into its own subtree.
+    pfs::error_code ec;
+    auto before = fs.tree_hash("/");
+    fs.rename("a", "a/b/c", ec);
+    REQUIRE(ec == std::errc::invalid_argument);
+    fs.rename("a", "a/c", ec);
+    REQUIRE(ec == std::errc::invalid_argument);
+    REQUIRE(fs.is_directory("a/b"));
+    REQUIRE(fs.tree_hash("/") == before);
   }
 
   SECTION("directory_iterator") {
@@ -142,4 +160,409 @@ TEST_CASE("fake_filesystem") {
     }
     REQUIRE(actual == expected);
   }
-}
\ No newline at end of file
+
+  SECTION("large directory") {
+    // Many names share long prefixes, and some are prefixes of others.
+    std::vector<std::string> names{"entry", "entry_", "a", "zzz"};
+    for (int i = 0; i < 300; ++i) {
+      names.push_back("entry_" + std::to_string(i));
+      names.push_back("entry_long_name_" + std::to_string(i));
+    }
+    std::shuffle(names.begin(), names.end(), std::mt19937(1));
+    REQUIRE(fs.create_directory("big"));
+    for (const auto &name : names) {
+      REQUIRE(fs.create_directory("big/" + name));
+    }
+    for (const auto &name : names) {
+      REQUIRE(fs.is_directory("big/" + name));
+      REQUIRE(!fs.create_directory("big/" + name));
+    }
+    for (auto missing : {"0", "e", "entr", "entry_1000", "entry_long_name_",
+                         "entry_long_name_3000", "b", "zzzz", "~"}) {
+      REQUIRE(!fs.exists(std::string("big/") + missing));
+    }
+
+    std::vector<std::string> listed;
+    for (auto it = fs.directory_iterator("big"); !it->at_end();
+         it->increment()) {
+      listed.push_back(it->path().filename().string());
+    }
+    std::sort(names.begin(), names.end());
+    REQUIRE(listed == names);
+
+    for (std::size_t i = 0; i < names.size(); i += 2) {
+      REQUIRE(fs.remove("big/" + names[i]));
+    }
+    for (std::size_t i = 0; i < names.size(); ++i) {
+      REQUIRE(fs.exists("big/" + names[i]) == (i % 2 == 1));
+    }
+  }
+
+  SECTION("compact") {
+    REQUIRE(fs.create_directories("a/b/c"));
+    REQUIRE(fs.create_directories("x/y"));
+    for (int i = 0; i < 50; ++i) {
+      *fs.open_file("a/b/" + std::to_string(i), std::ios::out) << i;
+    }
+    REQUIRE(fs.create_directory("a/b/a_long_directory_name_beyond_sso"));
+    REQUIRE_NOTHROW(fs.rename("a/b/c", "x/y/c"));
+    REQUIRE_NOTHROW(fs.current_path("x/y"));
+    auto open = fs.open_file(root / "a/b/0", std::ios::out | std::ios::app);
+    auto old_it = fs.recursive_directory_iterator(root);
+    auto listing = [&] {
+      std::vector<pfs::path> paths;
+      for (auto it = fs.recursive_directory_iterator(root); !it->at_end();
+           it->increment()) {
+        paths.push_back(it->path());
+      }
+      return paths;
+    };
+    auto before = listing();
+    auto stats = fs.memory_stats();
+
+    fs.compact();
+    REQUIRE(listing() == before);
+    REQUIRE(fs.memory_stats().nodes == stats.nodes);
+    REQUIRE(fs.current_path() == root / "x/y");
+    REQUIRE(fs.is_directory("c"));
+    REQUIRE(fs.is_directory(".."));
+    REQUIRE(fs.file_size(root / "a/b/49") == 2);
+
+    // Open streams and iterators are unaffected.
+    *open << "more";
+    open.reset();
+    REQUIRE(fs.file_size(root / "a/b/0") == 5);
+    std::size_t count = 0;
+    for (; !old_it->at_end(); old_it->increment()) {
+      ++count;
+    }
+    REQUIRE(count == before.size());
+
+    // The compacted tree can be modified.
+    REQUIRE(fs.remove_all(root / "a") == 53);
+    REQUIRE(fs.create_directory("d"));
+    REQUIRE_NOTHROW(fs.compact());
+    REQUIRE(fs.is_directory(root / "x/y/d"));
+  }
+
+  SECTION("transactions") {
+    REQUIRE(fs.create_directories("a/b"));
+    *fs.open_file("a/file", std::ios::out) << "original";
+    auto listing = [&] {
+      std::vector<pfs::path> paths;
+      for (auto it = fs.recursive_directory_iterator(root); !it->at_end();
+           it->increment()) {
+        paths.push_back(it->path());
+      }
+      return paths;
+    };
+    auto before = listing();
+
+    fs.begin();
+    REQUIRE(fs.transaction_depth() == 1);
+    REQUIRE(fs.create_directories("x/y/z"));
+    REQUIRE_NOTHROW(fs.rename("a/b", "x/y/b"));
+    *fs.open_file("a/file", std::ios::out) << "changed";
+    *fs.open_file("a/new", std::ios::out) << "new";
+    REQUIRE(fs.remove_all("a") == 3);
+    REQUIRE(!fs.exists("a"));
+    fs.rollback();
+    REQUIRE(fs.transaction_depth() == 0);
+    REQUIRE(listing() == before);
+    std::string content;
+    std::getline(*fs.open_file("a/file", std::ios::in), content);
+    REQUIRE(content == "original");
+
+    // Committed changes are kept.
+    fs.begin();
+    REQUIRE(fs.create_directory("c"));
+    fs.commit();
+    REQUIRE(fs.is_directory("c"));
+
+    // Rolling back an outer transaction undoes committed inner ones.
+    fs.begin();
+    REQUIRE(fs.create_directory("d"));
+    fs.begin();
+    REQUIRE(fs.create_directory("e"));
+    fs.commit();
+    fs.begin();
+    REQUIRE(fs.create_directory("f"));
+    fs.rollback();
+    REQUIRE(fs.is_directory("e"));
+    REQUIRE(!fs.exists("f"));
+    REQUIRE_THROWS_AS(fs.compact(), std::logic_error);
+    fs.rollback();
+    REQUIRE(!fs.exists("d"));
+    REQUIRE(!fs.exists("e"));
+    REQUIRE(fs.is_directory("c"));
+
+    REQUIRE_THROWS_AS(fs.commit(), std::logic_error);
+    REQUIRE_THROWS_AS(fs.rollback(), std::logic_error);
+  }
+
+  SECTION("open_file") {
+    REQUIRE(fs.create_directories("a"));
+    {
+      auto f = fs.open_file("a/hello.txt", std::ios::out);
+      REQUIRE(f->good());
+      *f << "hello";
+    }
+    REQUIRE(fs.status("a/hello.txt").type() == pfs::file_type::regular);
+    REQUIRE(fs.file_size("a/hello.txt") == 5);
+    {
+      auto f = fs.open_file("a/hello.txt", std::ios::app);
+      *f << ", world";
+    }
+    {
+      auto f = fs.open_file("a/hello.txt", std::ios::in);
+      std::string contents;
+      std::getline(*f, contents);
+      REQUIRE(contents == "hello, world");
+    }
+    {
+      auto f = fs.open_file("a/hello.txt", std::ios::out);
+      REQUIRE(fs.file_size("a/hello.txt") == 0);
+    }
+    REQUIRE(fs.open_file("a/missing.txt", std::ios::in)->fail());
+    REQUIRE(
+        fs.open_file("a/missing.txt", std::ios::in | std::ios::out)->fail());
+    REQUIRE(fs.open_file("no/parent.txt", std::ios::out)->fail());
+    REQUIRE(fs.open_file("a", std::ios::out)->fail());
+  }
+
+  SECTION("file_size") {
+    std::error_code ec;
+    REQUIRE(fs.create_directories("a"));
+    REQUIRE(fs.file_size("missing", ec) == static_cast<std::uintmax_t>(-1));
+    REQUIRE(ec == std::errc::no_such_file_or_directory);
+    REQUIRE(fs.file_size("a", ec) == static_cast<std::uintmax_t>(-1));
+    REQUIRE(ec == std::errc::is_a_directory);
+    REQUIRE_THROWS_AS(fs.file_size("a"), pfs::filesystem_error);
+  }
+
+  SECTION("remove file") {
+    *fs.open_file("file", std::ios::out) << "data";
+    REQUIRE(fs.remove("file"));
+    REQUIRE(!fs.exists("file"));
+  }
+
+  SECTION("memory_stats") {
+    auto before = fs.memory_stats();
+    REQUIRE(before.nodes == 2); // meta-root and root directory
+    REQUIRE(fs.create_directories("a/b"));
+    *fs.open_file("a/file", std::ios::out) << std::string(1000, 'x');
+    auto after = fs.memory_stats();
+    REQUIRE(after.nodes == 5);
+    REQUIRE(after.node_bytes > before.node_bytes);
+    REQUIRE(after.content_used_bytes == 1000);
+    REQUIRE(after.content_capacity_bytes >= 1000);
+    REQUIRE(after.total_bytes() > before.total_bytes());
+
+    // Files do not carry a directory entry list.
+    REQUIRE(fs.create_directory("d"));
+    auto with_dir = fs.memory_stats();
+    REQUIRE(fs.open_file("f", std::ios::out)->good());
+    auto with_file = fs.memory_stats();
+    REQUIRE(with_file.node_bytes - with_dir.node_bytes <
+            with_dir.node_bytes - after.node_bytes);
+  }
+
+  SECTION("shrink_to_fit") {
+    REQUIRE(fs.create_directories("a"));
+    for (int i = 0; i < 100; ++i) {
+      REQUIRE(fs.create_directory("a/" + std::to_string(i)));
+    }
+    for (int i = 10; i < 100; ++i) {
+      REQUIRE(fs.remove("a/" + std::to_string(i)));
+    }
+    auto before = fs.memory_stats();
+    REQUIRE(before.dents_capacity_bytes > before.dents_used_bytes);
+    REQUIRE(fs.shrink_to_fit() > 0);
+    auto after = fs.memory_stats();
+    REQUIRE(after.dents_capacity_bytes == after.dents_used_bytes);
+    REQUIRE(after.nodes == before.nodes);
+    REQUIRE(fs.shrink_to_fit() == 0);
+  }
+
+  SECTION("tree_hash of edited files") {
+    // Hashes follow partial changes to files of several blocks exactly.
+    std::string content;
+    for (int i = 0; content.size() < 3 * 4096 + 100; ++i) {
+      content += std::to_string(i) + ",";
+    }
+    pfs::fake_filesystem other;
+    auto require_same = [&](const std::string &expected) {
+      other.write_file("/f", expected);
+      REQUIRE(fs.tree_hash("/") == other.tree_hash("/"));
+    };
+    fs.write_file("/f", content);
+    require_same(content);
+
+    auto edited = content;
+    edited.replace(4000, 200, std::string(200, 'x'));
+    fs.write_file("/f", edited);
+    require_same(edited);
+    REQUIRE(fs.tree_hash("/") != pfs::fake_filesystem().tree_hash("/"));
+
+    {
+      auto h = fs.open_handle("/f", std::ios::in | std::ios::out);
+      h->pwrite("yy", 2, 5000);
+      edited.replace(5000, 2, "yy");
+      h->pwrite("end", 3, 20000);
+      edited.resize(20000, '\0');
+      edited += "end";
+      h->punch_hole(100, 9000);
+      std::fill(edited.begin() + 100, edited.begin() + 9100, '\0');
+    }
+    require_same(edited);
+
+    *fs.open_file("/f", std::ios::app) << "more";
+    require_same(edited + "more");
+    fs.write_file("/f", content.substr(0, 4096));
+    require_same(content.substr(0, 4096));
+  }
+
+  SECTION("tree_hash") {
+    // The same tree, built in a different order elsewhere.
+    auto build = [](pfs::fake_filesystem &f, const pfs::path &root,
+                    bool reversed) {
+      REQUIRE(f.create_directories(root));
+      std::vector<std::string> names{"a", "b", "c", "d"};
+      if (reversed) {
+        std::reverse(names.begin(), names.end());
+      }
+      for (const auto &name : names) {
+        REQUIRE(f.create_directories(root / name / "sub"));
+        *f.open_file(root / name / "file", std::ios::out) << name;
+      }
+    };
+    pfs::fake_filesystem other;
+    build(fs, "/x", false);
+    build(other, "/y/z", true);
+    REQUIRE(fs.tree_hash("/x") == other.tree_hash("/y/z"));
+    REQUIRE(fs.tree_hash("/") != other.tree_hash("/"));
+    REQUIRE(fs.tree_hash("/x/a") != fs.tree_hash("/x/b"));
+    REQUIRE(fs.tree_hash("/x/a/sub") == fs.tree_hash("/x/b/sub"));
+    REQUIRE(pfs::fake_filesystem::differences(fs, "/x", other, "/y/z")
+                .empty());
+    REQUIRE_THROWS(fs.tree_hash("/missing"));
+
+    auto original = fs.tree_hash("/x");
+    auto root = fs.tree_hash("/");
+
+    // Contents, once flushed.
+    {
+      auto file = fs.open_file("/x/c/file", std::ios::app);
+      *file << "!";
+      REQUIRE(fs.tree_hash("/x") == original);
+      file->flush();
+      REQUIRE(fs.tree_hash("/x") != original);
+    }
+    *fs.open_file("/x/c/file", std::ios::out) << "c";
+    REQUIRE(fs.tree_hash("/x") == original);
+    REQUIRE(fs.tree_hash("/") == root);
+
+    // Names, types and structure.
+    fs.rename("/x/d/sub", "/x/d/sub2");
+    REQUIRE(fs.tree_hash("/x") != original);
+    fs.rename("/x/d/sub2", "/x/d/sub");
+    REQUIRE(fs.tree_hash("/x") == original);
+    REQUIRE(fs.remove("/x/a/sub"));
+    *fs.open_file("/x/a/sub", std::ios::out) << "";
+    REQUIRE(fs.tree_hash("/x") != original);
+    REQUIRE(fs.remove("/x/a/sub"));
+    REQUIRE(fs.create_directory("/x/a/sub"));
+    REQUIRE(fs.tree_hash("/x") == original);
+
+    // Differences descend only where the hashes differ.
+    REQUIRE(other.create_directory("/y/z/new"));
+    REQUIRE(other.remove("/y/z/b/sub"));
+    *other.open_file("/y/z/c/file", std::ios::out) << "changed";
+    REQUIRE(other.remove("/y/z/d/sub"));
+    REQUIRE(other.open_file("/y/z/d/sub", std::ios::out)->good());
+    std::vector<pfs::path> expected{"b/sub", "c/file", "d/sub", "new"};
+    REQUIRE(pfs::fake_filesystem::differences(fs, "/x", other, "/y/z") ==
+            expected);
+    REQUIRE(pfs::fake_filesystem::differences(fs, "/x/a/file", other,
+                                              "/y/z/b/file") ==
+            std::vector<pfs::path>{""});
+
+    // Rollback and compaction keep the hashes.
+    fs.begin();
+    REQUIRE(fs.remove_all("/x/b") == 3);
+    *fs.open_file("/x/a/file", std::ios::out) << "rolled back";
+    REQUIRE(fs.create_directories("/x/e/f/g"));
+    fs.rollback();
+    REQUIRE(fs.tree_hash("/x") == original);
+    fs.compact();
+    REQUIRE(fs.tree_hash("/x") == original);
+    REQUIRE(fs.tree_hash("/") == root);
+  }
+
+  SECTION("name index") {
+    using paths = std::vector<pfs::path>;
+    REQUIRE(!fs.name_index_enabled());
+    REQUIRE_THROWS_AS(fs.find_by_name("a"), std::logic_error);
+    REQUIRE(fs.create_directories("/src/core"));
+    *fs.open_file("/src/core/main.cpp", std::ios::out) << "";
+    fs.enable_name_index();
+    REQUIRE(fs.find_by_name("main.cpp") == paths{"/src/core/main.cpp"});
+    REQUIRE(fs.find_by_name("/").empty());
+
+    REQUIRE(fs.create_directories("/lib/core/x"));
+    for (auto p : {"/lib/main.cpp", "/lib/core/a.tar.gz", "/.profile"}) {
+      *fs.open_file(p, std::ios::out) << "";
+    }
+    REQUIRE(fs.find_by_name("core") == paths{"/lib/core", "/src/core"});
+    REQUIRE(fs.find_by_name("main.cpp") ==
+            paths{"/lib/main.cpp", "/src/core/main.cpp"});
+    REQUIRE(fs.find_by_extension(".cpp") ==
+            paths{"/lib/main.cpp", "/src/core/main.cpp"});
+    REQUIRE(fs.find_by_extension(".gz") == paths{"/lib/core/a.tar.gz"});
+    REQUIRE(fs.find_by_extension(".profile").empty());
+    REQUIRE(fs.find_by_name(".profile") == paths{"/.profile"});
+
+    // Renames move the entry and its descendants.
+    fs.rename("/lib", "/library");
+    REQUIRE(fs.find_by_name("lib").empty());
+    REQUIRE(fs.find_by_name("library") == paths{"/library"});
+    REQUIRE(fs.find_by_extension(".cpp") ==
+            paths{"/library/main.cpp", "/src/core/main.cpp"});
+    fs.rename("/src/core/main.cpp", "/src/core/main.hpp");
+    REQUIRE(fs.find_by_extension(".cpp") == paths{"/library/main.cpp"});
+    REQUIRE(fs.find_by_extension(".hpp") == paths{"/src/core/main.hpp"});
+
+    // Removals and rollbacks.
+    fs.begin();
+    REQUIRE(fs.remove_all("/library") == 5);
+    REQUIRE(fs.find_by_name("core") == paths{"/src/core"});
+    REQUIRE(fs.find_by_extension(".gz").empty());
+    *fs.open_file("/src/new.cpp", std::ios::out) << "";
+    fs.rename("/src/core", "/src/core2");
+    fs.rollback();
+    REQUIRE(fs.find_by_name("core") == paths{"/library/core", "/src/core"});
+    REQUIRE(fs.find_by_name("core2").empty());
+    REQUIRE(fs.find_by_extension(".cpp") == paths{"/library/main.cpp"});
+    REQUIRE(fs.find_by_extension(".gz") == paths{"/library/core/a.tar.gz"});
+
+    fs.compact();
+    REQUIRE(fs.find_by_name("core") == paths{"/library/core", "/src/core"});
+    REQUIRE(fs.remove("/library/core/a.tar.gz"));
+    REQUIRE(fs.find_by_extension(".gz").empty());
+
+    fs.disable_name_index();
+    REQUIRE_THROWS_AS(fs.find_by_extension(".cpp"), std::logic_error);
+  }
+
+  SECTION("removed directories") {
+    REQUIRE(fs.create_directories("/a/b"));
+    auto file = fs.open_file("/a/b/file", std::ios::out);
+    fs.current_path("/a/b");
+    REQUIRE(fs.remove_all("/a") == 3);
+    // Writes to a file whose directories are gone do not reach the tree.
+    *file << "orphan";
+    file->flush();
+    REQUIRE(fs.tree_hash("/") == pfs::fake_filesystem().tree_hash("/"));
+    REQUIRE_NOTHROW(fs.exists(".."));
+  }
+}
@@ -0,0 +1,354 @@
+#include <catch2/catch_test_macros.hpp>
+#include <filesystem>
+#include <iterator>
+#include <limits>
+#include <pfs/fake_filesystem.hpp>
+#include <pfs/open_handle.hpp>
+#include <pfs/std_filesystem.hpp>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+std::string read(pfs::filesystem &fs, const pfs::path &p) {
+  auto in = fs.open_file(p, std::ios::in | std::ios::binary);
+  return {std::istreambuf_iterator<char>(*in), {}};
+}
+
+/**
+ * @brief Checks reads and writes through a handle opened read-write on a
+ * new file.
+ */
+void check_handle(pfs::file_handle &h) {
+  REQUIRE(h.size() == 0);
+  REQUIRE(h.pwrite("world", 5, 6) == 5);
+  REQUIRE(h.pwrite("hello", 5, 0) == 5);
+  REQUIRE(h.size() == 11);
+
+  char buf[16] = {};
+  REQUIRE(h.pread(buf, sizeof(buf), 0) == 11);
+  REQUIRE(std::string(buf, 11) == std::string("hello\0world", 11));
+  REQUIRE(h.pread(buf, 4, 7) == 4);
+  REQUIRE(std::string(buf, 4) == "orld");
+  REQUIRE(h.pread(buf, 4, 11) == 0);
+  REQUIRE(h.pread(buf, 4, 100) == 0);
+
+  pfs::const_buffer out[] = {{"ab", 2}, {"", 0}, {"cde", 3}};
+  REQUIRE(h.pwritev(out, 3, 9) == 5);
+  REQUIRE(h.size() == 14);
+  char a[3], b[20];
+  pfs::mutable_buffer in[] = {{a, 3}, {b, 20}};
+  REQUIRE(h.preadv(in, 2, 2) == 12);
+  REQUIRE(std::string(a, 3) == "llo");
+  REQUIRE(std::string(b, 9) == std::string("\0worabcde", 9));
+
+  // Writes past the largest offset fail without changing the file.
+  pfs::error_code ec;
+  REQUIRE(h.pwrite("x", 1, std::numeric_limits<std::int64_t>::max(), ec) ==
+          0);
+  REQUIRE(ec);
+  REQUIRE(h.pwrite("x", 1, std::numeric_limits<std::uint64_t>::max(), ec) ==
+          0);
+  REQUIRE(ec);
+  REQUIRE_THROWS(h.pwrite("x", 1, std::numeric_limits<std::uint64_t>::max()));
+  REQUIRE(h.size() == 14);
+  h.sync();
+}
+
+void check_readers(pfs::file_handle &h, const std::string &content) {
+  std::vector<std::thread> threads;
+  std::vector<int> mismatches(4);
+  for (int t = 0; t < 4; ++t) {
+    threads.emplace_back([&, t] {
+      std::string buf(64, '\0');
+      for (std::size_t off = 0; off + 64 <= content.size(); off += 61) {
+        if (h.pread(buf.data(), 64, off) != 64 ||
+            buf != content.substr(off, 64)) {
+          ++mismatches[t];
+        }
+      }
+    });
+  }
+  for (auto &t : threads) {
+    t.join();
+  }
+  REQUIRE(mismatches == std::vector<int>(4));
+}
+
+/**
+ * @brief A stream that knows its size but fails to seek to a position.
+ */
+class unseekable_stream : public std::iostream {
+  struct buffer : std::stringbuf {
+    using std::stringbuf::stringbuf;
+
+    pos_type seekpos(pos_type, std::ios_base::openmode) override {
+      return pos_type(off_type(-1));
+    }
+  } buffer_;
+
+public:
+  explicit unseekable_stream(const std::string &content)
+      : std::iostream(&buffer_), buffer_(content) {}
+};
+
+} // namespace
+
+TEST_CASE("open_handle") {
+  std::string content;
+  for (int i = 0; content.size() < 100000; ++i) {
+    content += std::to_string(i) + ",";
+  }
+
+  SECTION("fake") {
+    pfs::fake_filesystem fs;
+    fs.create_directory("/d");
+    auto before = fs.tree_hash("/");
+    {
+      auto h = fs.open_handle("/d/f", std::ios::in | std::ios::out |
+                                          std::ios::trunc);
+      check_handle(*h);
+      REQUIRE(fs.tree_hash("/") != before);
+    }
+    REQUIRE(read(fs, "/d/f") == std::string("hello\0worabcde", 14));
+
+    // The hash follows the contents once the handle syncs.
+    pfs::fake_filesystem other;
+    other.create_directory("/d");
+    other.write_file("/d/f", std::string("hello\0worabcde", 14));
+    REQUIRE(fs.tree_hash("/") == other.tree_hash("/"));
+    {
+      auto h = fs.open_handle("/d/f", std::ios::out | std::ios::app);
+      h->pwrite("!", 1, 14);
+      h->sync();
+      other.write_file("/d/f", std::string("hello\0worabcde!", 15));
+      REQUIRE(fs.tree_hash("/") == other.tree_hash("/"));
+    }
+
+    {
+      // More than a string can hold.
+      auto h = fs.open_handle("/d/f", std::ios::out | std::ios::app);
+      pfs::error_code ec;
+      REQUIRE(h->pwrite("x", 1, std::uint64_t(1) << 62, ec) == 0);
+      REQUIRE(ec == std::errc::file_too_large);
+      REQUIRE(h->size() == 15);
+    }
+
+    fs.write_file("/d/big", content);
+    auto h = fs.open_handle("/d/big", std::ios::in);
+    check_readers(*h, content);
+    pfs::error_code ec;
+    REQUIRE(h->pwrite("x", 1, 0, ec) == 0);
+    REQUIRE(ec == std::errc::bad_file_descriptor);
+    REQUIRE(fs.open_handle("/d/missing", std::ios::in, ec) == nullptr);
+    REQUIRE(ec == std::errc::no_such_file_or_directory);
+    REQUIRE(fs.open_handle("/d", std::ios::in, ec) == nullptr);
+    REQUIRE(ec == std::errc::is_a_directory);
+    REQUIRE_THROWS(fs.open_handle("/missing/f", std::ios::out));
+
+    // Opening for writing is undone by a rollback.
+    fs.begin();
+    fs.open_handle("/d/big", std::ios::out)->pwrite("x", 1, 0);
+    REQUIRE(read(fs, "/d/big") == "x");
+    fs.rollback();
+    REQUIRE(read(fs, "/d/big") == content);
+  }
+
+  SECTION("std") {
+    pfs::std_filesystem fs;
+    std::random_device rd;
+    auto root = std::filesystem::temp_directory_path() /
+                ("pfs_test_handle_" + std::to_string(rd()));
+    fs.create_directories(root);
+    {
+      auto h = fs.open_handle(root / "f", std::ios::in | std::ios::out |
+                                              std::ios::trunc);
+      check_handle(*h);
+    }
+    REQUIRE(read(fs, root / "f") == std::string("hello\0worabcde", 14));
+
+    *fs.open_file(root / "big", std::ios::out) << content;
+    auto h = fs.open_handle(root / "big", std::ios::in);
+    check_readers(*h, content);
+    pfs::error_code ec;
+    REQUIRE(h->pwrite("x", 1, 0, ec) == 0);
+    REQUIRE(ec == std::errc::bad_file_descriptor);
+    REQUIRE(fs.open_handle(root / "missing", std::ios::in, ec) == nullptr);
+    REQUIRE(ec == std::errc::no_such_file_or_directory);
+    REQUIRE(fs.open_handle(root, std::ios::in, ec) == nullptr);
+    REQUIRE(ec == std::errc::is_a_directory);
+    REQUIRE_THROWS(fs.open_handle(root / "missing" / "f", std::ios::out));
+    std::filesystem::remove_all(root);
+  }
+
+  SECTION("stream") {
+    auto stream = std::make_unique<std::stringstream>(
+        std::ios::in | std::ios::out | std::ios::binary);
+    pfs::stream_file_handle h(std::move(stream), std::ios::in | std::ios::out);
+    check_handle(h);
+
+    pfs::stream_file_handle reader(
+        std::make_unique<std::stringstream>(content, std::ios::in),
+        std::ios::in);
+    REQUIRE(reader.size() == content.size());
+    check_readers(reader, content);
+    pfs::error_code ec;
+    REQUIRE(reader.pwrite("x", 1, 0, ec) == 0);
+    REQUIRE(ec == std::errc::bad_file_descriptor);
+
+    // A failed seek is an error rather than the end of the file.
+    pfs::stream_file_handle unseekable(
+        std::make_unique<unseekable_stream>("abc"), std::ios::in);
+    char buf[4];
+    REQUIRE(unseekable.pread(buf, 4, 1, ec) == 0);
+    REQUIRE(ec == std::errc::io_error);
+    REQUIRE(unseekable.pread(buf, 4, 3, ec) == 0);
+    REQUIRE(!ec);
+  }
+}
+
+TEST_CASE("preallocate") {
+  using holes = std::vector<std::pair<std::uint64_t, std::uint64_t>>;
+
+  SECTION("fake") {
+    pfs::fake_filesystem fs;
+    auto h = fs.open_handle("/f", std::ios::in | std::ios::out |
+                                      std::ios::trunc);
+    h->pwrite("abcd", 4, 0);
+    auto info = h->allocation();
+    REQUIRE(info.size == 4);
+    REQUIRE(info.allocated == 4);
+    REQUIRE(info.holes.empty());
+
+    // Writing past the end leaves a hole.
+    h->pwrite("xyz", 3, 10);
+    info = h->allocation();
+    REQUIRE(info.size == 13);
+    REQUIRE(info.allocated == 7);
+    REQUIRE(info.holes == holes{{4, 10}});
+
+    // Preallocating fills holes and reserves space past the end.
+    h->preallocate(8, 12);
+    info = h->allocation();
+    REQUIRE(info.size == 13);
+    REQUIRE(info.allocated == 16);
+    REQUIRE(info.holes == holes{{4, 8}});
+
+    // Appends into preallocated space allocate nothing more.
+    h->pwrite("0123456", 7, 13);
+    info = h->allocation();
+    REQUIRE(info.size == 20);
+    REQUIRE(info.allocated == 16);
+
+    h->punch_hole(1, 2);
+    info = h->allocation();
+    REQUIRE(info.allocated == 14);
+    REQUIRE(info.holes == holes{{1, 3}, {4, 8}});
+    char buf[4];
+    REQUIRE(h->pread(buf, 4, 0) == 4);
+    REQUIRE(std::string(buf, 4) == std::string("a\0\0d", 4));
+
+    // Writing everything allocates the file exactly again.
+    std::string all(20, 'z');
+    h->pwrite(all.data(), all.size(), 0);
+    info = h->allocation();
+    REQUIRE(info.allocated == 20);
+    REQUIRE(info.holes.empty());
+    h->advise(0, 0, pfs::access_advice::sequential);
+    h->readahead(0, 20);
+    h.reset();
+
+    // Replacing the contents resets the allocation.
+    pfs::preallocate(fs, "/f", 0, 100);
+    REQUIRE(pfs::allocation(fs, "/f").allocated == 100);
+    fs.write_file("/f", "new");
+    REQUIRE(pfs::allocation(fs, "/f").allocated == 3);
+    pfs::punch_hole(fs, "/f", 0, 100);
+    REQUIRE(pfs::allocation(fs, "/f").holes == holes{{0, 3}});
+
+    // Ranges may run to the end of the file, but not past the largest
+    // offset.
+    constexpr auto to_end = std::numeric_limits<std::uint64_t>::max();
+    fs.write_file("/big", std::string(100, 'x'));
+    pfs::punch_hole(fs, "/big", 10, to_end);
+    REQUIRE(pfs::allocation(fs, "/big").holes == holes{{10, 100}});
+    REQUIRE(fs.view_file("/big").data() ==
+            std::string(10, 'x') + std::string(90, '\0'));
+    pfs::error_code ec;
+    pfs::preallocate(fs, "/big", 10, to_end, ec);
+    REQUIRE(ec == std::errc::file_too_large);
+    pfs::preallocate(fs, "/big", to_end - 1, 1, ec);
+    REQUIRE(ec == std::errc::file_too_large);
+    REQUIRE(pfs::allocation(fs, "/big").allocated == 10);
+
+    fs.open_handle("/f", std::ios::in)->preallocate(0, 10, ec);
+    REQUIRE(ec == std::errc::bad_file_descriptor);
+    REQUIRE_THROWS(pfs::preallocate(fs, "/missing", 0, 10));
+  }
+
+#ifdef __linux__
+  SECTION("std") {
+    pfs::std_filesystem fs;
+    std::random_device rd;
+    auto root = std::filesystem::temp_directory_path() /
+                ("pfs_test_preallocate_" + std::to_string(rd()));
+    fs.create_directories(root);
+    auto h = fs.open_handle(root / "f", std::ios::in | std::ios::out |
+                                            std::ios::trunc);
+    pfs::error_code ec;
+    h->preallocate(0, 1 << 20, ec);
+    if (ec != std::errc::operation_not_supported) {
+      REQUIRE(!ec);
+      auto info = h->allocation();
+      REQUIRE(info.size == 0);
+      REQUIRE(info.allocated >= 1 << 20);
+
+      std::string block(1 << 16, 'x');
+      for (std::uint64_t off = 0; off < 1 << 20; off += block.size()) {
+        h->pwrite(block.data(), block.size(), off);
+      }
+      h->punch_hole(1 << 18, 1 << 18, ec);
+      if (!ec) {
+        info = h->allocation();
+        REQUIRE(info.size == 1 << 20);
+        REQUIRE(info.allocated <= 3 << 18);
+        REQUIRE(info.holes == holes{{1 << 18, 1 << 19}});
+        char c;
+        REQUIRE(h->pread(&c, 1, 1 << 18) == 1);
+        REQUIRE(c == '\0');
+        h->punch_hole(1 << 19, std::numeric_limits<std::uint64_t>::max());
+        REQUIRE(h->allocation().holes == holes{{1 << 18, 1 << 20}});
+      }
+      h->preallocate(1, std::numeric_limits<std::uint64_t>::max(), ec);
+      REQUIRE(ec == std::errc::file_too_large);
+    }
+    h->advise(0, 0, pfs::access_advice::sequential);
+    h->advise(0, 0, pfs::access_advice::dontneed);
+    h->readahead(0, 1 << 20);
+    h.reset();
+    std::filesystem::remove_all(root);
+  }
+#endif
+
+  SECTION("stream") {
+    pfs::stream_file_handle h(
+        std::make_unique<std::stringstream>(std::string("abcdef"),
+                                            std::ios::in | std::ios::out),
+        std::ios::in | std::ios::out);
+    pfs::error_code ec;
+    h.preallocate(0, 10, ec);
+    REQUIRE(ec == std::errc::operation_not_supported);
+    h.punch_hole(2, 2);
+    char buf[6];
+    REQUIRE(h.pread(buf, 6, 0) == 6);
+    REQUIRE(std::string(buf, 6) == std::string("ab\0\0ef", 6));
+    h.punch_hole(5, std::numeric_limits<std::uint64_t>::max());
+    REQUIRE(h.pread(buf, 6, 0) == 6);
+    REQUIRE(std::string(buf, 6) == std::string("ab\0\0e\0", 6));
+    h.advise(0, 0, pfs::access_advice::willneed);
+    REQUIRE(h.allocation().allocated == 6);
+  }
+}
@@ -0,0 +1,113 @@
+#include <catch2/catch_test_macros.hpp>
+#include <pfs/fake_filesystem.hpp>
+#include <pfs_gen/tree_generator.hpp>
+#include <pfs_gen/workload.hpp>
+#include <string>
+#include <vector>
+
+namespace {
+
+/**
+ * @brief Lists every path below a directory with its size, in iteration
+ * order.
+ */
+std::vector<std::string> listing(pfs::filesystem &fs, const pfs::path &p) {
+  std::vector<std::string> ret;
+  for (auto it = fs.recursive_directory_iterator(p); !it->at_end();
+       it->increment()) {
+    auto entry = it->path().string();
+    if (it->status().type() == pfs::file_type::regular) {
+      entry += " " + std::to_string(fs.file_size(it->path()));
+    }
+    ret.push_back(entry);
+  }
+  return ret;
+}
+
+} // namespace
+
+TEST_CASE("distribution") {
+  pfs_gen::engine rng(1);
+  auto u = pfs_gen::distribution::uniform(3, 5);
+  auto g = pfs_gen::distribution::geometric(4, 10);
+  auto l = pfs_gen::distribution::lognormal(100, 1.0, 1000);
+  for (int i = 0; i < 1000; ++i) {
+    auto x = u(rng);
+    REQUIRE(x >= 3);
+    REQUIRE(x <= 5);
+    REQUIRE(g(rng) <= 10);
+    REQUIRE(l(rng) <= 1000);
+  }
+  REQUIRE(pfs_gen::distribution::constant(7)(rng) == 7);
+}
+
+TEST_CASE("generate_tree") {
+  pfs_gen::tree_spec spec;
+  spec.depth = 2;
+  spec.dir_fanout = pfs_gen::distribution::constant(3);
+  spec.file_fanout = pfs_gen::distribution::constant(2);
+  spec.name_length = pfs_gen::distribution::uniform(1, 2);
+  spec.file_size = pfs_gen::distribution::uniform(0, 100);
+  spec.seed = 42;
+
+  pfs::fake_filesystem fs1, fs2;
+  auto root = fs1.default_root() / "gen";
+  auto stats = pfs_gen::generate_tree(fs1, root, spec);
+  REQUIRE(stats.directories == 3 + 9);
+  REQUIRE(stats.files == 2 * (1 + 3 + 9));
+  REQUIRE(listing(fs1, root).size() == stats.directories + stats.files);
+
+  SECTION("same seed, same tree") {
+    pfs_gen::generate_tree(fs2, root, spec);
+    REQUIRE(listing(fs1, root) == listing(fs2, root));
+  }
+
+  SECTION("different seed, different tree") {
+    spec.seed = 43;
+    pfs_gen::generate_tree(fs2, root, spec);
+    REQUIRE(listing(fs1, root) != listing(fs2, root));
+  }
+}
+
+TEST_CASE("run_workload") {
+  pfs::fake_filesystem fs;
+  auto root = fs.default_root() / "work";
+  pfs_gen::workload_spec spec;
+  spec.operations = 2000;
+  spec.initial_files = 10;
+  spec.file_size = pfs_gen::distribution::uniform(0, 64);
+
+  SECTION("single thread") {
+    auto result = pfs_gen::run_workload(fs, root, spec);
+    REQUIRE(result.operations() == spec.operations);
+    for (auto errors : result.errors) {
+      REQUIRE(errors == 0);
+    }
+    REQUIRE(result.throughput() > 0);
+    REQUIRE(result.percentile(50) <= result.percentile(99));
+    REQUIRE(!result.latencies[0].empty());
+  }
+
+  SECTION("serialized threads") {
+    spec.threads = 4;
+    spec.serialize = true;
+    auto result = pfs_gen::run_workload(fs, root, spec);
+    REQUIRE(result.operations() == spec.operations * spec.threads);
+    for (auto errors : result.errors) {
+      REQUIRE(errors == 0);
+    }
+    REQUIRE(fs.is_directory(root / "t3"));
+  }
+
+  SECTION("forced creates") {
+    // With no files left to unlink, creates are recorded as such.
+    spec.initial_files = 0;
+    spec.weights = {0, 0, 0, 0, 1};
+    auto result = pfs_gen::run_workload(fs, root, spec);
+    auto create = static_cast<std::size_t>(pfs_gen::operation::create);
+    auto unlink = static_cast<std::size_t>(pfs_gen::operation::unlink);
+    REQUIRE(result.latencies[create].size() == spec.operations / 2);
+    REQUIRE(result.latencies[unlink].size() == spec.operations / 2);
+    REQUIRE(result.errors[unlink] == 0);
+  }
+}
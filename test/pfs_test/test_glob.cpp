@@ -0,0 +1,87 @@
+#include <catch2/catch_test_macros.hpp>
+#include <pfs/fake_filesystem.hpp>
+#include <pfs/glob.hpp>
+#include <stdexcept>
+#include <vector>
+
+TEST_CASE("glob") {
+  using paths = std::vector<pfs::path>;
+
+  SECTION("patterns") {
+    REQUIRE(pfs::glob_pattern("*.cpp").match("main.cpp"));
+    REQUIRE(pfs::glob_pattern("*.cpp").match(".cpp"));
+    REQUIRE(!pfs::glob_pattern("*.cpp").match("main.hpp"));
+    REQUIRE(!pfs::glob_pattern("*.cpp").match("src/main.cpp"));
+    REQUIRE(pfs::glob_pattern("**/*.cpp").match("main.cpp"));
+    REQUIRE(pfs::glob_pattern("**/*.cpp").match("a/b/c/main.cpp"));
+    REQUIRE(pfs::glob_pattern("a/**/b").match("a/b"));
+    REQUIRE(pfs::glob_pattern("a/**/b").match("a/x/y/b"));
+    REQUIRE(!pfs::glob_pattern("a/**/b").match("a/x/y/bc"));
+    REQUIRE(pfs::glob_pattern("a/**").match("a/x/y"));
+    REQUIRE(pfs::glob_pattern("te?t_*_*.hpp").match("test_a_b.hpp"));
+    REQUIRE(!pfs::glob_pattern("te?t_*_*.hpp").match("test_ab.hpp"));
+    REQUIRE(pfs::glob_pattern("*a*a*a*b").match("aaaaaaaaaaab"));
+    REQUIRE(!pfs::glob_pattern("*a*a*a*b").match("aaaaaaaaaaaa"));
+    REQUIRE(pfs::glob_pattern("[a-c]x").match("bx"));
+    REQUIRE(!pfs::glob_pattern("[a-c]x").match("dx"));
+    REQUIRE(pfs::glob_pattern("[!a-c]x").match("dx"));
+    REQUIRE(pfs::glob_pattern("[]]").match("]"));
+    REQUIRE(pfs::glob_pattern("\\*").match("*"));
+    REQUIRE(!pfs::glob_pattern("\\*").match("a"));
+    REQUIRE(pfs::glob_pattern("./a//b").match("a/b"));
+    REQUIRE_THROWS_AS(pfs::glob_pattern("[ab"), std::invalid_argument);
+    REQUIRE_THROWS_AS(pfs::glob_pattern("/abs"), std::invalid_argument);
+    REQUIRE_THROWS_AS(pfs::glob_pattern(""), std::invalid_argument);
+  }
+
+  pfs::fake_filesystem fs;
+  fs.create_directories("/repo/src/core/include");
+  fs.create_directories("/repo/src/net");
+  fs.create_directories("/repo/build/src/core");
+  for (auto p : {"/repo/main.cpp", "/repo/src/core/core.cpp",
+                 "/repo/src/core/test_core.hpp", "/repo/src/net/net.cpp",
+                 "/repo/src/net/test_net.hpp", "/repo/src/net/test_net.cpp",
+                 "/repo/src/core/include/test_api.hpp",
+                 "/repo/build/src/core/core.cpp"}) {
+    fs.open_file(p, std::ios::out);
+  }
+
+  SECTION("find") {
+    REQUIRE(pfs::find(fs, "/repo", pfs::glob_pattern("**/*.cpp")) ==
+            paths{"/repo/build/src/core/core.cpp", "/repo/main.cpp",
+                  "/repo/src/core/core.cpp", "/repo/src/net/net.cpp",
+                  "/repo/src/net/test_net.cpp"});
+    REQUIRE(pfs::find(fs, "/repo", pfs::glob_pattern("src/*/test_*.hpp")) ==
+            paths{"/repo/src/core/test_core.hpp",
+                  "/repo/src/net/test_net.hpp"});
+    REQUIRE(pfs::find(fs, "/repo", pfs::glob_pattern("src/**/test_*")) ==
+            paths{"/repo/src/core/include/test_api.hpp",
+                  "/repo/src/core/test_core.hpp", "/repo/src/net/test_net.cpp",
+                  "/repo/src/net/test_net.hpp"});
+    REQUIRE(pfs::find(fs, "/repo", pfs::glob_pattern("*/core")) ==
+            paths{"/repo/src/core"});
+    REQUIRE(pfs::find(fs, "/repo", pfs::glob_pattern("**/core/*.cpp")) ==
+            paths{"/repo/build/src/core/core.cpp", "/repo/src/core/core.cpp"});
+    REQUIRE(pfs::find(fs, "/repo", pfs::glob_pattern("src/net/net.cpp")) ==
+            paths{"/repo/src/net/net.cpp"});
+    REQUIRE(pfs::find(fs, "/repo", pfs::glob_pattern("src/missing/*")) ==
+            paths{});
+    REQUIRE(pfs::find(fs, "/repo/src", pfs::glob_pattern("**")).size() == 9);
+    REQUIRE_THROWS(pfs::find(fs, "/missing", pfs::glob_pattern("*")));
+    REQUIRE_THROWS(pfs::find(fs, "/repo/main.cpp", pfs::glob_pattern("*")));
+  }
+
+  SECTION("glob") {
+    REQUIRE(pfs::glob(fs, "/repo/src/*/test_*.hpp") ==
+            paths{"/repo/src/core/test_core.hpp",
+                  "/repo/src/net/test_net.hpp"});
+    fs.current_path("/repo");
+    REQUIRE(pfs::glob(fs, "*.cpp") == paths{"main.cpp"});
+    REQUIRE(pfs::glob(fs, "src/n*/*.cpp") ==
+            paths{"src/net/net.cpp", "src/net/test_net.cpp"});
+    REQUIRE(pfs::glob(fs, "src/net/") == paths{"src/net"});
+    REQUIRE(pfs::glob(fs, "missing/*.cpp").empty());
+    REQUIRE(pfs::glob(fs, "main.cpp/*").empty());
+    REQUIRE(pfs::glob(fs, "").empty());
+  }
+}
@@ -0,0 +1,183 @@
+#include <catch2/catch_test_macros.hpp>
+#include <catch2/generators/catch_generators.hpp>
+#include <pfs/fake_filesystem.hpp>
+#include <pfs/grep.hpp>
+#include <pfs/std_filesystem.hpp>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace {
+
+std::vector<std::string> lines(const pfs::grep_pattern &pattern,
+                               std::string_view text) {
+  std::vector<std::string> ret;
+  pattern.for_each_line(text, [&](std::size_t start, std::size_t end) {
+    ret.emplace_back(text.substr(start, end - start));
+  });
+  return ret;
+}
+
+void build(pfs::filesystem &fs, const pfs::path &root) {
+  fs.create_directories(root / "src" / "net");
+  *fs.open_file(root / "src" / "main.cpp", std::ios::out)
+      << "#include \"net.hpp\"\n"
+      << "int main() {\n"
+      << "  // TODO: parse arguments\n"
+      << "  return run();\n"
+      << "}\n";
+  *fs.open_file(root / "src" / "net" / "net.cpp", std::ios::out)
+      << "int run() { return 0; } // todo";
+  *fs.open_file(root / "README", std::ios::out) << "No TODOs here.\n";
+  fs.open_file(root / "empty", std::ios::out);
+}
+
+} // namespace
+
+TEST_CASE("grep_pattern") {
+  using strings = std::vector<std::string>;
+
+  SECTION("literals") {
+    pfs::grep_pattern p("needle");
+    REQUIRE(p.match("a needle in a haystack"));
+    REQUIRE(p.match("needle"));
+    REQUIRE(!p.match("needl"));
+    REQUIRE(!p.match("Needle"));
+    REQUIRE(pfs::grep_pattern("NeEdLe", true).match("a NEEDLE"));
+    REQUIRE(pfs::grep_pattern("x").match("x"));
+    REQUIRE(pfs::grep_pattern("a.c").match("abc"));
+    REQUIRE(!pfs::grep_pattern("a.c").match("ac"));
+    REQUIRE(pfs::grep_pattern("a\\.c").match("a.c"));
+    REQUIRE(!pfs::grep_pattern("a\\.c").match("abc"));
+    REQUIRE(pfs::grep_pattern("a$b").match("a$b"));
+    REQUIRE(pfs::grep_pattern("a\\$").match("a$"));
+    REQUIRE_THROWS_AS(pfs::grep_pattern(""), std::invalid_argument);
+    REQUIRE_THROWS_AS(pfs::grep_pattern("a\nb"), std::invalid_argument);
+  }
+
+  SECTION("anchors") {
+    REQUIRE(pfs::grep_pattern("^ab").match("abc"));
+    REQUIRE(!pfs::grep_pattern("^ab").match("cab"));
+    REQUIRE(pfs::grep_pattern("ab$").match("cab"));
+    REQUIRE(!pfs::grep_pattern("ab$").match("abc"));
+    REQUIRE(pfs::grep_pattern("^ab$").match("ab"));
+    REQUIRE(lines(pfs::grep_pattern("^a"), "ba\nab\na") == strings{"ab", "a"});
+    REQUIRE(lines(pfs::grep_pattern("a$"), "ba\nab\na\n") ==
+            strings{"ba", "a"});
+    REQUIRE(lines(pfs::grep_pattern("^$"), "a\n\nb\n") == strings{""});
+    REQUIRE(lines(pfs::grep_pattern("^..$"), "a\nbc\ndef") == strings{"bc"});
+  }
+
+  SECTION("lines") {
+    // A match is reported once per line, and never spans a line break.
+    REQUIRE(lines(pfs::grep_pattern("ab"), "abab\nxx\nab") ==
+            strings{"abab", "ab"});
+    REQUIRE(lines(pfs::grep_pattern("a.b"), "a\nb\na-b").size() == 1);
+    REQUIRE(lines(pfs::grep_pattern("x"), "").empty());
+  }
+
+  SECTION("every alignment") {
+    // Put the needle at each offset of texts long enough to fill several
+    // SIMD blocks, with near misses of its first and last bytes around it.
+    pfs::grep_pattern p("needle", GENERATE(false, true));
+    for (std::size_t size = 0; size < 100; ++size) {
+      for (std::size_t at = 0; at + 6 <= size; ++at) {
+        std::string text(size, 'e');
+        for (std::size_t i = 0; i < size; i += 7) {
+          text[i] = 'n';
+        }
+        REQUIRE(!p.match(text));
+        text.replace(at, 6, "needle");
+        REQUIRE(p.match(text));
+      }
+    }
+  }
+}
+
+TEST_CASE("grep") {
+  using paths = std::vector<pfs::path>;
+  auto files = [](const std::vector<pfs::grep_match> &matches) {
+    paths ret;
+    for (const auto &m : matches) {
+      ret.push_back(m.file);
+    }
+    return ret;
+  };
+  pfs::grep_options options;
+  options.threads = GENERATE(1u, 4u);
+
+  SECTION("fake") {
+    pfs::fake_filesystem fs;
+    build(fs, "/tree");
+    auto matches = pfs::grep(fs, "/tree", pfs::grep_pattern("TODO"), options);
+    REQUIRE(files(matches) == paths{"/tree/README", "/tree/src/main.cpp"});
+    REQUIRE(matches[1].line == 3);
+    REQUIRE(matches[1].text == "  // TODO: parse arguments");
+
+    matches = pfs::grep(fs, "/tree", pfs::grep_pattern("todo", true), options);
+    REQUIRE(files(matches) == paths{"/tree/README", "/tree/src/main.cpp",
+                                    "/tree/src/net/net.cpp"});
+    REQUIRE(matches[2].line == 1);
+
+    matches = pfs::grep(fs, "/tree/src/main.cpp", pfs::grep_pattern("^.$"),
+                        options);
+    REQUIRE(matches.size() == 1);
+    REQUIRE(matches[0].line == 5);
+    REQUIRE(matches[0].text == "}");
+
+    REQUIRE(pfs::grep(fs, "/tree", pfs::grep_pattern("missing")).empty());
+    REQUIRE_THROWS(pfs::grep(fs, "/missing", pfs::grep_pattern("x")));
+  }
+
+  SECTION("std") {
+    pfs::std_filesystem fs;
+    std::random_device rd;
+    auto root = std::filesystem::temp_directory_path() /
+                ("pfs_test_grep_" + std::to_string(rd()));
+    build(fs, root);
+    auto matches =
+        pfs::grep(fs, root, pfs::grep_pattern("todo", true), options);
+    REQUIRE(files(matches) == paths{root / "README", root / "src" / "main.cpp",
+                                    root / "src" / "net" / "net.cpp"});
+    REQUIRE(matches[1].line == 3);
+    std::filesystem::remove_all(root);
+    std::error_code ec;
+    pfs::grep(fs, root, pfs::grep_pattern("x"), options, ec);
+    REQUIRE(ec);
+  }
+}
+
+TEST_CASE("view_file") {
+  pfs::fake_filesystem fake;
+  *fake.open_file("/file", std::ios::out) << "contents";
+  fake.create_directory("/dir");
+  fake.open_file("/empty", std::ios::out);
+
+  auto view = fake.view_file("/file");
+  REQUIRE(view.data() == "contents");
+  fake.remove("/file");
+  // The view keeps the removed node alive.
+  REQUIRE(view.data() == "contents");
+  REQUIRE(fake.view_file("/empty").empty());
+  REQUIRE_THROWS(fake.view_file("/dir"));
+  REQUIRE_THROWS(fake.view_file("/missing"));
+
+  pfs::std_filesystem real;
+  std::random_device rd;
+  auto root = std::filesystem::temp_directory_path() /
+              ("pfs_test_view_" + std::to_string(rd()));
+  real.create_directory(root);
+  *real.open_file(root / "file", std::ios::out) << "contents";
+  real.open_file(root / "empty", std::ios::out);
+  view = real.view_file(root / "file");
+  REQUIRE(view.data() == "contents");
+  REQUIRE(real.view_file(root / "empty").empty());
+  std::error_code ec;
+  real.view_file(root, ec);
+  REQUIRE(ec == std::errc::is_a_directory);
+  std::filesystem::remove_all(root);
+  // The mapping outlives the file.
+  REQUIRE(view.data() == "contents");
+  REQUIRE_THROWS(real.view_file(root / "file"));
+}
@@ -0,0 +1,130 @@
+#include <catch2/catch_test_macros.hpp>
+#include <catch2/generators/catch_generators.hpp>
+#include <chrono>
+#include <pfs/fake_filesystem.hpp>
+#include <pfs/hash.hpp>
+#include <pfs/std_filesystem.hpp>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+void build(pfs::filesystem &fs, const pfs::path &root) {
+  std::string big;
+  for (int i = 0; i < 10000; ++i) {
+    big += std::to_string(i);
+  }
+  fs.create_directories(root / "a" / "b");
+  fs.create_directories(root / "c");
+  *fs.open_file(root / "a" / "one", std::ios::out) << "same";
+  *fs.open_file(root / "a" / "b" / "two", std::ios::out) << "same";
+  *fs.open_file(root / "c" / "three", std::ios::out) << "same";
+  *fs.open_file(root / "c" / "other", std::ios::out) << "diff";
+  *fs.open_file(root / "c" / "unique", std::ios::out) << "unique";
+  *fs.open_file(root / "big1", std::ios::out) << big;
+  *fs.open_file(root / "big2", std::ios::out) << big;
+  big.back() = 'x';
+  *fs.open_file(root / "big3", std::ios::out) << big;
+  fs.open_file(root / "a" / "empty", std::ios::out);
+}
+
+} // namespace
+
+TEST_CASE("xxh64") {
+  REQUIRE(pfs::detail::xxh64("") == 0xef46db3751d8e999ULL);
+  REQUIRE(pfs::detail::xxh64("a") == 0xd24ec4f1a98c6e5bULL);
+  REQUIRE(pfs::detail::xxh64("abc") == 0x44bc2cf5ad770999ULL);
+  REQUIRE(pfs::detail::xxh64("Nobody inspects the spammish repetition") ==
+          0xfbcea83c8a378bf1ULL);
+  std::string bytes;
+  for (int i = 0; i < 3 * 256; ++i) {
+    bytes += static_cast<char>(i);
+  }
+  REQUIRE(pfs::detail::xxh64(bytes) == 0x8e03c838c596036fULL);
+}
+
+TEST_CASE("content_hasher") {
+  using groups = std::vector<std::vector<pfs::path>>;
+  pfs::hash_options options;
+  options.threads = GENERATE(1u, 4u);
+  options.chunk_size = 1000;
+
+  SECTION("fake") {
+    pfs::fake_filesystem fs;
+    build(fs, "/tree");
+    pfs::content_hasher hasher(options);
+    auto hashes = hasher.hash_tree(fs, "/tree");
+    REQUIRE(hashes.size() == 9);
+    REQUIRE(hashes[0].file == "/tree/a/b/two");
+    REQUIRE(hashes[0].size == 4);
+    REQUIRE(hashes[0].hash == pfs::detail::xxh64("same"));
+    // Chunked files hash the same way whatever the number of threads.
+    REQUIRE(hashes[3].file == "/tree/big1");
+    REQUIRE(hashes[3].hash ==
+            pfs::detail::chunked_hash(fs.view_file("/tree/big1").data(),
+                                      options.chunk_size));
+    REQUIRE(hashes[3].hash == hashes[4].hash);
+    REQUIRE(hashes[3].hash != hashes[5].hash);
+    // Fakes are not cached.
+    hasher.hash_tree(fs, "/tree");
+    REQUIRE(hasher.stats().files_hashed == 18);
+    REQUIRE(hasher.stats().cache_hits == 0);
+
+    REQUIRE(pfs::find_duplicates(fs, "/tree", hasher) ==
+            groups{{"/tree/a/b/two", "/tree/a/one", "/tree/c/three"},
+                   {"/tree/big1", "/tree/big2"}});
+    // Only files that share their size were read: not empty or unique.
+    REQUIRE(hasher.stats().files_hashed == 18 + 7);
+
+    REQUIRE_THROWS(hasher.hash_tree(fs, "/missing"));
+    REQUIRE_THROWS(hasher.hash_files(fs, {"/tree/a"}));
+    REQUIRE_THROWS(pfs::find_duplicates(fs, "/missing", hasher));
+  }
+
+  SECTION("std") {
+    pfs::std_filesystem fs;
+    std::random_device rd;
+    auto root = std::filesystem::temp_directory_path() /
+                ("pfs_test_hash_" + std::to_string(rd()));
+    build(fs, root);
+    // Recently modified files are not cached, so age them.
+    auto old = std::filesystem::file_time_type::clock::now() -
+               std::chrono::hours(1);
+    for (auto &e : std::filesystem::recursive_directory_iterator(root)) {
+      std::filesystem::last_write_time(e.path(), old);
+    }
+
+    pfs::content_hasher hasher(options);
+    pfs::fake_filesystem fake;
+    build(fake, "/tree");
+    auto hashes = hasher.hash_tree(fs, root);
+    auto expected = pfs::content_hasher(options).hash_tree(fake, "/tree");
+    REQUIRE(hashes.size() == expected.size());
+    for (std::size_t i = 0; i < hashes.size(); ++i) {
+      REQUIRE(hashes[i].hash == expected[i].hash);
+    }
+    REQUIRE(hasher.cache_size() == 9);
+
+    // Unchanged files are not read again.
+    hasher.hash_tree(fs, root);
+    REQUIRE(hasher.stats().files_hashed == 9);
+    REQUIRE(hasher.stats().cache_hits == 9);
+
+    // A rewrite with the same size is noticed by its modification time.
+    *fs.open_file(root / "c" / "other", std::ios::out) << "same";
+    std::filesystem::last_write_time(root / "c" / "other",
+                                     old + std::chrono::seconds(1));
+    REQUIRE(pfs::find_duplicates(fs, root, hasher) ==
+            groups{{root / "a" / "b" / "two", root / "a" / "one",
+                    root / "c" / "other", root / "c" / "three"},
+                   {root / "big1", root / "big2"}});
+    REQUIRE(hasher.stats().files_hashed == 10);
+
+    options.cache = false;
+    pfs::content_hasher uncached(options);
+    uncached.hash_tree(fs, root);
+    REQUIRE(uncached.cache_size() == 0);
+    std::filesystem::remove_all(root);
+  }
+}
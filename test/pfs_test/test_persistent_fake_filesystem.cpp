@@ -0,0 +1,248 @@
+#include <algorithm>
+#include <catch2/catch_test_macros.hpp>
+#include <filesystem>
+#include <fstream>
+#include <pfs/persistent_fake_filesystem.hpp>
+#include <pfs/tar.hpp>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+/**
+ * @brief Gets the whole tree as an archive, which is equal for equal trees.
+ */
+std::string dump(pfs::filesystem &fs) {
+  std::stringstream out;
+  pfs::write_tar(fs, "/", out);
+  return out.str();
+}
+
+void build(pfs::filesystem &fs) {
+  fs.create_directories("/a/b/c");
+  fs.create_directory("/d");
+  *fs.open_file("/a/one", std::ios::out) << "one";
+  *fs.open_file("/a/b/two", std::ios::out) << "two";
+  *fs.open_file("/a/b/two", std::ios::app) << ", three";
+  fs.open_file("/d/empty", std::ios::out);
+  fs.current_path("/a");
+  fs.rename("b", "/d/moved");
+  fs.remove("one");
+  fs.create_directories("x/y");
+  fs.remove_all("x");
+  fs.current_path("/");
+}
+
+std::vector<std::string> list(const std::filesystem::path &dir) {
+  std::vector<std::string> names;
+  for (auto &e : std::filesystem::directory_iterator(dir)) {
+    names.push_back(e.path().filename().string());
+  }
+  std::sort(names.begin(), names.end());
+  return names;
+}
+
+} // namespace
+
+TEST_CASE("persistent_fake_filesystem") {
+  std::random_device rd;
+  auto dir = std::filesystem::temp_directory_path() /
+             ("pfs_test_wal_" + std::to_string(rd()));
+  pfs::persistence_options options;
+  options.sync = false;
+
+  SECTION("recovers from the log") {
+    std::string expected;
+    {
+      pfs::persistent_fake_filesystem fs(dir, options);
+      build(fs);
+      REQUIRE(fs.is_directory("/d/moved/c"));
+      REQUIRE(!fs.exists("/a/one"));
+      expected = dump(fs);
+      REQUIRE(fs.stats().records == fs.stats().commits);
+      REQUIRE_THROWS(pfs::persistent_fake_filesystem(dir, options));
+    }
+    pfs::persistent_fake_filesystem fs(dir, options);
+    REQUIRE(dump(fs) == expected);
+    REQUIRE(fs.stats().replayed == 12);
+    std::string content;
+    std::getline(*fs.open_file("/d/moved/two", std::ios::in), content);
+    REQUIRE(content == "two, three");
+  }
+
+  SECTION("recovers from a checkpoint and its log") {
+    std::string expected;
+    {
+      pfs::persistent_fake_filesystem fs(dir, options);
+      build(fs);
+      fs.checkpoint();
+      REQUIRE(fs.stats().log_bytes == 0);
+      *fs.open_file("/d/empty", std::ios::out) << "not empty";
+      expected = dump(fs);
+    }
+    REQUIRE(list(dir) ==
+            std::vector<std::string>{"checkpoint-1.tar", "log-1"});
+    pfs::persistent_fake_filesystem fs(dir, options);
+    REQUIRE(dump(fs) == expected);
+    REQUIRE(fs.stats().replayed == 1);
+  }
+
+  SECTION("checkpoints when the log grows") {
+    options.checkpoint_bytes = 4096;
+    std::string expected;
+    {
+      pfs::persistent_fake_filesystem fs(dir, options);
+      for (int i = 0; i < 100; ++i) {
+        *fs.open_file("/f" + std::to_string(i % 10), std::ios::out)
+            << std::string(100, static_cast<char>('a' + i % 26));
+      }
+      REQUIRE(fs.stats().checkpoints > 0);
+      REQUIRE(fs.stats().log_bytes < 4096);
+      expected = dump(fs);
+    }
+    pfs::persistent_fake_filesystem fs(dir, options);
+    REQUIRE(dump(fs) == expected);
+  }
+
+  SECTION("discards a torn record") {
+    std::string before;
+    {
+      pfs::persistent_fake_filesystem fs(dir, options);
+      build(fs);
+      before = dump(fs);
+      fs.create_directory("/torn");
+    }
+    auto log = dir / "log-0";
+    auto size = std::filesystem::file_size(log);
+    std::filesystem::resize_file(log, size - 3);
+    {
+      pfs::persistent_fake_filesystem fs(dir, options);
+      REQUIRE(dump(fs) == before);
+      REQUIRE(fs.stats().replayed == 12);
+      // The torn record was cut off, so new records follow the good ones.
+      fs.create_directory("/after");
+    }
+    {
+      pfs::persistent_fake_filesystem fs(dir, options);
+      REQUIRE(fs.is_directory("/after"));
+      REQUIRE(!fs.exists("/torn"));
+      fs.create_directory("/corrupt");
+    }
+
+    // A record with a bad checksum ends the log too.
+    {
+      std::fstream file(log, std::ios::in | std::ios::out | std::ios::binary);
+      file.seekp(-1, std::ios::end);
+      file.put('?');
+    }
+    pfs::persistent_fake_filesystem fs(dir, options);
+    REQUIRE(fs.is_directory("/after"));
+    REQUIRE(!fs.exists("/corrupt"));
+  }
+
+  SECTION("streams") {
+    {
+      pfs::persistent_fake_filesystem fs(dir, options);
+      auto out = fs.open_file("/file", std::ios::out);
+      *out << "flushed" << std::flush;
+      REQUIRE(fs.stats().records == 2);
+      *out << " and closed";
+      out.reset();
+      REQUIRE(fs.stats().records == 3);
+
+      // Unchanged contents are not logged again.
+      fs.open_file("/file", std::ios::in | std::ios::out);
+      REQUIRE(fs.stats().records == 3);
+
+      // Writes to a file removed since it was opened are dropped.
+      auto gone = fs.open_file("/gone", std::ios::out);
+      fs.remove("/gone");
+      *gone << "dropped";
+      gone.reset();
+      REQUIRE(!fs.exists("/gone"));
+
+      REQUIRE(fs.open_file("/missing/file", std::ios::out)->fail());
+    }
+    pfs::persistent_fake_filesystem fs(dir, options);
+    REQUIRE(fs.file_size("/file") == 18);
+    REQUIRE(!fs.exists("/gone"));
+  }
+
+  SECTION("write_all") {
+    {
+      pfs::persistent_fake_filesystem fs(dir, options);
+      fs.create_directory("/d");
+      *fs.open_file("/d/old", std::ios::out) << "old";
+      auto records = fs.stats().records;
+      auto stats = fs.write_all({{"/d/old", "replaced"}, {"/d/new", "new"}},
+                                pfs::atomic_write_options{});
+      REQUIRE(stats.files == 2);
+      REQUIRE(stats.commits == 1);
+      // One record per file, holding its whole contents.
+      REQUIRE(fs.stats().records == records + 2);
+      pfs::error_code ec;
+      fs.write_all({{"/d/third", "3"}, {"/missing/f", "x"}},
+                   pfs::atomic_write_options{}, ec);
+      REQUIRE(ec == std::errc::no_such_file_or_directory);
+    }
+    pfs::persistent_fake_filesystem fs(dir, options);
+    std::string content;
+    std::getline(*fs.open_file("/d/old", std::ios::in), content);
+    REQUIRE(content == "replaced");
+    REQUIRE(fs.file_size("/d/new") == 3);
+    REQUIRE(fs.file_size("/d/third") == 1);
+  }
+
+  SECTION("views") {
+    pfs::persistent_fake_filesystem fs(dir, options);
+    *fs.open_file("/file", std::ios::out) << "contents";
+    auto view = fs.view_file("/file");
+    fs.remove("/file");
+    // The view keeps the removed node alive.
+    REQUIRE(view.data() == "contents");
+    REQUIRE_THROWS(fs.view_file("/missing"));
+    REQUIRE(fs.allows_concurrent_reads());
+    REQUIRE(fs.allows_concurrent_writes());
+  }
+
+  SECTION("group commit") {
+    options.sync = true;
+    int rounds = 0;
+    {
+      pfs::persistent_fake_filesystem fs(dir, options);
+      // Threads that modify while another one syncs share its next commit.
+      // Whether they get to depends on the scheduler, so retry a few times.
+      do {
+        std::vector<std::thread> threads;
+        for (int t = 0; t < 4; ++t) {
+          threads.emplace_back([&fs, t, rounds] {
+            auto d = "/r" + std::to_string(rounds) + "t" + std::to_string(t);
+            fs.create_directory(d);
+            for (int i = 0; i < 50; ++i) {
+              *fs.open_file(d + "/" + std::to_string(i), std::ios::out) << i;
+            }
+          });
+        }
+        for (auto &t : threads) {
+          t.join();
+        }
+        ++rounds;
+      } while (fs.stats().commits == fs.stats().records && rounds < 20);
+      REQUIRE(fs.stats().records == rounds * 4 * 101u);
+      REQUIRE(fs.stats().commits < fs.stats().records);
+    }
+    pfs::persistent_fake_filesystem fs(dir, options);
+    std::size_t files = 0;
+    for (auto it = fs.recursive_directory_iterator("/"); !it->at_end();
+         it->increment()) {
+      files += it->status().type() == pfs::file_type::regular;
+    }
+    REQUIRE(files == rounds * 200u);
+    REQUIRE(fs.file_size("/r0t3/49") == 2);
+  }
+
+  std::filesystem::remove_all(dir);
+}
@@ -0,0 +1,238 @@
+#include <catch2/catch_test_macros.hpp>
+#include <pfs/diff.hpp>
+#include <pfs/fake_filesystem.hpp>
+#include <pfs/remote_filesystem.hpp>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace {
+
+/**
+ * @brief Serves a fake filesystem to a client over a socket pair.
+ */
+struct served_fake_filesystem {
+  pfs::fake_filesystem served;
+  std::unique_ptr<pfs::remote_filesystem> client;
+  std::thread server;
+
+  served_fake_filesystem() {
+    int fds[2];
+    REQUIRE(::socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) == 0);
+    client = std::make_unique<pfs::remote_filesystem>(
+        std::make_unique<pfs::rpc::socket_transport>(fds[0]));
+    server = std::thread([this, fd = fds[1]] {
+      pfs::rpc::socket_transport t(fd);
+      pfs::rpc::serve(served, t);
+    });
+  }
+
+  ~served_fake_filesystem() {
+    client.reset();
+    server.join();
+  }
+};
+
+} // namespace
+
+TEST_CASE("remote_filesystem") {
+  served_fake_filesystem server;
+  auto &fs = *server.client;
+
+  SECTION("create directory") {
+    REQUIRE(fs.create_directory("/hello"));
+    REQUIRE(!fs.create_directory("/hello"));
+    REQUIRE(server.served.is_directory("/hello"));
+    REQUIRE(fs.create_directories("hello/a/b/c"));
+    REQUIRE(fs.is_directory("/hello/a/b/c"));
+    REQUIRE(!fs.exists("/hello/x"));
+    REQUIRE_THROWS(fs.create_directory("does/not/exist"));
+  }
+
+  SECTION("current_path") {
+    REQUIRE(fs.current_path() == "/");
+    REQUIRE(fs.create_directories("a/b"));
+    fs.current_path("a/../a/b");
+    REQUIRE(fs.current_path() == "/a/b");
+    REQUIRE(fs.absolute("c") == "/a/b/c");
+    REQUIRE(fs.is_directory(".."));
+    REQUIRE_THROWS(fs.current_path("missing"));
+    REQUIRE(server.served.current_path() == "/");
+  }
+
+  SECTION("files") {
+    REQUIRE(fs.create_directory("/d"));
+    *fs.open_file("/d/file", std::ios::out) << "hello";
+    REQUIRE(fs.file_size("/d/file") == 5);
+    *fs.open_file("/d/file", std::ios::app) << ", world";
+    std::string content;
+    std::getline(*fs.open_file("/d/file", std::ios::in), content);
+    REQUIRE(content == "hello, world");
+    REQUIRE(fs.open_file("/missing/file", std::ios::out)->fail());
+    REQUIRE(fs.open_file("/d", std::ios::in)->fail());
+    REQUIRE(fs.status("/d/file").type() == pfs::file_type::regular);
+  }
+
+  SECTION("write_all") {
+    REQUIRE(fs.create_directory("/d"));
+    fs.current_path("/d");
+    auto stats = fs.write_all({{"one", "1"}, {"/d/two", "22"}},
+                              pfs::atomic_write_options{});
+    REQUIRE(stats.files == 2);
+    REQUIRE(server.served.file_size("/d/one") == 1);
+    REQUIRE(server.served.file_size("/d/two") == 2);
+    std::error_code ec;
+    fs.write_all({{"/missing/f", "x"}}, pfs::atomic_write_options{}, ec);
+    REQUIRE(ec == std::errc::no_such_file_or_directory);
+  }
+
+  SECTION("handles and views") {
+    // Neither is native, so both go through open_file.
+    REQUIRE(fs.create_directory("/d"));
+    auto h = fs.open_handle("/d/f", std::ios::in | std::ios::out |
+                                        std::ios::trunc);
+    h->pwrite("hello", 5, 0);
+    h->sync();
+    REQUIRE(fs.view_file("/d/f").data() == "hello");
+    REQUIRE(server.served.file_size("/d/f") == 5);
+    std::error_code ec;
+    REQUIRE(fs.open_handle("/d", std::ios::in, ec) == nullptr);
+    REQUIRE(ec == std::errc::is_a_directory);
+    REQUIRE_THROWS(fs.view_file("/d/missing"));
+    REQUIRE(!fs.allows_concurrent_reads());
+    REQUIRE(!fs.allows_concurrent_writes());
+  }
+
+  SECTION("remove and rename") {
+    REQUIRE(fs.create_directories("/a/b/c"));
+    REQUIRE_NOTHROW(fs.rename("/a/b", "/b"));
+    REQUIRE(fs.is_directory("/b/c"));
+    REQUIRE_THROWS(fs.remove("/b"));
+    REQUIRE(fs.remove_all("/b") == 2);
+    REQUIRE(!fs.exists("/b"));
+    std::error_code ec;
+    fs.rename("/missing", "/other", ec);
+    REQUIRE(ec == std::errc::no_such_file_or_directory);
+  }
+
+  SECTION("iterators") {
+    REQUIRE(fs.create_directories("a/b/c"));
+    REQUIRE(fs.create_directories("x/y/z"));
+    REQUIRE(fs.create_directories("a/b/i"));
+    std::set<pfs::path> expected{"./a", "./x"};
+    std::set<pfs::path> actual;
+    for (auto it = fs.directory_iterator("."); !it->at_end(); it->increment()) {
+      actual.insert(it->path());
+    }
+    REQUIRE(actual == expected);
+
+    expected = {"./a", "./a/b", "./a/b/c", "./a/b/i", "./x", "./x/y"};
+    actual.clear();
+    for (auto it = fs.recursive_directory_iterator("."); !it->at_end();
+         it->increment()) {
+      actual.insert(it->path());
+      if (it->path() == "./x/y") {
+        it->disable_recursion_pending();
+      }
+    }
+    REQUIRE(actual == expected);
+    REQUIRE_THROWS(fs.directory_iterator("/missing"));
+  }
+
+  SECTION("batch") {
+    pfs::remote_filesystem::batch b(fs);
+    auto made = b.create_directories("/p/q");
+    std::vector<pfs::remote_filesystem::pending<bool>> files;
+    for (int i = 0; i < 100; ++i) {
+      files.push_back(b.create_directory("/p/q/" + std::to_string(i)));
+    }
+    auto missing = b.status("/p/missing");
+    auto size = b.file_size("/p/missing");
+    REQUIRE(b.size() == 103);
+    std::error_code ec;
+    size.get(ec);
+    REQUIRE(ec == std::errc::operation_in_progress);
+
+    b.submit();
+    REQUIRE(made.get());
+    for (auto &f : files) {
+      REQUIRE(f.get());
+    }
+    REQUIRE(missing.get().type() == pfs::file_type::not_found);
+    REQUIRE_THROWS(size.get());
+    REQUIRE(b.size() == 0);
+    REQUIRE(server.served.is_directory("/p/q/99"));
+
+    auto removed = b.remove_all("/p");
+    b.submit();
+    REQUIRE(removed.get() == 102);
+  }
+
+  SECTION("discarded batch") {
+    {
+      pfs::remote_filesystem::batch b(fs);
+      b.create_directory("/never");
+    }
+    REQUIRE(fs.create_directory("/sent"));
+    REQUIRE(!fs.exists("/never"));
+  }
+
+  SECTION("diff with the default number of threads") {
+    pfs::fake_filesystem local;
+    for (int i = 0; i < 20; ++i) {
+      auto dir = pfs::path("/tree") / std::to_string(i);
+      REQUIRE(fs.create_directories(dir));
+      REQUIRE(local.create_directories(dir));
+      *fs.open_file(dir / "file", std::ios::out) << i;
+      *local.open_file(dir / "file", std::ios::out) << i + 1;
+    }
+    auto changes = pfs::diff(fs, "/tree", local, "/tree");
+    REQUIRE(changes.changed.size() == 20);
+  }
+}
+
+TEST_CASE("rpc channel") {
+  int fds[2];
+  REQUIRE(::socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) == 0);
+  pfs::rpc::socket_transport in(fds[0]);
+  pfs::rpc::socket_transport out(fds[1]);
+  pfs::rpc::channel ch(in);
+  pfs::error_code ec;
+
+  // A frame announced longer than the limit is refused before it arrives.
+  REQUIRE(::write(fds[1], "\x02\0\0\0ok\xff\xff\xff\xff", 10) == 10);
+  REQUIRE(ch.read_frame(ec) == "ok");
+  REQUIRE(!ec);
+  REQUIRE(ch.read_frame(ec).empty());
+  REQUIRE(ec == std::errc::bad_message);
+}
+
+TEST_CASE("remote_filesystem over a Unix domain socket") {
+  pfs::path socket_path = "/tmp/pfs_test_" + std::to_string(::getpid());
+  ::unlink(socket_path.c_str());
+  std::error_code ec;
+  int listener = pfs::rpc::listen(socket_path, ec);
+  REQUIRE(listener >= 0);
+
+  pfs::fake_filesystem served;
+  std::thread server([&] {
+    int fd = ::accept(listener, nullptr, nullptr);
+    pfs::rpc::socket_transport t(fd);
+    pfs::rpc::serve(served, t);
+  });
+
+  {
+    pfs::remote_filesystem fs(socket_path);
+    REQUIRE(fs.create_directory("/over_socket"));
+    REQUIRE(served.is_directory("/over_socket"));
+  }
+  server.join();
+  ::close(listener);
+  ::unlink(socket_path.c_str());
+
+  REQUIRE_THROWS(pfs::remote_filesystem(socket_path));
+}
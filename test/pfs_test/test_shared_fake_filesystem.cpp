@@ -0,0 +1,175 @@
+#include <catch2/catch_test_macros.hpp>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <pfs/shared_fake_filesystem.hpp>
+#include <set>
+#include <string>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace {
+
+/**
+ * @brief Gives each test process its own shared memory object.
+ */
+std::string shm_name() { return "/pfs_test_" + std::to_string(::getpid()); }
+
+} // namespace
+
+TEST_CASE("shared_fake_filesystem") {
+  auto name = shm_name();
+  pfs::shared_fake_filesystem::destroy(name);
+  pfs::shared_fake_filesystem fs(name, 1 << 20);
+
+  SECTION("create directory") {
+    REQUIRE(fs.create_directory("/hello"));
+    REQUIRE(!fs.create_directory("/hello"));
+    REQUIRE(fs.is_directory("/hello"));
+    REQUIRE(fs.create_directories("hello/a/b/c"));
+    REQUIRE(!fs.create_directories("hello/a/b"));
+    REQUIRE(fs.is_directory("/hello/a/b/c/"));
+    REQUIRE_THROWS(fs.create_directory("does/not/exist"));
+  }
+
+  SECTION("current_path") {
+    REQUIRE(fs.current_path() == "/");
+    REQUIRE(fs.create_directories("a/b"));
+    fs.current_path("a/b");
+    REQUIRE(fs.current_path() == "/a/b");
+    REQUIRE(fs.absolute("../c") == "/a/c");
+    REQUIRE(fs.is_directory(".."));
+    REQUIRE_THROWS(fs.current_path("missing"));
+  }
+
+  SECTION("files") {
+    REQUIRE(fs.create_directory("/d"));
+    *fs.open_file("/d/file", std::ios::out) << "hello";
+    REQUIRE(fs.status("/d/file").type() == pfs::file_type::regular);
+    REQUIRE(fs.file_size("/d/file") == 5);
+    *fs.open_file("/d/file", std::ios::app) << ", world";
+    std::string content;
+    std::getline(*fs.open_file("/d/file", std::ios::in), content);
+    REQUIRE(content == "hello, world");
+    REQUIRE(fs.open_file("/missing/file", std::ios::out)->fail());
+    REQUIRE(fs.open_file("/d", std::ios::in)->fail());
+    REQUIRE_THROWS(fs.create_directories("/d/file/sub"));
+  }
+
+  SECTION("remove and rename") {
+    REQUIRE(fs.create_directories("/a/b/c"));
+    REQUIRE(fs.open_file("/a/f", std::ios::out)->good());
+    REQUIRE_NOTHROW(fs.rename("/a/b", "/b"));
+    REQUIRE(fs.is_directory("/b/c"));
+    REQUIRE(!fs.exists("/a/b"));
+    REQUIRE_THROWS(fs.rename("/b", "/b/c/d"));
+    // Existing files are never replaced.
+    std::error_code ec;
+    fs.rename("/b", "/a/f", ec);
+    REQUIRE(ec == std::errc::permission_denied);
+    REQUIRE(fs.is_directory("/b/c"));
+    REQUIRE_THROWS(fs.remove("/b"));
+    REQUIRE(fs.remove("/a/f"));
+    REQUIRE(fs.remove_all("/b") == 2);
+    REQUIRE(!fs.exists("/b"));
+    REQUIRE_THROWS(fs.remove_all("/"));
+  }
+
+  SECTION("iterators") {
+    REQUIRE(fs.create_directories("a/b/c"));
+    REQUIRE(fs.create_directories("x/y/z"));
+    REQUIRE(fs.create_directories("a/b/i"));
+    std::set<pfs::path> expected{"a", "x"};
+    std::set<pfs::path> actual;
+    for (auto it = fs.directory_iterator("."); !it->at_end(); it->increment()) {
+      actual.insert(it->path().filename());
+    }
+    REQUIRE(actual == expected);
+
+    expected = {"./a", "./a/b", "./a/b/c", "./a/b/i", "./x", "./x/y"};
+    actual.clear();
+    for (auto it = fs.recursive_directory_iterator("."); !it->at_end();
+         it->increment()) {
+      actual.insert(it->path());
+      if (it->path() == "./x/y") {
+        it->disable_recursion_pending();
+      }
+    }
+    REQUIRE(actual == expected);
+  }
+
+  SECTION("instances share the tree") {
+    pfs::shared_fake_filesystem other(name);
+    REQUIRE(fs.create_directory("/shared"));
+    REQUIRE(other.is_directory("/shared"));
+    *other.open_file("/shared/file", std::ios::out) << "from other";
+    REQUIRE(fs.file_size("/shared/file") == 10);
+    other.current_path("/shared");
+    REQUIRE(fs.current_path() == "/");
+  }
+
+  SECTION("processes share the tree") {
+    auto pid = ::fork();
+    REQUIRE(pid >= 0);
+    if (pid == 0) {
+      bool ok = false;
+      try {
+        pfs::shared_fake_filesystem child(name);
+        ok = child.create_directory("/from_child");
+        *child.open_file("/from_child/file", std::ios::out) << "hi";
+      } catch (...) {
+      }
+      ::_exit(ok ? 0 : 1);
+    }
+    int status = 0;
+    REQUIRE(::waitpid(pid, &status, 0) == pid);
+    REQUIRE(WIFEXITED(status));
+    REQUIRE(WEXITSTATUS(status) == 0);
+    REQUIRE(fs.is_directory("/from_child"));
+    REQUIRE(fs.file_size("/from_child/file") == 2);
+  }
+
+  SECTION("full mapping") {
+    std::error_code ec;
+    int created = 0;
+    while (fs.create_directory("/" + std::to_string(created), ec)) {
+      ++created;
+    }
+    REQUIRE(ec == std::errc::not_enough_memory);
+    REQUIRE(created > 1000);
+    REQUIRE(fs.remove_all("/0") == 1);
+    REQUIRE(fs.create_directory("/0"));
+
+    // Free room a little at a time. Until there is enough, creating a chain
+    // of directories fails without leaving any of them behind.
+    for (int i = 0; i < created; ++i) {
+      fs.remove("/" + std::to_string(i));
+      if (fs.create_directories("/deep/a/b/c/d/e/f/g", ec)) {
+        break;
+      }
+      REQUIRE(ec == std::errc::not_enough_memory);
+      REQUIRE(!fs.exists("/deep"));
+    }
+    REQUIRE(fs.is_directory("/deep/a/b/c/d/e/f/g"));
+  }
+
+  SECTION("streams of removed files") {
+    REQUIRE(fs.open_file("/b", std::ios::out)->good());
+    auto stream = fs.open_file("/a", std::ios::out);
+    REQUIRE(fs.remove("/a"));
+
+    // Give /b contents the size of a node that hold the removed node's id
+    // (the root is 1, then /b and /a) where a node keeps it. Flushing the
+    // stream must not mistake them for the removed file.
+    std::string content(56, 'x');
+    std::uint64_t id = 3;
+    std::memcpy(content.data() + 8, &id, sizeof(id));
+    *fs.open_file("/b", std::ios::out) << content;
+    *stream << "stale";
+    stream.reset();
+    auto in = fs.open_file("/b", std::ios::in);
+    REQUIRE(std::string(std::istreambuf_iterator<char>(*in), {}) == content);
+  }
+
+  pfs::shared_fake_filesystem::destroy(name);
+}
@@ -0,0 +1,167 @@
+#include <atomic>
+#include <catch2/catch_test_macros.hpp>
+#include <cstdint>
+#include <fcntl.h>
+#include <pfs/fake_filesystem.hpp>
+#include <pfs/remote_filesystem.hpp>
+#include <pfs/shm_transport.hpp>
+#include <string>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+
+namespace {
+
+/**
+ * @brief Gives each test process its own shared memory object.
+ */
+std::string shm_name() {
+  return "/pfs_test_ring_" + std::to_string(::getpid());
+}
+
+} // namespace
+
+TEST_CASE("shm_transport") {
+  auto name = shm_name();
+  pfs::rpc::shm_transport::destroy(name);
+  std::error_code ec;
+
+  SECTION("wraps around a small ring") {
+    auto server = pfs::rpc::shm_transport::create(name, 64, ec);
+    REQUIRE(server);
+    auto client = pfs::rpc::shm_transport::open(name, ec);
+    REQUIRE(client);
+
+    std::string sent(100000, '\0');
+    for (std::size_t i = 0; i < sent.size(); ++i) {
+      sent[i] = static_cast<char>(i * 7 + i / 256);
+    }
+    std::error_code write_ec;
+    std::thread writer([&] {
+      client->write(sent.data(), sent.size(), write_ec);
+      client.reset();
+    });
+    std::string received;
+    char buf[48];
+    while (auto n = server->read_some(buf, sizeof(buf), ec)) {
+      REQUIRE(n <= 48);
+      received.append(buf, n);
+    }
+    writer.join();
+    REQUIRE(!write_ec);
+    REQUIRE(!ec);
+    REQUIRE(received == sent);
+    server->write("x", 1, ec);
+    REQUIRE(ec == std::errc::broken_pipe);
+  }
+
+  SECTION("serves a remote_filesystem") {
+    auto server_t = pfs::rpc::shm_transport::create(
+        name, pfs::rpc::shm_transport::default_capacity, ec);
+    REQUIRE(server_t);
+    pfs::fake_filesystem served;
+    std::thread server([&] { pfs::rpc::serve(served, *server_t); });
+    {
+      pfs::remote_filesystem fs(pfs::rpc::shm_transport::open(name, ec));
+      REQUIRE(fs.create_directories("/a/b"));
+      *fs.open_file("/a/file", std::ios::out) << "over rings";
+      REQUIRE(fs.file_size("/a/file") == 10);
+
+      pfs::remote_filesystem::batch b(fs);
+      std::vector<pfs::remote_filesystem::pending<bool>> made;
+      for (int i = 0; i < 10000; ++i) {
+        made.push_back(b.create_directory("/a/b/" + std::to_string(i)));
+      }
+      b.submit();
+      for (auto &m : made) {
+        REQUIRE(m.get());
+      }
+      std::size_t count = 0;
+      for (auto it = fs.directory_iterator("/a/b"); !it->at_end();
+           it->increment()) {
+        ++count;
+      }
+      REQUIRE(count == 10000);
+    }
+    server.join();
+    REQUIRE(served.is_directory("/a/b/9999"));
+  }
+
+  SECTION("connects processes") {
+    auto pid = ::fork();
+    REQUIRE(pid >= 0);
+    if (pid == 0) {
+      pfs::fake_filesystem served;
+      std::error_code child_ec;
+      auto t = pfs::rpc::shm_transport::create(name, 4096, child_ec);
+      if (t) {
+        pfs::rpc::serve(served, *t);
+      }
+      ::_exit(t ? 0 : 1);
+    }
+    std::unique_ptr<pfs::rpc::shm_transport> t;
+    for (int i = 0; i < 1000 && !t; ++i) {
+      t = pfs::rpc::shm_transport::open(name, ec);
+      if (!t) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      }
+    }
+    REQUIRE(t);
+    {
+      pfs::remote_filesystem fs(std::move(t));
+      REQUIRE(fs.create_directory("/from_parent"));
+      REQUIRE(fs.is_directory("/from_parent"));
+      REQUIRE(!fs.exists("/missing"));
+    }
+    int status = 0;
+    REQUIRE(::waitpid(pid, &status, 0) == pid);
+    REQUIRE(WIFEXITED(status));
+    REQUIRE(WEXITSTATUS(status) == 0);
+  }
+
+  SECTION("rejects corrupt indices") {
+    auto server = pfs::rpc::shm_transport::create(name, 64, ec);
+    REQUIRE(server);
+    auto client = pfs::rpc::shm_transport::open(name, ec);
+    REQUIRE(client);
+    int fd = ::shm_open(name.c_str(), O_RDWR, 0);
+    REQUIRE(fd >= 0);
+    auto size = ::lseek(fd, 0, SEEK_END);
+    void *base = ::mmap(nullptr, static_cast<std::size_t>(size),
+                        PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    REQUIRE(base != MAP_FAILED);
+    // The rings follow the first cache line of the header, one per
+    // producer, the server's first, with the head and the tail on cache
+    // lines of their own.
+    auto index = [&](int producer, int tail) -> std::atomic<std::uint64_t> & {
+      return *reinterpret_cast<std::atomic<std::uint64_t> *>(
+          static_cast<char *>(base) + 64 + producer * 128 + tail * 64);
+    };
+
+    client->write("hello", 5, ec);
+    REQUIRE(!ec);
+    REQUIRE(index(1, 0).load() == 5);
+    index(1, 0).store(5 + 64 + 1);
+    char buf[16];
+    REQUIRE(server->read_some(buf, sizeof(buf), ec) == 0);
+    REQUIRE(ec == std::errc::bad_message);
+
+    index(0, 1).store(1);
+    server->write("x", 1, ec);
+    REQUIRE(ec == std::errc::bad_message);
+    REQUIRE(index(0, 0).load() == 0);
+
+    ::munmap(base, static_cast<std::size_t>(size));
+  }
+
+  SECTION("errors") {
+    REQUIRE(!pfs::rpc::shm_transport::create(name, 1000, ec));
+    REQUIRE(ec == std::errc::invalid_argument);
+    REQUIRE(!pfs::rpc::shm_transport::open(name, ec));
+    REQUIRE(ec == std::errc::no_such_file_or_directory);
+  }
+
+  pfs::rpc::shm_transport::destroy(name);
+}
@@ -0,0 +1,108 @@
+#include <catch2/catch_test_macros.hpp>
+#include <catch2/generators/catch_generators.hpp>
+#include <pfs/diff.hpp>
+#include <pfs/fake_filesystem.hpp>
+#include <pfs/std_filesystem.hpp>
+#include <pfs/sync.hpp>
+#include <random>
+#include <string>
+
+namespace {
+
+void build(pfs::filesystem &fs, const pfs::path &root) {
+  fs.create_directories(root / "src" / "lib");
+  fs.create_directories(root / "docs" / "old");
+  *fs.open_file(root / "src" / "main.cpp", std::ios::out) << "int main() {}";
+  *fs.open_file(root / "src" / "lib" / "a.cpp", std::ios::out) << "a";
+  *fs.open_file(root / "docs" / "old" / "notes", std::ios::out) << "notes";
+  *fs.open_file(root / "big", std::ios::out) << std::string(300000, 'x');
+  fs.open_file(root / "empty", std::ios::out);
+}
+
+void change(pfs::filesystem &fs, const pfs::path &root) {
+  auto big = fs.open_file(root / "big", std::ios::in | std::ios::out);
+  big->seekp(200000);
+  *big << 'y';
+  big.reset();
+  *fs.open_file(root / "src" / "lib" / "a.cpp", std::ios::out) << "ab";
+  fs.remove(root / "src" / "main.cpp");
+  fs.remove_all(root / "docs" / "old");
+  fs.create_directories(root / "new" / "sub");
+  *fs.open_file(root / "new" / "sub" / "file", std::ios::out) << "new";
+  fs.remove(root / "empty");
+  fs.create_directory(root / "empty");
+}
+
+} // namespace
+
+TEST_CASE("sync_tree") {
+  pfs::fake_filesystem src;
+  build(src, "/tree");
+  pfs::sync_options options;
+  options.threads = GENERATE(1u, 4u);
+  options.delta_threshold = 100000;
+  options.block_size = 4096;
+
+  SECTION("fake to fake") {
+    pfs::fake_filesystem dst;
+    auto stats = pfs::sync_tree(src, "/tree", dst, "/a/b", options);
+    REQUIRE(stats.directories_created == 5);
+    REQUIRE(stats.files_copied == 5);
+    REQUIRE(stats.bytes_written == 300019);
+    REQUIRE(src.tree_hash("/tree") == dst.tree_hash("/a/b"));
+
+    // Nothing to do once in sync.
+    stats = pfs::sync_tree(src, "/tree", dst, "/a/b", options);
+    REQUIRE(stats.bytes_written == 0);
+    REQUIRE(stats.directories_created == 0);
+
+    change(src, "/tree");
+    auto before = dst.tree_hash("/a/b");
+    options.dry_run = true;
+    auto planned = pfs::sync_tree(src, "/tree", dst, "/a/b", options);
+    REQUIRE(dst.tree_hash("/a/b") == before);
+    options.dry_run = false;
+    stats = pfs::sync_tree(src, "/tree", dst, "/a/b", options);
+    REQUIRE(src.tree_hash("/tree") == dst.tree_hash("/a/b"));
+
+    REQUIRE(stats.directories_created == planned.directories_created);
+    REQUIRE(stats.files_copied == planned.files_copied);
+    REQUIRE(stats.files_patched == planned.files_patched);
+    REQUIRE(stats.bytes_written == planned.bytes_written);
+    REQUIRE(stats.entries_removed == planned.entries_removed);
+    REQUIRE(stats.directories_created == 3); // empty, new, new/sub
+    REQUIRE(stats.files_copied == 2);        // a.cpp, new/sub/file
+    REQUIRE(stats.files_patched == 1);       // big
+    REQUIRE(stats.bytes_written == 4096 + 2 + 3);
+    REQUIRE(stats.entries_removed == 4); // empty, main.cpp, old, old/notes
+  }
+
+  SECTION("fake to std and back") {
+    pfs::std_filesystem real;
+    std::random_device rd;
+    auto root = std::filesystem::temp_directory_path() /
+                ("pfs_test_sync_" + std::to_string(rd()));
+    pfs::sync_tree(src, "/tree", real, root, options);
+    REQUIRE(pfs::diff(src, "/tree", real, root).empty());
+    change(src, "/tree");
+    auto stats = pfs::sync_tree(src, "/tree", real, root, options);
+    REQUIRE(stats.files_patched == 1);
+    REQUIRE(pfs::diff(src, "/tree", real, root).empty());
+
+    pfs::fake_filesystem copy;
+    pfs::sync_tree(real, root, copy, "/copy", options);
+    REQUIRE(copy.tree_hash("/copy") == src.tree_hash("/tree"));
+    std::filesystem::remove_all(root);
+  }
+
+  SECTION("errors") {
+    pfs::fake_filesystem dst;
+    *dst.open_file("/file", std::ios::out) << "file";
+    REQUIRE_THROWS(pfs::sync_tree(src, "/tree", dst, "/file", options));
+    REQUIRE_THROWS(pfs::sync_tree(src, "/missing", dst, "/dst", options));
+    REQUIRE_THROWS(pfs::sync_tree(src, "/tree/big", dst, "/dst", options));
+    std::error_code ec;
+    pfs::sync_tree(src, "/tree", dst, "/file/sub", options, ec);
+    REQUIRE(ec);
+  }
+}
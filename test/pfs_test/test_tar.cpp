@@ -0,0 +1,187 @@
+#include <catch2/catch_test_macros.hpp>
+#include <cstdio>
+#include <pfs/diff.hpp>
+#include <pfs/fake_filesystem.hpp>
+#include <pfs/std_filesystem.hpp>
+#include <pfs/tar.hpp>
+#include <random>
+#include <sstream>
+#include <string>
+
+namespace {
+
+void build(pfs::filesystem &fs, const pfs::path &root) {
+  std::string binary;
+  for (int i = 0; i < 2000; ++i) {
+    binary += static_cast<char>(i * 7);
+  }
+  auto deep = root / std::string(60, 'd') / std::string(60, 'e');
+  auto wide = root / std::string(200, 'w');
+  fs.create_directories(root / "src" / "lib");
+  fs.create_directories(root / "empty_dir");
+  fs.create_directories(deep);
+  fs.create_directories(wide);
+  *fs.open_file(root / "src" / "main.cpp", std::ios::out) << "int main() {}";
+  *fs.open_file(root / "src" / "lib" / "blob", std::ios::out) << binary;
+  fs.open_file(root / "empty", std::ios::out);
+  // Split between the ustar prefix and name fields.
+  *fs.open_file(deep / std::string(30, 'f'), std::ios::out) << "deep";
+  // Too long for ustar, so named by a pax header.
+  *fs.open_file(wide / "file", std::ios::out) << "wide";
+}
+
+/**
+ * @brief Renames the first entry of an archive, keeping its checksum valid.
+ */
+void rename_first(std::string &archive, const std::string &name) {
+  using header = pfs::detail::tar_header;
+  std::fill_n(&archive[header::name], header::name_size, '\0');
+  archive.replace(header::name, name.size(), name);
+  std::snprintf(&archive[header::checksum], 8, "%06o",
+                static_cast<unsigned>(header::sum(archive.data())));
+}
+
+/**
+ * @brief Replaces the size field and type of the first entry of an archive,
+ * keeping its checksum valid.
+ */
+void set_first(std::string &archive, const std::string &size, char type) {
+  using header = pfs::detail::tar_header;
+  archive.replace(header::size, header::size_size, size);
+  archive[header::type] = type;
+  std::snprintf(&archive[header::checksum], 8, "%06o",
+                static_cast<unsigned>(header::sum(archive.data())));
+}
+
+/**
+ * @brief Makes the first entry of an archive a pax header holding one
+ * record.
+ */
+std::string with_pax(const std::string &archive, const std::string &record) {
+  using header = pfs::detail::tar_header;
+  auto line = " " + record + "\n";
+  line = std::to_string(line.size() + 2) + line;
+  auto ret = archive;
+  std::string size(header::size_size, '\0');
+  std::snprintf(size.data(), size.size(), "%011o",
+                static_cast<unsigned>(line.size()));
+  set_first(ret, size, 'x');
+  ret.replace(header::block, line.size(), line);
+  return ret;
+}
+
+} // namespace
+
+TEST_CASE("tar") {
+  pfs::fake_filesystem src;
+  build(src, "/tree");
+
+  SECTION("fake to fake") {
+    std::stringstream archive;
+    auto written = pfs::write_tar(src, "/tree", archive);
+    REQUIRE(written.directories == 6);
+    REQUIRE(written.files == 5);
+    REQUIRE(written.bytes == 13 + 2000 + 8);
+    REQUIRE(archive.str().size() % 512 == 0);
+
+    pfs::fake_filesystem dst;
+    auto read = pfs::read_tar(archive, dst, "/copy");
+    REQUIRE(read.directories == written.directories);
+    REQUIRE(read.files == written.files);
+    REQUIRE(read.bytes == written.bytes);
+    REQUIRE(dst.tree_hash("/copy") == src.tree_hash("/tree"));
+
+    // Equal trees give equal archives.
+    std::stringstream again;
+    pfs::write_tar(dst, "/copy", again);
+    REQUIRE(again.str() == archive.str());
+  }
+
+  SECTION("fake to std") {
+    pfs::std_filesystem real;
+    std::random_device rd;
+    auto root = std::filesystem::temp_directory_path() /
+                ("pfs_test_tar_" + std::to_string(rd()));
+    std::stringstream archive;
+    pfs::write_tar(src, "/tree", archive);
+    pfs::read_tar(archive, real, root);
+    REQUIRE(pfs::diff(src, "/tree", real, root).empty());
+
+    std::stringstream back;
+    pfs::write_tar(real, root, back);
+    pfs::fake_filesystem copy;
+    pfs::read_tar(back, copy, "/copy");
+    REQUIRE(copy.tree_hash("/copy") == src.tree_hash("/tree"));
+    std::filesystem::remove_all(root);
+  }
+
+  SECTION("single file") {
+    std::stringstream archive;
+    pfs::write_tar(src, "/tree/src/main.cpp", archive);
+    pfs::fake_filesystem dst;
+    REQUIRE(pfs::read_tar(archive, dst, "/out").files == 1);
+    REQUIRE(dst.view_file("/out/main.cpp").data() == "int main() {}");
+  }
+
+  SECTION("malformed archives") {
+    std::stringstream out;
+    pfs::write_tar(src, "/tree/src/main.cpp", out);
+    auto good = out.str();
+    pfs::fake_filesystem dst;
+    std::error_code ec;
+
+    auto corrupt = good;
+    corrupt[0] = 'x';
+    std::istringstream in1(corrupt);
+    pfs::read_tar(in1, dst, "/out", ec);
+    REQUIRE(ec == std::errc::bad_message);
+
+    std::istringstream in2(good.substr(0, 600));
+    pfs::read_tar(in2, dst, "/out", ec);
+    REQUIRE(ec == std::errc::bad_message);
+
+    auto escape = good;
+    rename_first(escape, "a/../../evil");
+    std::istringstream in3(escape);
+    pfs::read_tar(in3, dst, "/out", ec);
+    REQUIRE(ec == std::errc::bad_message);
+    REQUIRE(!dst.exists("/evil"));
+
+    // Absolute names are extracted below the root.
+    auto absolute = good;
+    rename_first(absolute, "/abs");
+    std::istringstream in4(absolute);
+    pfs::read_tar(in4, dst, "/out", ec);
+    REQUIRE(!ec);
+    REQUIRE(dst.exists("/out/abs"));
+
+    // Sizes are not trusted before the data arrives.
+    auto base256 = good.substr(0, 512);
+    set_first(base256, std::string(1, '\x80') + std::string(11, '\xff'), '0');
+    std::istringstream in5(base256);
+    pfs::read_tar(in5, dst, "/out", ec);
+    REQUIRE(ec == std::errc::bad_message);
+    auto huge = good.substr(0, 1024);
+    set_first(huge, "77777777777", '0');
+    std::istringstream in6(huge);
+    pfs::read_tar(in6, dst, "/out", ec);
+    REQUIRE(ec == std::errc::bad_message);
+    auto long_name = good.substr(0, 1024);
+    set_first(long_name, "77777777777", 'L');
+    std::istringstream in7(long_name);
+    pfs::read_tar(in7, dst, "/out", ec);
+    REQUIRE(ec == std::errc::bad_message);
+    for (auto size : {"size=99999999999999999999999",
+                      "size=9223372036854775808", "size=12x"}) {
+      std::istringstream in8(with_pax(good, size));
+      pfs::read_tar(in8, dst, "/out", ec);
+      REQUIRE(ec == std::errc::bad_message);
+    }
+    // The same header with a sensible size is well formed.
+    std::istringstream in9(with_pax(good, "size=13"));
+    pfs::read_tar(in9, dst, "/pax", ec);
+    REQUIRE(!ec);
+
+    REQUIRE_THROWS(pfs::write_tar(src, "/missing", out));
+  }
+}